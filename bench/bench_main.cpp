@@ -0,0 +1,1812 @@
+// ネイティブビルド用のフレーム時間ベンチマーク
+// setup() の後、固定刻みのシミュレーション時間で loop() を N フレーム回し、
+// 段階ごとの処理時間・合成ピクセル数・パネル転送量を集計する。
+//
+//   pio run -e native && .pio/build/native/program --frames 600 --fish 3
+
+#include <M5Unified.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../src/aquarium.h"
+#include "../src/asset_archive.h"
+#include "../src/profiler.h"
+#include "../src/sim_random.h"
+
+namespace {
+
+struct Options {
+    int frames = 600;
+    int warmup = 30;
+    int fish = NUM_FISHES;
+    uint32_t dt_ms = 16;
+    unsigned long seed = 1;
+    const char* data_dir = "data";
+    const char* dump_path = nullptr;
+    float max_ms = 0.0f;  // 平均フレーム時間の上限（0=判定しない）
+    int max_allocs = -1;  // 1フレームのメモリ確保回数の上限（-1=判定しない）
+    bool verbose = false;
+    bool single_rect = false;
+    bool front_to_back = false;
+    int depth_levels = DEPTH_LEVELS;
+    size_t cache_budget = DEPTH_CACHE_BUDGET;
+    bool cache_preload = false;
+    SpriteFormat sprite_format = SpriteFormat::Indexed;
+    AssetFormat asset_format = AssetFormat::Auto;
+    bool eager_sprites = false;
+    size_t sprite_budget = SPRITE_BUDGET;
+    bool serial_render = false;
+    int target_fps = 0;  // フレームの間隔を揃える目標（0=揃えない。実機の既定は TARGET_FPS）
+    uint32_t panel_bandwidth = 0;  // パネル転送速度の模擬（バイト/秒、0=待たない）
+    int blit_bench = 0;  // 色キー方式とスパン方式の描画比較の繰り返し回数（0=実行しない）
+    int sim_bench = 0;   // 魚の更新処理の比較に使う魚の数（0=実行しない）
+    int boids_bench = 0;  // 群れの計算を比較する最大の魚の数（0=実行しない）
+    bool schooling = true;
+    bool spatial_index = true;
+    const char* record_path = nullptr;  // タッチ入力を記録するファイル
+    const char* replay_path = nullptr;  // 再生する記録
+    bool auto_touch = false;  // 疑似的なタッチ（タップ・長押し・なぞり）を入力する
+    bool touch_task = false;  // タッチを別タスクで読む（実機の既定。読み取りの時刻が実時間で決まり再現しない）
+    const char* trace_path = nullptr;  // 計測区間のトレース（Chrome のトレース形式）
+    bool scene_log = false;
+    bool scene_layers = true;
+    bool particles = true;
+    float bubble_rate = BUBBLE_RATE;
+    int particle_bench = 0;  // 粒子の数ごとの計測フレーム数（0=実行しない）
+    bool mirror_sprites = true;
+    bool mirror_check = false;
+    bool palette_check = false;
+    bool separable_scale = true;
+    int scale_bench = 0;  // 縮小の比較の繰り返し回数（0=実行しない）
+    const char* stream_path = nullptr;  // 更新領域の差分を書き出すファイル（pty でもよい）
+    uint32_t stream_rate = STREAM_BYTES_PER_SEC;  // 差分の送り出しのリンクの速さ（バイト/秒、0=制限しない）
+    size_t budgets[(int)MemoryCategory::Count] = {};  // memory_budget の分類ごとの予算（0=無制限）
+    bool memory_report = false;
+    int quality = -1;  // 描画の品質をこの段階に固定する（-1=固定しない）
+    const char* replay_check = nullptr;  // 品質の段階ごとに再生して一致するか確かめる記録
+};
+
+struct StageAccum {
+    const char* name;
+    uint32_t FrameStats::*field;
+    uint64_t sum;
+    uint32_t max;
+};
+
+void usage(const char* prog) {
+    std::printf(
+        "usage: %s [options]\n"
+        "  --frames N     計測フレーム数 (既定 600)\n"
+        "  --warmup N     計測前に捨てるフレーム数 (既定 30)\n"
+        "  --fish N       魚の数 (既定 %d)\n"
+        "  --dt MS        1フレームのシミュレーション時間 (既定 16)\n"
+        "  --seed S       乱数シード (既定 1)\n"
+        "  --data DIR     LittleFS の代わりに使うディレクトリ (既定 data)\n"
+        "  --dump FILE    最終フレームを PPM で書き出す\n"
+        "  --max-ms MS    平均フレーム時間が超えたら終了コード 1\n"
+        "  --max-allocs N 1フレームのメモリ確保回数が超えたら終了コード 1\n"
+        "  --single-rect  更新領域を1矩形にまとめる（従来方式）\n"
+        "  --front-to-back   手前の魚から合成し、隠れた部分を描かない\n"
+        "  --depth-levels N  奥行きの量子化段階数、0で毎フレーム縮小 (既定 %d)\n"
+        "  --cache-budget KB 縮小済みスプライトの上限 (既定 %u)\n"
+        "  --cache-preload   縮小済みスプライトを起動時に作成\n"
+        "  --sprite-format canvas|spans|alpha|indexed  魚スプライトの保持形式 (既定 indexed)\n"
+        "  --asset-format auto|png|pack  画像の読み込み元 (既定 auto)\n"
+        "  --eager-sprites   魚スプライトを起動時に全て読み込む\n"
+        "  --sprite-budget KB  常駐させる魚スプライトの上限、0で無制限 (既定 %u)\n"
+        "  --serial-render   合成と転送を loop() の中で順に行う（転送タスクを使わない）\n"
+        "  --target-fps N    N fps に間隔を揃え、間に合わなければ描画の品質を下げる (既定 0=揃えない)\n"
+        "  --panel-mbps N    パネル転送を N MB/s として転送時間を模擬する (既定 0=待たない)\n"
+        "  --blit-bench N    色キー方式とスパン方式の描画を N 回ずつ比較する\n"
+        "  --sim-bench N     N 匹の魚の更新を従来の構造体配列と FishSchool で比較する\n"
+        "  --boids-bench N   群れの計算を N 匹までグリッドあり・なしで比較する\n"
+        "  --no-schooling    群れの行動を無効にする（ランダムに泳ぐだけ）\n"
+        "  --no-grid         近傍・当たり判定・重なりの検索に一様グリッドを使わない\n"
+        "  --auto-touch      シードから作った疑似的なタッチを入力する\n"
+        "  --touch-task      タッチを別タスクで読む（実機と同じ。結果は実行ごとに変わる）\n"
+        "  --record FILE     タッチ入力を FILE に記録する\n"
+        "  --replay FILE     FILE の記録を再生し、シミュレーションが一致するか確認する\n"
+        "  --no-layers       水草と泡のレイヤーを使わない（静的な背景だけ）\n"
+        "  --no-particles    細かい泡と餌の粒子を使わない\n"
+        "  --bubble-rate R   細かい泡が湧く速さ（個/秒、既定 %.0f）\n"
+        "  --particle-bench N  泡の数を 0〜%d 個に変えて N フレームずつ粒子の処理時間を計測する\n"
+        "  --trace FILE      計測区間の段階ごとの処理時間を Chrome のトレース形式で書き出す\n"
+        "  --scene-log       drawScene() のデバッグログを有効にする（--verbose と一緒に使う）\n"
+        "  --no-mirror       右向きの画像も読み込む（左向きの画像を反転して描かない）\n"
+        "  --mirror-check    反転描画を反転した画像の描画と比較し、右向きの画像との一致度を表示する\n"
+        "  --palette-check   パレット形式の魚スプライトを PNG と比べ（PSNR）、16 ビットの形式と描画速度を比較する\n"
+        "  --rotate-zoom     魚の縮小を pushRotateZoomWithAA で描く（縦横に分けた縮小を使わない）\n"
+        "  --scale-bench N   0.7〜1.0 倍の縮小を pushRotateZoomWithAA と N 回ずつ比較し、画質（PSNR）も比べる\n"
+        "  --stream FILE     更新領域の差分を FILE（pty でもよい）に送り出す（tools/stream_viewer.py で見る）\n"
+        "  --stream-rate KB  送り出しのリンクの速さ（KB/s、シミュレーション時間で、0 で制限しない。既定 %u）\n"
+        "  --budget NAME=KB  メモリの分類の予算（sprites|cache|compose|scene|work、何度でも指定できる。既定は無制限）\n"
+        "  --memory-report   終了時に分類と持ち主ごとのメモリの使用量を表示する\n"
+        "  --quality NAME    描画の品質をこの段階に固定する（full|no-aa|coarse-depth|static-layers|half-res）\n"
+        "  --replay-check FILE  品質の段階とメモリの予算を変えて FILE の記録を再生し、一致しなければ終了コード 1\n"
+        "  --verbose      スケッチのログを表示\n",
+        prog, NUM_FISHES, DEPTH_LEVELS, (unsigned)(DEPTH_CACHE_BUDGET / 1024),
+        (unsigned)(SPRITE_BUDGET / 1024), (double)BUBBLE_RATE, PARTICLE_CAPACITY,
+        (unsigned)(STREAM_BYTES_PER_SEC / 1000));
+}
+
+// NAME=KB（NAME は memoryCategoryName() の名前）
+bool parseBudget(const char* text, Options& opt) {
+    const char* eq = std::strchr(text, '=');
+    if (!eq) {
+        return false;
+    }
+    for (int c = 0; c < (int)MemoryCategory::Count; c++) {
+        const char* name = memoryCategoryName((MemoryCategory)c);
+        if (std::strlen(name) == (size_t)(eq - text) && !std::strncmp(text, name, eq - text)) {
+            opt.budgets[c] = (size_t)std::atoi(eq + 1) * 1024;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (!std::strcmp(arg, "--frames") && has_value) {
+            opt.frames = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--warmup") && has_value) {
+            opt.warmup = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--fish") && has_value) {
+            opt.fish = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--dt") && has_value) {
+            opt.dt_ms = (uint32_t)std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--seed") && has_value) {
+            opt.seed = std::strtoul(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(arg, "--data") && has_value) {
+            opt.data_dir = argv[++i];
+        } else if (!std::strcmp(arg, "--dump") && has_value) {
+            opt.dump_path = argv[++i];
+        } else if (!std::strcmp(arg, "--max-ms") && has_value) {
+            opt.max_ms = (float)std::atof(argv[++i]);
+        } else if (!std::strcmp(arg, "--max-allocs") && has_value) {
+            opt.max_allocs = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--single-rect")) {
+            opt.single_rect = true;
+        } else if (!std::strcmp(arg, "--front-to-back")) {
+            opt.front_to_back = true;
+        } else if (!std::strcmp(arg, "--depth-levels") && has_value) {
+            opt.depth_levels = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--cache-budget") && has_value) {
+            opt.cache_budget = (size_t)std::atoi(argv[++i]) * 1024;
+        } else if (!std::strcmp(arg, "--cache-preload")) {
+            opt.cache_preload = true;
+        } else if (!std::strcmp(arg, "--sprite-format") && has_value) {
+            const char* v = argv[++i];
+            if (!std::strcmp(v, "canvas")) {
+                opt.sprite_format = SpriteFormat::Canvas;
+            } else if (!std::strcmp(v, "spans")) {
+                opt.sprite_format = SpriteFormat::Spans;
+            } else if (!std::strcmp(v, "alpha")) {
+                opt.sprite_format = SpriteFormat::Alpha;
+            } else if (!std::strcmp(v, "indexed")) {
+                opt.sprite_format = SpriteFormat::Indexed;
+            } else {
+                usage(argv[0]);
+                return false;
+            }
+        } else if (!std::strcmp(arg, "--asset-format") && has_value) {
+            const char* v = argv[++i];
+            if (!std::strcmp(v, "auto")) {
+                opt.asset_format = AssetFormat::Auto;
+            } else if (!std::strcmp(v, "png")) {
+                opt.asset_format = AssetFormat::Png;
+            } else if (!std::strcmp(v, "pack")) {
+                opt.asset_format = AssetFormat::Pack;
+            } else {
+                usage(argv[0]);
+                return false;
+            }
+        } else if (!std::strcmp(arg, "--eager-sprites")) {
+            opt.eager_sprites = true;
+        } else if (!std::strcmp(arg, "--sprite-budget") && has_value) {
+            opt.sprite_budget = (size_t)std::atoi(argv[++i]) * 1024;
+        } else if (!std::strcmp(arg, "--serial-render")) {
+            opt.serial_render = true;
+        } else if (!std::strcmp(arg, "--target-fps") && has_value) {
+            opt.target_fps = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--panel-mbps") && has_value) {
+            opt.panel_bandwidth = (uint32_t)(std::atof(argv[++i]) * 1000000);
+        } else if (!std::strcmp(arg, "--blit-bench") && has_value) {
+            opt.blit_bench = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--sim-bench") && has_value) {
+            opt.sim_bench = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--boids-bench") && has_value) {
+            opt.boids_bench = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--no-schooling")) {
+            opt.schooling = false;
+        } else if (!std::strcmp(arg, "--no-grid")) {
+            opt.spatial_index = false;
+        } else if (!std::strcmp(arg, "--auto-touch")) {
+            opt.auto_touch = true;
+        } else if (!std::strcmp(arg, "--touch-task")) {
+            opt.touch_task = true;
+        } else if (!std::strcmp(arg, "--record") && has_value) {
+            opt.record_path = argv[++i];
+        } else if (!std::strcmp(arg, "--replay") && has_value) {
+            opt.replay_path = argv[++i];
+        } else if (!std::strcmp(arg, "--trace") && has_value) {
+            opt.trace_path = argv[++i];
+        } else if (!std::strcmp(arg, "--no-layers")) {
+            opt.scene_layers = false;
+        } else if (!std::strcmp(arg, "--no-particles")) {
+            opt.particles = false;
+        } else if (!std::strcmp(arg, "--bubble-rate") && has_value) {
+            opt.bubble_rate = (float)std::atof(argv[++i]);
+        } else if (!std::strcmp(arg, "--particle-bench") && has_value) {
+            opt.particle_bench = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--scene-log")) {
+            opt.scene_log = true;
+        } else if (!std::strcmp(arg, "--no-mirror")) {
+            opt.mirror_sprites = false;
+        } else if (!std::strcmp(arg, "--mirror-check")) {
+            opt.mirror_check = true;
+        } else if (!std::strcmp(arg, "--palette-check")) {
+            opt.palette_check = true;
+        } else if (!std::strcmp(arg, "--rotate-zoom")) {
+            opt.separable_scale = false;
+        } else if (!std::strcmp(arg, "--scale-bench") && has_value) {
+            opt.scale_bench = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--stream") && has_value) {
+            opt.stream_path = argv[++i];
+        } else if (!std::strcmp(arg, "--stream-rate") && has_value) {
+            opt.stream_rate = (uint32_t)std::atoi(argv[++i]) * 1000;
+        } else if (!std::strcmp(arg, "--budget") && has_value) {
+            if (!parseBudget(argv[++i], opt)) {
+                usage(argv[0]);
+                return false;
+            }
+        } else if (!std::strcmp(arg, "--memory-report")) {
+            opt.memory_report = true;
+        } else if (!std::strcmp(arg, "--quality") && has_value) {
+            const char* v = argv[++i];
+            for (int q = 0; q < (int)Quality::Count; q++) {
+                if (!std::strcmp(v, qualityName((Quality)q))) {
+                    opt.quality = q;
+                }
+            }
+            if (opt.quality < 0) {
+                usage(argv[0]);
+                return false;
+            }
+        } else if (!std::strcmp(arg, "--replay-check") && has_value) {
+            opt.replay_check = argv[++i];
+        } else if (!std::strcmp(arg, "--verbose")) {
+            opt.verbose = true;
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+    return opt.frames > 0 && opt.fish > 0;
+}
+
+// 奥行きキャッシュと同じく 0.7 倍に縮小した泳ぎフレームを、透過色で抜いたもの（spans）と
+// 縁を半透明で残したもの（alpha）で描画して比較する
+bool runScaledBlitBench(int iterations) {
+    const int count = swim_frame_count * 2;
+    const float scale = 0.7f;
+    FishSprite keyed[MAX_SWIM_FRAMES * 2];
+    FishSprite alpha[MAX_SWIM_FRAMES * 2];
+    SpriteFormat saved_format = sprite_format;
+    size_t keyed_bytes = 0;
+    size_t alpha_bytes = 0;
+    uint64_t blend = 0;
+    uint64_t pixels = 0;
+    bool ok = true;
+    for (int i = 0; i < count && ok; i++) {
+        int id = i < swim_frame_count ? swim_left_ids[i] : swim_right_ids[i - swim_frame_count];
+        FishSprite* source = sprite_residency.loadNow(id & ~SPRITE_MIRRORED);
+        int w = (int)(source->width * scale);
+        int h = (int)(source->height * scale);
+        sprite_format = SpriteFormat::Spans;
+        ok = scaleFishSprite(*source, w, h, keyed[i]);
+        sprite_format = SpriteFormat::Alpha;
+        ok = ok && scaleFishSprite(*source, w, h, alpha[i]);
+        keyed_bytes += keyed[i].bytes();
+        alpha_bytes += alpha[i].bytes();
+        blend += alpha[i].spans.blendPixels();
+        pixels += (uint64_t)w * h;
+    }
+    sprite_format = saved_format;
+    if (!ok) {
+        std::fprintf(stderr, "failed to scale sprites\n");
+        return false;
+    }
+
+    M5Canvas dst;
+    dst.setPsram(true);
+    dst.setColorDepth(16);
+    dst.createSprite(1280, 720);
+    const int positions[][2] = {{100, 100}, {-120, 300}, {1100, 50}, {500, 600}, {640, 260}};
+    const int num_positions = sizeof(positions) / sizeof(positions[0]);
+
+    // 黒の上に合成した結果は展開（黒の上に合成した色）と一致するはず
+    std::vector<uint16_t> decoded((size_t)alpha[0].width * alpha[0].height);
+    bool identical = true;
+    for (int i = 0; i < count && identical; i++) {
+        const FishSprite& s = alpha[i];
+        decoded.resize((size_t)s.width * s.height);
+        s.spans.decode(decoded.data(), s.width, TFT_BLACK);
+        dst.fillSprite(TFT_BLACK);
+        s.spans.blit((uint16_t*)dst.getBuffer(), 1280, 720, 0, 0);
+        for (int y = 0; y < s.height && identical; y++) {
+            identical = std::memcmp((const uint16_t*)dst.getBuffer() + y * 1280,
+                                    decoded.data() + y * s.width, s.width * 2) == 0;
+        }
+    }
+
+    uint32_t us[2];
+    FishSprite* sets[2] = {keyed, alpha};
+    for (int f = 0; f < 2; f++) {
+        dst.fillSprite(0x1234);
+        for (int i = 0; i < count; i++) {
+            sets[f][i].spans.blit((uint16_t*)dst.getBuffer(), 1280, 720, 0, 0);  // 慣らし
+        }
+        uint32_t t0 = micros();
+        for (int n = 0; n < iterations; n++) {
+            for (int i = 0; i < count; i++) {
+                const int* pos = positions[(n + i) % num_positions];
+                sets[f][i].spans.blit((uint16_t*)dst.getBuffer(), 1280, 720, pos[0], pos[1]);
+            }
+        }
+        us[f] = micros() - t0;
+    }
+
+    int blits = iterations * count;
+    std::printf("scaled x%.1f: %d sprites, blend pixels %.1f%%\n", scale, count,
+                100.0 * blend / pixels);
+    std::printf("%-10s %12.2f %12.1f\n", "spans", (double)us[0] / blits,
+                keyed_bytes / 1024.0 / count);
+    std::printf("%-10s %12.2f %12.1f\n", "alpha", (double)us[1] / blits,
+                alpha_bytes / 1024.0 / count);
+    std::printf("alpha/spans time: %.2fx, blend over black matches decode: %s\n",
+                (double)us[1] / us[0], identical ? "yes" : "NO");
+    return identical;
+}
+
+// manifest の画像を sprite_format の FishSprite に読み込む（alpha は画像の大きさ以上の作業領域）
+bool loadAssetSprite(const char* name, FishSprite& sprite, std::vector<uint8_t>& alpha) {
+    const AssetEntry* entry = asset_archive.find(name);
+    if (!entry) {
+        return false;
+    }
+    sprite.canvas.setPsram(true);
+    sprite.canvas.setColorDepth(16);
+    sprite.canvas.createSprite(FISH_WIDTH, FISH_HEIGHT);
+    sprite.canvas.fillSprite(TFT_BLACK);
+    alpha.resize((size_t)FISH_WIDTH * FISH_HEIGHT);
+    return asset_archive.load(*entry, &sprite.canvas, alpha.data()) &&
+           finishFishSprite(sprite, alpha.data());
+}
+
+// sprite を左右反転した画像（色とアルファ）を w x h に展開する
+void decodeMirrored(const SpanSprite& sprite, std::vector<uint16_t>& pixels, std::vector<uint8_t>& alpha) {
+    int w = sprite.width();
+    int h = sprite.height();
+    pixels.resize((size_t)w * h);
+    alpha.resize((size_t)w * h);
+    sprite.decode(pixels.data(), w, TFT_BLACK);
+    sprite.decodeAlpha(alpha.data(), w);
+    for (int y = 0; y < h; y++) {
+        std::reverse(pixels.begin() + y * w, pixels.begin() + (y + 1) * w);
+        std::reverse(alpha.begin() + y * w, alpha.begin() + (y + 1) * w);
+    }
+}
+
+// 反転描画（等倍と奥行きキャッシュの縮小）が、反転した画像を普通に描いた結果と一致するかを
+// はみ出す位置も含めて確認する。あわせて、左向きの画像を反転したものと manifest の
+// 右向きの画像のシルエットの一致度（IoU、左右のずれ ±32 ピクセルで最良のもの）を表示する
+bool runMirrorCheck() {
+    const char* pairs[][2] = {
+        {"turn/left_90", "turn/right_90"},
+        {"turn/left_45", "turn/right_45"},
+        {"turn/tail_left_45", "turn/tail_right_45"},
+    };
+    std::vector<std::pair<std::string, std::string>> names;
+    for (int i = 0; i < swim_frame_count; i++) {
+        names.push_back({"swim_left/" + std::to_string(i), "swim_right/" + std::to_string(i)});
+    }
+    for (const auto& pair : pairs) {
+        names.push_back({pair[0], pair[1]});
+    }
+    if (sprite_format == SpriteFormat::Canvas) {
+        std::fprintf(stderr, "mirror check needs --sprite-format spans, alpha or indexed\n");
+        return false;
+    }
+
+    M5Canvas dst;
+    dst.setPsram(true);
+    dst.setColorDepth(16);
+    dst.createSprite(1280, 720);
+    std::vector<uint16_t> expected((size_t)1280 * 720);
+    const int positions[][2] = {{100, 100}, {-120, 300}, {1100, 50}, {500, 600}, {-300, -150}};
+    std::vector<uint8_t> alpha;
+    std::vector<uint16_t> flipped;
+    std::vector<uint8_t> flipped_alpha;
+    bool all_identical = true;
+    std::printf("%-20s %-10s %-10s %8s %6s\n", "left", "plain", "scaled", "IoU", "shift");
+    for (const auto& pair : names) {
+        FishSprite left;
+        FishSprite right;
+        if (!loadAssetSprite(pair.first.c_str(), left, alpha) ||
+            !loadAssetSprite(pair.second.c_str(), right, alpha) || left.spans.empty()) {
+            std::printf("%-20s (missing)\n", pair.first.c_str());
+            continue;
+        }
+        // 等倍と 0.7 倍（奥行きキャッシュと同じ縮小）
+        FishSprite scaled;
+        scaleFishSprite(left, (int)(left.width * 0.7f), (int)(left.height * 0.7f), scaled);
+        bool identical[2] = {true, true};
+        const FishSprite* sources[2] = {&left, &scaled};
+        for (int k = 0; k < 2; k++) {
+            const SpanSprite& spans = sources[k]->spans;
+            decodeMirrored(spans, flipped, flipped_alpha);
+            SpanSprite reference;
+            if (sprite_format != SpriteFormat::Spans) {  // Indexed でもここではアルファのスパン
+                reference.buildAlpha(flipped.data(), flipped_alpha.data(), spans.width(), spans.height(),
+                                     spans.width());
+            } else {
+                reference.build(flipped.data(), spans.width(), spans.height(), spans.width(), TFT_BLACK);
+            }
+            for (const auto& pos : positions) {
+                dst.fillSprite(0x1234);
+                reference.blit((uint16_t*)dst.getBuffer(), 1280, 720, pos[0], pos[1]);
+                std::memcpy(expected.data(), dst.getBuffer(), expected.size() * 2);
+                dst.fillSprite(0x1234);
+                spans.blitMirrored((uint16_t*)dst.getBuffer(), 1280, 720, pos[0], pos[1]);
+                identical[k] = identical[k] &&
+                               std::memcmp(expected.data(), dst.getBuffer(), expected.size() * 2) == 0;
+            }
+        }
+        all_identical = all_identical && identical[0] && identical[1];
+
+        // 右向きの画像とのシルエットの一致度
+        decodeMirrored(left.spans, flipped, flipped_alpha);
+        std::vector<uint8_t> right_alpha((size_t)right.width * right.height);
+        right.spans.decodeAlpha(right_alpha.data(), right.width);
+        double best_iou = 0.0;
+        int best_shift = 0;
+        for (int shift = -32; shift <= 32; shift++) {
+            uint32_t both = 0;
+            uint32_t either = 0;
+            for (int y = 0; y < min(left.height, right.height); y++) {
+                for (int x = 0; x < right.width; x++) {
+                    int lx = x - shift;
+                    bool a = lx >= 0 && lx < left.width && flipped_alpha[y * left.width + lx] >= 128;
+                    bool b = right_alpha[y * right.width + x] >= 128;
+                    both += a && b;
+                    either += a || b;
+                }
+            }
+            double iou = either ? (double)both / either : 0.0;
+            if (iou > best_iou) {
+                best_iou = iou;
+                best_shift = shift;
+            }
+        }
+        std::printf("%-20s %-10s %-10s %8.3f %+6d\n", pair.first.c_str(), identical[0] ? "ok" : "MISMATCH",
+                    identical[1] ? "ok" : "MISMATCH", best_iou, best_shift);
+    }
+    std::printf("mirrored blit matches flipped sprite: %s\n", all_identical ? "yes" : "NO");
+    return all_identical;
+}
+
+// RGB565（スワップ済み）を 8 ビットに広げた各チャンネルの差の二乗和
+uint64_t squaredError565(const uint16_t* a, const uint16_t* b, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint16_t pa = (uint16_t)((a[i] << 8) | (a[i] >> 8));
+        uint16_t pb = (uint16_t)((b[i] << 8) | (b[i] >> 8));
+        int d[3] = {
+            (int)((pa >> 11) * 255 / 31) - (int)((pb >> 11) * 255 / 31),
+            (int)(((pa >> 5) & 63) * 255 / 63) - (int)(((pb >> 5) & 63) * 255 / 63),
+            (int)((pa & 31) * 255 / 31) - (int)((pb & 31) * 255 / 31),
+        };
+        sum += d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    }
+    return sum;
+}
+
+double psnr(uint64_t squared_error, uint64_t samples) {
+    return squared_error ? 10.0 * std::log10(255.0 * 255.0 * samples / squared_error) : 99.0;
+}
+
+// パレット形式の魚スプライトを確認する
+// ・PNG をデコードした 16 ビットの画像に対する PSNR（黒の上に合成した色）とメモリ量
+// ・描画（等倍、反転、はみ出し、最近傍の拡大縮小）が、番号の画像から作った期待値と一致するか
+// ・16 ビットの形式（アルファのスパン）との描画速度（等倍、奥行きキャッシュの 0.7 倍、
+//   キャッシュを使わない 0.7 倍）
+bool runPaletteCheck() {
+    const int iterations = 200;
+    const float scale = 0.7f;
+    AssetFormat saved_asset_format = asset_format;
+    asset_format = AssetFormat::Png;
+    AssetArchive png;
+    bool png_ok = png.open();
+    asset_format = saved_asset_format;
+    if (!png_ok) {
+        std::fprintf(stderr, "palette check needs the PNG files and manifest\n");
+        return false;
+    }
+
+    M5Canvas dst;
+    dst.setPsram(true);
+    dst.setColorDepth(16);
+    dst.createSprite(1280, 720);
+    uint16_t* out = (uint16_t*)dst.getBuffer();
+    std::vector<uint16_t> expected((size_t)1280 * 720);
+    const int positions[][2] = {{100, 100}, {-120, 300}, {1100, 50}, {500, 600}, {-300, -150}};
+    const int num_positions = sizeof(positions) / sizeof(positions[0]);
+
+    M5Canvas reference;
+    reference.setPsram(true);
+    reference.setColorDepth(16);
+    reference.createSprite(FISH_WIDTH, FISH_HEIGHT);
+    std::vector<uint8_t> alpha((size_t)FISH_WIDTH * FISH_HEIGHT);
+    std::vector<uint8_t> indices((size_t)FISH_WIDTH * FISH_HEIGHT);
+    std::vector<uint8_t> flipped(indices.size());
+    std::vector<uint16_t> decoded(indices.size());
+
+    struct Pair {
+        std::unique_ptr<SpanSprite> spans;  // 16 ビット（アルファのスパン）
+        std::unique_ptr<IndexedSprite> indexed;
+        FishSprite scaled_alpha;
+        FishSprite scaled_indexed;
+        FishSprite zoom;  // キャンバス形式（キャンバスを使わない 0.7 倍の描画の元）
+    };
+    std::vector<std::unique_ptr<Pair>> pairs;
+    uint64_t squared_error = 0;
+    uint64_t samples = 0;
+    double worst = 99.0;
+    const char* worst_name = "";
+    size_t span_bytes = 0;
+    size_t indexed_bytes = 0;
+    uint64_t blend_pixels = 0;
+    uint64_t drawn_pixels = 0;
+    bool all_identical = true;
+    SpriteFormat saved_format = sprite_format;
+
+    for (int e = 0; e < asset_archive.count(); e++) {
+        const AssetEntry& entry = asset_archive.entry(e);
+        const SpritePalette* palette = asset_archive.palette(entry);
+        const AssetEntry* png_entry = png.find(entry.name);
+        if (!palette || !png_entry) {
+            continue;
+        }
+        int w = FISH_WIDTH;
+        int h = FISH_HEIGHT;
+        reference.fillSprite(TFT_BLACK);
+        std::unique_ptr<Pair> pair(new Pair());
+        pair->spans.reset(new SpanSprite());
+        pair->indexed.reset(new IndexedSprite());
+        // 16 ビットの形式はパレットの色とアルファをそのまま展開したもの（同じ画像で比べる）
+        if (!asset_archive.load(entry, &reference, alpha.data()) ||
+            !pair->spans->buildAlpha((const uint16_t*)reference.getBuffer(), alpha.data(), w, h, w) ||
+            !asset_archive.loadIndices(entry, indices.data(), w, h) ||
+            !pair->indexed->build(indices.data(), w, h, w, palette)) {
+            std::fprintf(stderr, "failed to load %s\n", entry.name);
+            return false;
+        }
+        span_bytes += pair->spans->bytes();
+        indexed_bytes += pair->indexed->bytes();
+        blend_pixels += pair->indexed->blendPixels();
+        drawn_pixels += pair->indexed->blendPixels() + pair->indexed->opaquePixels();
+
+        // 縮小の比較に使う 16 ビットの元画像（spans と同じ）
+        FishSprite source;
+        source.spans.buildAlpha((const uint16_t*)reference.getBuffer(), alpha.data(), w, h, w);
+        source.width = w;
+        source.height = h;
+        pair->zoom.canvas.setPsram(true);
+        pair->zoom.canvas.setColorDepth(16);
+        pair->zoom.canvas.createSprite(w, h);
+        std::memcpy(pair->zoom.canvas.getBuffer(), reference.getBuffer(), (size_t)w * h * 2);
+        pair->zoom.width = w;
+        pair->zoom.height = h;
+
+        // PNG に対する誤差（黒の上に合成した色どうし）
+        reference.fillSprite(TFT_BLACK);
+        if (!png.load(*png_entry, &reference)) {
+            std::fprintf(stderr, "failed to load %s\n", png_entry->name);
+            return false;
+        }
+        pair->indexed->decode(decoded.data(), w, TFT_BLACK);
+        uint64_t error = squaredError565(decoded.data(), (const uint16_t*)reference.getBuffer(),
+                                         decoded.size());
+        squared_error += error;
+        samples += decoded.size() * 3;
+        double image_psnr = psnr(error, decoded.size() * 3);
+        if (image_psnr < worst) {
+            worst = image_psnr;
+            worst_name = entry.name;
+        }
+
+        // 等倍・反転・拡大縮小の描画を、番号の画像から 1 ピクセルずつ作った期待値と比べる
+        // （左右反転した番号の画像から作った IndexedSprite を普通に描いたものと反転描画も比べる）
+        for (int y = 0; y < h; y++) {
+            std::reverse_copy(indices.begin() + y * w, indices.begin() + (y + 1) * w,
+                              flipped.begin() + y * w);
+        }
+        IndexedSprite mirror_reference;
+        mirror_reference.build(flipped.data(), w, h, w, palette);
+        const int sizes[][2] = {{w, h}, {(int)(w * scale), (int)(h * scale)}, {w * 5 / 4, h * 5 / 4}};
+        for (const auto& size : sizes) {
+            for (int mirror = 0; mirror < 2; mirror++) {
+                for (const auto& pos : positions) {
+                    dst.fillSprite(0x1234);
+                    if (size[0] == w && size[1] == h && mirror) {
+                        mirror_reference.blit(out, 1280, 720, pos[0], pos[1]);
+                    } else {
+                        for (int v = 0; v < size[1]; v++) {
+                            for (int u = 0; u < size[0]; u++) {
+                                int px = pos[0] + (mirror ? size[0] - 1 - u : u);
+                                int py = pos[1] + v;
+                                uint8_t k = indices[(v * h / size[1]) * w + u * w / size[0]];
+                                if (px < 0 || py < 0 || px >= 1280 || py >= 720 || palette->alpha32[k] == 0) {
+                                    continue;
+                                }
+                                SpanSprite one;  // 1 ピクセルの合成（SpanSprite と同じ計算）
+                                uint16_t color = palette->color[k];
+                                uint8_t a = palette->alpha[k];
+                                one.buildAlpha(&color, &a, 1, 1, 1);
+                                one.blit(out, 1280, 720, px, py);
+                            }
+                        }
+                    }
+                    std::memcpy(expected.data(), out, expected.size() * 2);
+                    dst.fillSprite(0x1234);
+                    pair->indexed->blitScaled(out, 1280, 720, pos[0], pos[1], size[0], size[1], mirror);
+                    if (std::memcmp(expected.data(), out, expected.size() * 2) != 0) {
+                        std::printf("%-20s %dx%d%s at (%d, %d): MISMATCH\n", entry.name, size[0],
+                                    size[1], mirror ? " mirrored" : "", pos[0], pos[1]);
+                        all_identical = false;
+                    }
+                }
+            }
+        }
+
+        // 奥行きキャッシュと同じ縮小（Alpha は面積平均、Indexed は面積平均の後パレットに戻す）
+        sprite_format = SpriteFormat::Alpha;
+        scaleFishSprite(source, (int)(w * scale), (int)(h * scale), pair->scaled_alpha);
+        FishSprite indexed_source;
+        buildIndexedFishSprite(indexed_source, indices.data(), w, h, palette);
+        sprite_format = SpriteFormat::Indexed;
+        scaleFishSprite(indexed_source, (int)(w * scale), (int)(h * scale), pair->scaled_indexed);
+        sprite_format = saved_format;
+        pairs.push_back(std::move(pair));
+    }
+    if (pairs.empty()) {
+        std::fprintf(stderr, "no indexed fish images (run tools/convert_assets.py without --no-palette)\n");
+        return false;
+    }
+
+    const int count = (int)pairs.size();
+    const int sw = (int)(FISH_WIDTH * scale);
+    const int sh = (int)(FISH_HEIGHT * scale);
+    auto timeBlits = [&](auto draw) {
+        dst.fillSprite(0x1234);
+        for (int i = 0; i < count; i++) draw(*pairs[i], 640, 260);  // 慣らし
+        uint32_t t0 = micros();
+        for (int n = 0; n < iterations; n++) {
+            for (int i = 0; i < count; i++) {
+                const int* pos = positions[(n + i) % num_positions];
+                draw(*pairs[i], pos[0], pos[1]);
+            }
+        }
+        return (double)(micros() - t0) / (iterations * count);
+    };
+    double alpha_us = timeBlits([&](Pair& p, int x, int y) { p.spans->blit(out, 1280, 720, x, y); });
+    double indexed_us = timeBlits([&](Pair& p, int x, int y) { p.indexed->blit(out, 1280, 720, x, y); });
+    double mirrored_us = timeBlits([&](Pair& p, int x, int y) {
+        p.indexed->blit(out, 1280, 720, x, y, true);
+    });
+    double alpha_cached_us = timeBlits([&](Pair& p, int x, int y) {
+        drawFishSprite(p.scaled_alpha, &dst, x, y, sw, sh);
+    });
+    double indexed_cached_us = timeBlits([&](Pair& p, int x, int y) {
+        drawFishSprite(p.scaled_indexed, &dst, x, y, sw, sh);
+    });
+    double zoom_us = timeBlits([&](Pair& p, int x, int y) { drawFishSprite(p.zoom, &dst, x, y, sw, sh); });
+    double direct_us = timeBlits([&](Pair& p, int x, int y) {
+        p.indexed->blitScaled(out, 1280, 720, x, y, sw, sh);
+    });
+    size_t scaled_alpha_bytes = 0;
+    size_t scaled_indexed_bytes = 0;
+    for (const auto& p : pairs) {
+        scaled_alpha_bytes += p->scaled_alpha.bytes();
+        scaled_indexed_bytes += p->scaled_indexed.bytes();
+    }
+
+    const SpritePalette* palette = pairs[0]->indexed->palette();
+    std::printf("palette: %d colours, %d images, blend pixels %.1f%%\n", palette->count, count,
+                100.0 * blend_pixels / drawn_pixels);
+    std::printf("PSNR vs PNG (RGB565, over black): %.1f dB, worst %.1f dB (%s)\n",
+                psnr(squared_error, samples), worst, worst_name);
+    std::printf("%-22s %10s %10s\n", "format", "us/blit", "KB/sprite");
+    std::printf("%-22s %10.2f %10.1f\n", "alpha 1.0x", alpha_us, span_bytes / 1024.0 / count);
+    std::printf("%-22s %10.2f %10.1f\n", "indexed 1.0x", indexed_us, indexed_bytes / 1024.0 / count);
+    std::printf("%-22s %10.2f %10.1f\n", "indexed 1.0x mirrored", mirrored_us,
+                indexed_bytes / 1024.0 / count);
+    std::printf("%-22s %10.2f %10.1f\n", "alpha 0.7x cached", alpha_cached_us,
+                scaled_alpha_bytes / 1024.0 / count);
+    std::printf("%-22s %10.2f %10.1f\n", "indexed 0.7x cached", indexed_cached_us,
+                scaled_indexed_bytes / 1024.0 / count);
+    std::printf("%-22s %10.2f %10s\n", "canvas 0.7x zoom", zoom_us, "-");
+    std::printf("%-22s %10.2f %10s\n", "indexed 0.7x direct", direct_us, "-");
+    std::printf("memory: %.1f%% of alpha spans, blits match reference: %s\n",
+                100.0 * indexed_bytes / span_bytes, all_identical ? "yes" : "NO");
+    return all_identical;
+}
+
+// 泳ぎフレーム（左右）を、色キー付き pushSprite とスパン描画でそれぞれ描画して比較する
+// 一部が画面外にはみ出す位置も含め、同じ位置列で描画する
+// 面積平均の重み（縮小後のピクセル d に掛かる元のピクセル first + k の割合）
+struct ReferenceTaps {
+    int first;
+    std::vector<double> weight;
+};
+
+std::vector<ReferenceTaps> referenceTaps(int src, int dst) {
+    std::vector<ReferenceTaps> taps(dst);
+    double s = (double)src / dst;
+    for (int d = 0; d < dst; d++) {
+        double lo = d * s;
+        double hi = (d + 1) * s;
+        taps[d].first = (int)lo;
+        for (int i = (int)lo; i < src && i < hi; i++) {
+            taps[d].weight.push_back((std::min(hi, i + 1.0) - std::max(lo, (double)i)) / s);
+        }
+    }
+    return taps;
+}
+
+// sprite を浮動小数点で面積平均して draw_w x draw_h に縮小し、background（スワップ済み、
+// stride ピクセル間隔）に重ねた期待値を out（draw_w x draw_h）に作る
+void referenceScale(const FishSprite& sprite, int draw_w, int draw_h, const uint16_t* background, int stride,
+                    std::vector<uint16_t>& out) {
+    int w = sprite.width;
+    int h = sprite.height;
+    std::vector<uint16_t> color(w);
+    std::vector<uint8_t> alpha(w);
+    std::vector<ReferenceTaps> columns = referenceTaps(w, draw_w);
+    std::vector<ReferenceTaps> rows = referenceTaps(h, draw_h);
+    // 横に縮小した行（R G B A、乗算済み。アルファは 0〜1）
+    std::vector<double> filtered((size_t)h * draw_w * 4);
+    for (int r = 0; r < h; r++) {
+        int x0, x1;
+        if (!sprite.indexed.empty()) {
+            sprite.indexed.decodeRow(r, color.data(), alpha.data(), &x0, &x1);
+        } else {
+            sprite.spans.decodeRow(r, color.data(), alpha.data(), &x0, &x1);
+        }
+        for (int u = 0; u < draw_w; u++) {
+            double* f = &filtered[((size_t)r * draw_w + u) * 4];
+            for (size_t k = 0; k < columns[u].weight.size(); k++) {
+                int i = columns[u].first + (int)k;
+                double wk = columns[u].weight[k];
+                f[0] += wk * (color[i] >> 11);
+                f[1] += wk * ((color[i] >> 5) & 63);
+                f[2] += wk * (color[i] & 31);
+                f[3] += wk * alpha[i] / 32.0;
+            }
+        }
+    }
+    out.resize((size_t)draw_w * draw_h);
+    for (int v = 0; v < draw_h; v++) {
+        for (int u = 0; u < draw_w; u++) {
+            double c[4] = {0, 0, 0, 0};
+            for (size_t k = 0; k < rows[v].weight.size(); k++) {
+                const double* f = &filtered[((size_t)(rows[v].first + k) * draw_w + u) * 4];
+                for (int n = 0; n < 4; n++) c[n] += rows[v].weight[k] * f[n];
+            }
+            uint16_t bg = background[v * stride + u];
+            bg = (uint16_t)((bg << 8) | (bg >> 8));
+            int r = (int)std::lround(c[0] + (bg >> 11) * (1.0 - c[3]));
+            int g = (int)std::lround(c[1] + ((bg >> 5) & 63) * (1.0 - c[3]));
+            int b = (int)std::lround(c[2] + (bg & 31) * (1.0 - c[3]));
+            uint16_t px = (uint16_t)((std::min(r, 31) << 11) | (std::min(g, 63) << 5) | std::min(b, 31));
+            out[(size_t)v * draw_w + u] = (uint16_t)((px << 8) | (px >> 8));
+        }
+    }
+}
+
+// 奥行きを量子化しないときの魚の縮小を比べる
+// ・縦横に分けた縮小（scale_filter）と pushRotateZoomWithAA（ホストではその模擬）と最近傍の描画時間
+//   （泳ぎフレームを 0.70〜0.99 倍で、はみ出す位置も含めて N 回ずつ）
+// ・元の画像を浮動小数点で面積平均して背景に重ねた画像に対する PSNR
+// ・反転した描画が、反転しない描画を左右に入れ替えたものと一致するか
+// 縦横に分けた縮小が全ての倍率で pushRotateZoomWithAA 以上の画質で、反転が一致すれば成功
+bool runScaleBench(int iterations) {
+    if (sprite_format == SpriteFormat::Canvas || !scale_filter.enabled()) {
+        std::fprintf(stderr, "scale bench needs --sprite-format spans, alpha or indexed\n");
+        return false;
+    }
+    const int count = swim_frame_count;
+    FishSprite* sources[MAX_SWIM_FRAMES];
+    for (int i = 0; i < count; i++) {
+        sources[i] = sprite_residency.loadNow(swim_left_ids[i] & ~SPRITE_MIRRORED);
+        if (!sources[i] || !sources[i]->loaded()) {
+            std::fprintf(stderr, "failed to load swim frame %d\n", i);
+            return false;
+        }
+    }
+    M5Canvas dst;
+    dst.setPsram(true);
+    dst.setColorDepth(16);
+    dst.createSprite(1280, 720);
+    uint16_t* pixels = (uint16_t*)dst.getBuffer();
+    // 縁の合成の違いが見えるよう、黒ではない縦横のグラデーションの上に描く
+    std::vector<uint16_t> background((size_t)1280 * 720);
+    for (int y = 0; y < 720; y++) {
+        for (int x = 0; x < 1280; x++) {
+            uint16_t px = (uint16_t)(((x * 31 / 1279) << 11) | ((20 + y * 40 / 719) << 5) | (31 - x * 16 / 1279));
+            background[(size_t)y * 1280 + x] = (uint16_t)((px << 8) | (px >> 8));
+        }
+    }
+    const int positions[][2] = {{100, 100}, {-120, 300}, {1100, 50}, {500, 600}, {640, 260}};
+    const int num_positions = sizeof(positions) / sizeof(positions[0]);
+    const float scales[] = {0.70f, 0.75f, 0.80f, 0.85f, 0.90f, 0.95f, 0.99f};
+    // 0: scale_filter、1: pushRotateZoomWithAA（従来の経路。展開した画像を黒の上に縮小して透過色で抜く）、
+    // 2: 最近傍（drawFishSprite の AA なし）
+    bool saved_antialias = scale_antialias;
+    auto draw = [&](int method, FishSprite& sprite, int x, int y, int w, int h, bool mirror) {
+        if (method == 1) {
+            M5Canvas* source = fishSpriteCanvas(sprite);
+            source->pushRotateZoomWithAA(&dst, x + w / 2, y + h / 2, 0.0f,
+                                         (float)w / sprite.width * (mirror ? -1.0f : 1.0f),
+                                         (float)h / sprite.height, TFT_BLACK);
+            return;
+        }
+        scale_antialias = method == 0;
+        drawFishSprite(sprite, &dst, x, y, w, h, mirror);
+    };
+
+    std::printf("scale bench: %d swim frames, %d draws each (host pushRotateZoomWithAA is the emulation)\n",
+                count, iterations);
+    std::printf("%6s %13s %13s %11s %8s %10s %12s %9s\n", "scale", "separable us", "rotozoom us", "nearest us",
+                "speedup", "sep dB", "rotozoom dB", "near dB");
+    std::vector<uint16_t> expected;
+    std::vector<uint16_t> plain;
+    bool ok = true;
+    bool mirror_ok = true;
+    for (float scale : scales) {
+        double us[3];
+        double db[3];
+        int draw_w = 0;
+        int draw_h = 0;
+        for (int method = 0; method < 3; method++) {
+            std::memcpy(pixels, background.data(), background.size() * 2);
+            uint32_t t0 = micros();
+            for (int n = 0; n < iterations; n++) {
+                for (int i = 0; i < count; i++) {
+                    FishSprite& sprite = *sources[i];
+                    const int* pos = positions[(n + i) % num_positions];
+                    draw(method, sprite, pos[0], pos[1], (int)(sprite.width * scale),
+                         (int)(sprite.height * scale), (n & 1) != 0);
+                }
+            }
+            us[method] = (double)(micros() - t0) / ((double)iterations * count);
+
+            // 画質（背景の上の同じ位置に 1 枚ずつ描いて、期待値との差を足す）
+            uint64_t error = 0;
+            uint64_t samples = 0;
+            for (int i = 0; i < count; i++) {
+                FishSprite& sprite = *sources[i];
+                draw_w = (int)(sprite.width * scale);
+                draw_h = (int)(sprite.height * scale);
+                const int x = 200, y = 150;
+                std::memcpy(pixels, background.data(), background.size() * 2);
+                draw(method, sprite, x, y, draw_w, draw_h, false);
+                referenceScale(sprite, draw_w, draw_h, background.data() + y * 1280 + x, 1280, expected);
+                for (int row = 0; row < draw_h; row++) {
+                    error += squaredError565(pixels + (y + row) * 1280 + x, expected.data() + row * draw_w,
+                                             draw_w);
+                }
+                samples += (uint64_t)draw_w * draw_h * 3;
+                if (method == 0) {
+                    // 単色の上なら、反転した描画は反転しない描画を左右に入れ替えたものになる
+                    dst.fillSprite(0x1234);
+                    draw(method, sprite, x, y, draw_w, draw_h, false);
+                    plain.assign(pixels, pixels + (size_t)1280 * 720);
+                    dst.fillSprite(0x1234);
+                    draw(method, sprite, x, y, draw_w, draw_h, true);
+                    for (int row = 0; row < draw_h && mirror_ok; row++) {
+                        for (int col = 0; col < draw_w; col++) {
+                            if (pixels[(y + row) * 1280 + x + col] !=
+                                plain[(size_t)(y + row) * 1280 + x + draw_w - 1 - col]) {
+                                mirror_ok = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            db[method] = psnr(error, samples);
+        }
+        std::printf("%6.2f %13.2f %13.2f %11.2f %7.2fx %10.2f %12.2f %9.2f  (%dx%d)\n", scale, us[0], us[1], us[2],
+                    us[1] / us[0], db[0], db[1], db[2], draw_w, draw_h);
+        ok = ok && db[0] >= db[1];
+    }
+    scale_antialias = saved_antialias;
+    const ScaleFilter::Stats& fs = scale_filter.stats();
+    std::printf("scale filter: %u draws, %u source rows, %u weight tables built, %u KB\n", fs.draws, fs.rows,
+                fs.table_builds, (unsigned)(scale_filter.bytes() / 1024));
+    std::printf("separable at least as close as rotate-zoom: %s, mirrored matches flipped: %s\n",
+                ok ? "yes" : "NO", mirror_ok ? "yes" : "NO");
+    return ok && mirror_ok;
+}
+
+bool runBlitBench(int iterations) {
+    const int count = swim_frame_count * 2;
+    M5Canvas keyed[MAX_SWIM_FRAMES * 2];
+    SpanSprite spans[MAX_SWIM_FRAMES * 2];
+    if (count == 0) {
+        std::fprintf(stderr, "no swim frames loaded\n");
+        return false;
+    }
+    size_t keyed_bytes = 0;
+    size_t span_bytes = 0;
+    uint64_t opaque = 0;
+    for (int i = 0; i < count; i++) {
+        int id = i < swim_frame_count ? swim_left_ids[i] : swim_right_ids[i - swim_frame_count];
+        FishSprite* sprite = sprite_residency.loadNow(id & ~SPRITE_MIRRORED);
+        M5Canvas* source = sprite ? fishSpriteCanvas(*sprite) : nullptr;
+        if (!source) {
+            std::fprintf(stderr, "sprite %d not loaded\n", i);
+            return false;
+        }
+        keyed[i].setPsram(true);
+        keyed[i].setColorDepth(16);
+        keyed[i].createSprite(source->width(), source->height());
+        std::memcpy(keyed[i].getBuffer(), source->getBuffer(),
+                    (size_t)source->width() * source->height() * 2);
+        spans[i].build((const uint16_t*)keyed[i].getBuffer(), keyed[i].width(), keyed[i].height(),
+                       keyed[i].width(), TFT_BLACK);
+        keyed_bytes += (size_t)keyed[i].width() * keyed[i].height() * 2;
+        span_bytes += spans[i].bytes();
+        opaque += spans[i].opaquePixels();
+    }
+
+    M5Canvas dst;
+    dst.setPsram(true);
+    dst.setColorDepth(16);
+    dst.createSprite(1280, 720);
+    const int positions[][2] = {{100, 100}, {-120, 300}, {1100, 50}, {500, 600}, {640, 260}};
+    const int num_positions = sizeof(positions) / sizeof(positions[0]);
+
+    // 出力が一致することを確認
+    std::vector<uint16_t> keyed_out((size_t)1280 * 720);
+    bool identical = true;
+    for (int p = 0; p < num_positions && identical; p++) {
+        for (int i = 0; i < count && identical; i++) {
+            dst.fillSprite(0x1234);
+            keyed[i].pushSprite(&dst, positions[p][0], positions[p][1], TFT_BLACK);
+            std::memcpy(keyed_out.data(), dst.getBuffer(), keyed_out.size() * 2);
+            dst.fillSprite(0x1234);
+            spans[i].blit((uint16_t*)dst.getBuffer(), 1280, 720, positions[p][0], positions[p][1]);
+            identical = std::memcmp(keyed_out.data(), dst.getBuffer(), keyed_out.size() * 2) == 0;
+        }
+    }
+
+    uint32_t t0 = micros();
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < count; i++) {
+            const int* pos = positions[(n + i) % num_positions];
+            keyed[i].pushSprite(&dst, pos[0], pos[1], TFT_BLACK);
+        }
+    }
+    uint32_t keyed_us = micros() - t0;
+    t0 = micros();
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < count; i++) {
+            const int* pos = positions[(n + i) % num_positions];
+            spans[i].blit((uint16_t*)dst.getBuffer(), 1280, 720, pos[0], pos[1]);
+        }
+    }
+    uint32_t span_us = micros() - t0;
+    t0 = micros();
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < count; i++) {
+            const int* pos = positions[(n + i) % num_positions];
+            spans[i].blitMirrored((uint16_t*)dst.getBuffer(), 1280, 720, pos[0], pos[1]);
+        }
+    }
+    uint32_t mirrored_us = micros() - t0;
+
+    int blits = iterations * count;
+    std::printf("blit bench: %d sprites x %d iterations, opaque %.1f%%\n", count, iterations,
+                100.0 * opaque / (keyed_bytes / 2));
+    std::printf("%-10s %12s %12s\n", "format", "us/blit", "KB/sprite");
+    std::printf("%-10s %12.2f %12.1f\n", "colorkey", (double)keyed_us / blits,
+                keyed_bytes / 1024.0 / count);
+    std::printf("%-10s %12.2f %12.1f\n", "spans", (double)span_us / blits,
+                span_bytes / 1024.0 / count);
+    std::printf("%-10s %12.2f %12.1f\n", "mirrored", (double)mirrored_us / blits,
+                span_bytes / 1024.0 / count);
+    std::printf("speedup: %.2fx, memory: %.1f%%, output identical: %s\n",
+                (double)keyed_us / span_us, 100.0 * span_bytes / keyed_bytes,
+                identical ? "yes" : "NO");
+    return identical && runScaledBlitBench(iterations);
+}
+
+// FishSchool 以前の魚 1 匹分の状態（比較用。描画矩形を含めて同じ大きさにする）
+struct LegacyFish {
+    float x, y, vx, vy;
+    bool facing_right;
+    float swim_phase, swim_speed;
+    bool is_turning;
+    float turn_progress;
+    bool turn_target_right, turn_start_facing_right, turn_via_tail;
+    float depth, depth_target;
+    DirtyRect prev_rect, curr_rect;
+};
+
+// FishSchool 以前の updateFishes() と同じ処理（random() と分岐を使う 1 匹ずつの更新）
+void updateLegacyFishes(std::vector<LegacyFish>& school, float delta_sec) {
+    for (auto& fish : school) {
+        fish.swim_phase += delta_sec * 6.0f * fish.swim_speed;
+        if (fish.swim_phase >= 6.0f) {
+            fish.swim_phase -= 6.0f;
+        }
+        if (fish.is_turning) {
+            fish.turn_progress += delta_sec / TURN_DURATION;
+            if (fish.turn_progress >= 1.0f) {
+                fish.turn_progress = 1.0f;
+                fish.is_turning = false;
+                fish.facing_right = fish.turn_target_right;
+            }
+        }
+        fish.x += fish.vx * delta_sec * 50;
+        fish.y += fish.vy * delta_sec * 50;
+        float scale = getDrawScale(fish.depth);
+        int scaled_w = (int)(FISH_WIDTH * scale);
+        int scaled_h = (int)(FISH_HEIGHT * scale);
+        if (fish.x < 0) {
+            fish.x = 0;
+            fish.vx = -fish.vx;
+        }
+        if (fish.x + scaled_w > 1280) {
+            fish.x = 1280 - scaled_w;
+            fish.vx = -fish.vx;
+        }
+        if (fish.y < 0) {
+            fish.y = 0;
+            fish.vy = -fish.vy;
+        }
+        if (fish.y + scaled_h > 720) {
+            fish.y = 720 - scaled_h;
+            fish.vy = -fish.vy;
+        }
+        fish.vx += (random(-10, 11) / 100.0f);
+        fish.vy += (random(-10, 11) / 100.0f);
+        float speed = sqrt(fish.vx * fish.vx + fish.vy * fish.vy);
+        if (speed > MAX_SPEED) {
+            fish.vx = fish.vx / speed * MAX_SPEED;
+            fish.vy = fish.vy / speed * MAX_SPEED;
+        }
+        if (!fish.is_turning) {
+            bool new_facing_right = fish.vx > 0;
+            if (new_facing_right != fish.facing_right) {
+                fish.turn_start_facing_right = fish.facing_right;
+                fish.is_turning = true;
+                fish.turn_progress = 0.0f;
+                fish.turn_target_right = new_facing_right;
+                fish.facing_right = new_facing_right;
+                fish.turn_via_tail = random(0, 2) == 0;
+            }
+        }
+        if (fabs(fish.vx) > 0.1f) {
+            float depth_diff = fish.depth_target - fish.depth;
+            if (fabs(depth_diff) > 0.01f) {
+                float depth_step = DEPTH_CHANGE_SPEED * delta_sec;
+                if (fabs(depth_diff) < depth_step) {
+                    fish.depth = fish.depth_target;
+                } else {
+                    fish.depth += (depth_diff > 0 ? depth_step : -depth_step);
+                }
+            } else {
+                fish.depth_target = random(0, 100) / 100.0f;
+            }
+        }
+        fish.depth = max(0.0f, min(1.0f, fish.depth));
+        fish.prev_rect = fish.curr_rect;
+        scale = getDrawScale(fish.depth);
+        fish.curr_rect = {(int)fish.x, (int)fish.y, (int)(FISH_WIDTH * scale),
+                          (int)(FISH_HEIGHT * scale)};
+    }
+}
+
+// count 匹の魚を従来の構造体配列と FishSchool で同じフレーム数だけ更新し、1 秒あたりの更新数を比べる
+bool runSimBench(int count, float delta_sec) {
+    std::vector<LegacyFish> legacy(count);
+    FishSchool school;
+    school.resize(count, 1);
+    for (int i = 0; i < count; i++) {
+        LegacyFish& fish = legacy[i];
+        fish = LegacyFish{};
+        fish.x = school.x[i] = (float)random(0, 1280 - FISH_WIDTH);
+        fish.y = school.y[i] = (float)random(0, 720 - FISH_HEIGHT);
+        fish.vx = school.vx[i] = random(-20, 21) / 10.0f;
+        fish.vy = school.vy[i] = random(-10, 11) / 10.0f;
+        fish.facing_right = fish.vx > 0;
+        school.facing_right[i] = fish.facing_right;
+        fish.swim_phase = school.swim_phase[i] = random(0, 600) / 100.0f;
+        fish.swim_speed = school.swim_speed[i] = 0.8f + random(0, 40) / 100.0f;
+        fish.depth = school.depth[i] = random(0, 100) / 100.0f;
+        fish.depth_target = school.depth_target[i] = random(0, 100) / 100.0f;
+        school.resetRect(i, getDrawScale(school.depth[i]));
+    }
+
+    // 1 回あたり 1ms 程度以上になるようにフレーム数を決める
+    const int frames = max(20, 2000000 / max(count, 1));
+    uint32_t t0 = micros();
+    for (int n = 0; n < frames; n++) {
+        updateLegacyFishes(legacy, delta_sec);
+    }
+    uint32_t legacy_us = max<uint32_t>(1, micros() - t0);
+    t0 = micros();
+    for (int n = 0; n < frames; n++) {
+        school.update(delta_sec, 1280, 720, getDrawScale);
+    }
+    uint32_t school_us = max<uint32_t>(1, micros() - t0);
+
+    // 結果が画面内に収まっていることだけ確認する（乱数が異なるので値は比較しない）
+    bool in_bounds = true;
+    for (int i = 0; i < count; i++) {
+        in_bounds &= school.x[i] >= 0 && school.x[i] <= 1280 && school.y[i] >= 0 &&
+                     school.y[i] <= 720 && school.depth[i] >= 0 && school.depth[i] <= 1;
+    }
+
+    double updates = (double)count * frames;
+    std::printf("sim bench: %d fish x %d frames\n", count, frames);
+    std::printf("%-10s %12s %14s\n", "layout", "ns/fish", "Mupdates/s");
+    std::printf("%-10s %12.2f %14.2f\n", "legacy", legacy_us * 1000.0 / updates,
+                updates / legacy_us);
+    std::printf("%-10s %12.2f %14.2f\n", "school", school_us * 1000.0 / updates,
+                updates / school_us);
+    std::printf("speedup: %.2fx, in bounds: %s\n", (double)legacy_us / school_us,
+                in_bounds ? "yes" : "NO");
+    return in_bounds;
+}
+
+// 群れの計算（steer + update + グリッドの更新）の 1 フレームの時間を、グリッドを使う場合と
+// 全ての組を調べる場合で比べる。魚の数に比例して水槽を広げ、密度は画面に 24 匹と同じにする
+// （画面の大きさのまま増やすと全ての魚が近傍になり、どちらも O(n^2) になるため）
+bool runBoidsBench(int max_count, float delta_sec) {
+    const int reference_count = 24;
+    std::printf("boids bench: density %d fish per 1280x720, radius %d px\n", reference_count,
+                BOIDS_RADIUS);
+    std::printf("%8s %10s %14s %14s %9s\n", "fish", "neighbors", "grid ms/frame",
+                "scan ms/frame", "speedup");
+    bool ok = true;
+    for (int count = 32; count <= max_count; count *= 2) {
+        float world = sqrtf((float)count / reference_count);
+        int width = (int)(1280 * world);
+        int height = (int)(720 * world);
+        double ms[2] = {0, 0};
+        double neighbors = 0;
+        const int frames = max(10, 200000 / count);
+        for (int use_grid = 1; use_grid >= 0; use_grid--) {
+            FishSchool school;
+            school.resize(count, 1);
+            for (int i = 0; i < count; i++) {
+                school.x[i] = (float)random(0, width - FISH_WIDTH);
+                school.y[i] = (float)random(0, height - FISH_HEIGHT);
+                school.vx[i] = random(-20, 21) / 10.0f;
+                school.vy[i] = random(-10, 11) / 10.0f;
+                school.facing_right[i] = school.vx[i] > 0;
+                school.swim_speed[i] = 1.0f;
+                school.depth[i] = school.depth_target[i] = random(0, 100) / 100.0f;
+                school.resetRect(i, getDrawScale(school.depth[i]));
+            }
+            SpatialGrid grid;
+            grid.begin(width, height, BOIDS_RADIUS, FISH_WIDTH / 2 + 1, FISH_HEIGHT / 2 + 1);
+            grid.resize(count);
+            for (int i = 0; i < count; i++) {
+                grid.update(i, school.center_x[i], school.center_y[i]);
+            }
+            uint32_t t0 = micros();
+            for (int n = 0; n < frames; n++) {
+                school.steer(use_grid ? &grid : nullptr);
+                school.update(delta_sec, width, height, getDrawScale);
+                for (int i = 0; i < count; i++) {
+                    grid.update(i, school.center_x[i], school.center_y[i]);
+                }
+            }
+            ms[use_grid] = (micros() - t0) / 1000.0 / frames;
+            if (use_grid) {
+                // 最後のフレームの近傍数の平均（グリッドが正しければ全探索と同じ値になる）
+                float r_sq = (float)BOIDS_RADIUS * BOIDS_RADIUS;
+                uint64_t pairs = 0, grid_pairs = 0;
+                for (int i = 0; i < count; i++) {
+                    float cx = school.center_x[i], cy = school.center_y[i];
+                    auto near = [&](int j) {
+                        float dx = school.center_x[j] - cx, dy = school.center_y[j] - cy;
+                        return j != i && dx * dx + dy * dy < r_sq;
+                    };
+                    for (int j = 0; j < count; j++) pairs += near(j);
+                    grid.forEachNear(cx, cy, (float)BOIDS_RADIUS, [&](int j) { grid_pairs += near(j); });
+                }
+                neighbors = (double)pairs / count;
+                ok &= pairs == grid_pairs;
+            }
+        }
+        std::printf("%8d %10.1f %14.3f %14.3f %8.2fx\n", count, neighbors, ms[1], ms[0],
+                    ms[0] / ms[1]);
+    }
+    std::printf("grid neighbors match full scan: %s\n", ok ? "yes" : "NO");
+    return ok;
+}
+
+// 疑似的なタッチ入力（フレームごとに呼ぶ）
+// 平均 1 秒に 1 回押し、数フレームで離すタップか、最大 1.5 秒なぞる長押しにする
+class AutoTouch {
+public:
+    explicit AutoTouch(uint32_t seed) : _rng(seed ^ 0x70C4u) {}
+
+    void step(int width, int height) {
+        if (_frames_left > 0) {
+            _frames_left--;
+            _x = max(0, min(width - 1, _x + _rng.range(-8, 9)));
+            _y = max(0, min(height - 1, _y + _rng.range(-8, 9)));
+            host::setTouch(_frames_left > 0, _x, _y);
+            return;
+        }
+        if (_rng.range(0, 60) == 0) {
+            _x = _rng.range(0, width);
+            _y = _rng.range(0, height);
+            _frames_left = _rng.range(0, 2) ? _rng.range(2, 6) : _rng.range(10, 90);
+            host::setTouch(true, _x, _y);
+        }
+    }
+
+private:
+    SimRandom _rng;
+    int _frames_left = 0;
+    int _x = 0;
+    int _y = 0;
+};
+
+bool readFile(const char* path, std::vector<uint8_t>& data) {
+    std::FILE* fp = std::fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    std::fseek(fp, 0, SEEK_END);
+    data.resize((size_t)std::ftell(fp));
+    std::fseek(fp, 0, SEEK_SET);
+    bool ok = std::fread(data.data(), 1, data.size(), fp) == data.size();
+    std::fclose(fp);
+    return ok;
+}
+
+bool writeFile(const char* path, const std::vector<uint8_t>& data) {
+    std::FILE* fp = std::fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool ok = std::fwrite(data.data(), 1, data.size(), fp) == data.size();
+    return std::fclose(fp) == 0 && ok;
+}
+
+// 泡の数を変えて、粒子の更新（タイルの印と更新領域）と描画にかかる時間を計測する
+// 泡を target 個撒いてから同じ数を保つ速さで湧かせ、advance と loop() で N フレーム回す。
+// どのフレームでも粒子の更新領域の数が maxRects() を超えなければ成功
+template <class Advance>
+bool runParticleBench(int frames, Advance advance) {
+    if (!particles.enabled()) {
+        std::fprintf(stderr, "particles are disabled\n");
+        return false;
+    }
+    const int targets[] = {0, 250, 1000, 2000, PARTICLE_CAPACITY};
+    std::printf("particle bench: %d frames each, tile rows bounded to %u rects\n", frames,
+                (unsigned)particles.maxRects());
+    std::printf("%8s %8s %11s %11s %11s %11s %7s %7s %10s\n", "target", "live", "total ms",
+                "particle ms", "bounds ms", "bubbles ms", "tiles", "rects", "dirty px");
+    bool ok = true;
+    for (int target : targets) {
+        // 前の泡を消してから撒き直す
+        particles.setAnimated(false);
+        advance();
+        loop();
+        particles.setAnimated(true);
+        particles.setBubbleRate(target / particles.bubbleLifetime());
+        particles.fillBubbles(target);
+        for (int i = 0; i < 10; i++) {
+            advance();
+            loop();
+        }
+        uint64_t live = 0, total = 0, update = 0, bounds = 0, bubbles = 0, tiles = 0, rects = 0,
+                 dirty = 0;
+        uint32_t rects_max = 0;
+        for (int i = 0; i < frames; i++) {
+            advance();
+            loop();
+            const ParticleSystem::Stats& ps = particles.stats();
+            live += ps.bubbles + ps.pellets;
+            total += frame_stats.total_us;
+            update += frame_stats.particles_us;
+            bounds += frame_stats.bounds_us;
+            bubbles += frame_stats.bubbles_us;
+            tiles += ps.tiles;
+            rects += ps.rects;
+            rects_max = std::max(rects_max, ps.rects);
+            dirty += frame_stats.dirty_pixels;
+        }
+        std::printf("%8d %8.0f %11.3f %11.3f %11.3f %11.3f %7.1f %7.2f %10.0f\n", target,
+                    (double)live / frames, total / 1000.0 / frames, update / 1000.0 / frames,
+                    bounds / 1000.0 / frames, bubbles / 1000.0 / frames, (double)tiles / frames,
+                    (double)rects / frames, (double)dirty / frames);
+        if (rects_max > particles.maxRects()) {
+            std::printf("  %u rects in a frame\n", rects_max);
+            ok = false;
+        }
+    }
+    particles.setBubbleRate(bubble_rate);
+    render_pipeline.flush();  // 転送タスクが描き終わってから終了する
+    return ok;
+}
+
+// 描画の設定を変えて同じ記録を再生する（描画の品質やメモリの不足はシミュレーションを変えない）
+struct ReplayCase {
+    const char* name;
+    int quality;  // 固定する品質の段階（-1=固定しない）
+    const char* budget;  // memory_budget の予算（NAME=KB、nullptr=無制限）
+};
+
+// opt.replay_check の記録を ReplayCase（品質の段階と、メモリが足りず軽くする場合）ごとに子プロセスで再生する（setup() の前に分けるので、
+// グローバルの状態を作り直さずに済む）。親は全ての結果を表示して終了コードを返す。
+// 子は opt をその場合の設定にして -1 を返す（main() がそのまま再生する）
+int runReplayCheck(Options& opt) {
+    static const ReplayCase cases[] = {
+        {"full", (int)Quality::Full, nullptr},
+        {"no-aa", (int)Quality::NoAntialias, nullptr},
+        {"coarse-depth", (int)Quality::CoarseDepth, nullptr},
+        {"static-layers", (int)Quality::StaticLayers, nullptr},
+        {"half-res", (int)Quality::HalfResolution, nullptr},
+        {"budget cache=200", -1, "cache=200"},      // 奥行きのレベルを間引く
+        {"budget sprites=300", -1, "sprites=300"},  // 魚スプライトを入れ替え続ける
+        {"budget compose=2000", -1, "compose=2000"},  // 合成用のバッファを 1 面にする
+    };
+    int failed = 0;
+    for (const ReplayCase& c : cases) {
+        std::fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::fprintf(stderr, "fork failed\n");
+            return 1;
+        }
+        if (pid == 0) {
+            opt.replay_path = opt.replay_check;
+            opt.replay_check = nullptr;
+            opt.quality = c.quality;
+            if (c.budget) {
+                parseBudget(c.budget, opt);
+            }
+            if (!std::freopen("/dev/null", "w", stdout)) {
+                std::_Exit(1);
+            }
+            return -1;
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        std::printf("replay %-20s %s\n", c.name, ok ? "ok" : "FAIL");
+        failed += !ok;
+    }
+    std::printf("replay check: %d/%d cases matched\n", (int)(sizeof(cases) / sizeof(cases[0])) - failed,
+                (int)(sizeof(cases) / sizeof(cases[0])));
+    return failed > 0 ? 1 : 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        return 2;
+    }
+    if (opt.replay_check) {
+        int status = runReplayCheck(opt);
+        if (status >= 0) {
+            return status;
+        }
+    }
+
+    host::setLogLevel(opt.verbose ? 3 : 1);
+    host::setDataRoot(opt.data_dir);
+    host::useVirtualClock(true);
+    randomSeed(opt.seed);
+    sim_seed = (uint32_t)opt.seed;
+    num_fishes = opt.fish;
+    multi_rect_dirty = !opt.single_rect;
+    front_to_back = opt.front_to_back;
+    depth_levels = opt.depth_levels;
+    depth_cache_budget = opt.cache_budget;
+    depth_cache_preload = opt.cache_preload;
+    sprite_format = opt.sprite_format;
+    asset_format = opt.asset_format;
+    lazy_sprites = !opt.eager_sprites;
+    sprite_budget = opt.sprite_budget;
+    pipelined_render = !opt.serial_render;
+    target_fps = opt.target_fps;
+    pinned_quality = opt.quality;
+    touch_task = opt.touch_task;
+    schooling = opt.schooling;
+    spatial_index = opt.spatial_index;
+    scene_debug_log = opt.scene_log;
+    scene_layers_enabled = opt.scene_layers;
+    particles_enabled = opt.particles;
+    bubble_rate = opt.bubble_rate;
+    mirror_sprites = opt.mirror_sprites;
+    separable_scale = opt.separable_scale;
+    host::setPanelBandwidth(opt.panel_bandwidth);
+    for (int c = 0; c < (int)MemoryCategory::Count; c++) {
+        memory_budget.setBudget((MemoryCategory)c, opt.budgets[c]);
+    }
+    if (opt.replay_path) {
+        // 魚の数・シード・奥行きの段階数などは記録の値が使われる
+        std::vector<uint8_t> data;
+        if (!readFile(opt.replay_path, data) || !session_log.beginReplay(data.data(), data.size())) {
+            std::fprintf(stderr, "failed to read session %s\n", opt.replay_path);
+            return 1;
+        }
+    } else if (opt.record_path) {
+        session_record = true;
+        session_save_path = nullptr;  // 終了時にまとめて書き出す
+    }
+
+    uint32_t setup_start = micros();
+    setup();
+    uint32_t setup_us = micros() - setup_start;
+    opt.fish = num_fishes;
+    opt.seed = sim_seed;
+    AutoTouch auto_touch(sim_seed);
+    auto advanceFrame = [&]() {
+        host::advanceMillis(opt.dt_ms);
+        if (opt.auto_touch) {
+            auto_touch.step(display->width(), display->height());
+        }
+    };
+
+    if (opt.blit_bench > 0) {
+        return runBlitBench(opt.blit_bench) ? 0 : 1;
+    }
+    if (opt.mirror_check) {
+        return runMirrorCheck() ? 0 : 1;
+    }
+    if (opt.palette_check) {
+        return runPaletteCheck() ? 0 : 1;
+    }
+    if (opt.scale_bench > 0) {
+        return runScaleBench(opt.scale_bench) ? 0 : 1;
+    }
+    if (opt.sim_bench > 0) {
+        return runSimBench(opt.sim_bench, opt.dt_ms / 1000.0f) ? 0 : 1;
+    }
+    if (opt.boids_bench > 0) {
+        return runBoidsBench(opt.boids_bench, opt.dt_ms / 1000.0f) ? 0 : 1;
+    }
+
+    // 差分は最初のフレーム（画面全体）から送る。1 パケットずつ書く（pty の先で待っているビューアーに届くよう）
+    FILE* stream_fp = nullptr;
+    if (opt.stream_path) {
+        stream_fp = std::fopen(opt.stream_path, "wb");
+        if (!stream_fp) {
+            std::fprintf(stderr, "failed to open %s\n", opt.stream_path);
+            return 1;
+        }
+        std::setvbuf(stream_fp, nullptr, _IONBF, 0);
+        frame_stream.begin(display->width(), display->height(), opt.stream_rate,
+                           [](const uint8_t* data, size_t length, void* file) {
+                               return std::fwrite(data, 1, length, (FILE*)file);
+                           },
+                           stream_fp);
+    }
+
+    // 起動から最初のフレームの表示まで（1フレーム目はウォームアップに含める）
+    advanceFrame();
+    loop();
+    render_pipeline.flush();  // 転送が終わって画面に出るまで
+    uint32_t first_frame_us = micros() - setup_start;
+
+    for (int i = 1; i < opt.warmup; i++) {
+        advanceFrame();
+        loop();
+    }
+    if (opt.particle_bench > 0) {
+        return runParticleBench(opt.particle_bench, advanceFrame) ? 0 : 1;
+    }
+
+    StageAccum stages[] = {
+        {"input", &FrameStats::input_us, 0, 0},
+        {"update", &FrameStats::update_us, 0, 0},
+        {"bounds", &FrameStats::bounds_us, 0, 0},
+        {"wait", &FrameStats::wait_us, 0, 0},
+        {"alloc", &FrameStats::alloc_us, 0, 0},
+        {"background", &FrameStats::background_us, 0, 0},
+        {"sort", &FrameStats::sort_us, 0, 0},
+        {"plants", &FrameStats::plants_us, 0, 0},
+        {"fish", &FrameStats::fish_us, 0, 0},
+        {"bubbles", &FrameStats::bubbles_us, 0, 0},
+        {"push", &FrameStats::push_us, 0, 0},
+        {"total", &FrameStats::total_us, 0, 0},
+    };
+    uint64_t pixels_blitted = 0;
+    uint64_t bytes_pushed = 0;
+    uint64_t fish_drawn = 0;
+    uint64_t fish_scaled = 0;
+    uint64_t fish_occluded = 0;
+    uint64_t occlusion_fallbacks = 0;
+    double overdraw_sum = 0.0;  // フレームごとの 書き込んだピクセル数 / 更新領域の面積
+    double overdraw_max = 0.0;
+    uint64_t regions = 0;
+    uint64_t layer_regions = 0;
+    uint64_t dirty_pixels = 0;
+    uint64_t union_pixels = 0;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    uint64_t allocations = 0;
+    uint64_t allocations_max = 0;
+    int alloc_frames = 0;  // メモリを確保したフレーム数
+
+    render_pipeline.flush();
+    host::resetPanelCounters();
+    sprite_residency.resetCounters();
+    render_pipeline.resetStats();
+    frame_pacer.resetStats();
+    touch_input.resetStats();
+    frame_stream.resetStats();
+    uint32_t millis_start = millis();
+#if AQUARIUM_PROFILE
+    profiler.reset(0);  // 計測区間の終わりでまとめて集計する
+#endif
+    uint32_t measure_start = micros();
+    for (int i = 0; i < opt.frames; i++) {
+        advanceFrame();
+        uint64_t allocs_before = host::allocationCount();
+        loop();
+        uint64_t allocs = host::allocationCount() - allocs_before;
+        allocations += allocs;
+        allocations_max = std::max(allocations_max, allocs);
+        alloc_frames += allocs > 0;
+        for (auto& stage : stages) {
+            uint32_t v = frame_stats.*stage.field;
+            stage.sum += v;
+            stage.max = std::max(stage.max, v);
+        }
+        pixels_blitted += frame_stats.pixels_blitted;
+        bytes_pushed += frame_stats.bytes_pushed;
+        fish_drawn += frame_stats.fish_drawn;
+        fish_scaled += frame_stats.fish_scaled;
+        fish_occluded += frame_stats.fish_occluded;
+        occlusion_fallbacks += frame_stats.occlusion_fallbacks;
+        if (frame_stats.dirty_pixels > 0) {
+            double overdraw = (double)frame_stats.pixels_blitted / frame_stats.dirty_pixels;
+            overdraw_sum += overdraw;
+            overdraw_max = std::max(overdraw_max, overdraw);
+        }
+        regions += frame_stats.regions;
+        layer_regions += frame_stats.layer_regions;
+        dirty_pixels += frame_stats.dirty_pixels;
+        union_pixels += frame_stats.union_pixels;
+        cache_hits += frame_stats.cache_hits;
+        cache_misses += frame_stats.cache_misses;
+    }
+    render_pipeline.flush();
+    uint32_t measure_us = micros() - measure_start;
+    host::PanelCounters panel = host::panelCounters();
+#if AQUARIUM_PROFILE
+    profiler.roll();
+#endif
+
+    std::printf("frames: %d  fish: %d  dt: %u ms  seed: %lu\n",
+                opt.frames, opt.fish, opt.dt_ms, opt.seed);
+    std::printf("setup: %.1f ms  boot to first frame: %.1f ms (assets: %s)\n", setup_us / 1000.0,
+                first_frame_us / 1000.0, asset_archive.sourceName());
+    std::printf("%-12s %10s %10s\n", "stage", "avg ms", "max ms");
+    for (const auto& stage : stages) {
+        std::printf("%-12s %10.3f %10.3f\n", stage.name,
+                    stage.sum / 1000.0 / opt.frames, stage.max / 1000.0);
+    }
+    std::printf("fish drawn/frame:     %.2f (scaled %.2f)\n",
+                (double)fish_drawn / opt.frames, (double)fish_scaled / opt.frames);
+    std::printf("regions/frame:        %.2f (layers added %.2f)\n", (double)regions / opt.frames,
+                (double)layer_regions / opt.frames);
+    std::printf("dirty pixels/frame:   %.0f (single rect %.0f, saved %.1f%%)\n",
+                (double)dirty_pixels / opt.frames, (double)union_pixels / opt.frames,
+                union_pixels ? 100.0 * (1.0 - (double)dirty_pixels / union_pixels) : 0.0);
+    std::printf("pixels blitted/frame: %.0f\n", (double)pixels_blitted / opt.frames);
+    std::printf("overdraw:             avg %.2fx, max %.2fx (%s", overdraw_sum / opt.frames, overdraw_max,
+                front_to_back ? "front-to-back" : "back-to-front");
+    if (front_to_back) {
+        std::printf(", occluded fish %.2f/frame, %llu fallback regions",
+                    (double)fish_occluded / opt.frames, (unsigned long long)occlusion_fallbacks);
+    }
+    std::printf(")\n");
+    std::printf("bytes pushed/frame:   %.0f\n", (double)bytes_pushed / opt.frames);
+    std::printf("panel bytes/frame:    %.0f (%.2f pushes)\n",
+                (double)panel.bytes_pushed / opt.frames, (double)panel.push_calls / opt.frames);
+    if (opt.depth_levels >= 2) {
+        std::printf("depth cache:          %llu hits, %llu misses (levels %d, resident %u KB)\n",
+                    (unsigned long long)cache_hits, (unsigned long long)cache_misses,
+                    opt.depth_levels, (unsigned)(depth_cache.stats().resident_bytes / 1024));
+    }
+
+    std::printf("allocations/frame:    %.2f (max %llu, %d frames allocated)\n",
+                (double)allocations / opt.frames, (unsigned long long)allocations_max,
+                alloc_frames);
+    std::printf("frame arena:          %u/%u bytes used (peak), %u overflows, %u failed\n",
+                (unsigned)frame_arena.highWater(), (unsigned)frame_arena.capacity(),
+                frame_arena.overflows(), frame_arena.failures());
+    RenderPipeline::Stats ps = render_pipeline.stats();
+    std::printf("render:               %s, %.1f fps (%.3f ms/frame wall)\n",
+                render_pipeline.pipelined() ? "pipelined" : "serial",
+                opt.frames * 1000000.0 / measure_us, measure_us / 1000.0 / opt.frames);
+    if (ps.frames > 0) {
+        std::printf("panel push:           avg %.3f ms, max %.3f ms; latency avg %.3f ms, max %.3f ms\n",
+                    ps.push_us / 1000.0 / ps.frames, ps.push_us_max / 1000.0,
+                    ps.latency_us / 1000.0 / ps.frames, ps.latency_us_max / 1000.0);
+    }
+    if (opt.auto_touch || touch_input.threaded()) {
+        TouchInput::Stats ts = touch_input.stats();
+        std::printf("touch input:          %s, %u samples, %u events, %u dropped\n",
+                    touch_input.threaded() ? "task" : "loop()", ts.samples, ts.events, ts.dropped);
+        // 読み取った時刻から、タップした魚が方向転換の画像で画面に出るまで（実時間）
+        if (ps.input_frames > 0) {
+            std::printf("tap to turn:          %u taps, avg %.3f ms, max %.3f ms\n", ps.input_frames,
+                        ps.input_latency_us / 1000.0 / ps.input_frames, ps.input_latency_us_max / 1000.0);
+        }
+    }
+    if (particles.enabled()) {
+        const ParticleSystem::Stats& pts = particles.stats();
+        std::printf("particles:            %u bubbles, %u pellets (%u spawned, %u pool full, %u eaten), "
+                    "%u KB\n",
+                    pts.bubbles, pts.pellets, pts.spawned, pts.pool_full, pts.eaten,
+                    (unsigned)(particles.bytes() / 1024));
+    }
+    if (frame_stream.enabled()) {
+        FrameStream::Stats ss = frame_stream.stats();
+        std::printf("stream:               %u frames sent, %u dropped (%u merged later), %u rects, %u write errors\n",
+                    ss.frames_sent, ss.frames_dropped, ss.pending_merged, ss.rects_sent, ss.write_errors);
+        if (ss.frames_sent > 0) {
+            std::printf("stream bytes:         %.0f/frame sent, %.0f KB/s sim, %.3f bytes/pixel, encode avg %.3f ms\n",
+                        (double)ss.bytes_sent / ss.frames_sent,
+                        (double)ss.bytes_sent / std::max<uint32_t>(1, millis() - millis_start),
+                        ss.pixels_sent ? (double)ss.bytes_sent / ss.pixels_sent : 0.0,
+                        ss.encode_us / 1000.0 / ss.frames_sent);
+        }
+    }
+    if (frame_pacer.pinned()) {
+        std::printf("quality:              pinned to %s\n", qualityName(frame_pacer.quality()));
+    } else if (frame_pacer.enabled()) {
+        // 待ちは仮想の時計で進むので、シミュレーション上の間隔（ms/frame）で表示する
+        const FramePacer::Stats& fs = frame_pacer.stats();
+        std::printf("pacing:               %d fps (budget %.3f ms), %.2f ms/frame sim, %u over budget, "
+                    "%u down / %u up, now %s\n",
+                    frame_pacer.targetFps(), frame_pacer.budgetUs() / 1000.0,
+                    (double)(millis() - millis_start) / opt.frames, fs.misses, fs.steps_down, fs.steps_up,
+                    qualityName(frame_pacer.quality()));
+        std::printf("quality frames:      ");
+        for (int q = 0; q < (int)Quality::Count; q++) {
+            std::printf(" %s %u", qualityName((Quality)q), fs.level_frames[q]);
+        }
+        std::printf("\n");
+    }
+
+#if AQUARIUM_PROFILE
+    std::printf("%-12s %8s %9s %9s %9s %9s\n", "profile", "count", "min us", "avg us", "p99 us",
+                "max us");
+    for (int s = 0; s < (int)ProfileStage::Count; s++) {
+        const Profiler::Summary& sum = profiler.summary((ProfileStage)s);
+        std::printf("%-12s %8u %9u %9u %9u %9u\n", profileStageName((ProfileStage)s), sum.count,
+                    sum.min_us, sum.avg_us, sum.p99_us, sum.max_us);
+    }
+    if (opt.trace_path) {
+        FILE* fp = std::fopen(opt.trace_path, "wb");
+        uint32_t events = 0;
+        if (fp) {
+            events = profiler.exportTrace(
+                [](const char* text, size_t length, void* file) {
+                    std::fwrite(text, 1, length, (FILE*)file);
+                },
+                fp);
+        }
+        if (!fp || std::fclose(fp) != 0) {
+            std::fprintf(stderr, "failed to write %s\n", opt.trace_path);
+            return 1;
+        }
+        std::printf("trace:                %u events (of %u recorded) written to %s\n",
+                    (unsigned)events, (unsigned)profiler.recorded(), opt.trace_path);
+    }
+#else
+    if (opt.trace_path) {
+        std::fprintf(stderr, "--trace needs a build with -DAQUARIUM_PROFILE=1\n");
+        return 1;
+    }
+#endif
+
+    sprite_residency.waitIdle();  // 終了時にローダータスクが読み込み中のスプライトを解放しないように
+    SpriteResidency::Stats rs = sprite_residency.stats();
+    std::printf("sprites:              %u/%d resident, %u KB (peak %u KB), %u loads, %u evictions\n",
+                rs.resident, sprite_residency.count(), (unsigned)(rs.resident_bytes / 1024),
+                (unsigned)(rs.peak_bytes / 1024), rs.loads, rs.evictions);
+    std::printf("sprite requests:      %u hits, %u misses (%u fallbacks, %u blank), %u prefetches, load max %.2f ms\n",
+                rs.hits, rs.misses, rs.fallbacks, rs.blanks, rs.prefetches, rs.load_us_max / 1000.0);
+    MemoryBudget::Usage mu = memory_budget.total();
+    std::printf("memory:               %u KB in use (peak %u KB), %u denied, %u failed, %u degraded%s\n",
+                (unsigned)(mu.bytes / 1024), (unsigned)(mu.peak / 1024), mu.denied, mu.failures, mu.degraded,
+                mirror_sprites && !opt.mirror_sprites ? " (right-facing mirrored)" : "");
+    if (depth_cache.memoryStep() > 1) {
+        std::printf("depth cache degraded: every %d of %d levels\n", depth_cache.memoryStep(), depth_cache.levels());
+    }
+    if (opt.memory_report) {
+        memory_budget.report([](const char* text, void*) { std::printf("%s\n", text); }, nullptr);
+    }
+
+    // 同じ条件の実行どうしはこの値が一致する
+    uint32_t sim_hash = fishes.checksum();
+    std::printf("simulation:           %u ticks, state %08x\n", (unsigned)sim_tick,
+                (unsigned)sim_hash);
+    bool session_ok = true;
+    if (session_log.mode() == SessionLog::Mode::Record) {
+        session_log.finish(sim_tick, sim_hash);
+        const SessionLog::Stats& ss = session_log.stats();
+        std::printf("session:              recorded %u ticks, %u touch events, %u checks, %u bytes\n",
+                    (unsigned)sim_tick, ss.events, ss.checks, (unsigned)session_log.data().size());
+        if (!writeFile(opt.record_path, session_log.data())) {
+            std::fprintf(stderr, "failed to write %s\n", opt.record_path);
+            return 1;
+        }
+    } else if (session_log.mode() == SessionLog::Mode::Replay) {
+        const SessionLog::Stats& ss = session_log.stats();
+        std::printf("session:              replayed %u/%u ticks%s, %u touch events, %u checks, %u mismatches\n",
+                    (unsigned)std::min(sim_tick, ss.last_tick), (unsigned)ss.last_tick,
+                    ss.ended ? " (complete)" : "", ss.events, ss.checks, ss.mismatches);
+        if (ss.mismatches > 0) {
+            std::printf("FAIL: replay diverged at tick %u\n", (unsigned)ss.first_mismatch_tick);
+            session_ok = false;
+        }
+    }
+
+    if (stream_fp && std::fclose(stream_fp) != 0) {
+        std::fprintf(stderr, "failed to write %s\n", opt.stream_path);
+        return 1;
+    }
+
+    if (opt.dump_path && !host::dumpDisplayPpm(opt.dump_path)) {
+        std::fprintf(stderr, "failed to write %s\n", opt.dump_path);
+        return 1;
+    }
+
+    if (!session_ok) {
+        return 1;
+    }
+    if (opt.max_allocs >= 0 && allocations_max > (uint64_t)opt.max_allocs) {
+        std::printf("FAIL: %llu allocations in one frame exceeds %d\n",
+                    (unsigned long long)allocations_max, opt.max_allocs);
+        return 1;
+    }
+    double avg_ms = stages[11].sum / 1000.0 / opt.frames;
+    if (opt.max_ms > 0.0f && avg_ms > opt.max_ms) {
+        std::printf("FAIL: average frame time %.3f ms exceeds %.3f ms\n", avg_ms, opt.max_ms);
+        return 1;
+    }
+    return 0;
+}
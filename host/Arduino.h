@@ -0,0 +1,49 @@
+#pragma once
+
+// ネイティブ（Linux）ビルド用の最小限の Arduino 互換レイヤー
+// 実機では Arduino-ESP32 コアが提供する API のうち、スケッチが使うものだけを用意する
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+// スケッチ側で定義する
+void setup();
+void loop();
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// PSRAM から確保する（ホストでは通常のヒープ）
+void* ps_malloc(size_t size);
+
+// ESP クラスの代替（PSRAM 残量はスプライト確保量から算出する）
+class EspClass {
+public:
+    uint32_t getFreeHeap() const;
+    uint32_t getFreePsram() const;
+    uint32_t getPsramSize() const;
+};
+
+extern EspClass ESP;
+
+// シリアルの代替（入力は無く、出力は標準出力に書く）
+class HardwareSerial {
+public:
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t write(const uint8_t* data, size_t size);
+};
+
+extern HardwareSerial Serial;
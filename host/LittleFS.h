@@ -0,0 +1,46 @@
+#pragma once
+
+// ネイティブビルド用の LittleFS 互換レイヤー
+// パス "/images/..." を host::dataRoot() 配下のファイルとして開く
+
+#include "Arduino.h"
+#include <cstdio>
+#include <memory>
+
+namespace fs {
+
+class File {
+public:
+    File() {}
+    explicit File(std::FILE* fp);
+
+    explicit operator bool() const { return (bool)_fp; }
+
+    size_t size() const { return _size; }
+    size_t position() const;
+    int available() const { return (int)(_size - position()); }
+    bool seek(uint32_t pos);
+    int read();
+    size_t read(uint8_t* buf, size_t size);
+    size_t readBytes(char* buf, size_t length) { return read((uint8_t*)buf, length); }
+    size_t write(const uint8_t* buf, size_t size);
+    void close() { _fp.reset(); }
+
+private:
+    std::shared_ptr<std::FILE> _fp;
+    size_t _size = 0;
+};
+
+class LittleFSFS {
+public:
+    bool begin(bool formatOnFail = false, const char* basePath = "/littlefs",
+               uint8_t maxOpenFiles = 10, const char* partitionLabel = "spiffs");
+    File open(const char* path, const char* mode = "r");
+    bool exists(const char* path);
+};
+
+}  // namespace fs
+
+using fs::File;
+
+extern fs::LittleFSFS LittleFS;
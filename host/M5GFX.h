@@ -0,0 +1,182 @@
+#pragma once
+
+// ネイティブビルド用の M5GFX 互換レイヤー
+// LovyanGFX / LGFX_Device / LGFX_Sprite(M5Canvas) のうちスケッチが使う API だけを
+// メモリ上の RGB565 フレームバッファで実装する。
+// ピクセルは実機の 16bit スプライトと同じくバイトスワップ済み RGB565 で保持するので、
+// getBuffer() を直接読み書きするコードも実機と同じ結果になる。
+
+#include "Arduino.h"
+
+#define TFT_BLACK       0x0000
+#define TFT_WHITE       0xFFFF
+#define TFT_RED         0xF800
+#define TFT_GREEN       0x07E0
+#define TFT_BLUE        0x001F
+#define TFT_TRANSPARENT 0x0120
+
+namespace lgfx {
+
+enum color_depth_t : uint8_t {
+    rgb332_1Byte = 8,
+    rgb565_2Byte = 16,
+};
+
+// バイトスワップ済み RGB565（実機のスプライトメモリ上の表現）
+struct swap565_t {
+    uint16_t raw;
+};
+
+static inline uint16_t swap16(uint16_t v) {
+    return (uint16_t)((v << 8) | (v >> 8));
+}
+
+static inline constexpr uint16_t color565(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+// 色指定をスワップ済み RGB565 に変換する
+// LovyanGFX と同じく int/uint16_t は RGB565、uint32_t は RGB888 として扱う
+static inline uint16_t toSwap565(int c) { return swap16((uint16_t)c); }
+static inline uint16_t toSwap565(uint16_t c) { return swap16(c); }
+static inline uint16_t toSwap565(uint32_t c) {
+    return swap16(color565((uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c));
+}
+static inline uint16_t toSwap565(swap565_t c) { return c.raw; }
+
+}  // namespace lgfx
+
+class LovyanGFX {
+public:
+    virtual ~LovyanGFX() {}
+
+    int32_t width() const { return _width; }
+    int32_t height() const { return _height; }
+    uint8_t getColorDepth() const { return _buffer ? 16 : 0; }
+
+    uint16_t color565(uint8_t r, uint8_t g, uint8_t b) const { return lgfx::color565(r, g, b); }
+
+    template <typename T>
+    void fillScreen(const T& color) { fillRect(0, 0, _width, _height, color); }
+
+    template <typename T>
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, const T& color) {
+        fillRectRaw(x, y, w, h, lgfx::toSwap565(color));
+    }
+
+    template <typename T>
+    void drawPixel(int32_t x, int32_t y, const T& color) { fillRect(x, y, 1, 1, color); }
+
+    // RGB565（ネイティブバイト順）で返す
+    uint16_t readPixel(int32_t x, int32_t y) const;
+
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const lgfx::swap565_t* data);
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data);
+
+    bool drawPng(const uint8_t* data, uint32_t len, int32_t x = 0, int32_t y = 0);
+
+    void startWrite() {}
+    void endWrite() {}
+    void waitDMA() {}
+
+    // 以下はホスト実装用
+    uint16_t* rawBuffer() { return _buffer; }
+    const uint16_t* rawBuffer() const { return _buffer; }
+    void fillRectRaw(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t raw);
+    // 指定範囲へスワップ済みピクセル列を書き込む（stride はピクセル数）
+    void writeRaw(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* src, int32_t stride);
+
+protected:
+    // 転送完了時に呼ばれる（パネルの転送量計測用）
+    virtual void onWrite(int32_t w, int32_t h) { (void)w; (void)h; }
+
+    uint16_t* _buffer = nullptr;
+    int32_t _width = 0;
+    int32_t _height = 0;
+};
+
+class LGFX_Device : public LovyanGFX {
+public:
+    LGFX_Device(int32_t panel_width, int32_t panel_height);
+    ~LGFX_Device() override;
+
+    bool init();
+    void setRotation(uint8_t r);
+    uint8_t getRotation() const { return _rotation; }
+
+    template <typename T>
+    void pushImageDMA(int32_t x, int32_t y, int32_t w, int32_t h, const T* data) {
+        pushImage(x, y, w, h, data);
+    }
+
+protected:
+    void onWrite(int32_t w, int32_t h) override;
+
+private:
+    void allocate();
+
+    int32_t _panel_width;
+    int32_t _panel_height;
+    uint8_t _rotation = 0;
+};
+
+class M5GFX : public LGFX_Device {
+public:
+    M5GFX() : LGFX_Device(720, 1280) {}  // Tab5 のパネル（縦置き）
+};
+
+class LGFX_Sprite : public LovyanGFX {
+public:
+    LGFX_Sprite() {}
+    explicit LGFX_Sprite(LovyanGFX* parent) { (void)parent; }
+    ~LGFX_Sprite() override { deleteSprite(); }
+
+    LGFX_Sprite(const LGFX_Sprite&) = delete;
+    LGFX_Sprite& operator=(const LGFX_Sprite&) = delete;
+
+    void setPsram(bool enabled) { _psram = enabled; }
+    void setColorDepth(int bits) { _depth = bits; }
+
+    void* createSprite(int32_t w, int32_t h);
+    void deleteSprite();
+    // 外部バッファを割り当てる（deleteSprite() では解放しない）
+    void setBuffer(void* buffer, int32_t w, int32_t h, lgfx::color_depth_t bpp = lgfx::rgb565_2Byte);
+    void* getBuffer() const { return _buffer; }
+
+    template <typename T>
+    void fillSprite(const T& color) { fillScreen(color); }
+
+    void pushSprite(LovyanGFX* dst, int32_t x, int32_t y) const;
+
+    template <typename T>
+    void pushSprite(LovyanGFX* dst, int32_t x, int32_t y, const T& transp) const {
+        pushSpriteKeyed(dst, x, y, lgfx::toSwap565(transp));
+    }
+
+    template <typename T>
+    void pushRotateZoom(LovyanGFX* dst, float dst_x, float dst_y, float angle,
+                        float zoom_x, float zoom_y, const T& transp) const {
+        rotateZoom(dst, dst_x, dst_y, angle, zoom_x, zoom_y, lgfx::toSwap565(transp), false);
+    }
+
+    template <typename T>
+    void pushRotateZoomWithAA(LovyanGFX* dst, float dst_x, float dst_y, float angle,
+                              float zoom_x, float zoom_y, const T& transp) const {
+        rotateZoom(dst, dst_x, dst_y, angle, zoom_x, zoom_y, lgfx::toSwap565(transp), true);
+    }
+
+private:
+    void pushSpriteKeyed(LovyanGFX* dst, int32_t x, int32_t y, uint16_t transp) const;
+    void rotateZoom(LovyanGFX* dst, float dst_x, float dst_y, float angle,
+                    float zoom_x, float zoom_y, uint16_t transp, bool antialias) const;
+
+    bool _psram = false;
+    bool _owned = false;
+    int _depth = 16;
+};
+
+class M5Canvas : public LGFX_Sprite {
+public:
+    M5Canvas() {}
+    explicit M5Canvas(LovyanGFX* parent) : LGFX_Sprite(parent) {}
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+// ネイティブビルド用の M5Unified 互換レイヤー
+
+#include "Arduino.h"
+#include "M5GFX.h"
+#include "host.h"
+
+#define M5_LOGE(format, ...) host::log(1, "E", format, ##__VA_ARGS__)
+#define M5_LOGW(format, ...) host::log(2, "W", format, ##__VA_ARGS__)
+#define M5_LOGI(format, ...) host::log(3, "I", format, ##__VA_ARGS__)
+#define M5_LOGD(format, ...) host::log(4, "D", format, ##__VA_ARGS__)
+#define M5_LOGV(format, ...) host::log(5, "V", format, ##__VA_ARGS__)
+
+namespace m5 {
+
+struct touch_detail_t {
+    int16_t x = 0;
+    int16_t y = 0;
+    int16_t prev_x = 0;
+    int16_t prev_y = 0;
+    uint32_t base_msec = 0;
+    bool pressed = false;
+    bool prev_pressed = false;
+
+    bool isPressed() const { return pressed; }
+    bool wasPressed() const { return pressed && !prev_pressed; }
+    bool wasReleased() const { return !pressed && prev_pressed; }
+    bool isReleased() const { return !pressed; }
+};
+
+class Touch_Class {
+public:
+    uint8_t getCount() const { return (_detail.pressed || _detail.prev_pressed) ? 1 : 0; }
+    const touch_detail_t& getDetail(size_t index = 0) const { (void)index; return _detail; }
+
+    // M5.update() から呼ばれる
+    void update(uint32_t msec);
+
+private:
+    touch_detail_t _detail;
+};
+
+struct config_t {
+    bool serial = true;
+    bool clear_display = true;
+};
+
+class M5Unified {
+public:
+    M5GFX Display;
+    Touch_Class Touch;
+
+    config_t config() const { return config_t(); }
+    void begin(const config_t& cfg) { (void)cfg; }
+    void update();
+};
+
+}  // namespace m5
+
+extern m5::M5Unified M5;
@@ -0,0 +1,27 @@
+#pragma once
+
+// ネイティブビルド用の FreeRTOS 互換レイヤー（このスケッチで使う範囲のみ）
+// タスクは std::thread、キュー・セマフォは mutex + condition_variable で実装する。
+// tick は 1ms 固定で、待ち時間は実時間（仮想クロックとは無関係）。
+
+#include <cstddef>
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define errQUEUE_FULL 0
+#define errQUEUE_EMPTY 0
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#define configMAX_PRIORITIES 25
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7FFFFFFF
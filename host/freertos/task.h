@@ -0,0 +1,24 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+struct HostTask;
+typedef HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+// core_id と優先度は記録するだけ（スケジューリングは OS に任せる）
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_depth,
+                                   void* parameter, UBaseType_t priority, TaskHandle_t* created,
+                                   BaseType_t core_id);
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth,
+                       void* parameter, UBaseType_t priority, TaskHandle_t* created);
+// 自タスク（nullptr）の削除のみ対応
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+// タスク以外のスレッド（loop() を回すメインスレッドなど）にもハンドルを割り当てる
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+// 直接通知（カウンティングセマフォとしての使い方のみ）
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
@@ -0,0 +1,53 @@
+#pragma once
+
+// ネイティブビルド専用の制御 API（ベンチマークなどホスト側ツールから使う）
+
+#include <cstdint>
+#include <cstddef>
+
+namespace host {
+
+// シミュレーション時間（millis）を仮想クロックにする
+// 有効な間は millis() は advanceMillis() でしか進まない。micros() は常に実時間
+void useVirtualClock(bool enable);
+void advanceMillis(uint32_t ms);
+
+// LittleFS のルートに対応するホスト側ディレクトリ（既定: "data"）
+void setDataRoot(const char* path);
+const char* dataRoot();
+
+// ログ出力レベル（0=なし, 1=E, 2=W, 3=I, 4=D, 5=V）
+void setLogLevel(int level);
+int logLevel();
+void log(int level, const char* tag, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// タッチ入力を注入する（次の M5.update() か、タッチの読み取りタスクの次の読み取りで反映）
+void setTouch(bool pressed, int x, int y);
+
+// パネル（M5.Display）への転送量の累計
+struct PanelCounters {
+    uint64_t push_calls;
+    uint64_t pixels_pushed;
+    uint64_t bytes_pushed;
+};
+PanelCounters panelCounters();
+void resetPanelCounters();
+void countPanelWrite(int32_t w, int32_t h);  // シム内部用
+// パネルの転送速度を模擬する（バイト/秒、0 で待たない）
+// 設定すると転送量に応じた実時間だけ書き込みが戻らない（転送タスクの効果を測るため）
+void setPanelBandwidth(uint32_t bytes_per_sec);
+
+// スプライトとして確保したメモリ量（ESP.getFreePsram() の算出に使う）
+void trackPsram(ptrdiff_t bytes);
+size_t psramUsed();
+
+// 呼び出し元スレッドでのメモリ確保の累計回数
+// operator new / ps_malloc / スプライトのバッファ確保を数える（malloc の直接呼び出しは数えない）
+uint64_t allocationCount();
+void countAllocation();  // シム内部用
+
+// 画面を PPM 形式で書き出す
+bool dumpDisplayPpm(const char* path);
+
+}  // namespace host
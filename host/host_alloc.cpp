@@ -0,0 +1,55 @@
+// ネイティブビルド用のメモリ確保回数の計測
+// operator new を置き換え、スレッドごとに確保回数を数える
+// （ローダータスクなど別スレッドの確保は loop() の計測に混ざらない）
+
+#include "host.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local uint64_t allocation_count = 0;
+
+}  // namespace
+
+namespace host {
+
+uint64_t allocationCount() {
+    return allocation_count;
+}
+
+void countAllocation() {
+    allocation_count++;
+}
+
+}  // namespace host
+
+void* operator new(std::size_t size) {
+    host::countAllocation();
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
@@ -0,0 +1,230 @@
+// ネイティブビルド用 Arduino / M5Unified 互換レイヤーの実装
+
+#include "M5Unified.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+EspClass ESP;
+HardwareSerial Serial;
+m5::M5Unified M5;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+const Clock::time_point start_time = Clock::now();
+
+bool virtual_clock = false;
+std::atomic<uint32_t> virtual_millis(0);  // ローダータスクからも読む
+
+std::mt19937 rng(1);  // ベンチマークの再現性のため固定シードで開始
+
+int log_level = 3;
+const char* data_root = "data";
+
+// タッチの読み取りタスクからも読む
+std::atomic<bool> touch_pressed(false);
+std::atomic<int> touch_x(0);
+std::atomic<int> touch_y(0);
+
+// 転送タスクから更新し、メインスレッドから読む
+std::atomic<uint64_t> panel_push_calls(0);
+std::atomic<uint64_t> panel_pixels_pushed(0);
+uint32_t panel_bytes_per_sec = 0;
+std::atomic<size_t> psram_used(0);  // ローダータスクからも確保される
+
+const uint32_t PSRAM_SIZE = 32 * 1024 * 1024;  // Tab5 の PSRAM 容量
+const uint32_t FREE_HEAP = 384 * 1024;
+
+}  // namespace
+
+uint32_t millis() {
+    if (virtual_clock) {
+        return virtual_millis;
+    }
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        Clock::now() - start_time).count();
+}
+
+uint32_t micros() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - start_time).count();
+}
+
+void delay(uint32_t ms) {
+    if (virtual_clock) {
+        virtual_millis += ms;
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+long random(long howbig) {
+    if (howbig <= 0) {
+        return 0;
+    }
+    return (long)(rng() % (uint32_t)howbig);
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) {
+        return howsmall;
+    }
+    return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+    if (seed != 0) {
+        rng.seed((uint32_t)seed);
+    }
+}
+
+void* ps_malloc(size_t size) {
+    host::countAllocation();
+    return std::malloc(size);
+}
+
+uint32_t EspClass::getFreeHeap() const {
+    return FREE_HEAP;
+}
+
+uint32_t EspClass::getFreePsram() const {
+    return psram_used >= PSRAM_SIZE ? 0 : (uint32_t)(PSRAM_SIZE - psram_used);
+}
+
+uint32_t EspClass::getPsramSize() const {
+    return PSRAM_SIZE;
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t size) {
+    return fwrite(data, 1, size, stdout);
+}
+
+namespace m5 {
+
+void Touch_Class::update(uint32_t msec) {
+    _detail.prev_pressed = _detail.pressed;
+    _detail.prev_x = _detail.x;
+    _detail.prev_y = _detail.y;
+    _detail.pressed = touch_pressed;
+    if (_detail.pressed) {
+        _detail.x = (int16_t)touch_x;
+        _detail.y = (int16_t)touch_y;
+        if (!_detail.prev_pressed) {
+            _detail.base_msec = msec;
+        }
+    }
+}
+
+void M5Unified::update() {
+    Touch.update(millis());
+}
+
+}  // namespace m5
+
+namespace host {
+
+void useVirtualClock(bool enable) {
+    if (enable && !virtual_clock) {
+        virtual_millis = millis();
+    }
+    virtual_clock = enable;
+}
+
+void advanceMillis(uint32_t ms) {
+    virtual_millis += ms;
+}
+
+void setDataRoot(const char* path) {
+    data_root = path;
+}
+
+const char* dataRoot() {
+    return data_root;
+}
+
+void setLogLevel(int level) {
+    log_level = level;
+}
+
+int logLevel() {
+    return log_level;
+}
+
+void log(int level, const char* tag, const char* format, ...) {
+    if (level > log_level) {
+        return;
+    }
+    std::fprintf(stderr, "[%6u][%s] ", millis(), tag);
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(stderr, format, args);
+    va_end(args);
+    std::fputc('\n', stderr);
+}
+
+void setTouch(bool pressed, int x, int y) {
+    // 座標を先に書く（押した状態を読んだ側が古い座標を使わないよう）
+    touch_x = x;
+    touch_y = y;
+    touch_pressed = pressed;
+}
+
+PanelCounters panelCounters() {
+    uint64_t pixels = panel_pixels_pushed;
+    return {panel_push_calls, pixels, pixels * 2};
+}
+
+void resetPanelCounters() {
+    panel_push_calls = 0;
+    panel_pixels_pushed = 0;
+}
+
+void countPanelWrite(int32_t w, int32_t h) {
+    panel_push_calls++;
+    panel_pixels_pushed += (uint64_t)w * h;
+    if (panel_bytes_per_sec > 0) {
+        uint64_t us = (uint64_t)w * h * 2 * 1000000 / panel_bytes_per_sec;
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+}
+
+void setPanelBandwidth(uint32_t bytes_per_sec) {
+    panel_bytes_per_sec = bytes_per_sec;
+}
+
+void trackPsram(ptrdiff_t bytes) {
+    psram_used += bytes;
+}
+
+size_t psramUsed() {
+    return psram_used;
+}
+
+bool dumpDisplayPpm(const char* path) {
+    std::FILE* fp = std::fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    const LovyanGFX& gfx = M5.Display;
+    std::fprintf(fp, "P6\n%d %d\n255\n", (int)gfx.width(), (int)gfx.height());
+    for (int32_t y = 0; y < gfx.height(); y++) {
+        for (int32_t x = 0; x < gfx.width(); x++) {
+            uint16_t c = gfx.readPixel(x, y);
+            uint8_t rgb[3] = {
+                (uint8_t)(((c >> 11) & 0x1F) * 255 / 31),
+                (uint8_t)(((c >> 5) & 0x3F) * 255 / 63),
+                (uint8_t)((c & 0x1F) * 255 / 31),
+            };
+            std::fwrite(rgb, 1, 3, fp);
+        }
+    }
+    std::fclose(fp);
+    return true;
+}
+
+}  // namespace host
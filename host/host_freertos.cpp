@@ -0,0 +1,228 @@
+// ネイティブビルド用 FreeRTOS 互換レイヤーの実装
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+
+struct HostTask {
+    std::string name;
+    TaskFunction_t function;
+    void* parameter;
+    UBaseType_t priority;
+    BaseType_t core_id;
+    // 直接通知
+    std::mutex notify_mutex;
+    std::condition_variable notified;
+    uint32_t notify_value = 0;
+};
+
+// 実機と同じく作成時に領域を確保するリングバッファ（送受信ではメモリを確保しない）
+struct HostQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<uint8_t> storage;
+    size_t length;
+    size_t item_size;
+    size_t head = 0;   // 次に受信する位置
+    size_t count = 0;  // 入っている数
+};
+
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable changed;
+    UBaseType_t count;
+    UBaseType_t max_count;
+};
+
+namespace {
+
+// vTaskDelete(nullptr) でタスク関数を抜けるための例外
+struct TaskDeleted {};
+
+thread_local HostTask* current_task = nullptr;
+
+// ticks_to_wait の間 ready() が真になるのを待つ（lock は取得済み）
+template <class Predicate>
+bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock,
+             TickType_t ticks_to_wait, Predicate ready) {
+    if (ticks_to_wait == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks_to_wait), ready);
+}
+
+}  // namespace
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_depth,
+                                   void* parameter, UBaseType_t priority, TaskHandle_t* created,
+                                   BaseType_t core_id) {
+    (void)stack_depth;
+    // タスクは終了しても解放しない（実機でもこのスケッチのタスクは常駐する）
+    HostTask* task = new HostTask();
+    task->name = name ? name : "";
+    task->function = function;
+    task->parameter = parameter;
+    task->priority = priority;
+    task->core_id = core_id;
+    std::thread([task]() {
+        current_task = task;
+        try {
+            task->function(task->parameter);
+        } catch (const TaskDeleted&) {
+        }
+    }).detach();
+    if (created) {
+        *created = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth,
+                       void* parameter, UBaseType_t priority, TaskHandle_t* created) {
+    return xTaskCreatePinnedToCore(function, name, stack_depth, parameter, priority, created,
+                                   tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == nullptr || task == current_task) {
+        throw TaskDeleted();
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)millis();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (!current_task) {
+        // タスクとして作成していないスレッドは初回にハンドルを割り当てる（解放しない）
+        current_task = new HostTask();
+        current_task->name = "loopTask";
+    }
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> lock(task->notify_mutex);
+    task->notify_value++;
+    task->notified.notify_all();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    HostTask* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->notify_mutex);
+    if (!waitFor(task->notified, lock, ticks_to_wait,
+                 [task]() { return task->notify_value > 0; })) {
+        return 0;
+    }
+    uint32_t value = task->notify_value;
+    task->notify_value = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    HostQueue* queue = new HostQueue();
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->storage.resize((size_t)length * item_size);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticks_to_wait,
+                 [queue]() { return queue->count < queue->length; })) {
+        return errQUEUE_FULL;
+    }
+    size_t tail = (queue->head + queue->count) % queue->length;
+    std::memcpy(&queue->storage[tail * queue->item_size], item, queue->item_size);
+    queue->count++;
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!waitFor(queue->changed, lock, ticks_to_wait,
+                 [queue]() { return queue->count > 0; })) {
+        return errQUEUE_EMPTY;
+    }
+    std::memcpy(buffer, &queue->storage[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return (UBaseType_t)queue->count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->head = 0;
+    queue->count = 0;
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+    HostSemaphore* semaphore = new HostSemaphore();
+    semaphore->count = initial_count;
+    semaphore->max_count = max_count;
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!waitFor(semaphore->changed, lock, ticks_to_wait,
+                 [semaphore]() { return semaphore->count > 0; })) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count >= semaphore->max_count) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    semaphore->changed.notify_one();
+    return pdTRUE;
+}
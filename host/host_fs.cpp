@@ -0,0 +1,78 @@
+// ネイティブビルド用 LittleFS 互換レイヤーの実装
+
+#include "LittleFS.h"
+#include "host.h"
+
+#include <string>
+
+fs::LittleFSFS LittleFS;
+
+namespace {
+
+std::string hostPath(const char* path) {
+    std::string full = host::dataRoot();
+    if (path[0] != '/') {
+        full += '/';
+    }
+    return full + path;
+}
+
+}  // namespace
+
+namespace fs {
+
+File::File(std::FILE* fp) : _fp(fp, std::fclose) {
+    std::fseek(fp, 0, SEEK_END);
+    _size = (size_t)std::ftell(fp);
+    std::fseek(fp, 0, SEEK_SET);
+}
+
+size_t File::position() const {
+    return _fp ? (size_t)std::ftell(_fp.get()) : 0;
+}
+
+bool File::seek(uint32_t pos) {
+    return _fp && std::fseek(_fp.get(), pos, SEEK_SET) == 0;
+}
+
+int File::read() {
+    return _fp ? std::fgetc(_fp.get()) : -1;
+}
+
+size_t File::read(uint8_t* buf, size_t size) {
+    return _fp ? std::fread(buf, 1, size, _fp.get()) : 0;
+}
+
+size_t File::write(const uint8_t* buf, size_t size) {
+    return _fp ? std::fwrite(buf, 1, size, _fp.get()) : 0;
+}
+
+bool LittleFSFS::begin(bool formatOnFail, const char* basePath, uint8_t maxOpenFiles,
+                       const char* partitionLabel) {
+    (void)formatOnFail;
+    (void)basePath;
+    (void)maxOpenFiles;
+    (void)partitionLabel;
+    std::FILE* fp = std::fopen(host::dataRoot(), "r");
+    if (!fp) {
+        return false;
+    }
+    std::fclose(fp);
+    return true;
+}
+
+File LittleFSFS::open(const char* path, const char* mode) {
+    std::FILE* fp = std::fopen(hostPath(path).c_str(), mode[0] == 'w' ? "wb" : "rb");
+    return fp ? File(fp) : File();
+}
+
+bool LittleFSFS::exists(const char* path) {
+    std::FILE* fp = std::fopen(hostPath(path).c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    std::fclose(fp);
+    return true;
+}
+
+}  // namespace fs
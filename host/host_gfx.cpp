@@ -0,0 +1,302 @@
+// ネイティブビルド用 M5GFX 互換レイヤーの実装
+
+#include "M5GFX.h"
+#include "host.h"
+
+#include <png.h>
+#include <vector>
+
+namespace {
+
+inline void unpack565(uint16_t raw, int& r, int& g, int& b) {
+    uint16_t c = lgfx::swap16(raw);
+    r = ((c >> 11) & 0x1F) * 255 / 31;
+    g = ((c >> 5) & 0x3F) * 255 / 63;
+    b = (c & 0x1F) * 255 / 31;
+}
+
+inline uint16_t pack565(int r, int g, int b) {
+    return lgfx::swap16(lgfx::color565((uint8_t)r, (uint8_t)g, (uint8_t)b));
+}
+
+// 描画先の範囲にクリップする。描画不要なら false
+bool clipRect(int32_t dst_w, int32_t dst_h, int32_t& x, int32_t& y, int32_t& w, int32_t& h,
+              int32_t& src_x, int32_t& src_y) {
+    src_x = 0;
+    src_y = 0;
+    if (x < 0) { src_x = -x; w += x; x = 0; }
+    if (y < 0) { src_y = -y; h += y; y = 0; }
+    if (x + w > dst_w) w = dst_w - x;
+    if (y + h > dst_h) h = dst_h - y;
+    return w > 0 && h > 0;
+}
+
+}  // namespace
+
+uint16_t LovyanGFX::readPixel(int32_t x, int32_t y) const {
+    if (!_buffer || x < 0 || y < 0 || x >= _width || y >= _height) {
+        return 0;
+    }
+    return lgfx::swap16(_buffer[y * _width + x]);
+}
+
+void LovyanGFX::fillRectRaw(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t raw) {
+    int32_t sx, sy;
+    if (!_buffer || !clipRect(_width, _height, x, y, w, h, sx, sy)) {
+        return;
+    }
+    for (int32_t j = 0; j < h; j++) {
+        uint16_t* row = _buffer + (y + j) * _width + x;
+        std::fill(row, row + w, raw);
+    }
+    onWrite(w, h);
+}
+
+void LovyanGFX::writeRaw(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* src,
+                         int32_t stride) {
+    int32_t sx, sy;
+    if (!_buffer || !clipRect(_width, _height, x, y, w, h, sx, sy)) {
+        return;
+    }
+    for (int32_t j = 0; j < h; j++) {
+        std::memcpy(_buffer + (y + j) * _width + x, src + (sy + j) * stride + sx, w * 2);
+    }
+    onWrite(w, h);
+}
+
+void LovyanGFX::pushImage(int32_t x, int32_t y, int32_t w, int32_t h,
+                          const lgfx::swap565_t* data) {
+    writeRaw(x, y, w, h, (const uint16_t*)data, w);
+}
+
+void LovyanGFX::pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data) {
+    std::vector<uint16_t> swapped(data, data + (size_t)w * h);
+    for (auto& c : swapped) {
+        c = lgfx::swap16(c);
+    }
+    writeRaw(x, y, w, h, swapped.data(), w);
+}
+
+bool LovyanGFX::drawPng(const uint8_t* data, uint32_t len, int32_t x, int32_t y) {
+    if (!_buffer) {
+        return false;
+    }
+    png_image image;
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, data, len)) {
+        return false;
+    }
+    image.format = PNG_FORMAT_RGBA;
+    std::vector<uint8_t> rgba(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, nullptr, rgba.data(), 0, nullptr)) {
+        png_image_free(&image);
+        return false;
+    }
+    // 実機と同様に、半透明ピクセルは描画先の既存ピクセルと合成する
+    for (int32_t j = 0; j < (int32_t)image.height; j++) {
+        int32_t dy = y + j;
+        if (dy < 0 || dy >= _height) continue;
+        const uint8_t* src = rgba.data() + (size_t)j * image.width * 4;
+        for (int32_t i = 0; i < (int32_t)image.width; i++, src += 4) {
+            int32_t dx = x + i;
+            uint8_t a = src[3];
+            if (dx < 0 || dx >= _width || a == 0) continue;
+            uint16_t& dst = _buffer[dy * _width + dx];
+            if (a == 255) {
+                dst = pack565(src[0], src[1], src[2]);
+            } else {
+                int r, g, b;
+                unpack565(dst, r, g, b);
+                dst = pack565((src[0] * a + r * (255 - a)) / 255,
+                              (src[1] * a + g * (255 - a)) / 255,
+                              (src[2] * a + b * (255 - a)) / 255);
+            }
+        }
+    }
+    return true;
+}
+
+LGFX_Device::LGFX_Device(int32_t panel_width, int32_t panel_height)
+    : _panel_width(panel_width), _panel_height(panel_height) {}
+
+LGFX_Device::~LGFX_Device() {
+    delete[] _buffer;
+}
+
+bool LGFX_Device::init() {
+    allocate();
+    return true;
+}
+
+void LGFX_Device::setRotation(uint8_t r) {
+    _rotation = r & 3;
+    allocate();
+}
+
+void LGFX_Device::allocate() {
+    int32_t w = (_rotation & 1) ? _panel_height : _panel_width;
+    int32_t h = (_rotation & 1) ? _panel_width : _panel_height;
+    if (_buffer && w == _width && h == _height) {
+        return;
+    }
+    delete[] _buffer;
+    _width = w;
+    _height = h;
+    _buffer = new uint16_t[(size_t)w * h]();
+}
+
+void LGFX_Device::onWrite(int32_t w, int32_t h) {
+    host::countPanelWrite(w, h);
+}
+
+void* LGFX_Sprite::createSprite(int32_t w, int32_t h) {
+    deleteSprite();
+    if (w <= 0 || h <= 0 || _depth != 16) {
+        return nullptr;
+    }
+    host::countAllocation();
+    _buffer = (uint16_t*)std::calloc((size_t)w * h, 2);
+    if (!_buffer) {
+        return nullptr;
+    }
+    _owned = true;
+    _width = w;
+    _height = h;
+    if (_psram) {
+        host::trackPsram((ptrdiff_t)w * h * 2);
+    }
+    return _buffer;
+}
+
+void LGFX_Sprite::deleteSprite() {
+    if (_owned && _buffer) {
+        std::free(_buffer);
+        if (_psram) {
+            host::trackPsram(-(ptrdiff_t)_width * _height * 2);
+        }
+    }
+    _buffer = nullptr;
+    _owned = false;
+    _width = 0;
+    _height = 0;
+}
+
+void LGFX_Sprite::setBuffer(void* buffer, int32_t w, int32_t h, lgfx::color_depth_t bpp) {
+    deleteSprite();
+    if (bpp != lgfx::rgb565_2Byte) {
+        return;
+    }
+    _buffer = (uint16_t*)buffer;
+    _width = w;
+    _height = h;
+}
+
+void LGFX_Sprite::pushSprite(LovyanGFX* dst, int32_t x, int32_t y) const {
+    if (_buffer) {
+        dst->writeRaw(x, y, _width, _height, _buffer, _width);
+    }
+}
+
+void LGFX_Sprite::pushSpriteKeyed(LovyanGFX* dst, int32_t x, int32_t y, uint16_t transp) const {
+    int32_t w = _width;
+    int32_t h = _height;
+    int32_t sx, sy;
+    uint16_t* out = dst->rawBuffer();
+    if (!_buffer || !out || !clipRect(dst->width(), dst->height(), x, y, w, h, sx, sy)) {
+        return;
+    }
+    for (int32_t j = 0; j < h; j++) {
+        const uint16_t* src = _buffer + (sy + j) * _width + sx;
+        uint16_t* row = out + (y + j) * dst->width() + x;
+        for (int32_t i = 0; i < w; i++) {
+            if (src[i] != transp) {
+                row[i] = src[i];
+            }
+        }
+    }
+}
+
+// 逆変換で描画先の各ピクセルから元画像をサンプリングする
+// antialias ならバイリニア補間し、透過色のピクセルはアルファ 0 として扱って縁を描画先と合成する
+// そうでなければ最近傍のピクセルを透過色以外だけ書き込む
+void LGFX_Sprite::rotateZoom(LovyanGFX* dst, float dst_x, float dst_y, float angle,
+                             float zoom_x, float zoom_y, uint16_t transp, bool antialias) const {
+    uint16_t* out = dst->rawBuffer();
+    if (!_buffer || !out || zoom_x == 0.0f || zoom_y == 0.0f) {
+        return;
+    }
+    float rad = angle * (float)M_PI / 180.0f;
+    float cs = cosf(rad);
+    float sn = sinf(rad);
+    float pivot_x = _width / 2.0f;
+    float pivot_y = _height / 2.0f;
+
+    // 変換後の外接矩形
+    float min_fx = 1e9f, min_fy = 1e9f, max_fx = -1e9f, max_fy = -1e9f;
+    const float corners[4][2] = {
+        {-pivot_x, -pivot_y}, {_width - pivot_x, -pivot_y},
+        {-pivot_x, _height - pivot_y}, {_width - pivot_x, _height - pivot_y}};
+    for (const auto& c : corners) {
+        float px = c[0] * zoom_x * cs - c[1] * zoom_y * sn + dst_x;
+        float py = c[0] * zoom_x * sn + c[1] * zoom_y * cs + dst_y;
+        min_fx = std::min(min_fx, px);
+        max_fx = std::max(max_fx, px);
+        min_fy = std::min(min_fy, py);
+        max_fy = std::max(max_fy, py);
+    }
+    int32_t x0 = std::max<int32_t>(0, (int32_t)floorf(min_fx));
+    int32_t y0 = std::max<int32_t>(0, (int32_t)floorf(min_fy));
+    int32_t x1 = std::min<int32_t>(dst->width(), (int32_t)ceilf(max_fx));
+    int32_t y1 = std::min<int32_t>(dst->height(), (int32_t)ceilf(max_fy));
+
+    float inv_zx = 1.0f / zoom_x;
+    float inv_zy = 1.0f / zoom_y;
+    for (int32_t py = y0; py < y1; py++) {
+        uint16_t* row = out + py * dst->width();
+        float dy = py + 0.5f - dst_y;
+        for (int32_t px = x0; px < x1; px++) {
+            float dx = px + 0.5f - dst_x;
+            float u = (dx * cs + dy * sn) * inv_zx + pivot_x - 0.5f;
+            float v = (-dx * sn + dy * cs) * inv_zy + pivot_y - 0.5f;
+            if (u <= -1.0f || v <= -1.0f || u >= _width || v >= _height) continue;
+            if (!antialias) {
+                int32_t nu = (int32_t)floorf(u + 0.5f);
+                int32_t nv = (int32_t)floorf(v + 0.5f);
+                if (nu >= 0 && nv >= 0 && nu < _width && nv < _height && _buffer[nv * _width + nu] != transp) {
+                    row[px] = _buffer[nv * _width + nu];
+                }
+                continue;
+            }
+            int32_t iu = (int32_t)floorf(u);
+            int32_t iv = (int32_t)floorf(v);
+            float fu = u - iu;
+            float fv = v - iv;
+            float acc_r = 0, acc_g = 0, acc_b = 0, acc_a = 0;
+            for (int k = 0; k < 4; k++) {
+                int32_t su = iu + (k & 1);
+                int32_t sv = iv + (k >> 1);
+                if (su < 0 || sv < 0 || su >= _width || sv >= _height) continue;
+                uint16_t c = _buffer[sv * _width + su];
+                if (c == transp) continue;
+                float w = ((k & 1) ? fu : 1.0f - fu) * ((k >> 1) ? fv : 1.0f - fv);
+                int r, g, b;
+                unpack565(c, r, g, b);
+                acc_r += r * w;
+                acc_g += g * w;
+                acc_b += b * w;
+                acc_a += w;
+            }
+            if (acc_a <= 0.0f) continue;
+            if (acc_a >= 0.999f) {
+                row[px] = pack565((int)acc_r, (int)acc_g, (int)acc_b);
+            } else {
+                int r, g, b;
+                unpack565(row[px], r, g, b);
+                float inv_a = 1.0f - acc_a;
+                row[px] = pack565((int)(acc_r + r * inv_a), (int)(acc_g + g * inv_a),
+                                  (int)(acc_b + b * inv_a));
+            }
+        }
+    }
+}
@@ -0,0 +1,124 @@
+// ネイティブビルド用 esp_partition 互換レイヤーの実装
+
+#include "esp_partition.h"
+#include "host.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct HostPartition {
+    esp_partition_t info;
+    std::string path;
+};
+
+struct Mapping {
+    void* addr;
+    size_t length;
+};
+
+std::map<std::string, std::unique_ptr<HostPartition>> partitions;
+std::map<esp_partition_mmap_handle_t, Mapping> mappings;
+esp_partition_mmap_handle_t next_handle = 1;
+
+const HostPartition* hostPartition(const esp_partition_t* partition) {
+    for (const auto& item : partitions) {
+        if (&item.second->info == partition) {
+            return item.second.get();
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char* label) {
+    (void)subtype;
+    if (!label || (type != ESP_PARTITION_TYPE_DATA && type != ESP_PARTITION_TYPE_ANY)) {
+        return nullptr;
+    }
+    std::string path = std::string(host::dataRoot()) + "/" + label + ".pak";
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || st.st_size == 0) {
+        return nullptr;
+    }
+    // 呼ばれるたびにサイズを取り直す（ファイルを作り直しても追従する）
+    std::unique_ptr<HostPartition>& slot = partitions[path];
+    if (!slot) {
+        slot.reset(new HostPartition());
+    }
+    slot->path = path;
+    slot->info.type = ESP_PARTITION_TYPE_DATA;
+    slot->info.subtype = subtype;
+    slot->info.address = 0;
+    slot->info.size = (uint32_t)st.st_size;
+    std::snprintf(slot->info.label, sizeof(slot->info.label), "%s", label);
+    return &slot->info;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset,
+                             void* dst, size_t size) {
+    const HostPartition* part = hostPartition(partition);
+    if (!part || !dst) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (src_offset + size > part->info.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int fd = ::open(part->path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+    ssize_t n = ::pread(fd, dst, size, (off_t)src_offset);
+    ::close(fd);
+    return n == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle) {
+    (void)memory;
+    const HostPartition* part = hostPartition(partition);
+    if (!part || !out_ptr || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + size > part->info.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int fd = ::open(part->path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+    // mmap のオフセットはページ境界に揃える
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t base = offset / page * page;
+    size_t length = size + (offset - base);
+    void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, (off_t)base);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return ESP_FAIL;
+    }
+    esp_partition_mmap_handle_t handle = next_handle++;
+    mappings[handle] = Mapping{addr, length};
+    *out_ptr = (const uint8_t*)addr + (offset - base);
+    *out_handle = handle;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+    auto it = mappings.find(handle);
+    if (it == mappings.end()) {
+        return;
+    }
+    ::munmap(it->second.addr, it->second.length);
+    mappings.erase(it);
+}
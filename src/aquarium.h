@@ -0,0 +1,156 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <vector>
+
+#include "depth_cache.h"
+#include "fish_school.h"
+#include "fish_sprite.h"
+#include "frame_pacer.h"
+#include "frame_arena.h"
+#include "frame_stream.h"
+#include "memory_budget.h"
+#include "particle_system.h"
+#include "render_pipeline.h"
+#include "scene_layers.h"
+#include "session_log.h"
+#include "spatial_grid.h"
+#include "sprite_residency.h"
+#include "touch_input.h"
+
+// 1フレーム分の計測値（loop() の先頭でリセットされる）
+struct FrameStats {
+    uint32_t input_us;       // M5.update() とタッチの読み取り（読み取りタスクを使うときは 0 に近い）
+    uint32_t update_us;      // updateFishes()
+    uint32_t bounds_us;      // 更新矩形の計算
+    uint32_t particles_us;   // 粒子の更新（bounds_us に含む）
+    uint32_t wait_us;        // 合成先のバッファが転送から戻るのを待った時間
+    uint32_t alloc_us;       // バッファの再確保
+    uint32_t background_us;  // 背景の復元（静的なレイヤーを含む）
+    uint32_t plants_us;      // 中景の水草の合成
+    uint32_t bubbles_us;     // 前景の泡の合成
+    uint32_t sort_us;        // 奥行きソート
+    uint32_t fish_us;        // 魚の合成
+    uint32_t push_us;        // パネルへの転送（パイプライン時は転送タスクへの受け渡しのみ）
+    uint32_t total_us;       // loop() 全体
+    uint32_t fish_drawn;     // 描画した魚の数
+    uint32_t fish_scaled;    // 拡大縮小で描画した魚の数
+    uint32_t pixels_blitted; // 合成で書き込んだピクセル数（背景 + 水草 + 魚 + 泡。dirty_pixels との比が重ね描きの倍率）
+    uint32_t fish_occluded;  // 手前の魚に隠れて描かなかった魚の数（front-to-back のとき、領域ごとに数える）
+    uint32_t occlusion_fallbacks;  // front-to-back で描けず、奥から順に描いた領域の数
+    uint32_t bytes_pushed;   // パネルへ転送したバイト数
+    uint32_t regions;        // 更新領域の数
+    uint32_t layer_regions;  // そのうち水草と泡が加えた数（統合前）
+    uint32_t dirty_pixels;   // 更新領域の面積合計
+    uint32_t union_pixels;   // 1矩形にまとめた場合の面積
+    uint32_t cache_hits;     // 奥行きキャッシュのヒット数
+    uint32_t cache_misses;   // 奥行きキャッシュのミス数
+    uint32_t quality;        // このフレームを描いた品質の段階（Quality）
+    uint32_t budget_missed;  // 合成か転送がフレームの予算（frame_pacer）を超えたら 1
+};
+
+const int FISH_WIDTH = 358;
+const int FISH_HEIGHT = 200;
+const int NUM_FISHES = 3;
+const float MAX_SPEED = 2.0f;
+const uint32_t DIRECTION_CHANGE_INTERVAL = 3000;  // 3秒
+const float TURN_DURATION = 1.0f;  // 方向転換にかかる時間（秒）
+const float DEPTH_SCALE_MIN = 0.7f;  // 最も奥のスケール（70%）
+const float DEPTH_SCALE_MAX = 1.0f;  // 最も手前のスケール（100%）
+const float DEPTH_CHANGE_SPEED = 0.1f;  // 奥行き変化速度（秒あたり）
+const float DEPTH_TARGET_INTERVAL = 5.0f;  // 奥行き目標変更間隔（秒）
+const int DIRTY_MARGIN = 10;  // 更新領域の余白（ピクセル）
+const int DEPTH_LEVELS = 8;  // 奥行きの量子化段階数（0で連続スケール）
+const size_t DEPTH_CACHE_BUDGET = 4 * 1024 * 1024;  // 縮小済みスプライトの上限（バイト）
+const int MAX_SWIM_FRAMES = 12;  // 泳ぎアニメーションの最大フレーム数（片側）
+const size_t SPRITE_BUDGET = 1024 * 1024;  // 常駐させる魚スプライトの上限（バイト）
+const float TURN_PREFETCH_SPEED = 0.3f;  // X方向の速さがこれ未満なら方向転換の画像を先読み
+const int BOIDS_RADIUS = 240;  // 群れの計算で近傍とみなす中心間の距離（ピクセル、グリッドのセルの大きさ）
+const float BOIDS_SEPARATION = 160.0f;  // これより近い魚から離れる（ピクセル）
+const float BOIDS_SEPARATION_WEIGHT = 2.0f;  // 分離・整列・結合の強さ（秒あたりの速度変化）
+const float BOIDS_ALIGNMENT_WEIGHT = 0.5f;
+const float BOIDS_COHESION_WEIGHT = 0.6f;
+const float TOUCH_ATTRACT_RADIUS = 480.0f;  // タッチに反応する距離（ピクセル）
+const float TOUCH_ATTRACT_STRENGTH = 1.5f;  // 押し続けた位置に寄ってくる強さ
+const float TOUCH_AVOID_STRENGTH = 4.0f;  // 魚をタップしたとき周りの魚が逃げる強さ
+const uint32_t TOUCH_AVOID_DURATION = 600;  // 逃げ続ける時間（ms）
+const int TOUCH_DRAG_THRESHOLD = 24;  // 押した位置からこれ以上動かしたらなぞっているとみなす（ピクセル、縦横の和）
+const float TOUCH_FOLLOW_STRENGTH = 3.0f;  // なぞっている指を追いかける強さ
+const int PARTICLE_CAPACITY = 4096;  // 泡の粒子のプールの大きさ
+const int PELLET_CAPACITY = 128;  // 餌のプールの大きさ
+const float BUBBLE_RATE = 4.0f;  // 水底から湧く細かい泡（個/秒）
+const float FOOD_SENSE_RADIUS = 360.0f;  // 魚の口からこの距離までの餌に寄っていく（ピクセル）
+const float FOOD_SEEK_STRENGTH = 2.5f;  // 餌に寄っていく強さ（秒あたりの速度変化）
+const float FOOD_EAT_RADIUS = 28.0f;  // 口からこの距離まで来たら食べる
+const int GRID_SLACK = 16;  // 補間した描画矩形がシミュレーション上の矩形からずれる分（グリッドの検索範囲に足す）
+const uint32_t SIM_STEP_MS = 16;  // シミュレーションの固定刻み（ms）
+const int MAX_SIM_STEPS = 4;  // 1フレームで進める最大ステップ数（超えた分は捨てて遅らせる）
+const uint32_t SESSION_CHECK_INTERVAL = 60;  // 記録に状態のハッシュを入れる間隔（ステップ）
+const uint32_t SESSION_SAVE_INTERVAL = 600;  // 実機で記録をファイルに書き出す間隔（ステップ）
+const int DEBUG_LOG_FISH = 8;  // デバッグログに位置を出す魚の数（群れが大きいとき用）
+const size_t FRAME_ARENA_SIZE = 16 * 1024;  // フレーム内の一時データ用（足りなければ自動で広げる）
+const uint32_t PROFILE_WINDOW = 120;  // プロファイラの集計区間（フレーム）
+const int TARGET_FPS = 30;  // フレームの間隔を揃える目標（0 なら揃えず、描画の品質も下げない）
+const uint32_t STREAM_BYTES_PER_SEC = 800 * 1000;  // 差分の送り出しに使うリンクの速さ（USB の全速で余裕を見た値）
+const int SPRITE_MIRRORED = 1 << 30;  // 画像 id に付けると左右反転して描く（右向きを左向きの画像で描く）
+
+// グローバル変数
+extern FishSchool fishes;  // ネオンテトラの群れ
+extern LGFX_Device* display;
+extern int num_fishes;  // initFishes() で生成する魚の数（既定: NUM_FISHES）
+extern FrameStats frame_stats;
+extern bool multi_rect_dirty;  // 更新領域を魚ごとに分けるか
+extern bool front_to_back;  // setup() の前に設定する。手前の魚から描き、隠れた部分を描かない
+extern int depth_levels;  // setup() で奥行きキャッシュに設定する段階数
+extern size_t depth_cache_budget;
+extern bool depth_cache_preload;  // true なら起動時に全レベルを作成する
+extern DepthSpriteCache depth_cache;
+extern SpriteResidency sprite_residency;
+extern bool lazy_sprites;  // false なら起動時に全ての魚スプライトを読み込む
+extern size_t sprite_budget;  // 0 で無制限
+extern int swim_left_ids[MAX_SWIM_FRAMES];  // sprite_residency の id（SPRITE_MIRRORED が付くことがある）
+extern int swim_right_ids[MAX_SWIM_FRAMES];
+extern bool mirror_sprites;  // true なら右向きの画像を読み込まず、左向きの画像を反転して描く
+extern int swim_frame_count;  // manifest から読み込んだ泳ぎフレーム数（左右共通）
+extern RenderPipeline render_pipeline;
+extern FrameArena frame_arena;
+extern SceneLayers scene_layers;
+extern bool scene_layers_enabled;  // false なら水草と泡を作らない（背景は静的なまま）
+extern ParticleSystem particles;  // 細かい泡と餌
+extern bool particles_enabled;  // false なら粒子を使わない（餌も落とさない）
+extern float bubble_rate;  // setup() で particles に設定する（既定: BUBBLE_RATE）
+extern bool feeding;  // 魚のいない所をタップしたら餌を落とす（particles を使うときだけ）
+extern SpatialGrid fish_grid;  // 魚の中心の一様グリッド（群れ・タッチ・更新領域の検索）
+extern bool schooling;  // 群れの行動を有効にするか
+extern bool spatial_index;  // false なら fish_grid を使わず全ての魚を調べる
+extern uint32_t sim_seed;  // シミュレーションの乱数の元（initFishes() で使う）
+extern uint32_t sim_tick;  // 進めたステップ数
+extern SessionLog session_log;  // タッチ入力の記録と再生
+extern TouchInput touch_input;  // タッチの変化を時刻付きで溜めるキュー
+extern bool touch_task;  // setup() の前に設定する。true ならタッチを別タスクで読む
+extern bool session_record;  // true なら起動時から記録し、session_save_path に書き出す
+extern const char* session_save_path;  // nullptr なら書き出さない（ベンチマークが自分で保存する）
+extern bool pipelined_render;  // setup() で転送タスクを起動するか
+extern bool scene_debug_log;  // drawScene() のデバッグログを出すか
+extern int target_fps;  // setup() で frame_pacer に設定する（既定: TARGET_FPS）
+extern int pinned_quality;  // 0 以上なら setup() で frame_pacer の品質をこの段階（Quality）に固定する（既定: -1）
+extern FramePacer frame_pacer;  // フレームの間隔と描画の品質
+extern FrameStream frame_stream;  // 更新領域の差分をシリアルに送り出す
+extern bool frame_streaming;  // true なら setup() でシリアルへの送り出しを始める
+extern uint32_t stream_rate;  // setup() で frame_stream に設定する（バイト/秒、既定: STREAM_BYTES_PER_SEC）
+
+// 関数プロトタイプ
+void initDisplay();
+void loadBackgroundImage();
+void loadFishImages();
+void beginSession();
+void saveSession();
+void initFishes();
+void updateFishes(uint32_t delta_ms);
+void drawScene();
+FishSprite* getFishSprite(int fish, bool* mirrored = nullptr);  // mirrored: 左右反転して描くか
+int handleTouch(const TouchSample& touch);  // タップで方向転換させた魚を返す（無ければ -1）
+void handleSerialCommand();  // シリアルからの 1 文字のコマンド（プロファイラ・差分の送り出し・メモリの使用量）
+void triggerFishTurn(int fish);
+float getDepthScale(float depth);
+float getDrawScale(float depth);
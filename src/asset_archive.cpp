@@ -0,0 +1,590 @@
+#include "asset_archive.h"
+
+AssetFormat asset_format = AssetFormat::Auto;
+AssetArchive asset_archive;
+
+namespace {
+
+const char* PACK_PARTITION_LABEL = "assets";
+const char* PACK_FILE_PATH = "/assets.pak";
+const char* MANIFEST_PATH = "/images/manifest.txt";
+const uint16_t PACK_VERSION = 1;
+const size_t PACK_HEADER_SIZE = 16;
+
+const uint8_t ENCODING_RAW = 0;
+const uint8_t ENCODING_QOI565 = 1;
+const uint8_t ENCODING_INDEX8 = 2;
+const uint8_t ENCODING_PALETTE = 3;
+const size_t PALETTE_ENTRY_SIZE = 3;  // u16 RGB565 + u8 アルファ
+
+const uint8_t OP_DIFF = 0x40;
+const uint8_t OP_LUMA = 0x80;
+const uint8_t OP_RUN = 0xC0;
+const uint8_t OP_RGB565 = 0xFE;
+const uint8_t OP_RUN_LONG = 0xFF;
+
+inline uint16_t readU16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline uint32_t readU32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// ヘッダーを確認して画像数と全体のバイト数を返す
+bool parseHeader(const uint8_t* header, size_t available, int* count, uint32_t* total) {
+    if (memcmp(header, "AQPK", 4) != 0 || readU16(header + 4) != PACK_VERSION) {
+        return false;
+    }
+    *count = readU16(header + 6);
+    *total = readU32(header + 12);
+    return readU32(header + 8) == PACK_HEADER_SIZE + *count * sizeof(AssetEntry) &&
+           *total <= available;
+}
+
+// マップしたメモリから 1 バイトずつ読む
+class MemoryReader {
+public:
+    MemoryReader(const uint8_t* data, size_t size) : _p(data), _end(data + size) {}
+
+    int next() {
+        return _p < _end ? *_p++ : -1;
+    }
+
+private:
+    const uint8_t* _p;
+    const uint8_t* _end;
+};
+
+// ファイルを小さなバッファ単位で読み進める
+class ChunkReader {
+public:
+    ChunkReader(File& file, size_t size) : _file(file), _remaining(size) {}
+
+    int next() {
+        if (_pos >= _len) {
+            _len = _file.read(_buf, min(sizeof(_buf), _remaining));
+            _remaining -= _len;
+            _pos = 0;
+            if (_len == 0) {
+                return -1;
+            }
+        }
+        return _buf[_pos++];
+    }
+
+private:
+    File& _file;
+    size_t _remaining;
+    uint8_t _buf[1024];
+    size_t _pos = 0;
+    size_t _len = 0;
+};
+
+inline uint16_t swap16(uint16_t v) {
+    return (uint16_t)((v << 8) | (v >> 8));
+}
+
+inline int hash565(uint16_t px) {
+    return (((px >> 11) & 31) * 3 + ((px >> 5) & 63) * 5 + (px & 31) * 7) & 63;
+}
+
+// QOI565 をデコードして dst（stride ピクセル間隔、クリップ幅 clip_w x clip_h）に書き込む
+template <class Reader>
+bool decodeQoi565(Reader& in, int w, int h, uint16_t* dst, int stride, int clip_w, int clip_h) {
+    uint16_t table[64] = {0};
+    uint16_t px = 0;
+    int x = 0;
+    int y = 0;
+    uint32_t remaining = (uint32_t)w * h;
+    uint16_t* row = dst;
+    uint16_t raw = 0;
+
+    auto emit = [&](uint32_t count) {
+        if (count > remaining) count = remaining;
+        remaining -= count;
+        while (count > 0) {
+            uint32_t n = min<uint32_t>(count, w - x);
+            if (y < clip_h) {
+                int end = min(x + (int)n, clip_w);
+                for (int i = x; i < end; i++) row[i] = raw;
+            }
+            x += n;
+            count -= n;
+            if (x == w) {
+                x = 0;
+                y++;
+                row += stride;
+            }
+        }
+    };
+
+    while (remaining > 0) {
+        int op = in.next();
+        if (op < 0) {
+            return false;
+        }
+        if (op == OP_RUN_LONG) {
+            int lo = in.next();
+            int hi = in.next();
+            if (hi < 0) return false;
+            emit((uint32_t)(lo | (hi << 8)));
+            continue;
+        }
+        if (op >= OP_RUN && op != OP_RGB565) {
+            emit(op - OP_RUN + 1);
+            continue;
+        }
+        if (op == OP_RGB565) {
+            int lo = in.next();
+            int hi = in.next();
+            if (hi < 0) return false;
+            px = (uint16_t)(lo | (hi << 8));
+        } else if (op < OP_DIFF) {
+            px = table[op];
+        } else {
+            int r = (px >> 11) & 31;
+            int g = (px >> 5) & 63;
+            int b = px & 31;
+            if (op < OP_LUMA) {
+                r += ((op >> 4) & 3) - 2;
+                g += ((op >> 2) & 3) - 2;
+                b += (op & 3) - 2;
+            } else {
+                int second = in.next();
+                if (second < 0) return false;
+                int dg = (op & 63) - 32;
+                g += dg;
+                r += (dg >> 1) + (second >> 4) - 8;
+                b += (dg >> 1) + (second & 15) - 8;
+            }
+            px = (uint16_t)(((r & 31) << 11) | ((g & 63) << 5) | (b & 31));
+        }
+        table[hash565(px)] = px;
+        raw = swap16(px);
+        emit(1);
+    }
+    return true;
+}
+
+// アルファ面（4 ビットのアルファと続く数のランレングス）を dst（stride バイト間隔）に展開する
+template <class Reader>
+bool decodeAlpha(Reader& in, int w, int h, uint8_t* dst, int stride, int clip_w, int clip_h) {
+    uint32_t remaining = (uint32_t)w * h;
+    int x = 0;
+    int y = 0;
+    while (remaining > 0) {
+        int op = in.next();
+        if (op < 0) {
+            return false;
+        }
+        uint8_t a = (uint8_t)((op >> 4) * 17);
+        uint32_t count = min<uint32_t>((op & 15) + 1, remaining);
+        remaining -= count;
+        while (count > 0) {
+            uint32_t n = min<uint32_t>(count, w - x);
+            if (y < clip_h && x < clip_w) {
+                memset(dst + y * stride + x, a, min<int>((int)n, clip_w - x));
+            }
+            x += n;
+            count -= n;
+            if (x == w) {
+                x = 0;
+                y++;
+            }
+        }
+    }
+    return true;
+}
+
+// PackBits のパレットの番号を展開し、描画先に収まる部分ごとに fill(x, y, 番号, 個数) を呼ぶ
+template <class Reader, class Fill>
+bool decodeIndex8(Reader& in, int w, int h, int clip_w, int clip_h, Fill fill) {
+    uint32_t remaining = (uint32_t)w * h;
+    int x = 0;
+    int y = 0;
+    auto emit = [&](uint8_t value, uint32_t count) {
+        if (count > remaining) count = remaining;
+        remaining -= count;
+        while (count > 0) {
+            uint32_t n = min<uint32_t>(count, w - x);
+            if (y < clip_h && x < clip_w) {
+                fill(x, y, value, min<int>((int)n, clip_w - x));
+            }
+            x += n;
+            count -= n;
+            if (x == w) {
+                x = 0;
+                y++;
+            }
+        }
+    };
+
+    while (remaining > 0) {
+        int op = in.next();
+        if (op < 0) {
+            return false;
+        }
+        if (op >= 128) {
+            int value = in.next();
+            if (value < 0) return false;
+            emit((uint8_t)value, op - 126);
+            continue;
+        }
+        for (int i = 0; i <= op; i++) {
+            int value = in.next();
+            if (value < 0) return false;
+            emit((uint8_t)value, 1);
+        }
+    }
+    return true;
+}
+
+// アルファ面の無い画像は透過色から作る
+void alphaFromColorKey(const uint16_t* src, int w, int h, int stride, uint8_t* dst) {
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            dst[y * stride + x] = src[y * stride + x] == TFT_BLACK ? 0 : 255;
+        }
+    }
+}
+
+// scratch はファイル全体を読み込む作業用バッファ（足りなければ広げる）
+bool loadPng(M5Canvas* canvas, const char* path, std::vector<uint8_t>& scratch) {
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+        M5_LOGE("Failed to open image file: %s", path);
+        return false;
+    }
+    size_t file_size = file.size();
+    if (scratch.size() < file_size) {
+        scratch.resize(file_size);
+    }
+    file.readBytes((char*)scratch.data(), file_size);
+    file.close();
+    bool drawn = canvas->drawPng(scratch.data(), file_size, 0, 0);
+    if (!drawn) {
+        M5_LOGE("Failed to draw PNG: %s", path);
+    }
+    return drawn;
+}
+
+}  // namespace
+
+bool AssetArchive::open() {
+    close();
+    if (asset_format != AssetFormat::Png && (openPartition() || openPackFile())) {
+        M5_LOGI("Assets: %d images from %s (%u bytes)", _count, sourceName(), (unsigned)_bytes);
+        return loadPalettes();
+    }
+    if (asset_format != AssetFormat::Pack && openManifest()) {
+        M5_LOGI("Assets: %d images from %s", _count, MANIFEST_PATH);
+        return true;
+    }
+    M5_LOGE("No asset archive or manifest found");
+    return false;
+}
+
+void AssetArchive::close() {
+    if (_source == Source::Mapped) {
+        esp_partition_munmap(_map_handle);
+    }
+    _file.close();
+    _source = Source::None;
+    _table = nullptr;
+    _count = 0;
+    _bytes = 0;
+    _mapped = nullptr;
+    _entries.clear();
+    _paths.clear();
+    _scratch = std::vector<uint8_t>();
+    _palettes.clear();
+    _palette_entries.clear();
+}
+
+bool AssetArchive::openPartition() {
+    const esp_partition_t* partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PACK_PARTITION_LABEL);
+    if (!partition) {
+        return false;
+    }
+    uint8_t header[PACK_HEADER_SIZE];
+    int count = 0;
+    uint32_t total = 0;
+    if (esp_partition_read(partition, 0, header, sizeof(header)) != ESP_OK ||
+        !parseHeader(header, partition->size, &count, &total)) {
+        M5_LOGW("Partition '%s' does not contain assets.pak", PACK_PARTITION_LABEL);
+        return false;
+    }
+    const void* mapped = nullptr;
+    if (esp_partition_mmap(partition, 0, total, ESP_PARTITION_MMAP_DATA, &mapped,
+                           &_map_handle) != ESP_OK) {
+        M5_LOGW("Failed to map partition '%s' (%u bytes)", PACK_PARTITION_LABEL, (unsigned)total);
+        return false;
+    }
+    _mapped = (const uint8_t*)mapped;
+    _table = (const AssetEntry*)(_mapped + PACK_HEADER_SIZE);
+    _count = count;
+    _bytes = total;
+    _source = Source::Mapped;
+    return true;
+}
+
+bool AssetArchive::openPackFile() {
+    _file = LittleFS.open(PACK_FILE_PATH, "r");
+    if (!_file) {
+        return false;
+    }
+    uint8_t header[PACK_HEADER_SIZE];
+    int count = 0;
+    uint32_t total = 0;
+    if (_file.read(header, sizeof(header)) != sizeof(header) ||
+        !parseHeader(header, _file.size(), &count, &total)) {
+        M5_LOGW("Invalid %s", PACK_FILE_PATH);
+        _file.close();
+        return false;
+    }
+    _entries.resize(count);
+    size_t table_bytes = count * sizeof(AssetEntry);
+    if (_file.read((uint8_t*)_entries.data(), table_bytes) != table_bytes) {
+        _file.close();
+        _entries.clear();
+        return false;
+    }
+    _table = _entries.data();
+    _count = count;
+    _bytes = total;
+    _source = Source::File;
+    return true;
+}
+
+bool AssetArchive::openManifest() {
+    File file = LittleFS.open(MANIFEST_PATH, "r");
+    if (!file) {
+        return false;
+    }
+    std::string text(file.size(), '\0');
+    file.readBytes(&text[0], text.size());
+    file.close();
+
+    // 1 行に「名前  画像ファイル」、'#' 以降はコメント
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) eol = text.size();
+        std::string line = text.substr(pos, eol - pos);
+        pos = eol + 1;
+        line = line.substr(0, line.find('#'));
+        char name[sizeof(AssetEntry::name)];
+        char image[96];
+        if (sscanf(line.c_str(), "%43s %95s", name, image) != 2) {
+            continue;
+        }
+        AssetEntry entry = {};
+        memcpy(entry.name, name, strlen(name));  // %43s なので NUL 終端は残る
+        _entries.push_back(entry);
+        _paths.push_back(std::string("/images/") + image);
+    }
+    _table = _entries.data();
+    _count = (int)_entries.size();
+    _source = Source::Png;
+    return _count > 0;
+}
+
+const AssetEntry* AssetArchive::find(const char* name) const {
+    for (int i = 0; i < _count; i++) {
+        if (strncmp(_table[i].name, name, sizeof(_table[i].name)) == 0) {
+            return &_table[i];
+        }
+    }
+    return nullptr;
+}
+
+bool AssetArchive::load(const AssetEntry& entry, M5Canvas* canvas, uint8_t* alpha) {
+    if (entry.encoding == ENCODING_INDEX8) {
+        return loadIndexed(entry, canvas, alpha);
+    }
+    if (!loadColor(entry, canvas)) {
+        return false;
+    }
+    if (!alpha) {
+        return true;
+    }
+    int stride = canvas->width();
+    int clip_w = min((int)entry.width, stride);
+    int clip_h = min((int)entry.height, (int)canvas->height());
+    if (_source != Source::Png && (entry.flags & ASSET_ALPHA) && entry.alpha_size > 0) {
+        uint32_t offset = entry.offset + entry.size;
+        if (offset + entry.alpha_size > _bytes) {
+            M5_LOGE("Alpha plane out of range: %s", entry.name);
+            return false;
+        }
+        memset(alpha, 0, (size_t)stride * canvas->height());
+        if (_source == Source::Mapped) {
+            MemoryReader reader(_mapped + offset, entry.alpha_size);
+            return decodeAlpha(reader, entry.width, entry.height, alpha, stride, clip_w, clip_h);
+        }
+        if (!_file.seek(offset)) {
+            return false;
+        }
+        ChunkReader reader(_file, entry.alpha_size);
+        return decodeAlpha(reader, entry.width, entry.height, alpha, stride, clip_w, clip_h);
+    }
+    alphaFromColorKey((const uint16_t*)canvas->getBuffer(), stride, canvas->height(), stride, alpha);
+    return true;
+}
+
+bool AssetArchive::loadColor(const AssetEntry& entry, M5Canvas* canvas) {
+    if (_source == Source::Png) {
+        return loadPng(canvas, _paths[&entry - _table].c_str(), _scratch);
+    }
+    if (entry.offset + entry.size > _bytes) {
+        M5_LOGE("Asset out of range: %s", entry.name);
+        return false;
+    }
+    uint16_t* dst = (uint16_t*)canvas->getBuffer();
+    if (!dst) {
+        return false;
+    }
+    int w = entry.width;
+    int h = entry.height;
+    int stride = canvas->width();
+    int clip_w = min(w, (int)canvas->width());
+    int clip_h = min(h, (int)canvas->height());
+
+    if (entry.encoding == ENCODING_RAW) {
+        // 行ごとに canvas のバッファへ直接コピーする（はみ出す部分は読み飛ばす）
+        if (entry.size < (uint32_t)w * h * 2) {
+            return false;
+        }
+        for (int y = 0; y < clip_h; y++) {
+            size_t src_offset = entry.offset + (size_t)y * w * 2;
+            if (_source == Source::Mapped) {
+                memcpy(dst + y * stride, _mapped + src_offset, clip_w * 2);
+            } else if (!_file.seek(src_offset) ||
+                       _file.read((uint8_t*)(dst + y * stride), clip_w * 2) != (size_t)clip_w * 2) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (entry.encoding == ENCODING_QOI565) {
+        if (_source == Source::Mapped) {
+            MemoryReader reader(_mapped + entry.offset, entry.size);
+            return decodeQoi565(reader, w, h, dst, stride, clip_w, clip_h);
+        }
+        if (!_file.seek(entry.offset)) {
+            return false;
+        }
+        ChunkReader reader(_file, entry.size);
+        return decodeQoi565(reader, w, h, dst, stride, clip_w, clip_h);
+    }
+    M5_LOGE("Unknown encoding %u: %s", entry.encoding, entry.name);
+    return false;
+}
+
+bool AssetArchive::loadPalettes() {
+    for (int i = 0; i < _count; i++) {
+        if (_table[i].encoding == ENCODING_PALETTE) {
+            _palette_entries.push_back(i);
+        }
+    }
+    _palettes.resize(_palette_entries.size());
+    for (size_t p = 0; p < _palettes.size(); p++) {
+        const AssetEntry& entry = _table[_palette_entries[p]];
+        int count = min((int)entry.width, SpritePalette::MAX_COLORS);
+        uint8_t data[SpritePalette::MAX_COLORS * PALETTE_ENTRY_SIZE];
+        size_t size = count * PALETTE_ENTRY_SIZE;
+        if (entry.size < size || entry.offset + size > _bytes) {
+            M5_LOGE("Invalid palette: %s", entry.name);
+            return false;
+        }
+        if (_source == Source::Mapped) {
+            memcpy(data, _mapped + entry.offset, size);
+        } else if (!_file.seek(entry.offset) || _file.read(data, size) != size) {
+            return false;
+        }
+        SpritePalette& palette = _palettes[p];
+        for (int i = 0; i < count; i++) {
+            const uint8_t* e = data + i * PALETTE_ENTRY_SIZE;
+            palette.set(i, readU16(e), e[2]);
+        }
+        palette.count = count;
+    }
+    return true;
+}
+
+const SpritePalette* AssetArchive::palette(const AssetEntry& entry) const {
+    if (entry.encoding != ENCODING_INDEX8) {
+        return nullptr;
+    }
+    for (size_t p = 0; p < _palettes.size(); p++) {
+        if (_palette_entries[p] == entry.palette) {
+            return &_palettes[p];
+        }
+    }
+    return nullptr;
+}
+
+bool AssetArchive::loadIndices(const AssetEntry& entry, uint8_t* dst, int dst_w, int dst_h) {
+    if (entry.encoding != ENCODING_INDEX8 || entry.offset + entry.size > _bytes) {
+        M5_LOGE("Not an indexed image: %s", entry.name);
+        return false;
+    }
+    int clip_w = min((int)entry.width, dst_w);
+    int clip_h = min((int)entry.height, dst_h);
+    memset(dst, 0, (size_t)dst_w * dst_h);
+    auto fill = [&](int x, int y, uint8_t value, int n) {
+        memset(dst + y * dst_w + x, value, n);
+    };
+    if (_source == Source::Mapped) {
+        MemoryReader reader(_mapped + entry.offset, entry.size);
+        return decodeIndex8(reader, entry.width, entry.height, clip_w, clip_h, fill);
+    }
+    if (!_file.seek(entry.offset)) {
+        return false;
+    }
+    ChunkReader reader(_file, entry.size);
+    return decodeIndex8(reader, entry.width, entry.height, clip_w, clip_h, fill);
+}
+
+bool AssetArchive::loadIndexed(const AssetEntry& entry, M5Canvas* canvas, uint8_t* alpha) {
+    const SpritePalette* palette = this->palette(entry);
+    uint16_t* dst = (uint16_t*)canvas->getBuffer();
+    if (!palette || !dst || entry.offset + entry.size > _bytes) {
+        M5_LOGE("Missing palette for: %s", entry.name);
+        return false;
+    }
+    int stride = canvas->width();
+    int clip_w = min((int)entry.width, stride);
+    int clip_h = min((int)entry.height, (int)canvas->height());
+    if (alpha) {
+        memset(alpha, 0, (size_t)stride * canvas->height());
+    }
+    // 色はパレットの表を引いて書き込み、アルファもパレットから決める
+    auto fill = [&](int x, int y, uint8_t value, int n) {
+        uint16_t* row = dst + y * stride + x;
+        for (int i = 0; i < n; i++) row[i] = palette->color[value];
+        if (alpha) {
+            memset(alpha + y * stride + x, palette->alpha[value], n);
+        }
+    };
+    if (_source == Source::Mapped) {
+        MemoryReader reader(_mapped + entry.offset, entry.size);
+        return decodeIndex8(reader, entry.width, entry.height, clip_w, clip_h, fill);
+    }
+    if (!_file.seek(entry.offset)) {
+        return false;
+    }
+    ChunkReader reader(_file, entry.size);
+    return decodeIndex8(reader, entry.width, entry.height, clip_w, clip_h, fill);
+}
+
+const char* AssetArchive::sourceName() const {
+    switch (_source) {
+        case Source::Mapped: return "mmap";
+        case Source::File: return "file";
+        case Source::Png: return "png";
+        default: return "none";
+    }
+}
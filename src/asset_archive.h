@@ -0,0 +1,92 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <LittleFS.h>
+#include <esp_partition.h>
+#include <string>
+#include <vector>
+
+#include "span_sprite.h"
+
+// 画像の読み込み元
+enum class AssetFormat {
+    Auto,  // assets.pak があればそれを使い、無ければ manifest.txt の PNG
+    Png,   // 常に PNG をデコードする
+    Pack,  // assets.pak のみ（無ければ失敗）
+};
+
+extern AssetFormat asset_format;
+
+// assets.pak の目次 1 件分（ファイル上の並びと同じ 64 バイト）
+struct AssetEntry {
+    char name[44];      // "swim_left/0" など（manifest.txt の名前）
+    uint32_t offset;    // アーカイブ先頭からの位置
+    uint32_t size;      // データのバイト数
+    uint16_t width;
+    uint16_t height;
+    uint8_t encoding;   // 0=raw, 1=qoi565, 2=index8, 3=palette
+    uint8_t flags;      // ASSET_* の組み合わせ
+    uint16_t palette;   // index8 の画像が使うパレットの目次番号
+    uint32_t alpha_size;  // アルファ面のバイト数（色のデータの直後、無ければ 0）
+};
+static_assert(sizeof(AssetEntry) == 64, "AssetEntry must match the assets.pak layout");
+
+const uint8_t ASSET_COLOR_KEY = 1 << 0;  // TFT_BLACK を透過色として使う
+const uint8_t ASSET_ALPHA = 1 << 1;      // アルファ面がある
+
+// 画像アセットの一覧（tools/convert_assets.py が作る assets.pak）
+//
+// assets パーティションに書き込まれていればメモリマップし、目次も画像データも
+// フラッシュ上のまま読む。無ければ LittleFS の /assets.pak を 1 つ開いたまま位置指定で読む。
+// どちらも無い場合は /images/manifest.txt を読み、PNG を 1 枚ずつデコードする。
+// 魚のスプライトは共有パレットの番号（index8）で入っていることがある。パレットは開くときに読み込む。
+class AssetArchive {
+public:
+    bool open();
+    void close();
+
+    int count() const { return _count; }
+    const AssetEntry& entry(int index) const { return _table[index]; }
+    const AssetEntry* find(const char* name) const;
+
+    // 画像を canvas の (0, 0) に描画する（はみ出す部分は切り捨てる）
+    // assets.pak の透過部分は TFT_BLACK として書き込まれる（魚スプライトの透過色と同じ）
+    // alpha があれば canvas と同じ大きさでアルファ（0〜255）を書き込む。アルファ面の無い画像
+    // （PNG から直接読む場合も）は TFT_BLACK を透明、それ以外を不透明とする
+    // index8 の画像はパレットの色とアルファに展開する
+    bool load(const AssetEntry& entry, M5Canvas* canvas, uint8_t* alpha = nullptr);
+
+    // index8 の画像が使うパレット（それ以外の画像は nullptr。閉じるまで有効）
+    const SpritePalette* palette(const AssetEntry& entry) const;
+    // index8 の画像のパレットの番号を dst（dst_w x dst_h）に書き込む（はみ出す部分は切り捨てる）
+    bool loadIndices(const AssetEntry& entry, uint8_t* dst, int dst_w, int dst_h);
+
+    const char* sourceName() const;  // "mmap" / "file" / "png"
+    size_t bytes() const { return _bytes; }
+
+private:
+    enum class Source { None, Mapped, File, Png };
+
+    bool openPartition();
+    bool openPackFile();
+    bool openManifest();
+    bool setTable(const uint8_t* header, const AssetEntry* table, size_t available);
+    bool loadColor(const AssetEntry& entry, M5Canvas* canvas);
+    bool loadIndexed(const AssetEntry& entry, M5Canvas* canvas, uint8_t* alpha);
+    bool loadPalettes();
+
+    Source _source = Source::None;
+    const AssetEntry* _table = nullptr;
+    int _count = 0;
+    size_t _bytes = 0;
+    const uint8_t* _mapped = nullptr;
+    esp_partition_mmap_handle_t _map_handle = 0;
+    File _file;
+    std::vector<AssetEntry> _entries;  // File / Png のときの目次
+    std::vector<std::string> _paths;   // Png のときの画像パス（_entries と同じ順）
+    std::vector<uint8_t> _scratch;     // PNG ファイルの読み込み先（最大の画像に合わせて広げ、使い回す）
+    std::vector<SpritePalette> _palettes;
+    std::vector<int> _palette_entries;  // _palettes の目次番号（同じ順）
+};
+
+extern AssetArchive asset_archive;
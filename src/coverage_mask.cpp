@@ -0,0 +1,71 @@
+#include "coverage_mask.h"
+
+#include <M5Unified.h>
+
+#include "memory_budget.h"
+
+CoverageMask::~CoverageMask() {
+    budgetedFree(_rows, sizeof(Interval) * ROW_CAPACITY * _max_height, MemoryOwner::CoverageMask);
+    budgetedFree(_counts, _max_height, MemoryOwner::CoverageMask);
+}
+
+bool CoverageMask::begin(int max_height) {
+    budgetedFree(_rows, sizeof(Interval) * ROW_CAPACITY * _max_height, MemoryOwner::CoverageMask);
+    budgetedFree(_counts, _max_height, MemoryOwner::CoverageMask);
+    size_t bytes = sizeof(Interval) * ROW_CAPACITY * max_height;
+    _rows = (Interval*)budgetedAlloc(bytes, MemoryOwner::CoverageMask);
+    _counts = (uint8_t*)budgetedAlloc(max_height, MemoryOwner::CoverageMask);
+    if (!_rows || !_counts) {
+        M5_LOGE("Failed to allocate coverage mask (%u bytes)", (unsigned)(bytes + max_height));
+        budgetedFree(_rows, bytes, MemoryOwner::CoverageMask);
+        budgetedFree(_counts, max_height, MemoryOwner::CoverageMask);
+        _rows = nullptr;
+        _counts = nullptr;
+        _max_height = 0;
+        return false;
+    }
+    _max_height = max_height;
+    memset(_counts, 0, max_height);
+    _overflowed = false;
+    return true;
+}
+
+void CoverageMask::reset(int height) {
+    memset(_counts, 0, (size_t)max(0, min(height, _max_height)));
+    _overflowed = false;
+}
+
+bool CoverageMask::covered(int y, int x0, int x1) const {
+    const Interval* row = _rows + y * ROW_CAPACITY;
+    int n = _counts[y];
+    int x = x0;
+    // 隣り合う区間（owner が違うとつながっていない）をたどって x1 まで届くか
+    for (int i = firstEnding(row, n, x0); i < n && row[i].x0 <= x && x < x1; i++) {
+        x = row[i].x1;
+    }
+    return x >= x1;
+}
+
+void CoverageMask::insert(int y, uint16_t x0, uint16_t x1, uint16_t owner) {
+    Interval* row = _rows + y * ROW_CAPACITY;
+    int n = _counts[y];
+    int i = firstEnding(row, n, x0);  // 埋まっていない区間なので、ここが入れる場所
+    // 左右の区間と同じ owner で接していればつなげる
+    bool join_left = i > 0 && row[i - 1].x1 == x0 && row[i - 1].owner == owner;
+    bool join_right = i < n && row[i].x0 == x1 && row[i].owner == owner;
+    if (join_left && join_right) {
+        row[i - 1].x1 = row[i].x1;
+        memmove(row + i, row + i + 1, sizeof(Interval) * (n - i - 1));
+        _counts[y] = (uint8_t)(n - 1);
+    } else if (join_left) {
+        row[i - 1].x1 = x1;
+    } else if (join_right) {
+        row[i].x0 = x0;
+    } else if (n < ROW_CAPACITY) {
+        memmove(row + i + 1, row + i, sizeof(Interval) * (n - i));
+        row[i] = {x0, x1, owner};
+        _counts[y] = (uint8_t)(n + 1);
+    } else {
+        _overflowed = true;
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+
+// 更新領域の行ごとに、不透明なピクセルで埋まった列の区間を持つ（front-to-back の合成用）
+//
+// 手前の魚から順に、不透明なスパンのうちまだ埋まっていない部分だけを描き、その区間を
+// 描いたもの（owner: 奥から数えた描画順）と一緒に記録する。奥の魚・水草・背景は埋まっていない
+// 部分だけを描けばよく、行が全て埋まっている魚はスパンの表を見るだけで読み飛ばせる。
+// 半透明の縁は後ろにあるものと合成する必要があるので、最後に奥から順に、より手前のものに
+// 埋められていない部分だけに重ねる（結果は奥から順に全て描いた場合と一致する）。
+//
+// 区間は行ごとに ROW_CAPACITY 個まで持ち（隣り合う同じ owner の区間はつなげる）、
+// 足りなくなったら overflowed() を立てる。呼び出し側はその領域を奥から順に描き直す。
+class CoverageMask {
+public:
+    static const int ROW_CAPACITY = 128;
+
+    struct Interval {
+        uint16_t x0;
+        uint16_t x1;
+        uint16_t owner;
+    };
+
+    CoverageMask() {}
+    ~CoverageMask();
+    CoverageMask(const CoverageMask&) = delete;
+    CoverageMask& operator=(const CoverageMask&) = delete;
+
+    // 高さ max_height までの領域を扱えるようにする（行ごとの区間を最大数で確保する）
+    bool begin(int max_height);
+    bool enabled() const { return _rows != nullptr; }
+    int maxHeight() const { return _max_height; }
+
+    // height 行の領域を全て埋まっていない状態にする
+    void reset(int height);
+    bool overflowed() const { return _overflowed; }
+
+    // 行 y の [x0, x1) が全て埋まっているか
+    bool covered(int y, int x0, int x1) const;
+
+    // 行 y の [x0, x1) のうち埋まっていない部分について fn(a, b) を呼び、その部分を owner で埋める
+    // 埋めたピクセル数を返す
+    template <class Fn>
+    uint32_t fill(int y, int x0, int x1, uint16_t owner, Fn fn) {
+        const Interval* row = _rows + y * ROW_CAPACITY;
+        int n = _counts[y];
+        uint16_t gaps[ROW_CAPACITY + 1][2];
+        int gap_count = 0;
+        int x = x0;
+        for (int i = firstEnding(row, n, x0); i < n && row[i].x0 < x1; i++) {
+            if (row[i].x0 > x) {
+                gaps[gap_count][0] = (uint16_t)x;
+                gaps[gap_count++][1] = row[i].x0;
+            }
+            x = row[i].x1;
+        }
+        if (x < x1) {
+            gaps[gap_count][0] = (uint16_t)x;
+            gaps[gap_count++][1] = (uint16_t)x1;
+        }
+        // 描いてから区間を足す（足すと row の並びが変わるので、先に集めておく）
+        uint32_t filled = 0;
+        for (int g = 0; g < gap_count; g++) {
+            fn((int)gaps[g][0], (int)gaps[g][1]);
+            insert(y, gaps[g][0], gaps[g][1], owner);
+            filled += gaps[g][1] - gaps[g][0];
+        }
+        return filled;
+    }
+
+    // 行 y の [x0, x1) のうち、owner より手前（owner が大きいもの）に埋められていない部分について
+    // fn(a, b) を呼ぶ。owner = 0 なら埋まっていない部分だけ
+    template <class Fn>
+    void forEachExposed(int y, int x0, int x1, uint16_t owner, Fn fn) const {
+        const Interval* row = _rows + y * ROW_CAPACITY;
+        int n = _counts[y];
+        int x = x0;
+        for (int i = firstEnding(row, n, x0); i < n && row[i].x0 < x1; i++) {
+            if (owner > 0 && row[i].owner < owner) {
+                continue;
+            }
+            if (row[i].x0 > x) {
+                fn(x, (int)row[i].x0);
+            }
+            x = row[i].x1;
+        }
+        if (x < x1) {
+            fn(x, x1);
+        }
+    }
+
+private:
+    // x より右で終わる最初の区間（区間は重ならないので、終わりも昇順に並んでいる）
+    static int firstEnding(const Interval* row, int n, int x) {
+        int lo = 0;
+        int hi = n;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (row[mid].x1 <= x) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+    // 行 y に埋まっていない [x0, x1) を owner の区間として足す
+    void insert(int y, uint16_t x0, uint16_t x1, uint16_t owner);
+
+    Interval* _rows = nullptr;   // 行ごとに ROW_CAPACITY 個（x0 の昇順、重ならない）
+    uint8_t* _counts = nullptr;  // 行ごとの区間の数（ROW_CAPACITY は 255 以下）
+    int _max_height = 0;
+    bool _overflowed = false;
+};
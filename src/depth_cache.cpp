@@ -0,0 +1,164 @@
+#include "depth_cache.h"
+
+#include "aquarium.h"
+#include "memory_budget.h"
+
+void DepthSpriteCache::configure(int levels, size_t budget_bytes) {
+    clear();
+    _levels = levels >= 2 ? levels : 0;
+    _budget = budget_bytes;
+    _memory_step = 1;
+}
+
+int DepthSpriteCache::baseLevel(float depth) const {
+    if (!enabled()) {
+        return 0;
+    }
+    return max(0, min(_levels - 1, (int)(depth * (_levels - 1) + 0.5f)));
+}
+
+int DepthSpriteCache::levelForDepth(float depth) const {
+    int level = baseLevel(depth);
+    int step = max(_level_step, _memory_step);
+    return level / step * step;
+}
+
+float DepthSpriteCache::levelScale(int level) const {
+    if (!enabled()) {
+        return DEPTH_SCALE_MAX;
+    }
+    return getDepthScale((float)level / (_levels - 1));
+}
+
+FishSprite* DepthSpriteCache::get(FishSprite* source, int level) {
+    if (!enabled() || !source->loaded()) {
+        return nullptr;
+    }
+    if (levelScale(level) >= 1.0f) {
+        return source;
+    }
+
+    auto found = _index.find(makeKey(source, level));
+    if (found != _index.end()) {
+        _stats.hits++;
+        auto it = found->second;
+        it->last_frame = _frame;
+        _lru.splice(_lru.begin(), _lru, it);
+        return it->sprite.get();
+    }
+
+    _stats.misses++;
+    return render(source, level);
+}
+
+FishSprite* DepthSpriteCache::render(FishSprite* source, int level) {
+    float scale = levelScale(level);
+    int w = (int)(source->width * scale);
+    int h = (int)(source->height * scale);
+    // 縮小中はキャンバス形式で確保するので、その大きさで空きを作る
+    size_t estimate = (size_t)w * h * 2;
+    if (!makeRoom(estimate) || !memory_budget.reserve(MemoryOwner::DepthCache, estimate)) {
+        _stats.rejected++;
+        // このフレームで使っているものだけで memory_budget が一杯なら、置く数を減らす
+        if (estimate <= _budget && !memory_budget.fits(MemoryCategory::Cache, estimate)) {
+            reduceLevels();
+        }
+        return nullptr;
+    }
+    std::unique_ptr<FishSprite> sprite(new FishSprite());
+    if (!scaleFishSprite(*source, w, h, *sprite)) {
+        // PSRAM が足りない。使っていないものを解放し、解放できるものが無ければ置く数を減らす
+        memory_budget.fail(MemoryOwner::DepthCache, estimate);
+        _stats.rejected++;
+        if (!evictUnused()) {
+            reduceLevels();
+        }
+        return nullptr;
+    }
+
+    FishSprite* result = sprite.get();
+    size_t bytes = sprite->bytes();
+    memory_budget.settle(MemoryOwner::DepthCache, estimate, bytes);
+    _lru.push_front({source, level, std::move(sprite), bytes, _frame});
+    _index[makeKey(source, level)] = _lru.begin();
+    _stats.entries++;
+    _stats.resident_bytes += bytes;
+    return result;
+}
+
+bool DepthSpriteCache::makeRoom(size_t bytes) {
+    if (bytes > _budget) {
+        return false;
+    }
+    while (_stats.resident_bytes + bytes > _budget || !memory_budget.fits(MemoryCategory::Cache, bytes)) {
+        if (_lru.empty() || _lru.back().last_frame == _frame) {
+            return false;  // 残りはこのフレームで使用中
+        }
+        evict(std::prev(_lru.end()));
+    }
+    return true;
+}
+
+bool DepthSpriteCache::evictUnused() {
+    bool evicted = false;
+    while (!_lru.empty() && _lru.back().last_frame != _frame) {
+        evict(std::prev(_lru.end()));
+        evicted = true;
+    }
+    if (evicted) {
+        memory_budget.noteDegraded(MemoryCategory::Cache);
+    }
+    return evicted;
+}
+
+void DepthSpriteCache::evict(EntryList::iterator it) {
+    _index.erase(makeKey(it->source, it->level));
+    memory_budget.release(MemoryOwner::DepthCache, it->bytes);
+    _stats.resident_bytes -= it->bytes;
+    _stats.entries--;
+    _stats.evictions++;
+    _lru.erase(it);
+}
+
+void DepthSpriteCache::reduceLevels() {
+    if (_memory_step * 2 >= _levels) {
+        return;  // 間隔は段階数の半分まで（手前・中間・奥は残す）
+    }
+    _memory_step *= 2;
+    _stats.degraded++;
+    memory_budget.noteDegraded(MemoryCategory::Cache);
+    M5_LOGW("Depth cache: out of memory, using every %d of %d levels (%u bytes cached)", _memory_step,
+            _levels, (unsigned)_stats.resident_bytes);
+}
+
+void DepthSpriteCache::preload(FishSprite* const* sources, int count) {
+    for (int level = 0; level < _levels; level++) {
+        for (int i = 0; i < count; i++) {
+            if (levelScale(level) >= 1.0f || !sources[i]->loaded() ||
+                _index.count(makeKey(sources[i], level))) {
+                continue;
+            }
+            if (!render(sources[i], level)) {
+                M5_LOGW("Depth cache preload stopped at level %d (budget %u bytes)",
+                        level, (unsigned)_budget);
+                return;
+            }
+        }
+    }
+}
+
+void DepthSpriteCache::clear() {
+    memory_budget.release(MemoryOwner::DepthCache, _stats.resident_bytes);
+    _index.clear();
+    _lru.clear();
+    _stats.entries = 0;
+    _stats.resident_bytes = 0;
+}
+
+void DepthSpriteCache::resetCounters() {
+    _stats.hits = 0;
+    _stats.misses = 0;
+    _stats.evictions = 0;
+    _stats.rejected = 0;
+    _stats.degraded = 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "fish_sprite.h"
+
+// 奥行きレベルごとに縮小済みのスプライトを保持するキャッシュ
+//
+// 奥行き（0.0〜1.0）を levels 段階に量子化し、(元スプライト, レベル) ごとに
+// scaleFishSprite で縮小した結果を PSRAM 上に保持する（形式は sprite_format に従う）。
+// 描画時は拡大縮小なしの描画だけで済む。
+// 予算を超える場合は最も長く使われていないものから解放する（LRU）。
+// 同じフレームで返したスプライトは解放しないので、フレーム中はポインタが有効。
+// 作ったものは memory_budget の Cache に計上する。予算か PSRAM が足りなければ、このフレームで
+// 使っていないものを解放し、それでも足りなければ使うレベルを 1 つおきに間引いていく
+// （隣り合う奥行きで同じ、小さい方のスプライトを使い、キャッシュに置く数を減らす。一度間引いたら戻さない）。
+// 間引いても魚の大きさ（baseLevel()。シミュレーションが使う）は変えないので、記録の再生は一致する。
+class DepthSpriteCache {
+public:
+    struct Stats {
+        uint32_t hits;
+        uint32_t misses;
+        uint32_t evictions;
+        uint32_t rejected;       // 予算不足でキャッシュできなかった数
+        uint32_t degraded;       // memory_budget が足りずレベルを間引いた回数
+        uint32_t entries;
+        size_t resident_bytes;
+    };
+
+    // levels: 量子化段階数（2以上、0で無効）、budget_bytes: 保持する最大バイト数
+    void configure(int levels, size_t budget_bytes);
+    bool enabled() const { return _levels >= 2; }
+    int levels() const { return _levels; }
+    size_t budget() const { return _budget; }
+
+    // step レベルおきにしか使わない（1 で全て。描画の品質を下げるとき）
+    void setLevelStep(int step) { _level_step = max(1, step); }
+    int levelStep() const { return _level_step; }
+    // memory_budget が足りずに間引いた分（実際に使う間隔は levelStep() とこれの大きい方）
+    int memoryStep() const { return _memory_step; }
+    // どちらかの理由でレベルを間引いているか（描くスプライトが魚の大きさより小さくなることがある）
+    bool thinned() const { return max(_level_step, _memory_step) > 1; }
+
+    // 奥行きを levels 段階に量子化したレベル（間引きの影響を受けない。魚の大きさ・当たり判定に使う）
+    int baseLevel(float depth) const;
+    // 描くスプライトのレベル（間引いているときは baseLevel() 以下で一番近い、使うレベル）
+    // シミュレーションの大きさより大きくならないので、描画範囲の中に置ける
+    int levelForDepth(float depth) const;
+    float levelScale(int level) const;
+
+    // フレームの開始時に呼ぶ（このフレームで返したスプライトは解放されなくなる）
+    void beginFrame() { _frame++; }
+
+    // 指定レベルに縮小済みのスプライトを返す。スケール 1.0 のレベルでは source を返す。
+    // 予算不足などで用意できない場合は nullptr
+    FishSprite* get(FishSprite* source, int level);
+
+    // sources の全レベルを予算の範囲で作成する（起動時の一括作成用）
+    void preload(FishSprite* const* sources, int count);
+    void clear();
+
+    const Stats& stats() const { return _stats; }
+    void resetCounters();
+
+private:
+    struct Entry {
+        FishSprite* source;
+        int level;
+        std::unique_ptr<FishSprite> sprite;
+        size_t bytes;
+        uint32_t last_frame;
+    };
+    using Key = uint64_t;
+    using EntryList = std::list<Entry>;
+
+    static Key makeKey(const FishSprite* source, int level) {
+        return ((Key)(uintptr_t)source << 8) ^ (Key)level;
+    }
+    // bytes を確保できるまで古いものを解放する（自分の予算と memory_budget の両方）
+    bool makeRoom(size_t bytes);
+    // このフレームで使っていないものを全て解放する。解放したら true
+    bool evictUnused();
+    void evict(EntryList::iterator it);
+    // 使うレベルを 1 つおきに間引く
+    void reduceLevels();
+    FishSprite* render(FishSprite* source, int level);
+
+    int _levels = 0;
+    int _level_step = 1;
+    int _memory_step = 1;
+    size_t _budget = 0;
+    uint32_t _frame = 0;
+    EntryList _lru;  // 先頭が最近使ったもの
+    std::unordered_map<Key, EntryList::iterator> _index;
+    Stats _stats = {};
+};
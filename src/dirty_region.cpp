@@ -0,0 +1,93 @@
+#include "dirty_region.h"
+
+#include <algorithm>
+
+DirtyRect unionRect(const DirtyRect& a, const DirtyRect& b) {
+    int x0 = std::min(a.x, b.x);
+    int y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.right(), b.right());
+    int y1 = std::max(a.bottom(), b.bottom());
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+bool intersects(const DirtyRect& a, const DirtyRect& b) {
+    return a.x < b.right() && b.x < a.right() && a.y < b.bottom() && b.y < a.bottom();
+}
+
+void DirtyRegionManager::setBounds(int width, int height) {
+    _width = width;
+    _height = height;
+}
+
+void DirtyRegionManager::clear() {
+    _rects.clear();
+}
+
+void DirtyRegionManager::add(int x, int y, int w, int h) {
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(_width, x + w);
+    int y1 = std::min(_height, y + h);
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
+    _rects.push_back({x0, y0, x1 - x0, y1 - y0});
+}
+
+bool DirtyRegionManager::shouldMerge(const DirtyRect& a, const DirtyRect& b) const {
+    uint32_t merged = unionRect(a, b).area() + _region_cost;
+    uint32_t separate = a.area() + b.area() + 2 * _region_cost;
+    return merged <= separate;
+}
+
+void DirtyRegionManager::merge() {
+    // 統合すると外接矩形が大きくなり、別の矩形と統合できるようになることがあるので
+    // 変化がなくなるまで繰り返す
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < _rects.size(); i++) {
+            for (size_t j = i + 1; j < _rects.size();) {
+                if (shouldMerge(_rects[i], _rects[j])) {
+                    _rects[i] = unionRect(_rects[i], _rects[j]);
+                    _rects[j] = _rects.back();
+                    _rects.pop_back();
+                    merged = true;
+                } else {
+                    j++;
+                }
+            }
+        }
+    }
+}
+
+void DirtyRegionManager::collapse() {
+    if (_rects.size() <= 1) {
+        return;
+    }
+    DirtyRect all = _rects[0];
+    for (const auto& r : _rects) {
+        all = unionRect(all, r);
+    }
+    _rects.clear();
+    _rects.push_back(all);
+}
+
+uint32_t DirtyRegionManager::dirtyPixels() const {
+    uint32_t total = 0;
+    for (const auto& r : _rects) {
+        total += r.area();
+    }
+    return total;
+}
+
+uint32_t DirtyRegionManager::unionPixels() const {
+    if (_rects.empty()) {
+        return 0;
+    }
+    DirtyRect all = _rects[0];
+    for (const auto& r : _rects) {
+        all = unionRect(all, r);
+    }
+    return all.area();
+}
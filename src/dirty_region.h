@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 画面上の矩形（部分更新の単位）
+struct DirtyRect {
+    int x;
+    int y;
+    int w;
+    int h;
+
+    int right() const { return x + w; }
+    int bottom() const { return y + h; }
+    uint32_t area() const { return (uint32_t)w * (uint32_t)h; }
+};
+
+// 魚ごとの更新矩形を管理し、重なる・近いものだけをまとめる
+//
+// 2つの矩形を統合するかどうかは「統合後の外接矩形の面積 + 1領域分のコスト」と
+// 「個別に処理した面積の合計 + 2領域分のコスト」の比較で決める。
+// 領域コストは背景復元・転送の呼び出し1回分の固定費をピクセル数に換算したもの。
+class DirtyRegionManager {
+public:
+    void setBounds(int width, int height);
+    void setRegionCost(uint32_t pixels) { _region_cost = pixels; }
+
+    void clear();
+    // count 個まで広げずに追加できるようにしておく
+    void reserve(size_t count) { _rects.reserve(count); }
+    // 画面範囲でクリップして追加する
+    void add(int x, int y, int w, int h);
+    // コストが下がる組み合わせを統合する
+    void merge();
+    // 全矩形を1つの外接矩形にまとめる（従来方式）
+    void collapse();
+
+    const std::vector<DirtyRect>& regions() const { return _rects; }
+    // 現在の矩形の面積合計
+    uint32_t dirtyPixels() const;
+    // 全矩形の外接矩形の面積（1矩形方式で処理した場合の面積）
+    uint32_t unionPixels() const;
+
+private:
+    bool shouldMerge(const DirtyRect& a, const DirtyRect& b) const;
+
+    std::vector<DirtyRect> _rects;
+    int _width = 0;
+    int _height = 0;
+    uint32_t _region_cost = 4096;
+};
+
+// 2つの矩形の外接矩形
+DirtyRect unionRect(const DirtyRect& a, const DirtyRect& b);
+// 2つの矩形が交差するか
+bool intersects(const DirtyRect& a, const DirtyRect& b);
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+
+// 魚のアニメーションの表（コンパイル時に作る）
+//
+// 方向転換は (回転の種類, 開始の向き, 進行度) から画像を 1 回の表引きで決める。
+// 進行度は TURN_STEPS 段階に分け、段階ごとに使う画像（FishPose）と、その画像が manifest に
+// 無いときの代わり（fallback）を持つ。正面経由の回転は angles/ の 10 枚（angle_000 = 左向き、
+// angle_090 = 正面、angle_180 = 右向きの回転角）を順に使い、無ければ 5 段階の画像で代用する。
+// 尾経由の回転は 5 段階の画像を使う。画像の組を増やすときは FISH_POSE_NAMES と
+// 下の並びを足すだけでよい（描画の処理は変えない）。
+//
+// どの表を使うか、泳ぎのフレームを間引くかはシミュレーションの状態（turn_via_tail、
+// turn_progress、frame_roll）だけで決まり、描画側では乱数を使わない。
+
+// 方向転換の画像（manifest の名前は FISH_POSE_NAMES）
+enum FishPose : uint8_t {
+    POSE_LEFT_90,
+    POSE_LEFT_45,
+    POSE_FRONT,
+    POSE_RIGHT_45,
+    POSE_RIGHT_90,
+    POSE_TAIL,
+    POSE_TAIL_LEFT_45,
+    POSE_TAIL_RIGHT_45,
+    POSE_ANGLE_000,
+    POSE_ANGLE_020,
+    POSE_ANGLE_040,
+    POSE_ANGLE_060,
+    POSE_ANGLE_090,
+    POSE_ANGLE_100,
+    POSE_ANGLE_120,
+    POSE_ANGLE_140,
+    POSE_ANGLE_160,
+    POSE_ANGLE_180,
+    POSE_COUNT
+};
+
+constexpr const char* FISH_POSE_NAMES[POSE_COUNT] = {
+    "turn/left_90",
+    "turn/left_45",
+    "turn/front",
+    "turn/right_45",
+    "turn/right_90",
+    "turn/tail",
+    "turn/tail_left_45",
+    "turn/tail_right_45",
+    "turn/angle_000",
+    "turn/angle_020",
+    "turn/angle_040",
+    "turn/angle_060",
+    "turn/angle_090",
+    "turn/angle_100",
+    "turn/angle_120",
+    "turn/angle_140",
+    "turn/angle_160",
+    "turn/angle_180",
+};
+
+// 左右を反転すると同じになる画像（反転して描くなら右向きの画像は読み込まない）
+// 左右対称の画像と、反転の元になる左向きの画像は POSE_COUNT
+constexpr uint8_t POSE_MIRROR_OF[POSE_COUNT] = {
+    POSE_COUNT, POSE_COUNT, POSE_COUNT,
+    POSE_LEFT_45,       // POSE_RIGHT_45
+    POSE_LEFT_90,       // POSE_RIGHT_90
+    POSE_COUNT, POSE_COUNT,
+    POSE_TAIL_LEFT_45,  // POSE_TAIL_RIGHT_45
+    POSE_COUNT, POSE_COUNT, POSE_COUNT, POSE_COUNT, POSE_COUNT,
+    POSE_COUNT, POSE_COUNT, POSE_COUNT, POSE_COUNT, POSE_COUNT,
+};
+
+// 回転の種類（FishSchool::turn_via_tail の値）
+enum TurnMode : uint8_t {
+    TURN_VIA_FRONT,
+    TURN_VIA_TAIL,
+    TURN_MODE_COUNT
+};
+
+const int TURN_STEPS = 10;  // 方向転換の進行度の段階数（angles/ の枚数）
+
+struct TurnFrame {
+    uint8_t pose;      // FishPose
+    uint8_t fallback;  // pose が manifest に無いときに使う画像
+};
+
+namespace fish_animation {
+
+// 左向きから右向きへ回転するときの並び（右向きから回転するときは逆順に使う）
+constexpr uint8_t FRONT_POSES[TURN_STEPS] = {
+    POSE_ANGLE_000, POSE_ANGLE_020, POSE_ANGLE_040, POSE_ANGLE_060, POSE_ANGLE_090,
+    POSE_ANGLE_100, POSE_ANGLE_120, POSE_ANGLE_140, POSE_ANGLE_160, POSE_ANGLE_180,
+};
+const int COARSE_STAGES = 5;
+constexpr uint8_t FRONT_STAGES[COARSE_STAGES] = {
+    POSE_LEFT_90, POSE_LEFT_45, POSE_FRONT, POSE_RIGHT_45, POSE_RIGHT_90,
+};
+constexpr uint8_t TAIL_STAGES[COARSE_STAGES] = {
+    POSE_LEFT_90, POSE_TAIL_LEFT_45, POSE_TAIL, POSE_TAIL_RIGHT_45, POSE_RIGHT_90,
+};
+
+struct TurnTable {
+    TurnFrame frames[TURN_MODE_COUNT][2][TURN_STEPS];  // [回転の種類][開始が右向きか][段階]
+};
+
+constexpr TurnTable buildTurnTable() {
+    TurnTable table = {};
+    for (int start_right = 0; start_right < 2; start_right++) {
+        for (int step = 0; step < TURN_STEPS; step++) {
+            // 右向きから始まる回転は左向きからの並びを逆にたどる
+            int s = start_right ? TURN_STEPS - 1 - step : step;
+            int stage = s * COARSE_STAGES / TURN_STEPS;
+            table.frames[TURN_VIA_FRONT][start_right][step] = {FRONT_POSES[s], FRONT_STAGES[stage]};
+            table.frames[TURN_VIA_TAIL][start_right][step] = {TAIL_STAGES[stage], TAIL_STAGES[stage]};
+        }
+    }
+    return table;
+}
+
+constexpr TurnTable TURN_TABLE = buildTurnTable();
+
+static_assert(TURN_TABLE.frames[TURN_VIA_FRONT][0][0].fallback == POSE_LEFT_90, "turn starts facing left");
+static_assert(TURN_TABLE.frames[TURN_VIA_FRONT][1][0].pose == POSE_ANGLE_180, "turn starts facing right");
+static_assert(TURN_TABLE.frames[TURN_VIA_TAIL][1][TURN_STEPS - 1].pose == POSE_LEFT_90, "turn ends facing left");
+
+// 6 フレームの泳ぎの素材では、片側ずつ 1 フレームが他と馴染まないので 8 割は前のフレームで代用する
+const int SWIM_SKIP_FRAMES = 6;
+const float SWIM_SKIP_RATE = 0.8f;
+
+struct SwimTable {
+    int8_t replace[2][SWIM_SKIP_FRAMES];  // [右向きか][フレーム]（間引くときに表示するフレーム）
+};
+
+constexpr SwimTable buildSwimTable() {
+    SwimTable table = {};
+    for (int right = 0; right < 2; right++) {
+        for (int frame = 0; frame < SWIM_SKIP_FRAMES; frame++) {
+            table.replace[right][frame] = (int8_t)frame;
+        }
+    }
+    table.replace[1][4] = 3;  // right_swim5 → swim4
+    table.replace[0][5] = 4;  // left_swim6 → swim5
+    return table;
+}
+
+constexpr SwimTable SWIM_TABLE = buildSwimTable();
+
+}  // namespace fish_animation
+
+// 進行度（0.0〜1.0）の段階
+constexpr int turnStep(float progress) {
+    return progress <= 0.0f ? 0
+         : progress >= 1.0f ? TURN_STEPS - 1
+         : (int)(progress * TURN_STEPS);
+}
+
+constexpr const TurnFrame& turnFrame(int mode, bool start_right, int step) {
+    return fish_animation::TURN_TABLE.frames[mode][start_right][step];
+}
+
+// 泳ぎの位相（0.0〜6.0）から表示するフレームを決める
+// frame_roll は泳ぎの 1 周ごとにシミュレーションが引き直す乱数
+inline int swimFrame(float swim_phase, int frame_count, bool facing_right, float frame_roll) {
+    int frame = (int)(swim_phase * frame_count / 6.0f);
+    if (frame >= frame_count) frame = frame_count - 1;
+    if (frame_count == fish_animation::SWIM_SKIP_FRAMES && frame_roll < fish_animation::SWIM_SKIP_RATE) {
+        frame = fish_animation::SWIM_TABLE.replace[facing_right][frame];
+    }
+    return frame;
+}
@@ -0,0 +1,289 @@
+#include "fish_school.h"
+
+#include "aquarium.h"
+#include "sim_random.h"
+
+#include <cstring>
+
+namespace {
+
+const float SWIM_PIXELS_PER_SEC = 50.0f;  // 速度 1.0 あたりの移動量
+const float VELOCITY_JITTER = 0.1f;       // 1フレームの速度の揺らぎ（±）
+const float DEPTH_MOVE_MIN_VX = 0.1f;     // X方向の速さがこれを超えるときだけ奥行きを変える
+const float DEPTH_ARRIVED = 0.01f;        // 目標との差がこれ以下なら新しい目標を選ぶ
+
+inline float clampf(float v, float lo, float hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// 1 つ目のループ: 物理量だけを分岐なし（条件は選択式）で更新する
+// 選択肢は計算済みの値か定数にする（選択肢の中で演算すると if 変換されず、ベクトル化されない）。
+// ポインタの restrict は引数でないと効かないため関数に分けている。ホストでは
+// -fno-math-errno -fno-trapping-math（platformio.ini）と合わせてベクトル化される
+void integrate(size_t padded, float delta_sec, float sw, float sh, float* __restrict px,
+               float* __restrict py, float* __restrict pvx, float* __restrict pvy,
+               float* __restrict pdepth, float* __restrict ptarget, float* __restrict pphase,
+               const float* __restrict pspeed, const float* __restrict pw,
+               const float* __restrict ph, const float* __restrict psteer_x,
+               const float* __restrict psteer_y, float* __restrict proll,
+               uint32_t* __restrict prng) {
+    const float move = delta_sec * SWIM_PIXELS_PER_SEC;
+    const float phase_step = delta_sec * 6.0f;
+    const float depth_step = DEPTH_CHANGE_SPEED * delta_sec;
+    const float max_speed_sq = MAX_SPEED * MAX_SPEED;
+
+    for (size_t i = 0; i < padded; i++) {
+        // 泳ぎのアニメーション位相を更新
+        float phase = pphase[i] + phase_step * pspeed[i];
+        bool wrapped = phase >= 6.0f;
+        pphase[i] = phase - (wrapped ? 6.0f : 0.0f);
+
+        // 位置を更新し、画面端で反射（スケールを考慮）
+        float fx = px[i] + pvx[i] * move;
+        float fy = py[i] + pvy[i] * move;
+        float fvx = pvx[i];
+        float fvy = pvy[i];
+        float right = sw - pw[i];   // x の上限
+        float bottom = sh - ph[i];  // y の上限
+        fvx = fx < 0.0f ? -fvx : fvx;
+        fx = fx < 0.0f ? 0.0f : fx;
+        fvx = fx > right ? -fvx : fvx;
+        fx = fx > right ? right : fx;
+        fvy = fy < 0.0f ? -fvy : fvy;
+        fy = fy < 0.0f ? 0.0f : fy;
+        fvy = fy > bottom ? -fvy : fvy;
+        fy = fy > bottom ? bottom : fy;
+        px[i] = fx;
+        py[i] = fy;
+
+        // 群れの行動による加速度とランダムな速度変更
+        fvx += psteer_x[i] * delta_sec;
+        fvy += psteer_y[i] * delta_sec;
+        uint32_t state = prng[i];
+        fvx += (simUniform(state) * 2.0f - 1.0f) * VELOCITY_JITTER;
+        fvy += (simUniform(state) * 2.0f - 1.0f) * VELOCITY_JITTER;
+        float new_target = simUniform(state);
+        float new_roll = simUniform(state);
+        prng[i] = state;
+        proll[i] = wrapped ? new_roll : proll[i];  // 泳ぎの 1 周ごとに引き直す
+
+        // 速度制限（超えたときだけ縮める。sqrt は選択の外で計算してベクトル化を妨げない）
+        float speed_sq = fvx * fvx + fvy * fvy;
+        float limit = MAX_SPEED / sqrtf(speed_sq > max_speed_sq ? speed_sq : max_speed_sq);
+        fvx *= limit;
+        fvy *= limit;
+        pvx[i] = fvx;
+        pvy[i] = fvy;
+
+        // 奥行きの更新（横方向の移動時に目標に向かって少しずつ変化し、着いたら新しい目標を選ぶ）
+        float d = pdepth[i];
+        float target = ptarget[i];
+        float diff = target - d;
+        bool moving = fabsf(fvx) > DEPTH_MOVE_MIN_VX;
+        bool arrived = fabsf(diff) <= DEPTH_ARRIVED;
+        d += (moving & !arrived) ? clampf(diff, -depth_step, depth_step) : 0.0f;
+        ptarget[i] = (moving & arrived) ? new_target : target;
+        pdepth[i] = clampf(d, 0.0f, 1.0f);
+    }
+}
+
+}  // namespace
+
+void FishSchool::resize(int count, uint32_t seed) {
+    _count = count;
+    size_t padded = (count + LANES - 1) / LANES * LANES;
+    for (auto* array : {&x, &y, &vx, &vy, &depth, &depth_target, &swim_phase, &swim_speed,
+                        &extent_w, &extent_h, &steer_x, &steer_y, &frame_roll, &prev_x, &prev_y,
+                        &prev_depth, &turn_progress}) {
+        array->assign(padded, 0.0f);
+    }
+    for (auto* array : {&facing_right, &is_turning, &turn_start_facing_right, &turn_via_tail}) {
+        array->assign(padded, 0);
+    }
+    prev_rect.assign(count, DirtyRect{0, 0, 0, 0});
+    curr_rect.assign(count, DirtyRect{0, 0, 0, 0});
+    center_x.assign(count, 0.0f);
+    center_y.assign(count, 0.0f);
+    rng.resize(padded);
+    // 魚ごとに異なる 0 以外の初期値を作る
+    for (size_t i = 0; i < padded; i++) {
+        rng[i] = simSeed(seed + 0x9E3779B9u * (uint32_t)(i + 1));
+    }
+}
+
+void FishSchool::update(float delta_sec, int screen_width, int screen_height,
+                        float (*draw_scale)(float)) {
+    // 描画位置の補間用に、進める前の位置と奥行きを残す
+    prev_x = x;
+    prev_y = y;
+    prev_depth = depth;
+
+    // 長さが LANES の倍数であることをコンパイラに伝える（端数処理のないループにする）
+    size_t padded = x.size() & ~(size_t)(LANES - 1);
+    integrate(padded, delta_sec, (float)screen_width, (float)screen_height, x.data(), y.data(),
+              vx.data(), vy.data(), depth.data(), depth_target.data(), swim_phase.data(),
+              swim_speed.data(), extent_w.data(), extent_h.data(), steer_x.data(), steer_y.data(),
+              frame_roll.data(), rng.data());
+
+    // 2 つ目のループ: 方向転換の状態と、画面端の反射・当たり判定に使う大きさ
+    const float turn_step = delta_sec / TURN_DURATION;
+    for (int i = 0; i < _count; i++) {
+        if (is_turning[i]) {
+            turn_progress[i] += turn_step;
+            if (turn_progress[i] >= 1.0f) {
+                turn_progress[i] = 1.0f;
+                is_turning[i] = false;
+            }
+        }
+        // 速度の符号が変わったら方向転換アニメーションを開始
+        if (!is_turning[i] && (vx[i] > 0) != (bool)facing_right[i]) {
+            startTurn(i);
+        }
+
+        float scale = draw_scale(depth[i]);
+        extent_w[i] = (float)(int)(FISH_WIDTH * scale);
+        extent_h[i] = (float)(int)(FISH_HEIGHT * scale);
+        center_x[i] = (int)x[i] + extent_w[i] * 0.5f;
+        center_y[i] = (int)y[i] + extent_h[i] * 0.5f;
+    }
+}
+
+void FishSchool::layout(float alpha, float (*draw_scale)(float)) {
+    for (int i = 0; i < _count; i++) {
+        // 前回の描画位置・サイズを保存し、直前のステップとの間を補間した位置・サイズを計算
+        prev_rect[i] = curr_rect[i];
+        float fx = prev_x[i] + (x[i] - prev_x[i]) * alpha;
+        float fy = prev_y[i] + (y[i] - prev_y[i]) * alpha;
+        float scale = draw_scale(prev_depth[i] + (depth[i] - prev_depth[i]) * alpha);
+        DirtyRect& rect = curr_rect[i];
+        rect.x = (int)fx;
+        rect.y = (int)fy;
+        rect.w = (int)(FISH_WIDTH * scale);
+        rect.h = (int)(FISH_HEIGHT * scale);
+    }
+}
+
+DirtyRect FishSchool::bounds(int i) const {
+    return DirtyRect{(int)x[i], (int)y[i], (int)extent_w[i], (int)extent_h[i]};
+}
+
+uint32_t FishSchool::checksum() const {
+    // 浮動小数点数はビット列のまま混ぜる（FNV-1a）
+    uint32_t hash = 2166136261u;
+    auto mix = [&](const void* data, size_t bytes) {
+        const uint8_t* p = (const uint8_t*)data;
+        for (size_t k = 0; k < bytes; k++) {
+            hash = (hash ^ p[k]) * 16777619u;
+        }
+    };
+    for (const auto* array : {&x, &y, &vx, &vy, &depth, &depth_target, &swim_phase, &turn_progress}) {
+        mix(array->data(), _count * sizeof(float));
+    }
+    mix(rng.data(), _count * sizeof(uint32_t));
+    mix(facing_right.data(), _count);
+    mix(is_turning.data(), _count);
+    return hash;
+}
+
+void FishSchool::steer(const SpatialGrid* grid) {
+    const float radius_sq = (float)BOIDS_RADIUS * BOIDS_RADIUS;
+    const float separation_sq = BOIDS_SEPARATION * BOIDS_SEPARATION;
+    const float attract_sq = TOUCH_ATTRACT_RADIUS * TOUCH_ATTRACT_RADIUS;
+    for (int i = 0; i < _count; i++) {
+        const float cx = center_x[i];
+        const float cy = center_y[i];
+        int neighbors = 0;
+        float sum_vx = 0.0f, sum_vy = 0.0f;  // 整列: 近傍の速度の合計
+        float sum_dx = 0.0f, sum_dy = 0.0f;  // 結合: 近傍への向きの合計
+        float sep_x = 0.0f, sep_y = 0.0f;    // 分離: 近すぎる魚から離れる向き
+        auto visit = [&](int j) {
+            float dx = center_x[j] - cx;
+            float dy = center_y[j] - cy;
+            float dist_sq = dx * dx + dy * dy;
+            if (j == i || dist_sq >= radius_sq) {
+                return;
+            }
+            neighbors++;
+            sum_vx += vx[j];
+            sum_vy += vy[j];
+            sum_dx += dx;
+            sum_dy += dy;
+            if (dist_sq < separation_sq && dist_sq > 0.0f) {
+                // 近いほど強く押し返す
+                float dist = sqrtf(dist_sq);
+                float push = (BOIDS_SEPARATION - dist) / (BOIDS_SEPARATION * dist);
+                sep_x -= dx * push;
+                sep_y -= dy * push;
+            }
+        };
+        if (grid) {
+            grid->forEachNear(cx, cy, (float)BOIDS_RADIUS, visit);
+        } else {
+            for (int j = 0; j < _count; j++) {
+                visit(j);
+            }
+        }
+
+        float ax = 0.0f;
+        float ay = 0.0f;
+        if (neighbors > 0) {
+            float inv = 1.0f / neighbors;
+            ax += (sum_vx * inv - vx[i]) * BOIDS_ALIGNMENT_WEIGHT;
+            ay += (sum_vy * inv - vy[i]) * BOIDS_ALIGNMENT_WEIGHT;
+            // 近傍の重心への向き（距離は BOIDS_RADIUS で正規化して速度の単位に合わせる）
+            ax += sum_dx * inv / BOIDS_RADIUS * BOIDS_COHESION_WEIGHT * MAX_SPEED;
+            ay += sum_dy * inv / BOIDS_RADIUS * BOIDS_COHESION_WEIGHT * MAX_SPEED;
+            ax += sep_x * BOIDS_SEPARATION_WEIGHT * MAX_SPEED;
+            ay += sep_y * BOIDS_SEPARATION_WEIGHT * MAX_SPEED;
+        }
+        if (_attract_strength != 0.0f) {
+            float dx = _attract_x - cx;
+            float dy = _attract_y - cy;
+            float dist_sq = dx * dx + dy * dy;
+            if (dist_sq < attract_sq && dist_sq > 1.0f) {
+                float scale = _attract_strength / sqrtf(dist_sq);
+                ax += dx * scale;
+                ay += dy * scale;
+            }
+        }
+        steer_x[i] = ax;
+        steer_y[i] = ay;
+    }
+}
+
+void FishSchool::setAttractor(float x, float y, float strength) {
+    _attract_x = x;
+    _attract_y = y;
+    _attract_strength = strength;
+}
+
+void FishSchool::reverse(int i) {
+    if (is_turning[i]) {
+        return;
+    }
+    vx[i] = -vx[i];
+    vy[i] = -vy[i];
+    startTurn(i);
+}
+
+void FishSchool::resetRect(int i, float scale) {
+    DirtyRect rect = {(int)x[i], (int)y[i], (int)(FISH_WIDTH * scale), (int)(FISH_HEIGHT * scale)};
+    prev_rect[i] = rect;
+    curr_rect[i] = rect;
+    prev_x[i] = x[i];
+    prev_y[i] = y[i];
+    prev_depth[i] = depth[i];
+    extent_w[i] = (float)rect.w;
+    extent_h[i] = (float)rect.h;
+    center_x[i] = rect.x + rect.w * 0.5f;
+    center_y[i] = rect.y + rect.h * 0.5f;
+}
+
+// 古い向きを保存して新しい向きに即座に切り替え、回転方向をランダムに選ぶ
+void FishSchool::startTurn(int i) {
+    turn_start_facing_right[i] = facing_right[i];
+    facing_right[i] = vx[i] > 0;
+    is_turning[i] = true;
+    turn_progress[i] = 0.0f;
+    turn_via_tail[i] = simUniform(rng[i]) < 0.5f;
+}
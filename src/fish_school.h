@@ -0,0 +1,86 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <vector>
+
+#include "dirty_region.h"
+#include "spatial_grid.h"
+
+// 魚の群れ（Structure of Arrays）
+//
+// 毎フレーム全ての魚について読み書きする物理量（位置・速度・奥行き・泳ぎの位相）は
+// 種類ごとの配列に分け、update() の 1 つ目のループを分岐のない配列演算にする
+// （ホストではそのまま自動ベクトル化される）。乱数は魚ごとの xorshift32 で、random() は使わない。
+// 方向転換の状態と描画矩形は別の配列に置き、2 つ目のループでまとめて更新する。
+// 配列は LANES の倍数の長さで確保し、余りの要素も同じように計算する（結果は使わない）。
+// 群れの行動（分離・整列・結合とタッチへの反応）は steer() が加速度として計算し、
+// 次の update() で速度に加える。近傍は SpatialGrid で探す（渡さなければ全ての組を調べる）。
+// update() は固定刻みのステップで呼び、描画矩形は layout() で直前のステップとの間を補間して作る
+// （シミュレーションの状態は描画のタイミングに左右されない）。
+struct FishSchool {
+    static const int LANES = 8;
+
+    // count 匹分の配列を確保する（値は呼び出し側で設定する）。乱数の状態は seed から作る
+    void resize(int count, uint32_t seed);
+    int size() const { return _count; }
+    bool empty() const { return _count == 0; }
+
+    // delta_sec 秒進める。draw_scale は奥行きから描画スケールを返す関数
+    void update(float delta_sec, int screen_width, int screen_height, float (*draw_scale)(float));
+    // 直前のステップの状態から alpha（0.0〜1.0）だけ進めた位置で描画矩形を計算する
+    void layout(float alpha, float (*draw_scale)(float));
+    // 補間しないシミュレーション上の矩形（当たり判定用。描画矩形とは最大 1 ステップ分ずれる）
+    DirtyRect bounds(int i) const;
+    // シミュレーションの状態のハッシュ（記録の再生が一致しているかの確認用）
+    uint32_t checksum() const;
+    // 描画矩形の中心から群れの加速度を計算する。grid には中心座標を登録しておく
+    void steer(const SpatialGrid* grid);
+    // タッチ位置 (x, y) に近い魚を strength（秒あたりの速度変化）で引き寄せる（負なら遠ざける）
+    void setAttractor(float x, float y, float strength);
+    void clearAttractor() { _attract_strength = 0.0f; }
+    // 速度を反転して方向転換を始める（転換中なら何もしない）
+    void reverse(int i);
+    // 現在の位置と奥行きから描画矩形を計算し直す（初期化時。prev も同じにする）
+    void resetRect(int i, float scale);
+
+    // 物理量（1 つ目のループ）
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> depth;         // 0.0=最も奥、1.0=最も手前
+    std::vector<float> depth_target;  // 奥行きの目標値
+    std::vector<float> swim_phase;    // 泳ぎのアニメーション位相（0.0〜6.0）
+    std::vector<float> swim_speed;    // 泳ぎの速度（個体差）
+    std::vector<float> extent_w;      // シミュレーション上の大きさ（画面端の反射に使う）
+    std::vector<float> extent_h;
+    std::vector<float> steer_x;       // 群れの行動による加速度（steer() が設定する）
+    std::vector<float> steer_y;
+    std::vector<float> frame_roll;    // 泳ぎの 1 周ごとに引き直す乱数（フレームの間引きに使う）
+    std::vector<uint32_t> rng;        // 魚ごとの乱数の状態（0 以外）
+    std::vector<float> prev_x;        // 直前のステップの位置と奥行き（描画位置の補間用）
+    std::vector<float> prev_y;
+    std::vector<float> prev_depth;
+
+    // 方向転換の状態（2 つ目のループ）
+    std::vector<float> turn_progress;  // 方向転換の進行度（0.0〜1.0）
+    std::vector<uint8_t> facing_right;
+    std::vector<uint8_t> is_turning;
+    std::vector<uint8_t> turn_start_facing_right;  // 方向転換開始時の向き
+    std::vector<uint8_t> turn_via_tail;            // 尾経由で回転するか（false=正面経由）
+
+    // 前回と今回の描画矩形（部分更新用、layout() が設定する）
+    std::vector<DirtyRect> prev_rect;
+    std::vector<DirtyRect> curr_rect;
+    // シミュレーション上の矩形の中心（群れの計算と SpatialGrid に使う）
+    std::vector<float> center_x;
+    std::vector<float> center_y;
+
+private:
+    void startTurn(int i);
+
+    int _count = 0;
+    float _attract_x = 0.0f;
+    float _attract_y = 0.0f;
+    float _attract_strength = 0.0f;
+};
@@ -0,0 +1,334 @@
+#include "fish_sprite.h"
+
+#include "memory_budget.h"
+
+SpriteFormat sprite_format = SpriteFormat::Indexed;
+bool scale_antialias = true;
+bool separable_scale = true;
+bool indexed_row_scale = false;
+ScaleFilter scale_filter;
+
+static M5Canvas scratch_canvas;  // Spans 形式を拡大縮小するときの展開先（scratch_pixels の一部を割り当てる）
+static uint16_t* scratch_pixels = nullptr;  // 大きさが変わっても作り直さないよう、最大の大きさで確保する
+static size_t scratch_capacity = 0;  // scratch_pixels のピクセル数
+static uint8_t* scale_alpha = nullptr;  // scaleFishSprite の元画像と縮小結果のアルファ（最大の大きさで確保）
+static uint16_t* scale_pixels = nullptr;  // scaleFishSprite の縮小結果の色
+static size_t scale_capacity = 0;  // scale_alpha のバイト数（scale_pixels も同じピクセル数）
+
+// 縮小した色をパレットに戻すときの直前の結果（同じ色が続くので探索を省く）
+static const int MATCH_CACHE_SIZE = 1024;
+static uint32_t match_keys[MATCH_CACHE_SIZE];  // (アルファ << 16 | RGB565) + 1、0 は空き
+static uint8_t match_values[MATCH_CACHE_SIZE];
+static const SpritePalette* match_palette = nullptr;
+
+// 描画先に収まる部分の面積
+static uint32_t clippedArea(const M5Canvas* dst, int x, int y, int w, int h) {
+    int x0 = max(0, x);
+    int y0 = max(0, y);
+    int x1 = min((int)dst->width(), x + w);
+    int y1 = min((int)dst->height(), y + h);
+    return (x1 > x0 && y1 > y0) ? (uint32_t)(x1 - x0) * (y1 - y0) : 0;
+}
+
+size_t FishSprite::bytes() const {
+    if (!indexed.empty()) {
+        return indexed.bytes();
+    }
+    if (!spans.empty()) {
+        return spans.bytes();
+    }
+    return (size_t)canvas.width() * canvas.height() * 2;
+}
+
+void FishSprite::release() {
+    canvas.deleteSprite();
+    spans.release();
+    indexed.release();
+    width = 0;
+    height = 0;
+}
+
+bool finishFishSprite(FishSprite& sprite, const uint8_t* alpha) {
+    sprite.width = sprite.canvas.width();
+    sprite.height = sprite.canvas.height();
+    if (sprite_format == SpriteFormat::Canvas || !sprite.loaded()) {
+        return sprite.loaded();
+    }
+    const uint16_t* pixels = (const uint16_t*)sprite.canvas.getBuffer();
+    bool ok = (sprite_format == SpriteFormat::Alpha || sprite_format == SpriteFormat::Indexed) && alpha
+        ? sprite.spans.buildAlpha(pixels, alpha, sprite.width, sprite.height, sprite.width)
+        : sprite.spans.build(pixels, sprite.width, sprite.height, sprite.width, TFT_BLACK);
+    if (!ok) {
+        M5_LOGW("Span encoding failed, keeping canvas (%dx%d)", sprite.width, sprite.height);
+        return true;
+    }
+    sprite.canvas.deleteSprite();
+    return true;
+}
+
+bool buildIndexedFishSprite(FishSprite& sprite, const uint8_t* indices, int w, int h,
+                            const SpritePalette* palette) {
+    if (!sprite.indexed.build(indices, w, h, w, palette)) {
+        M5_LOGW("Indexed encoding failed (%dx%d, Free PSRAM: %d)", w, h, ESP.getFreePsram());
+        return false;
+    }
+    sprite.width = w;
+    sprite.height = h;
+    return true;
+}
+
+M5Canvas* fishSpriteCanvas(FishSprite& sprite) {
+    if (sprite.spans.empty() && sprite.indexed.empty()) {
+        return &sprite.canvas;
+    }
+    if (scratch_canvas.width() != sprite.width || scratch_canvas.height() != sprite.height) {
+        size_t pixels = (size_t)sprite.width * sprite.height;
+        if (pixels > scratch_capacity) {
+            budgetedFree(scratch_pixels, scratch_capacity * sizeof(uint16_t), MemoryOwner::SpriteScratch);
+            scratch_pixels = (uint16_t*)budgetedAlloc(pixels * sizeof(uint16_t), MemoryOwner::SpriteScratch);
+            scratch_capacity = scratch_pixels ? pixels : 0;
+            if (!scratch_pixels) {
+                M5_LOGE("Failed to create scratch canvas (%dx%d)", sprite.width, sprite.height);
+                return nullptr;
+            }
+        }
+        scratch_canvas.setBuffer(scratch_pixels, sprite.width, sprite.height, lgfx::rgb565_2Byte);
+    }
+    uint16_t* pixels = (uint16_t*)scratch_canvas.getBuffer();
+    if (!sprite.indexed.empty()) {
+        sprite.indexed.decode(pixels, scratch_canvas.width(), TFT_BLACK);
+    } else {
+        sprite.spans.decode(pixels, scratch_canvas.width(), TFT_BLACK);
+    }
+    return &scratch_canvas;
+}
+
+// scale_alpha / scale_pixels を bytes バイト（ピクセル）以上にする
+static bool reserveScaleBuffers(size_t bytes) {
+    if (bytes <= scale_capacity) {
+        return true;
+    }
+    budgetedFree(scale_alpha, scale_capacity, MemoryOwner::ScaleBuffers);
+    budgetedFree(scale_pixels, scale_capacity * sizeof(uint16_t), MemoryOwner::ScaleBuffers);
+    scale_alpha = (uint8_t*)budgetedAlloc(bytes, MemoryOwner::ScaleBuffers);
+    scale_pixels = (uint16_t*)budgetedAlloc(bytes * sizeof(uint16_t), MemoryOwner::ScaleBuffers);
+    if (!scale_alpha || !scale_pixels) {
+        budgetedFree(scale_alpha, bytes, MemoryOwner::ScaleBuffers);
+        budgetedFree(scale_pixels, bytes * sizeof(uint16_t), MemoryOwner::ScaleBuffers);
+        scale_alpha = nullptr;
+        scale_pixels = nullptr;
+    }
+    scale_capacity = scale_alpha ? bytes : 0;
+    return scale_capacity > 0;
+}
+
+// 乗算済みの色（スワップ済み RGB565）とアルファを面積平均で縮小する
+static void downscaleAlpha(const uint16_t* src, const uint8_t* src_alpha, int sw, int sh,
+                           uint16_t* dst, uint8_t* dst_alpha, int dw, int dh) {
+    for (int dy = 0; dy < dh; dy++) {
+        int y0 = dy * sh / dh;
+        int y1 = max(y0 + 1, (dy + 1) * sh / dh);
+        for (int dx = 0; dx < dw; dx++) {
+            int x0 = dx * sw / dw;
+            int x1 = max(x0 + 1, (dx + 1) * sw / dw);
+            uint32_t r = 0, g = 0, b = 0, a = 0;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    uint16_t px = src[y * sw + x];
+                    px = (uint16_t)((px << 8) | (px >> 8));
+                    r += px >> 11;
+                    g += (px >> 5) & 63;
+                    b += px & 31;
+                    a += src_alpha[y * sw + x];
+                }
+            }
+            uint32_t n = (uint32_t)(y1 - y0) * (x1 - x0);
+            uint16_t px = (uint16_t)((((r + n / 2) / n) << 11) | (((g + n / 2) / n) << 5) |
+                                     ((b + n / 2) / n));
+            dst[dy * dw + dx] = (uint16_t)((px << 8) | (px >> 8));
+            dst_alpha[dy * dw + dx] = (uint8_t)((a + n / 2) / n);
+        }
+    }
+}
+
+// 乗算済みの色（スワップ済み）とアルファを、一番近いパレットの色の番号にする
+static uint8_t matchPalette(const SpritePalette* palette, uint16_t px, uint8_t a) {
+    if (a == 0) {
+        return 0;
+    }
+    if (palette != match_palette) {
+        memset(match_keys, 0, sizeof(match_keys));
+        match_palette = palette;
+    }
+    uint16_t native = (uint16_t)((px << 8) | (px >> 8));
+    uint32_t key = ((uint32_t)a << 16 | native) + 1;
+    uint32_t slot = (key * 2654435761u) >> 22;  // 上位 10 ビット
+    if (match_keys[slot] != key) {
+        match_keys[slot] = key;
+        match_values[slot] = palette->nearest(native, a);
+    }
+    return match_values[slot];
+}
+
+bool scaleFishSprite(FishSprite& source, int w, int h, FishSprite& dst) {
+    bool indexed = !source.indexed.empty();
+    if ((sprite_format == SpriteFormat::Alpha || sprite_format == SpriteFormat::Indexed) &&
+        (indexed || !source.spans.empty())) {
+        size_t src_pixels = (size_t)source.width * source.height;
+        // 元画像のアルファは scale_alpha の先頭、縮小結果のアルファはその後ろに置く
+        if (!reserveScaleBuffers(src_pixels + (size_t)w * h)) {
+            M5_LOGE("Failed to allocate scale buffers (%dx%d)", source.width, source.height);
+            return false;
+        }
+        M5Canvas* src_canvas = fishSpriteCanvas(source);
+        if (!src_canvas) {
+            return false;
+        }
+        uint8_t* dst_alpha = scale_alpha + src_pixels;
+        if (indexed) {
+            source.indexed.decodeAlpha(scale_alpha, source.width);
+        } else {
+            source.spans.decodeAlpha(scale_alpha, source.width);
+        }
+        downscaleAlpha((const uint16_t*)src_canvas->getBuffer(), scale_alpha, source.width,
+                       source.height, scale_pixels, dst_alpha, w, h);
+        bool ok;
+        if (indexed && sprite_format == SpriteFormat::Indexed) {
+            // 一番近いパレットの色に戻す（番号は縮小結果のアルファの場所に上書きする）
+            const SpritePalette* palette = source.indexed.palette();
+            for (size_t i = 0; i < (size_t)w * h; i++) {
+                dst_alpha[i] = matchPalette(palette, scale_pixels[i], dst_alpha[i]);
+            }
+            ok = dst.indexed.build(dst_alpha, w, h, w, palette);
+        } else {
+            ok = dst.spans.buildAlpha(scale_pixels, dst_alpha, w, h, w);
+        }
+        if (!ok) {
+            M5_LOGW("Depth cache: failed to encode %dx%d sprite (Free PSRAM: %d)",
+                    w, h, ESP.getFreePsram());
+            return false;
+        }
+        dst.width = w;
+        dst.height = h;
+        return true;
+    }
+
+    M5Canvas* src_canvas = fishSpriteCanvas(source);
+    if (!src_canvas) {
+        return false;
+    }
+    M5Canvas& canvas = dst.canvas;
+    canvas.setPsram(true);  // PSRAMを使用
+    canvas.setColorDepth(16);
+    if (!canvas.createSprite(w, h)) {
+        M5_LOGW("Depth cache: failed to create %dx%d sprite (Free PSRAM: %d)",
+                w, h, ESP.getFreePsram());
+        return false;
+    }
+    canvas.fillSprite(TFT_BLACK);
+    src_canvas->pushRotateZoomWithAA(&canvas, w / 2, h / 2, 0.0f,
+                                     (float)w / source.width, (float)h / source.height,
+                                     TFT_BLACK);
+    return finishFishSprite(dst);
+}
+
+// FishSprite の行 row を ScaleFilter の元の行に展開する
+static void decodeFishRow(const void* source, int row, uint16_t* color, uint8_t* alpha, int* x0, int* x1) {
+    const FishSprite& sprite = *(const FishSprite*)source;
+    if (!sprite.indexed.empty()) {
+        sprite.indexed.decodeRow(row, color, alpha, x0, x1);
+        return;
+    }
+    if (!sprite.spans.empty()) {
+        sprite.spans.decodeRow(row, color, alpha, x0, x1);
+        return;
+    }
+    // キャンバス形式は透過色以外を不透明とする
+    const uint16_t* src = (const uint16_t*)sprite.canvas.getBuffer() + row * sprite.width;
+    *x0 = sprite.width;
+    *x1 = 0;
+    for (int i = 0; i < sprite.width; i++) {
+        bool opaque = src[i] != TFT_BLACK;
+        color[i] = opaque ? (uint16_t)((src[i] << 8) | (src[i] >> 8)) : 0;
+        alpha[i] = opaque ? 32 : 0;
+        if (opaque) {
+            *x0 = min(*x0, i);
+            *x1 = i + 1;
+        }
+    }
+}
+
+// 縮小を scale_filter で描くか
+// （indexed_row_scale なら Indexed 形式は最近傍の blitScaled / blitRow で描く。front-to-back の合成で
+// 行ごとに描け、奥から描き直す領域とも同じ見た目になる）
+static bool useScaleFilter(const FishSprite& sprite, int draw_w, int draw_h) {
+    if (indexed_row_scale && !sprite.indexed.empty()) {
+        return false;
+    }
+    return scale_antialias && separable_scale && (draw_w != sprite.width || draw_h != sprite.height) &&
+           scale_filter.supports(sprite.width, sprite.height, draw_w, draw_h);
+}
+
+uint32_t drawFishSprite(FishSprite& sprite, M5Canvas* dst, int x, int y, int draw_w, int draw_h,
+                        bool mirror) {
+    if (!sprite.loaded()) {
+        return 0;
+    }
+    if (useScaleFilter(sprite, draw_w, draw_h)) {
+        return scale_filter.draw((uint16_t*)dst->getBuffer(), dst->width(), dst->height(), x, y, draw_w, draw_h,
+                                 mirror, &sprite, sprite.width, sprite.height, decodeFishRow);
+    }
+    if (!sprite.indexed.empty()) {
+        // 拡大縮小も含めて表を引いて直接書き込む
+        return sprite.indexed.blitScaled((uint16_t*)dst->getBuffer(), dst->width(), dst->height(),
+                                         x, y, draw_w, draw_h, mirror);
+    }
+    if (draw_w == sprite.width && draw_h == sprite.height) {
+        if (!sprite.spans.empty()) {
+            uint16_t* pixels = (uint16_t*)dst->getBuffer();
+            return mirror ? sprite.spans.blitMirrored(pixels, dst->width(), dst->height(), x, y)
+                          : sprite.spans.blit(pixels, dst->width(), dst->height(), x, y);
+        }
+        if (!mirror) {
+            sprite.canvas.pushSprite(dst, x, y, TFT_BLACK);
+            return clippedArea(dst, x, y, draw_w, draw_h);
+        }
+        // キャンバス形式の反転は等倍の -1 倍ズームで描く（下の拡大縮小と同じ経路）
+    }
+
+    // スケールが元サイズと異なる場合は拡大縮小して描画
+    M5Canvas* source = fishSpriteCanvas(sprite);
+    if (!source) {
+        return 0;
+    }
+    float zoom_x = (float)draw_w / sprite.width * (mirror ? -1.0f : 1.0f);  // 負なら左右反転
+    float zoom_y = (float)draw_h / sprite.height;
+    if (scale_antialias) {
+        source->pushRotateZoomWithAA(dst,
+            x + draw_w / 2, y + draw_h / 2,  // 描画先の中心座標
+            0.0f,  // 回転なし
+            zoom_x, zoom_y,
+            TFT_BLACK);  // 透過色
+    } else {
+        source->pushRotateZoom(dst, x + draw_w / 2, y + draw_h / 2, 0.0f, zoom_x, zoom_y, TFT_BLACK);
+    }
+    return clippedArea(dst, x, y, draw_w, draw_h);
+}
+
+bool fishSpriteHasRows(const FishSprite& sprite, int draw_w, int draw_h) {
+    if (useScaleFilter(sprite, draw_w, draw_h)) {
+        return false;
+    }
+    if (!sprite.indexed.empty()) {
+        return true;
+    }
+    return !sprite.spans.empty() && draw_w == sprite.width && draw_h == sprite.height;
+}
+
+uint32_t drawFishSpriteRow(const FishSprite& sprite, uint16_t* out, int dy, const ColumnRange* ranges,
+                           int count, int draw_w, int draw_h, bool mirror) {
+    if (!sprite.indexed.empty()) {
+        return sprite.indexed.blitRow(out, dy, ranges, count, draw_w, draw_h, mirror);
+    }
+    return sprite.spans.blitRow(out, dy, ranges, count, mirror);
+}
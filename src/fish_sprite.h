@@ -0,0 +1,83 @@
+#pragma once
+
+#include <M5Unified.h>
+
+#include "scale_filter.h"
+#include "span_sprite.h"
+
+// 魚スプライトの保持形式
+enum class SpriteFormat {
+    Canvas,  // 358x200 の RGB565 キャンバス（透過色で描画）
+    Spans,   // 不透明スパンのみ（SpanSprite）
+    Alpha,   // 不透明スパンと半透明スパン（SpanSprite、縁をアルファで合成する）
+    Indexed, // 共有パレットの番号のスパン（IndexedSprite、1 ピクセル 1 バイト。assets.pak が必要）
+};
+
+// 魚スプライト1枚分。形式に応じて canvas / spans / indexed のどれかを保持する
+struct FishSprite {
+    M5Canvas canvas;
+    SpanSprite spans;
+    IndexedSprite indexed;
+    int width = 0;
+    int height = 0;
+
+    bool loaded() const { return width > 0; }
+    size_t bytes() const;
+    void release();  // 画像のメモリを解放して未読み込みに戻す
+};
+
+extern SpriteFormat sprite_format;
+extern bool scale_antialias;  // false なら drawFishSprite() の拡大縮小を AA なし（最近傍）で描く
+extern bool separable_scale;  // false なら drawFishSprite() の AA ありの縮小を pushRotateZoomWithAA で描く（比較用）
+extern bool indexed_row_scale;  // true なら Indexed 形式の縮小も最近傍で描く（front-to-back の合成で行ごとに描けるように）
+extern ScaleFilter scale_filter;  // drawFishSprite() の縮小（setup() で begin() する）
+
+// canvas に読み込まれた画像を sprite_format の形式に変換する
+// （Spans / Alpha の場合は canvas を解放する。Indexed はパレットの番号が無い画像なので Alpha にする）
+// alpha は canvas と同じ大きさのアルファ（Alpha のときだけ使う。nullptr なら透過色から決める）
+bool finishFishSprite(FishSprite& sprite, const uint8_t* alpha = nullptr);
+
+// パレットの番号（w x h）から Indexed 形式の sprite を作る
+bool buildIndexedFishSprite(FishSprite& sprite, const uint8_t* indices, int w, int h,
+                            const SpritePalette* palette);
+
+// source を w x h に縮小した画像を dst に作る（dst は未読み込みであること）
+// Alpha 形式は乗算済みの色とアルファを面積平均で縮小し、縁を半透明で残す。
+// Indexed 形式は同じく縮小してから、一番近いパレットの色に戻す。
+// それ以外は pushRotateZoomWithAA で黒の上に縮小し、透過色で抜く
+bool scaleFishSprite(FishSprite& source, int w, int h, FishSprite& dst);
+
+// 拡大縮小の元画像として使うキャンバスを返す
+// Spans / Alpha / Indexed 形式のときは共有の作業用キャンバスに展開する（次の呼び出しまで有効。
+// 半透明のピクセルは黒の上に合成した色になる）
+M5Canvas* fishSpriteCanvas(FishSprite& sprite);
+
+// dst の (x, y) に draw_w x draw_h で描画する。書き込んだピクセル数（概算）を返す
+// スプライトより小さく描く場合は scale_filter で縦横に分けて面積平均で縮小し、描画先に直接重ねる
+// （全ての形式。半透明の縁はアルファのまま縮小する）。scale_antialias が false なら最近傍で、
+// scale_filter で描けない倍率なら pushRotateZoomWithAA で拡大縮小する
+// （Indexed 形式の最近傍は描画先に直接書き込む）
+// mirror なら左右を反転して描画する（右向きの画像を持たずに左向きの画像から描く）
+uint32_t drawFishSprite(FishSprite& sprite, M5Canvas* dst, int x, int y, int draw_w, int draw_h,
+                        bool mirror = false);
+
+// 行ごとに描けるか（front-to-back の合成で使う。Indexed 形式と、等倍で描く Spans / Alpha 形式。
+// scale_filter で縮小する場合は描けない。Indexed 形式は indexed_row_scale なら scale_filter を使わない）
+bool fishSpriteHasRows(const FishSprite& sprite, int draw_w, int draw_h);
+
+// draw_w x draw_h で描くときの行 dy のスパンについて fn(開始の列, 終わりの列, 半透明か) を呼ぶ
+// （列は描画位置の左端から数える。fishSpriteHasRows() が true のときだけ使える）
+template <class Fn>
+void forEachFishSpriteSpan(const FishSprite& sprite, int dy, int draw_w, int draw_h, bool mirror,
+                           Fn fn) {
+    if (!sprite.indexed.empty()) {
+        sprite.indexed.forEachRowSpan(dy, draw_w, draw_h, mirror, fn);
+    } else {
+        sprite.spans.forEachRowSpan(dy, mirror, fn);
+    }
+}
+
+// 行 dy の列の区間 ranges（昇順、重ならない）に掛かる部分だけを描く
+// （out は描画先のその行の、描画位置の左端）
+uint32_t drawFishSpriteRow(const FishSprite& sprite, uint16_t* out, int dy, const ColumnRange* ranges,
+                           int count, int draw_w, int draw_h, bool mirror);
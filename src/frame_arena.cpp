@@ -0,0 +1,59 @@
+#include "frame_arena.h"
+
+FrameArena::~FrameArena() {
+    reset();
+    free(_block);
+}
+
+bool FrameArena::begin(size_t bytes) {
+    // 確保できなければ今のブロックのまま使えるよう、新しいブロックを確保してから解放する
+    uint8_t* block = (uint8_t*)malloc(bytes);  // 小さく頻繁に触るので内部 RAM に置く
+    _used = 0;
+    if (!block) {
+        M5_LOGE("Failed to allocate frame arena (%u bytes)", (unsigned)bytes);
+        return false;
+    }
+    free(_block);
+    _block = block;
+    _capacity = bytes;
+    return true;
+}
+
+void FrameArena::reset() {
+    for (void* p : _spill) {
+        free(p);
+    }
+    _spill.clear();
+    if (_spilled > 0 && !_grow_failed) {
+        // 溢れた分を含めて 1 ブロックに収まるよう広げる
+        // 広げられなければ今のブロックのまま、以降は溢れた分をヒープから確保し続ける
+        // （毎フレーム広げようとしてログを埋めないように）
+        size_t grown = _capacity + _spilled;
+        M5_LOGW("Frame arena overflow: growing %u -> %u bytes", (unsigned)_capacity,
+                (unsigned)grown);
+        _grow_failed = !begin(grown);
+    }
+    _spilled = 0;
+    _used = 0;
+}
+
+void* FrameArena::allocBytes(size_t bytes, size_t align) {
+    size_t offset = (_used + align - 1) & ~(align - 1);
+    if (_block && offset + bytes <= _capacity) {
+        _used = offset + bytes;
+        _high_water = max(_high_water, _used);
+        return _block + offset;
+    }
+    _overflows++;
+    void* p = malloc(bytes);
+    if (!p) {
+        // 呼び出し側はこのフレームを描かずに済ませる（毎フレーム続くこともあるので最初だけログに出す）
+        if (_failures++ == 0) {
+            M5_LOGE("Frame arena: failed to allocate %u bytes", (unsigned)bytes);
+        }
+        return nullptr;
+    }
+    _spilled += bytes + align;  // ヒープに確保できたときだけ、次の reset() でその分広げる
+    _spill.push_back(p);
+    return p;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <vector>
+
+// 1 フレームの間だけ使う一時データ（描画順、スプライトの選択結果など）のバンプアロケータ
+//
+// 起動時に確保したブロックの先頭から順に切り出し、loop() の先頭の reset() で全て捨てる。
+// 足りない分はヒープから確保して次の reset() で解放し、ブロックをその分だけ大きくする
+// （以降のフレームは確保なしで済む）。デストラクタは呼ばないので、トリビアルな型だけを置く。
+// ヒープから確保できなければ alloc() は nullptr を返す（広げられなければ今のブロックのまま）。
+class FrameArena {
+public:
+    ~FrameArena();
+
+    bool begin(size_t bytes);
+    // フレームの開始時に呼ぶ（前のフレームで確保したものは全て無効になる）
+    void reset();
+
+    // count 個分の領域を返す（初期化しない。確保できなければ nullptr）
+    template <class T>
+    T* alloc(size_t count) {
+        return (T*)allocBytes(sizeof(T) * count, alignof(T));
+    }
+
+    size_t capacity() const { return _capacity; }
+    size_t used() const { return _used; }
+    size_t highWater() const { return _high_water; }
+    uint32_t overflows() const { return _overflows; }  // ブロックに収まらなかった回数
+    uint32_t failures() const { return _failures; }    // ヒープからも確保できなかった回数
+
+private:
+    void* allocBytes(size_t bytes, size_t align);
+
+    uint8_t* _block = nullptr;
+    size_t _capacity = 0;
+    size_t _used = 0;
+    size_t _high_water = 0;
+    size_t _spilled = 0;  // このフレームでヒープから確保したバイト数
+    uint32_t _overflows = 0;
+    uint32_t _failures = 0;
+    bool _grow_failed = false;
+    std::vector<void*> _spill;
+};
@@ -0,0 +1,101 @@
+#include "frame_pacer.h"
+
+#include <M5Unified.h>
+
+namespace {
+
+const char* const QUALITY_NAMES[(int)Quality::Count] = {
+    "full", "no-aa", "coarse-depth", "static-layers", "half-res",
+};
+
+}  // namespace
+
+const char* qualityName(Quality quality) {
+    return quality < Quality::Count ? QUALITY_NAMES[(int)quality] : "?";
+}
+
+void FramePacer::begin(int target_fps) {
+    _target_fps = max(0, target_fps);
+    _period_us = _target_fps > 0 ? 1000000u / _target_fps : 0;
+    _started = false;
+    _quality = Quality::Full;
+    _over = 0;
+    _under = 0;
+    _since_up = 0;
+    _up_hold = UP_HOLD;
+    _missed = false;
+    _pinned = false;
+    _pin_pending = false;
+    resetStats();
+}
+
+void FramePacer::wait() {
+    if (!enabled()) {
+        return;
+    }
+    uint32_t now = millis();
+    if (!_started) {
+        _started = true;
+        _deadline_ms = now;
+        _deadline_frac = 0;
+    }
+    int32_t ahead = (int32_t)(_deadline_ms - now);
+    if (ahead > 0) {
+        delay(ahead);
+        _stats.sleep_ms += ahead;
+    } else if ((uint32_t)-ahead > _period_us / 1000) {
+        // 1 フレーム以上遅れたら、遅れを取り戻そうとせず今から数え直す
+        _deadline_ms = now;
+        _deadline_frac = 0;
+    }
+    _deadline_frac += _period_us;
+    _deadline_ms += _deadline_frac / 1000;
+    _deadline_frac %= 1000;
+}
+
+bool FramePacer::update(uint32_t frame_us) {
+    _missed = enabled() && frame_us > _period_us;
+    _stats.frames++;
+    _stats.misses += _missed;
+    _stats.level_frames[(int)_quality]++;
+    if (_pinned) {
+        bool changed = _pin_pending;
+        _pin_pending = false;
+        return changed;
+    }
+    if (!enabled()) {
+        return false;
+    }
+    _since_up++;
+    _over = _missed ? _over + 1 : 0;
+    _under = frame_us < _period_us * HEADROOM ? _under + 1 : 0;
+
+    int level = (int)_quality;
+    if (_over >= DOWN_FRAMES && level + 1 < (int)Quality::Count) {
+        // 上げた直後に下げ直すなら、次に上げるまでを長くする
+        if (_stats.steps_up > 0 && _since_up < _up_hold) {
+            _up_hold = min(_up_hold * 2, UP_HOLD_MAX);
+        }
+        _quality = (Quality)(level + 1);
+        _stats.steps_down++;
+    } else if (_under >= _up_hold && level > 0) {
+        _quality = (Quality)(level - 1);
+        _stats.steps_up++;
+        _since_up = 0;
+    } else {
+        return false;
+    }
+    _over = 0;
+    _under = 0;
+    return true;
+}
+
+void FramePacer::pin(Quality quality) {
+    _quality = quality;
+    _pinned = true;
+    _pin_pending = true;
+}
+
+void FramePacer::resetStats() {
+    _stats = Stats();
+}
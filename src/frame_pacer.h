@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+// 描画の品質の段階（下の段階ほど軽い。上の段階で下げたものはそのまま下げておく）
+enum class Quality : uint8_t {
+    Full,          // 既定の描画
+    NoAntialias,   // 拡大縮小して描く魚を AA なし（最近傍）にする
+    CoarseDepth,   // 奥行きのレベルを 1 つおきにする（縮小済みスプライトの種類と作り直しを減らす）
+    StaticLayers,  // 水草の揺れを止め、泡を消す（レイヤーの更新領域をなくす）
+    HalfResolution,  // 縦横半分の解像度で合成し、転送するときに 2 倍に広げる
+    Count
+};
+
+const char* qualityName(Quality quality);
+
+// 目標のフレームレートに合わせて loop() の間隔を揃え、間に合わないときは描画の品質を下げる
+//
+// wait() はフレームの開始時刻を 1000 / target_fps ms ごとの刻みに合わせて待つ（delta_ms を
+// 一定にして、動きのがたつきをなくす）。遅れが 1 フレームを超えたら追いつこうとせず刻みを
+// 合わせ直す。update() にはフレームの処理時間（合成と転送の長い方。並行して動くので、
+// 長い方がフレームの間隔を決める）を渡す。予算（1 フレームの時間）を DOWN_FRAMES フレーム
+// 続けて超えたら品質を 1 段下げ、予算の HEADROOM 倍に収まるフレームが up_hold フレーム
+// 続いたら 1 段上げる。上げてすぐ下げ直したときは up_hold を倍にして（UP_HOLD_MAX まで）、
+// 段階の行き来を繰り返さないようにする。
+// target_fps = 0 なら待たず、品質も変えない。
+class FramePacer {
+public:
+    static const uint32_t DOWN_FRAMES = 6;
+    static const uint32_t UP_HOLD = 120;
+    static const uint32_t UP_HOLD_MAX = 960;
+    static constexpr float HEADROOM = 0.6f;
+
+    struct Stats {
+        uint32_t frames;
+        uint32_t misses;       // 処理時間が予算を超えたフレーム数
+        uint32_t steps_down;
+        uint32_t steps_up;
+        uint32_t sleep_ms;     // wait() で待った時間の合計
+        uint32_t level_frames[(int)Quality::Count];  // 段階ごとのフレーム数
+    };
+
+    void begin(int target_fps);
+    bool enabled() const { return _target_fps > 0; }
+    int targetFps() const { return _target_fps; }
+    uint32_t budgetUs() const { return _period_us; }
+    Quality quality() const { return _quality; }
+
+    // 次のフレームの開始時刻まで待つ（loop() の先頭で呼ぶ）
+    void wait();
+    // このフレームの処理時間を記録し、品質の段階を決める。段階が変わったら true
+    bool update(uint32_t frame_us);
+    // 品質をこの段階に固定する（処理時間では変えない。段階ごとの動きを確かめるとき）
+    // 次の update() で true を返す
+    void pin(Quality quality);
+    bool pinned() const { return _pinned; }
+    bool missed() const { return _missed; }  // 直近の update() で予算を超えたか
+
+    const Stats& stats() const { return _stats; }
+    void resetStats();
+
+private:
+    int _target_fps = 0;
+    uint32_t _period_us = 0;
+    uint32_t _deadline_ms = 0;    // 次のフレームの開始時刻
+    uint32_t _deadline_frac = 0;  // _deadline_ms の端数（us）
+    bool _started = false;
+    Quality _quality = Quality::Full;
+    uint32_t _over = 0;   // 続けて予算を超えたフレーム数
+    uint32_t _under = 0;  // 続けて余裕のあったフレーム数
+    uint32_t _since_up = 0;  // 最後に品質を上げてからのフレーム数
+    uint32_t _up_hold = UP_HOLD;
+    bool _missed = false;
+    bool _pinned = false;
+    bool _pin_pending = false;  // 固定した段階をまだ update() で知らせていない
+    Stats _stats = {};
+};
@@ -0,0 +1,309 @@
+#include "frame_stream.h"
+
+#include "profiler.h"
+
+namespace {
+
+const uint32_t BURST_DIVISOR = 8;  // トークンは 1/8 秒分まで溜める
+const int RECT_HEADER_BYTES = 8;
+const int FRAME_BYTES = 16;
+const uint32_t ADLER_MOD = 65521;
+const size_t ADLER_BLOCK = 5552;  // 32 ビットの和があふれない最大のバイト数
+
+// 1 行を圧縮したときの最大のバイト数（128 ピクセルごとに制御バイトが 1 つ）
+inline size_t worstRowBytes(int width) {
+    return (size_t)width * 2 + (width + 127) / 128;
+}
+
+inline void putU16(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+inline void putU32(uint8_t* p, uint32_t v) {
+    putU16(p, v);
+    putU16(p + 2, v >> 16);
+}
+
+// zlib の adler32 と同じ値（受け側の Python は zlib.adler32 で確かめる）
+uint32_t adler32(const uint8_t* data, size_t length) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (length > 0) {
+        size_t n = min(length, ADLER_BLOCK);
+        length -= n;
+        for (size_t i = 0; i < n; i++) {
+            a += data[i];
+            b += a;
+        }
+        data += n;
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return b << 16 | a;
+}
+
+}  // namespace
+
+FrameStream::~FrameStream() {
+    free(_packet);
+}
+
+bool FrameStream::begin(int width, int height, uint32_t bytes_per_sec, Sink sink, void* context) {
+    free(_packet);
+    _packet_capacity = max((size_t)MIN_PACKET_BYTES, RECT_HEADER_BYTES + worstRowBytes(width));
+    _packet = (uint8_t*)malloc(HEADER_BYTES + _packet_capacity + CHECK_BYTES);  // 毎行触るので内部 RAM に置く
+    if (!_packet) {
+        M5_LOGE("Failed to allocate frame stream packet (%u bytes)", (unsigned)_packet_capacity);
+        _packet_capacity = 0;
+        return false;
+    }
+    _sink = sink;
+    _context = context;
+    _width = width;
+    _height = height;
+    _bytes_per_sec = bytes_per_sec;
+    _tokens = bytes_per_sec / BURST_DIVISOR;
+    _last_ms = millis();
+    _tile_size = 32;
+    while ((width + _tile_size - 1) / _tile_size > MAX_TILE_COLUMNS ||
+           (height + _tile_size - 1) / _tile_size > MAX_TILE_ROWS) {
+        _tile_size *= 2;
+    }
+    _tile_columns = (width + _tile_size - 1) / _tile_size;
+    _tile_rows = (height + _tile_size - 1) / _tile_size;
+    requestKeyframe();
+    M5_LOGI("Frame stream: %dx%d, %u bytes/s", width, height, (unsigned)bytes_per_sec);
+    return true;
+}
+
+void FrameStream::requestKeyframe() {
+    addPending(DirtyRect{0, 0, _width, _height});
+}
+
+bool FrameStream::beginFrame(DirtyRegionManager& regions) {
+    if (!enabled()) {
+        return false;
+    }
+    if (_resync.exchange(false)) {
+        requestKeyframe();
+    }
+    uint32_t now = millis();
+    if (_bytes_per_sec > 0) {
+        int64_t refill = (int64_t)_bytes_per_sec * (now - _last_ms) / 1000;
+        _tokens = min(_tokens + refill, (int64_t)(_bytes_per_sec / BURST_DIVISOR));
+    }
+    _last_ms = now;
+    _sending = _bytes_per_sec == 0 || _tokens > 0;
+    if (_sending && _has_pending) {
+        flushPending(regions);
+        _pending_merged++;
+    }
+    return _sending;
+}
+
+bool FrameStream::endFrame(const DirtyRect* regions, size_t count, size_t pixels, bool composed) {
+    if (!enabled() || count == 0) {
+        return false;
+    }
+    if (!_sending || !composed) {
+        for (size_t i = 0; i < count; i++) {
+            addPending(regions[i]);
+        }
+        _frames_dropped++;
+        _dropped_total++;
+        return false;
+    }
+    // 借りた分は次からのフレームを送らないことで返す
+    uint64_t estimate = (uint64_t)pixels * _bytes_per_pixel_q8.load(std::memory_order_relaxed) / 256 +
+                        count * (HEADER_BYTES + RECT_HEADER_BYTES + CHECK_BYTES) + HEADER_BYTES + FRAME_BYTES +
+                        CHECK_BYTES;
+    _tokens -= (int64_t)estimate;
+    return true;
+}
+
+void FrameStream::addPending(const DirtyRect& region) {
+    int x0 = max(0, region.x);
+    int y0 = max(0, region.y);
+    int x1 = min(_width, region.right());
+    int y1 = min(_height, region.bottom());
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
+    int c0 = x0 / _tile_size;
+    int c1 = (x1 - 1) / _tile_size;
+    // c0〜c1 のビット（c1 が 63 でもあふれないよう 2 回に分けてずらす）
+    uint64_t bits = (((uint64_t)2 << c1) - 1) & ~(((uint64_t)1 << c0) - 1);
+    for (int r = y0 / _tile_size; r <= (y1 - 1) / _tile_size; r++) {
+        _pending[r] |= bits;
+    }
+    _has_pending = true;
+}
+
+void FrameStream::flushPending(DirtyRegionManager& regions) {
+    for (int r = 0; r < _tile_rows; r++) {
+        uint64_t row = _pending[r];
+        if (!row) {
+            continue;
+        }
+        _pending[r] = 0;
+        // 続いているタイルを 1 つの矩形にする（多すぎたら行全体の外接矩形）
+        int runs[MAX_ROW_RECTS + 1][2];
+        int count = 0;
+        int first = -1;
+        int last = -1;
+        for (int c = 0; c < _tile_columns; c++) {
+            if (!((row >> c) & 1)) {
+                continue;
+            }
+            if (count > 0 && runs[count - 1][1] == c) {
+                runs[count - 1][1] = c + 1;
+            } else if (count <= MAX_ROW_RECTS) {
+                runs[count][0] = c;
+                runs[count][1] = c + 1;
+                count++;
+            }
+            if (first < 0) first = c;
+            last = c;
+        }
+        if (count > MAX_ROW_RECTS) {
+            runs[0][0] = first;
+            runs[0][1] = last + 1;
+            count = 1;
+        }
+        for (int k = 0; k < count; k++) {
+            int x = runs[k][0] * _tile_size;
+            int y = r * _tile_size;
+            regions.add(x, y, min(_width, runs[k][1] * _tile_size) - x, min(_height, y + _tile_size) - y);
+        }
+    }
+    _has_pending = false;
+}
+
+size_t FrameStream::encodeRow(const uint16_t* row, int width, uint8_t* out) const {
+    uint8_t* p = out;
+    int x = 0;
+    while (x < width) {
+        int run = 1;
+        while (x + run < width && run < 129 && row[x + run] == row[x]) {
+            run++;
+        }
+        if (run >= 2) {
+            *p++ = (uint8_t)(run + 126);
+            memcpy(p, row + x, sizeof(uint16_t));
+            p += sizeof(uint16_t);
+            x += run;
+            continue;
+        }
+        // 同じピクセルが 2 つ続く所の手前までをそのまま
+        int start = x;
+        while (x < width && x - start < 128 && !(x + 1 < width && row[x + 1] == row[x])) {
+            x++;
+        }
+        int literal = x - start;
+        *p++ = (uint8_t)(literal - 1);
+        memcpy(p, row + start, literal * sizeof(uint16_t));
+        p += literal * sizeof(uint16_t);
+    }
+    return p - out;
+}
+
+void FrameStream::writePacket(uint8_t type, uint8_t flags) {
+    uint8_t* p = _packet;
+    p[0] = 'A';
+    p[1] = 'Q';
+    p[2] = type;
+    p[3] = flags;
+    putU16(p + 4, (uint32_t)_packet_used);
+    putU32(p + HEADER_BYTES + _packet_used, adler32(p + 2, HEADER_BYTES - 2 + _packet_used));
+    size_t length = HEADER_BYTES + _packet_used + CHECK_BYTES;
+    size_t written = _sink(_packet, length, _context);
+    _bytes_sent += written;
+    if (written != length) {
+        _write_errors++;
+        _resync = true;
+    }
+}
+
+void FrameStream::send(const DirtyRect* regions, size_t count, const uint16_t* pixels, bool half) {
+    if (!enabled()) {
+        return;
+    }
+    uint32_t t0 = micros();
+    uint8_t* body = _packet + HEADER_BYTES;
+    int shift = half ? 1 : 0;
+    uint64_t pixels_before = _pixels_sent.load(std::memory_order_relaxed);
+    uint64_t bytes_before = _bytes_sent.load(std::memory_order_relaxed);
+    uint32_t rects = 0;
+    for (size_t i = 0; i < count; i++) {
+        const DirtyRect& region = regions[i];
+        int w = region.w >> shift;
+        int h = region.h >> shift;
+        size_t worst = worstRowBytes(w);
+        // パケットに収まるだけの行ずつ送る（行は合成用のバッファから直接読む）
+        for (int row = 0; row < h;) {
+            int first = row;
+            _packet_used = RECT_HEADER_BYTES;
+            while (row < h && _packet_used + worst <= _packet_capacity) {
+                _packet_used += encodeRow(pixels + (size_t)row * w, w, body + _packet_used);
+                row++;
+            }
+            putU16(body, region.x);
+            putU16(body + 2, region.y + (first << shift));
+            putU16(body + 4, region.w);
+            putU16(body + 6, (row - first) << shift);
+            writePacket(PACKET_RECT, half ? FLAG_HALF : 0);
+            rects++;
+        }
+        pixels += (size_t)w * h;
+        _pixels_sent += (uint64_t)w * h;
+    }
+    uint32_t dropped = _dropped_total.load(std::memory_order_relaxed);
+    _packet_used = FRAME_BYTES;
+    putU32(body, _frame_number++);
+    putU32(body + 4, millis());
+    putU16(body + 8, _width);
+    putU16(body + 10, _height);
+    putU16(body + 12, min(rects, (uint32_t)0xFFFF));
+    putU16(body + 14, min(dropped - _dropped_reported, (uint32_t)0xFFFF));
+    _dropped_reported = dropped;
+    writePacket(PACKET_FRAME, 0);
+
+    // 次の見積もりに使うピクセルあたりのバイト数（直近を 1/4 の重みで混ぜる）
+    uint64_t sent_pixels = _pixels_sent.load(std::memory_order_relaxed) - pixels_before;
+    if (sent_pixels > 0) {
+        uint64_t bytes = _bytes_sent.load(std::memory_order_relaxed) - bytes_before;
+        uint32_t q8 = (uint32_t)min(bytes * 256 / sent_pixels, (uint64_t)1024);
+        uint32_t old = _bytes_per_pixel_q8.load(std::memory_order_relaxed);
+        _bytes_per_pixel_q8.store((old * 3 + q8) / 4, std::memory_order_relaxed);
+    }
+    _rects_sent += rects;
+    _frames_sent++;
+    uint32_t t1 = micros();
+    _encode_us += t1 - t0;
+    PROFILE_RECORD(Stream, t0, t1);
+}
+
+FrameStream::Stats FrameStream::stats() const {
+    Stats stats = {};
+    stats.frames_sent = _frames_sent.load();
+    stats.frames_dropped = _frames_dropped;
+    stats.rects_sent = _rects_sent.load();
+    stats.pending_merged = _pending_merged;
+    stats.write_errors = _write_errors.load();
+    stats.pixels_sent = _pixels_sent.load();
+    stats.bytes_sent = _bytes_sent.load();
+    stats.encode_us = _encode_us.load();
+    return stats;
+}
+
+void FrameStream::resetStats() {
+    _frames_sent = 0;
+    _frames_dropped = 0;
+    _rects_sent = 0;
+    _pending_merged = 0;
+    _write_errors = 0;
+    _pixels_sent = 0;
+    _bytes_sent = 0;
+    _encode_us = 0;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <atomic>
+
+#include "dirty_region.h"
+
+// パネルに送る更新領域と同じものを、シリアル（USB CDC）で差分として送り出す
+//
+// 手元の PC で画面を組み立て直して見るためのもの（tools/stream_viewer.py）。
+// 転送タスクが合成用のバッファ（render_pipeline のフレーム）から直接読んで、行ごとの
+// PackBits（assets.pak の index8 と同じ形を 16 ビットのピクセルに使ったもの）で圧縮し、
+// 小さなパケットにして sink に書く（フレームの画像を別のバッファに写さない）。
+//
+// リンクの速さは bytes_per_sec のトークンバケットで見積もる（loop() 側、millis で進める）。
+// トークンが残っているフレームだけを送り、送れなかったフレームの領域は保留にする。保留の領域は
+// ParticleSystem と同じく画面を 32 ピクセル四方（画面が大きければその倍）のタイルの印で持ち、
+// 次に送れるフレームでタイルの行ごとに続いている所を 1 つの矩形にして更新領域に加える
+// （行ごとに MAX_ROW_RECTS を超えたら行全体の外接矩形にまとめる）。何フレーム送れなくても、
+// 保留の領域は送れなかったフレームの更新領域を覆うタイルより広がらない。
+// 加えた領域は描き直し、そのフレームと一緒に送る。
+// トークンは借りて送ってもよい（1 回に送る量が多いキーフレームでも止まらない。その分後のフレームを送らない）。
+// 圧縮後の大きさはピクセルあたりのバイト数の移動平均で見積もる（転送タスクが更新する）。
+//
+// パケットの形式（リトルエンディアン。ピクセルは合成用のバッファと同じビッグエンディアンの RGB565）:
+//   0 'A' 'Q'  2 u8 種類  3 u8 フラグ  4 u16 内容のバイト数  6 内容  末尾 u32 Adler-32（種類から内容まで）
+//   PACKET_RECT:  x(u16) y(u16) w(u16) h(u16)、続けて h 行分の PackBits
+//                 （n < 128: 続く n + 1 ピクセルをそのまま, n >= 128: 次の 1 ピクセルを n - 126 回）
+//                 フラグ FLAG_HALF なら w / 2 x h / 2 のピクセルで、受け側で縦横 2 倍に広げる
+//   PACKET_FRAME: frame(u32) time_ms(u32) width(u16) height(u16) rects(u16) dropped(u16)
+//                 そのフレームの矩形を送り終えた印（dropped は前に送ってから送らなかったフレーム数）
+// ログと同じシリアルに流れても、受け側は 'A' 'Q' と検査値で区切りを見つけ直せる。
+// 書き込みが途中で失敗したら、次のフレームで画面全体を送り直す。
+class FrameStream {
+public:
+    static const uint8_t PACKET_RECT = 1;
+    static const uint8_t PACKET_FRAME = 2;
+    static const uint8_t FLAG_HALF = 1 << 0;
+    static const int HEADER_BYTES = 6;
+    static const int CHECK_BYTES = 4;
+    static const int MIN_PACKET_BYTES = 8192;  // 内容の上限（1 行が収まらなければ広げる）
+    static const int MAX_TILE_COLUMNS = 64;  // タイルの行を uint64_t の印で持つ
+    static const int MAX_TILE_ROWS = 64;
+    static const int MAX_ROW_RECTS = 4;
+
+    // data を length バイト書いて、書けたバイト数を返す
+    typedef size_t (*Sink)(const uint8_t* data, size_t length, void* context);
+
+    struct Stats {
+        uint32_t frames_sent;
+        uint32_t frames_dropped;  // リンクが追いつかず送らなかったフレーム
+        uint32_t rects_sent;      // 送った PACKET_RECT の数
+        uint32_t pending_merged;  // 保留の領域を後のフレームに加えた回数
+        uint32_t write_errors;    // 書き込みが途中で失敗したパケット
+        uint64_t pixels_sent;     // 送ったピクセル数（半分の解像度のフレームは半分の解像度で数える）
+        uint64_t bytes_sent;      // パケットの見出しを含む
+        uint64_t encode_us;       // 転送タスクで圧縮して書いた時間の合計
+    };
+
+    FrameStream() {}
+    ~FrameStream();
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+
+    // width x height の画面を送り始める（bytes_per_sec = 0 ならリンクの速さで制限しない）
+    // 最初のフレームで画面全体を送る
+    bool begin(int width, int height, uint32_t bytes_per_sec, Sink sink, void* context);
+    bool enabled() const { return _packet != nullptr; }
+    // 次に送るフレームで画面全体を送る（受け側が途中から繋いだとき）
+    void requestKeyframe();
+
+    // loop() 側: 更新領域を統合する前に呼ぶ。このフレームを送るなら保留の領域を regions に加える
+    bool beginFrame(DirtyRegionManager& regions);
+    // loop() 側: 合成した後、submit() の前に呼ぶ。送るなら true（render_pipeline.markStream() する）
+    // 送らないなら領域を保留にする。composed = false（合成できなかった）なら送らない
+    bool endFrame(const DirtyRect* regions, size_t count, size_t pixels, bool composed);
+    // 1 フレームで更新領域に加える最大数
+    size_t maxRects() const { return enabled() ? (size_t)_tile_rows * MAX_ROW_RECTS : 0; }
+
+    // 転送タスク側: フレームの領域を圧縮して送る（pixels は領域ごとの画像を詰めたもの）
+    void send(const DirtyRect* regions, size_t count, const uint16_t* pixels, bool half);
+
+    Stats stats() const;
+    void resetStats();
+
+private:
+    // 保留の領域に加える（region に掛かるタイルに印を付ける）
+    void addPending(const DirtyRect& region);
+    // 保留のタイルの印を更新領域にして regions に加え、印を消す
+    void flushPending(DirtyRegionManager& regions);
+    // 行を圧縮して _packet に書く。書いたバイト数を返す
+    size_t encodeRow(const uint16_t* row, int width, uint8_t* out) const;
+    // _packet の内容（_packet_used バイト）を見出しと検査値で包んで書く
+    void writePacket(uint8_t type, uint8_t flags);
+
+    Sink _sink = nullptr;
+    void* _context = nullptr;
+    int _width = 0;
+    int _height = 0;
+    uint8_t* _packet = nullptr;   // 見出し + 内容 + 検査値（転送タスク側で使う）
+    size_t _packet_capacity = 0;  // 内容の上限
+    size_t _packet_used = 0;
+
+    // loop() 側でだけ使う
+    uint32_t _bytes_per_sec = 0;
+    int64_t _tokens = 0;
+    uint32_t _last_ms = 0;
+    bool _sending = false;
+    int _tile_size = 32;
+    int _tile_columns = 0;
+    int _tile_rows = 0;
+    uint64_t _pending[MAX_TILE_ROWS] = {};  // 保留のタイルの印
+    bool _has_pending = false;
+    uint32_t _frames_dropped = 0;
+    uint32_t _pending_merged = 0;
+    std::atomic<uint32_t> _dropped_total{0};  // 送らなかったフレームの累計（PACKET_FRAME の dropped に使う）
+
+    // 転送タスク側でだけ使う
+    uint32_t _frame_number = 0;
+    uint32_t _dropped_reported = 0;  // PACKET_FRAME で知らせた送らなかったフレーム数
+
+    // 転送タスクから更新する
+    std::atomic<uint32_t> _bytes_per_pixel_q8{512};  // 圧縮後のピクセルあたりのバイト数 * 256
+    std::atomic<bool> _resync{false};
+    std::atomic<uint32_t> _frames_sent{0};
+    std::atomic<uint32_t> _rects_sent{0};
+    std::atomic<uint32_t> _write_errors{0};
+    std::atomic<uint64_t> _pixels_sent{0};
+    std::atomic<uint64_t> _bytes_sent{0};
+    std::atomic<uint64_t> _encode_us{0};
+};
@@ -4,91 +4,99 @@
 #include <cmath>
 #include <algorithm>
 
-// ネオンテトラの構造体
-struct NeonTetra {
-    float x;           // X座標
-    float y;           // Y座標
-    float vx;          // X方向の速度
-    float vy;          // Y方向の速度
-    bool facing_right; // 右向きか左向きか
-    int width;         // 画像幅
-    int height;        // 画像高さ
-    uint32_t last_direction_change; // 最後に方向が変わった時刻
-    float swim_phase;  // 泳ぎのアニメーション位相（0.0〜6.0）
-    float swim_speed;  // 泳ぎの速度（個体差）
-    bool is_turning;   // 方向転換中かどうか
-    float turn_progress; // 方向転換の進行度（0.0〜1.0）
-    bool turn_target_right; // 方向転換後の向き
-    bool turn_start_facing_right; // 方向転換開始時の向き
-    bool turn_via_tail; // 尾経由で回転するか（false=正面経由）
-    // 奥行き（depth）: 0.0=最も奥、1.0=最も手前
-    float depth;
-    float depth_target;  // 奥行きの目標値
-    // 前回の描画位置（部分更新用）
-    int prev_draw_x;
-    int prev_draw_y;
-    int prev_draw_w;
-    int prev_draw_h;
-    // 今回の描画位置
-    int curr_draw_x;
-    int curr_draw_y;
-    int curr_draw_w;
-    int curr_draw_h;
-};
+#include "aquarium.h"
+#include "asset_archive.h"
+#include "coverage_mask.h"
+#include "dirty_region.h"
+#include "fish_animation.h"
+#include "frame_arena.h"
+#include "frame_pacer.h"
+#include "frame_stream.h"
+#include "memory_budget.h"
+#include "particle_system.h"
+#include "profiler.h"
+#include "render_pipeline.h"
+#include "scene_layers.h"
+#include "session_log.h"
+#include "sim_random.h"
+#include "spatial_grid.h"
+#include "sprite_residency.h"
+#include "touch_input.h"
 
 // グローバル変数
-std::vector<NeonTetra> fishes;
+FishSchool fishes;
 LGFX_Device* display;
+int num_fishes = NUM_FISHES;
+FrameStats frame_stats;
 
-// 泳ぎアニメーション用の魚画像（左6フレーム + 右6フレーム）
-M5Canvas fish_sprites_left[6];
-M5Canvas fish_sprites_right[6];
+// 魚の画像（manifest の画像ごとに id を割り当て、必要になったときに読み込む）
+SpriteResidency sprite_residency;
+bool lazy_sprites = true;  // false なら起動時に全て読み込む
+size_t sprite_budget = SPRITE_BUDGET;
 
-// 方向転換用の画像（正面経由）
-M5Canvas fish_sprite_left_90;
-M5Canvas fish_sprite_left_45;
-M5Canvas fish_sprite_front;
-M5Canvas fish_sprite_right_45;
-M5Canvas fish_sprite_right_90;
+// 泳ぎアニメーション用の画像 id（フレーム数は manifest で決まる）
+int swim_left_ids[MAX_SWIM_FRAMES];
+int swim_right_ids[MAX_SWIM_FRAMES];
+int swim_frame_count = 0;
+bool mirror_sprites = true;
 
-// 方向転換用の画像（尾経由）
-M5Canvas fish_sprite_tail;
-M5Canvas fish_sprite_tail_left_45;
-M5Canvas fish_sprite_tail_right_45;
+// 方向転換用の画像 id（FishPose の順、manifest に無いものは -1）
+int turn_ids[POSE_COUNT];
 
-M5Canvas buffer_canvas;  // ダブルバッファ用キャンバス
-M5Canvas background_canvas;  // 背景画像用キャンバス
+M5Canvas buffer_canvas;  // 合成用キャンバス（render_pipeline のバッファの一部を割り当てる）
+RenderPipeline render_pipeline;  // 合成と画面転送を別コアで並行させる
+bool pipelined_render = true;  // false なら loop() の中で転送まで行う
+DirtyRegionManager dirty_regions;
+bool multi_rect_dirty = true;  // false なら従来どおり全更新領域を1矩形にまとめる
+CoverageMask coverage_mask;  // front-to-back の合成で、領域の行ごとに埋まった区間
+bool front_to_back = false;  // true なら手前の魚から描き、隠れた部分を描かない
+DepthSpriteCache depth_cache;  // 奥行きレベルごとの縮小済みスプライト
+int depth_levels = DEPTH_LEVELS;
+size_t depth_cache_budget = DEPTH_CACHE_BUDGET;
+bool depth_cache_preload = false;
+M5Canvas background_canvas;  // 背景画像用キャンバス（静的なレイヤーを重ねたもの）
+SceneLayers scene_layers;  // 動くレイヤー（水草と泡）
+bool scene_layers_enabled = true;
+ParticleSystem particles;
+bool particles_enabled = true;
+float bubble_rate = BUBBLE_RATE;
+bool feeding = true;
 bool sprites_loaded = false;
 bool background_loaded = false;
 int screen_width = 0;
 int screen_height = 0;
 uint16_t bg_color;  // 背景色（フォールバック用）
-
-const int FISH_WIDTH = 358;
-const int FISH_HEIGHT = 200;
-const int NUM_FISHES = 3;
-const float MAX_SPEED = 2.0f;
-const uint32_t DIRECTION_CHANGE_INTERVAL = 3000;  // 3秒
-const float TURN_DURATION = 1.0f;  // 方向転換にかかる時間（秒）
-const float DEPTH_SCALE_MIN = 0.7f;  // 最も奥のスケール（70%）
-const float DEPTH_SCALE_MAX = 1.0f;  // 最も手前のスケール（100%）
-const float DEPTH_CHANGE_SPEED = 0.1f;  // 奥行き変化速度（秒あたり）
-const float DEPTH_TARGET_INTERVAL = 5.0f;  // 奥行き目標変更間隔（秒）
+FrameArena frame_arena;  // フレーム内だけで使う一時データ（loop() の先頭でリセット）
+SpatialGrid fish_grid;  // 魚の中心の一様グリッド（updateFishes() の最後に更新）
+bool schooling = true;
+bool spatial_index = true;
+uint32_t touch_avoid_until = 0;  // このステップまではタップした位置から魚が逃げる
+TouchInput touch_input;  // タッチの変化を時刻付きで溜めるキュー
+bool touch_task = true;  // false なら loop() の先頭でタッチを読む
+int tap_turn_fish = -1;  // タップで方向転換させ、まだ画面に出ていない魚
+uint32_t tap_turn_us = 0;  // そのタップを読み取った時刻（micros）
+uint32_t sim_seed = 1;
+uint32_t sim_tick = 0;
+SessionLog session_log;
+bool session_record = false;
+const char* session_save_path = "/session.aqr";
+const char* SESSION_REPLAY_PATH = "/replay.aqr";  // 起動時にあれば再生する
+bool scene_debug_log = false;  // true なら drawScene() が 60 フレームごとに魚と更新領域をログに出す
+int target_fps = TARGET_FPS;
+int pinned_quality = -1;
+FramePacer frame_pacer;
+M5Canvas background_half;  // 半分の解像度で合成するときの背景（今の水草を含む。品質を下げたときに作る）
+bool half_resolution = false;  // true なら縦横半分の解像度で合成する（frame_pacer の品質で決まる）
+bool full_repaint = false;  // true なら次のフレームで画面全体を更新する
+FrameStream frame_stream;  // 更新領域の差分をシリアルに送り出す（tools/stream_viewer.py で見る）
+bool frame_streaming = false;  // true なら setup() で送り出しを始める
+uint32_t stream_rate = STREAM_BYTES_PER_SEC;
 
 int buffer_max_width = 0;
 int buffer_max_height = 0;
 
-// 関数プロトタイプ
-void initDisplay();
-void loadBackgroundImage();
-void loadFishImages();
-void initFishes();
-void updateFishes(uint32_t delta_ms);
-void drawScene();
-M5Canvas* getFishSprite(const NeonTetra& fish);
-void handleTouch();
-void triggerFishTurn(NeonTetra& fish);
-float getDepthScale(float depth);
+// 差分の送り出し先（USB CDC のシリアル）
+static size_t writeStream(const uint8_t* data, size_t length, void*);
 
 void setup() {
     // M5Stackの初期化
@@ -97,6 +105,35 @@ void setup() {
     
     // ディスプレイの初期化
     initDisplay();
+    render_pipeline.begin(display, pipelined_render);
+    if (front_to_back) {
+        coverage_mask.begin(screen_height);
+        indexed_row_scale = true;
+    }
+    frame_arena.begin(FRAME_ARENA_SIZE);
+    touch_input.begin(touch_task);
+    frame_pacer.begin(target_fps);
+    if (pinned_quality >= 0 && pinned_quality < (int)Quality::Count) {
+        frame_pacer.pin((Quality)pinned_quality);
+    }
+    if (frame_pacer.enabled() || frame_pacer.pinned()) {
+        // 品質を下げたときに使うものは先に確保しておく（フレームの途中で確保しない）
+        // 確保できなければ、品質を下げても半分の解像度にはしない
+        if (!createBudgetedSprite(background_half, screen_width / 2, screen_height / 2,
+                                  MemoryOwner::HalfBackground) ||
+            !render_pipeline.enableHalfResolution()) {
+            M5_LOGW("Half resolution compose disabled");
+            deleteBudgetedSprite(background_half, MemoryOwner::HalfBackground);
+            memory_budget.noteDegraded(MemoryCategory::Scene);
+        }
+        M5_LOGI("Frame pacing: %d fps (%u us budget)", target_fps, (unsigned)frame_pacer.budgetUs());
+    }
+    if (frame_streaming) {
+        frame_stream.begin(screen_width, screen_height, stream_rate, writeStream, nullptr);
+    }
+#if AQUARIUM_PROFILE
+    profiler.begin(PROFILE_WINDOW);
+#endif
     
     // LittleFSの初期化
     if (!LittleFS.begin(true)) {
@@ -104,10 +141,29 @@ void setup() {
         return;
     }
     
+    // 記録の再生・記録を始める（再生時は記録したときの条件に合わせる）
+    beginSession();
+    
+    // 画像アセットの一覧を開く（assets.pak または manifest.txt）
+    asset_archive.open();
+    
     // 背景画像を読み込み
     loadBackgroundImage();
     
+    // 水草と泡のレイヤーを作る
+    if (scene_layers_enabled && scene_layers.begin(screen_width, screen_height, sim_seed)) {
+        memory_budget.charge(MemoryOwner::SceneLayers, scene_layers.bytes());
+    }
+    // 細かい泡と餌の粒子のプールを確保する
+    if (particles_enabled && particles.begin(screen_width, screen_height, PARTICLE_CAPACITY, PELLET_CAPACITY,
+                                             sim_seed)) {
+        particles.setBubbleRate(bubble_rate);
+        memory_budget.charge(MemoryOwner::Particles, particles.bytes());
+    }
+    
     // 魚の画像を読み込み
+    depth_cache.configure(depth_levels, depth_cache_budget);
+    scale_filter.begin(FISH_WIDTH, FISH_HEIGHT);
     loadFishImages();
     
     // 魚を初期化
@@ -116,23 +172,150 @@ void setup() {
     M5_LOGI("Setup complete");
 }
 
+// 描画の品質を quality に合わせる（軽い段階は、それより上の段階で下げたものを含む）
+static void applyQuality(Quality quality);
+// 1 ステップ分のタッチ（step_end_ms までに起きた変化）を反映する
+static void applyStepTouch(uint32_t step_end_ms);
+
 void loop() {
+    // 前のフレームから 1000 / target_fps ms 経つまで待つ（delta_ms を揃える）
+    {
+        PROFILE_SCOPE(Pace);
+        frame_pacer.wait();
+    }
+    
     static uint32_t last_time = millis();
+    static uint32_t sim_accum_ms = 0;  // まだシミュレーションを進めていない時間
     uint32_t current_time = millis();
     uint32_t delta_ms = current_time - last_time;
     last_time = current_time;
     
-    // M5の状態を更新（タッチ情報を取得）
-    M5.update();
+    frame_stats = FrameStats();
+    frame_arena.reset();
+    uint32_t t0 = micros();
     
-    // タッチ処理
-    handleTouch();
+    // 合成先のバッファが転送から戻るのを待つ
+    // （入力を読む前に待つことで、タッチから表示までの遅延を転送 2 回分に抑える）
+    render_pipeline.acquire();
+    uint32_t t_input = micros();
+    frame_stats.wait_us = t_input - t0;
+    PROFILE_RECORD(Wait, t0, t_input);
     
-    // 魚を更新
-    updateFishes(delta_ms);
+    // タッチを別タスクで読んでいなければここで読む（読み取りタスクが M5.Touch を更新するので、
+    // そのときは M5.update() を呼ばない）。反映はステップの先頭で行う
+    if (!touch_input.threaded()) {
+        M5.update();
+        touch_input.poll();
+    }
+    uint32_t t1 = micros();
+    frame_stats.input_us = t1 - t_input;
+    PROFILE_RECORD(Input, t_input, t1);
+    
+    // 固定刻みで魚を更新（経過時間がステップに満たない分は次のフレームに持ち越す）
+    // タッチはステップの番号と一緒に記録・再生するので、同じ入力なら同じ結果になる
+    sim_accum_ms += delta_ms;
+    if (sim_accum_ms > SIM_STEP_MS * MAX_SIM_STEPS) {
+        sim_accum_ms = SIM_STEP_MS * MAX_SIM_STEPS;
+    }
+    while (sim_accum_ms >= SIM_STEP_MS) {
+        sim_accum_ms -= SIM_STEP_MS;
+        // 各ステップにはその終わりの時刻までに読んだタッチを渡す（このフレームの最後のステップは
+        // 今までに読んだ全て。まだステップの無い時刻の入力を次のフレームまで遅らせない）
+        applyStepTouch(sim_accum_ms >= SIM_STEP_MS ? current_time - sim_accum_ms : current_time);
+        updateFishes(SIM_STEP_MS);
+        sim_tick++;
+        if (session_log.wantsCheck(sim_tick)) {
+            session_log.check(sim_tick, fishes.checksum());
+        }
+        if (session_record && session_save_path && sim_tick % SESSION_SAVE_INTERVAL == 0) {
+            saveSession();
+        }
+    }
+    // 描画位置は直前の 2 ステップの間を補間する
+    fishes.layout((float)sim_accum_ms / SIM_STEP_MS, getDrawScale);
+    uint32_t t2 = micros();
+    frame_stats.update_us = t2 - t1;
+    PROFILE_RECORD(Update, t1, t2);
     
     // シーンを描画（最小矩形ダブルバッファ）
     drawScene();
+    uint32_t t3 = micros();
+    frame_stats.total_us = t3 - t0;
+    PROFILE_RECORD(Frame, t0, t3);
+    PROFILE_FRAME();
+    
+    // 合成と転送は並行して動くので、長い方がフレームの間隔を決める（転送は直前に終わったフレームの分）
+    uint32_t frame_us = frame_stats.total_us - frame_stats.wait_us;
+    if (render_pipeline.pipelined()) {
+        frame_us = max(frame_us, render_pipeline.lastPushUs());
+    }
+    frame_stats.quality = (uint32_t)frame_pacer.quality();
+    if (frame_pacer.update(frame_us)) {
+        applyQuality(frame_pacer.quality());
+    }
+    frame_stats.budget_missed = frame_pacer.missed();
+    handleSerialCommand();
+    
+    // 起動から最初のフレームを表示するまでの時間
+    static bool first_frame = true;
+    if (first_frame) {
+        first_frame = false;
+        M5_LOGI("First frame at %u ms", (unsigned)millis());
+    }
+}
+
+void beginSession() {
+    // ベンチマークは setup() の前に session_log に記録を渡す。それ以外は LittleFS から探す
+    if (session_log.mode() == SessionLog::Mode::Off && LittleFS.exists(SESSION_REPLAY_PATH)) {
+        File file = LittleFS.open(SESSION_REPLAY_PATH, "r");
+        std::vector<uint8_t> data(file.size());
+        if (file.read(data.data(), data.size()) == data.size()) {
+            session_log.beginReplay(data.data(), data.size());
+        }
+        file.close();
+    }
+    if (session_log.mode() == SessionLog::Mode::Replay) {
+        const SessionHeader& header = session_log.header();
+        sim_seed = header.seed;
+        num_fishes = header.fish_count;
+        depth_levels = header.depth_levels;
+        schooling = header.flags & SESSION_SCHOOLING;
+        spatial_index = header.flags & SESSION_SPATIAL_INDEX;
+        // 餌は魚の動きに影響するので、記録したときに使っていれば粒子も使う
+        feeding = header.flags & SESSION_FEEDING;
+        particles_enabled = particles_enabled || feeding;
+        M5_LOGI("Replaying session: seed %u, %d fish", (unsigned)sim_seed, num_fishes);
+        if (header.step_ms != SIM_STEP_MS || header.screen_width != screen_width ||
+            header.screen_height != screen_height) {
+            M5_LOGW("Session was recorded with step %u ms on %ux%u, results will differ",
+                    header.step_ms, header.screen_width, header.screen_height);
+        }
+    } else if (session_record) {
+        SessionHeader header = {};
+        header.seed = sim_seed;
+        header.step_ms = SIM_STEP_MS;
+        header.fish_count = num_fishes;
+        header.screen_width = screen_width;
+        header.screen_height = screen_height;
+        header.depth_levels = depth_levels;
+        header.flags = (schooling ? SESSION_SCHOOLING : 0) | (spatial_index ? SESSION_SPATIAL_INDEX : 0) |
+                       (feeding && particles_enabled ? SESSION_FEEDING : 0);
+        session_log.beginRecord(header, SESSION_CHECK_INTERVAL);
+        M5_LOGI("Recording session: seed %u, %d fish", (unsigned)sim_seed, num_fishes);
+    }
+}
+
+// 記録を書き出す（フラッシュへの書き込みでそのフレームは遅れる）
+void saveSession() {
+    File file = LittleFS.open(session_save_path, "w");
+    if (!file) {
+        M5_LOGE("Failed to open %s", session_save_path);
+        return;
+    }
+    const auto& data = session_log.data();
+    file.write(data.data(), data.size());
+    file.close();
+    M5_LOGI("Session saved: %u ticks, %u bytes", (unsigned)sim_tick, (unsigned)data.size());
 }
 
 void initDisplay() {
@@ -157,54 +340,68 @@ void initDisplay() {
     M5_LOGI("Dynamic buffer canvas enabled");
 }
 
+// manifest の static/0, static/1, ... を順に background_canvas に重ねる（黒は透過）
+// 合成時には背景と一緒にコピーされるだけなので、枚数が増えても描画の負荷は変わらない
+static void flattenStaticLayers() {
+    M5Canvas layer;
+    for (int i = 0;; i++) {
+        char name[24];
+        snprintf(name, sizeof(name), "static/%d", i);
+        const AssetEntry* entry = asset_archive.find(name);
+        if (!entry) {
+            break;
+        }
+        deleteBudgetedSprite(layer, MemoryOwner::StaticLayer);
+        if (!createBudgetedSprite(layer, entry->width, entry->height, MemoryOwner::StaticLayer)) {
+            M5_LOGE("Failed to load static layer %s", name);
+            break;
+        }
+        layer.fillSprite(TFT_BLACK);
+        if (!asset_archive.load(*entry, &layer)) {
+            M5_LOGE("Failed to load static layer %s", name);
+            break;
+        }
+        layer.pushSprite(&background_canvas, 0, 0, TFT_BLACK);
+        M5_LOGI("Flattened static layer %s (%dx%d)", name, entry->width, entry->height);
+    }
+    deleteBudgetedSprite(layer, MemoryOwner::StaticLayer);
+}
+
 void loadBackgroundImage() {
     M5_LOGI("=== Starting loadBackgroundImage() ===");
     M5_LOGI("Free heap: %d bytes", ESP.getFreeHeap());
     M5_LOGI("Free PSRAM: %d bytes", ESP.getFreePsram());
     
-    const char* bg_path = "/images/aquarium_background.png";
-    File file = LittleFS.open(bg_path, "r");
+    const AssetEntry* bg_entry = asset_archive.find("background");
+    if (!bg_entry) {
+        M5_LOGE("Background image not found in assets");
+        return;
+    }
+    uint32_t load_start = millis();
+    
+    // 作れなければ背景色で塗って続ける（background_loaded のまま false）
+    if (!createBudgetedSprite(background_canvas, screen_width, screen_height, MemoryOwner::Background)) {
+        M5_LOGE("Failed to create background sprite (Free heap: %d, Free PSRAM: %d)", 
+                ESP.getFreeHeap(), ESP.getFreePsram());
+        memory_budget.noteDegraded(MemoryCategory::Scene);
+        return;
+    }
     
-    if (file) {
-        size_t file_size = file.size();
-        uint8_t* buffer = (uint8_t*)malloc(file_size);
+    background_canvas.fillSprite(bg_color);
+    if (asset_archive.load(*bg_entry, &background_canvas)) {
+        M5_LOGI("Loaded background image: size=%dx%d, depth=%d (%u ms)", 
+                background_canvas.width(), background_canvas.height(), 
+                background_canvas.getColorDepth(), (unsigned)(millis() - load_start));
+        background_loaded = true;
         
-        if (buffer) {
-            file.readBytes((char*)buffer, file_size);
-            file.close();
-            
-            background_canvas.setPsram(true);  // PSRAMを使用
-            background_canvas.setColorDepth(16);
-            background_canvas.createSprite(screen_width, screen_height);
-            
-            if (background_canvas.width() == 0 || background_canvas.height() == 0) {
-                M5_LOGE("Failed to create background sprite (Free heap: %d, Free PSRAM: %d)", 
-                        ESP.getFreeHeap(), ESP.getFreePsram());
-                free(buffer);
-                return;
-            }
-            
-            background_canvas.fillSprite(bg_color);
-            bool png_drawn = background_canvas.drawPng(buffer, file_size, 0, 0);
-            if (png_drawn) {
-                M5_LOGI("Loaded background image: size=%dx%d, depth=%d", 
-                        background_canvas.width(), background_canvas.height(), 
-                        background_canvas.getColorDepth());
-                background_loaded = true;
-                
-                // 背景画像を画面に描画
-                background_canvas.pushSprite(display, 0, 0);
-                M5_LOGI("Background image drawn to display");
-            } else {
-                M5_LOGE("Failed to draw background PNG");
-            }
-            free(buffer);
-        } else {
-            M5_LOGE("Memory allocation failed for background image");
-            file.close();
-        }
+        // 静的なレイヤー（static/N）を背景に重ねて 1 枚にしておく
+        flattenStaticLayers();
+        
+        // 背景画像を画面に描画
+        background_canvas.pushSprite(display, 0, 0);
+        M5_LOGI("Background image drawn to display");
     } else {
-        M5_LOGE("Failed to open background image file: %s", bg_path);
+        M5_LOGE("Failed to load background image");
     }
     
     M5_LOGI("=== Finished loadBackgroundImage() ===");
@@ -212,108 +409,137 @@ void loadBackgroundImage() {
     M5_LOGI("Final free PSRAM: %d bytes", ESP.getFreePsram());
 }
 
+// 右向きの泳ぎ（frames 枚）と方向転換の画像 id を、左向きの画像に SPRITE_MIRRORED を付けたものにする
+static void mirrorRightFacing(int frames) {
+    for (int i = 0; i < frames; i++) {
+        swim_right_ids[i] = swim_left_ids[i] >= 0 ? swim_left_ids[i] | SPRITE_MIRRORED : -1;
+    }
+    for (int t = 0; t < POSE_COUNT; t++) {
+        int source = POSE_MIRROR_OF[t];
+        if (source != POSE_COUNT && turn_ids[source] >= 0) {
+            turn_ids[t] = turn_ids[source] | SPRITE_MIRRORED;
+        }
+    }
+}
+
+// 魚スプライトの予算が足りず、解放できるものも無いとき、右向きの画像を解放して
+// 左向きの画像を反転して描く（mirror_sprites にする。画像の数がほぼ半分になる）
+static void shareMirroredSprites() {
+    for (int i = 0; i < swim_frame_count; i++) {
+        if (!(swim_right_ids[i] & SPRITE_MIRRORED)) {
+            sprite_residency.release(swim_right_ids[i]);
+        }
+    }
+    for (int t = 0; t < POSE_COUNT; t++) {
+        int source = POSE_MIRROR_OF[t];
+        if (source != POSE_COUNT && turn_ids[source] >= 0 && turn_ids[t] >= 0 &&
+            !(turn_ids[t] & SPRITE_MIRRORED)) {
+            sprite_residency.release(turn_ids[t]);
+        }
+    }
+    mirrorRightFacing(swim_frame_count);
+    mirror_sprites = true;
+    memory_budget.noteDegraded(MemoryCategory::Sprites);
+    M5_LOGW("Fish sprites: out of memory, drawing right-facing fish from mirrored left-facing images");
+}
+
 void loadFishImages() {
     M5_LOGI("=== Starting loadFishImages() ===");
     M5_LOGI("Free heap: %d bytes", ESP.getFreeHeap());
     M5_LOGI("Free PSRAM: %d bytes", ESP.getFreePsram());
     
-    // 画像情報の構造体
-    struct ImageInfo {
-        const char* path;
-        M5Canvas* canvas;
-        const char* name;
-    };
-    
-    // 左向き泳ぎアニメーション（6フレーム）
-    ImageInfo left_swim_images[6] = {
-        {"/images/swim/neon_tetra_left_swim1_optimized.png", &fish_sprites_left[0], "left_swim1"},
-        {"/images/swim/neon_tetra_left_swim2_optimized.png", &fish_sprites_left[1], "left_swim2"},
-        {"/images/swim/neon_tetra_left_swim3_optimized.png", &fish_sprites_left[2], "left_swim3"},
-        {"/images/swim/neon_tetra_left_swim4_optimized.png", &fish_sprites_left[3], "left_swim4"},
-        {"/images/swim/neon_tetra_left_swim5_optimized.png", &fish_sprites_left[4], "left_swim5"},
-        {"/images/swim/neon_tetra_left_swim6_optimized.png", &fish_sprites_left[5], "left_swim6"}
-    };
-    
-    // 右向き泳ぎアニメーション（6フレーム）
-    ImageInfo right_swim_images[6] = {
-        {"/images/swim/neon_tetra_right_swim1_optimized.png", &fish_sprites_right[0], "right_swim1"},
-        {"/images/swim/neon_tetra_right_swim2_optimized.png", &fish_sprites_right[1], "right_swim2"},
-        {"/images/swim/neon_tetra_right_swim3_optimized.png", &fish_sprites_right[2], "right_swim3"},
-        {"/images/swim/neon_tetra_right_swim4_optimized.png", &fish_sprites_right[3], "right_swim4"},
-        {"/images/swim/neon_tetra_right_swim5_optimized.png", &fish_sprites_right[4], "right_swim5"},
-        {"/images/swim/neon_tetra_right_swim6_optimized.png", &fish_sprites_right[5], "right_swim6"}
-    };
-    
-    // 方向転換用の画像（正面経由）
-    ImageInfo turn_images[5] = {
-        {"/images/neon_tetra_left_optimized.png", &fish_sprite_left_90, "left_90"},
-        {"/images/neon_tetra_45left_optimized.png", &fish_sprite_left_45, "left_45"},
-        {"/images/neon_tetra_front_optimized.png", &fish_sprite_front, "front"},
-        {"/images/neon_tetra_45right_optimized.png", &fish_sprite_right_45, "right_45"},
-        {"/images/neon_tetra_right_optimized.png", &fish_sprite_right_90, "right_90"}
-    };
+    // パレットの番号で入っていなければ（PNG から読む場合など）アルファ形式で保持する
+    const AssetEntry* first_frame = asset_archive.find("swim_left/0");
+    if (sprite_format == SpriteFormat::Indexed && (!first_frame || !asset_archive.palette(*first_frame))) {
+        M5_LOGW("No palette for fish images, using alpha sprites");
+        sprite_format = SpriteFormat::Alpha;
+    }
+
+    // manifest に載っている魚の画像を登録する（読み込みは必要になったとき）
+    sprite_residency.begin(lazy_sprites ? sprite_budget : 0, lazy_sprites);
+    for (int i = 0; i < MAX_SWIM_FRAMES; i++) {
+        swim_left_ids[i] = -1;
+        swim_right_ids[i] = -1;
+    }
+    for (int i = 0; i < POSE_COUNT; i++) {
+        turn_ids[i] = -1;
+    }
+    int left_frames = 0;
+    int right_frames = 0;
+    // 反転して描く場合、右向きの画像は登録しない（左向きの画像に SPRITE_MIRRORED を付けて使う）
+    for (int i = 0; i < asset_archive.count(); i++) {
+        const AssetEntry& entry = asset_archive.entry(i);
+        int* slot = nullptr;
+        int frame = -1;
+        if (sscanf(entry.name, "swim_left/%d", &frame) == 1 && frame >= 0 && frame < MAX_SWIM_FRAMES) {
+            slot = &swim_left_ids[frame];
+            left_frames = max(left_frames, frame + 1);
+        } else if (sscanf(entry.name, "swim_right/%d", &frame) == 1 && frame >= 0 && frame < MAX_SWIM_FRAMES) {
+            slot = mirror_sprites ? nullptr : &swim_right_ids[frame];
+            right_frames = max(right_frames, frame + 1);
+        } else {
+            for (int t = 0; t < POSE_COUNT; t++) {
+                if (strcmp(entry.name, FISH_POSE_NAMES[t]) == 0) {
+                    slot = mirror_sprites && POSE_MIRROR_OF[t] != POSE_COUNT ? nullptr : &turn_ids[t];
+                    break;
+                }
+            }
+        }
+        if (slot) {
+            *slot = sprite_residency.add(&entry, FISH_WIDTH, FISH_HEIGHT);
+        }
+        // 背景など魚以外の画像は登録しない
+    }
     
-    // 方向転換用の画像（尾経由）
-    ImageInfo tail_turn_images[3] = {
-        {"/images/neon_tetra_tail_optimized.png", &fish_sprite_tail, "tail"},
-        {"/images/neon_tetra_tail_left_45_optimized.png", &fish_sprite_tail_left_45, "tail_left_45"},
-        {"/images/neon_tetra_tail_right_45_optimized.png", &fish_sprite_tail_right_45, "tail_right_45"}
-    };
+    if (mirror_sprites) {
+        mirrorRightFacing(left_frames);
+        right_frames = left_frames;
+    }
     
-    // 全ての画像を読み込み
-    ImageInfo all_images[20];
-    for (int i = 0; i < 6; i++) {
-        all_images[i] = left_swim_images[i];
-        all_images[i + 6] = right_swim_images[i];
+    // 左右で同じフレーム数だけ使う（途中が欠けていればそこまで）
+    swim_frame_count = min(left_frames, right_frames);
+    for (int i = 0; i < swim_frame_count; i++) {
+        if (swim_left_ids[i] < 0 || swim_right_ids[i] < 0) {
+            swim_frame_count = i;
+            break;
+        }
     }
-    for (int i = 0; i < 5; i++) {
-        all_images[i + 12] = turn_images[i];
+    if (left_frames != right_frames || swim_frame_count != left_frames) {
+        M5_LOGW("Swim frames differ (left %d, right %d), using %d",
+                left_frames, right_frames, swim_frame_count);
     }
-    for (int i = 0; i < 3; i++) {
-        all_images[i + 17] = tail_turn_images[i];
+    
+    // 泳ぎの最初のフレームは常に常駐させる（読み込みが間に合わないときの代わり）
+    // lazy_sprites でなければ全て起動時に読み込む
+    uint32_t load_start = millis();
+    for (int id = 0; id < sprite_residency.count(); id++) {
+        bool anchor = swim_frame_count > 0 && (id == swim_left_ids[0] || id == swim_right_ids[0]);
+        if ((anchor || !lazy_sprites) && sprite_residency.pin(id)) {
+            sprites_loaded = true;
+        }
     }
     
-    for (int i = 0; i < 20; i++) {
-        const auto& img = all_images[i];
-        File file = LittleFS.open(img.path, "r");
-        
-        if (file) {
-            size_t file_size = file.size();
-            uint8_t* buffer = (uint8_t*)malloc(file_size);
-            
-            if (buffer) {
-                file.readBytes((char*)buffer, file_size);
-                file.close();
-                
-                img.canvas->setPsram(true);  // PSRAMを使用
-                img.canvas->setColorDepth(16);
-                img.canvas->createSprite(FISH_WIDTH, FISH_HEIGHT);
-                
-                // スプライトが正しく作成されたか確認
-                if (img.canvas->width() == 0 || img.canvas->height() == 0) {
-                    M5_LOGE("Failed to create sprite for: %s (Free heap: %d, Free PSRAM: %d)", 
-                            img.name, ESP.getFreeHeap(), ESP.getFreePsram());
-                    free(buffer);
-                    continue;
-                }
-                
-                img.canvas->fillSprite(TFT_BLACK);
-                bool png_drawn = img.canvas->drawPng(buffer, file_size, 0, 0);
-                if (png_drawn) {
-                    M5_LOGI("Loaded fish image: %s (size: %dx%d, depth: %d)", 
-                            img.name, img.canvas->width(), img.canvas->height(), img.canvas->getColorDepth());
-                    sprites_loaded = true;
-                } else {
-                    M5_LOGE("Failed to draw PNG for: %s", img.name);
-                }
-                free(buffer);
-            } else {
-                M5_LOGE("Memory allocation failed: %s", img.name);
-                file.close();
+    auto rs = sprite_residency.stats();
+    M5_LOGI("Fish images: %d registered, %u loaded in %u ms (%d swim frames)",
+            sprite_residency.count(), rs.resident, (unsigned)(millis() - load_start),
+            swim_frame_count);
+    M5_LOGI("Fish sprites: %u bytes (%s%s)", (unsigned)rs.resident_bytes,
+            sprite_format == SpriteFormat::Indexed ? "indexed" :
+            sprite_format == SpriteFormat::Alpha ? "alpha" :
+            sprite_format == SpriteFormat::Spans ? "spans" : "canvas",
+            mirror_sprites ? ", right-facing mirrored" : "");
+    
+    // 縮小済みスプライトを一括作成（常駐しているものだけ。それ以外は描画時に作成）
+    if (depth_cache.enabled() && depth_cache_preload) {
+        std::vector<FishSprite*> resident_sprites;
+        for (int id = 0; id < sprite_residency.count(); id++) {
+            if (sprite_residency.resident(id)) {
+                resident_sprites.push_back(sprite_residency.acquire(id));
             }
-        } else {
-            M5_LOGE("Failed to open fish image file: %s", img.path);
         }
+        depth_cache.preload(resident_sprites.data(), (int)resident_sprites.size());
+        M5_LOGI("Depth cache preloaded: %u sprites, %u bytes",
+                depth_cache.stats().entries, (unsigned)depth_cache.stats().resident_bytes);
     }
     
     M5_LOGI("=== Finished loadFishImages() ===");
@@ -322,330 +548,965 @@ void loadFishImages() {
 }
 
 void initFishes() {
-    fishes.clear();
-    
-    for (int i = 0; i < NUM_FISHES; i++) {
-        NeonTetra fish;
-        fish.x = random(0, screen_width - FISH_WIDTH);
-        fish.y = random(0, screen_height - FISH_HEIGHT);
-        fish.vx = (random(50, 150) / 100.0f) * (random(0, 2) == 0 ? -1 : 1);
-        fish.vy = (random(50, 150) / 100.0f) * (random(0, 2) == 0 ? -1 : 1);
-        fish.facing_right = fish.vx > 0;
-        fish.width = FISH_WIDTH;
-        fish.height = FISH_HEIGHT;
-        fish.last_direction_change = millis();
-        fish.swim_phase = random(0, 600) / 100.0f;
-        fish.swim_speed = random(80, 120) / 100.0f;
-        fish.is_turning = false;
-        fish.turn_progress = 0.0f;
-        fish.turn_target_right = fish.facing_right;
-        fish.turn_start_facing_right = fish.facing_right;
-        fish.turn_via_tail = false;
-        fish.depth = random(0, 100) / 100.0f;  // ランダムな奥行き
-        fish.depth_target = random(0, 100) / 100.0f;
-        float init_scale = getDepthScale(fish.depth);
-        int scaled_w = (int)(FISH_WIDTH * init_scale);
-        int scaled_h = (int)(FISH_HEIGHT * init_scale);
-        fish.prev_draw_x = (int)fish.x;
-        fish.prev_draw_y = (int)fish.y;
-        fish.prev_draw_w = scaled_w;
-        fish.prev_draw_h = scaled_h;
-        fish.curr_draw_x = (int)fish.x;
-        fish.curr_draw_y = (int)fish.y;
-        fish.curr_draw_w = scaled_w;
-        fish.curr_draw_h = scaled_h;
-        
-        fishes.push_back(fish);
+    // 初期値も魚ごとの乱数も sim_seed の系列から作る
+    SimRandom rng(sim_seed);
+    fishes.resize(num_fishes, rng.next());
+    
+    for (int i = 0; i < num_fishes; i++) {
+        fishes.x[i] = rng.range(0, screen_width - FISH_WIDTH);
+        fishes.y[i] = rng.range(0, screen_height - FISH_HEIGHT);
+        fishes.vx[i] = (rng.range(50, 150) / 100.0f) * (rng.range(0, 2) == 0 ? -1 : 1);
+        fishes.vy[i] = (rng.range(50, 150) / 100.0f) * (rng.range(0, 2) == 0 ? -1 : 1);
+        fishes.facing_right[i] = fishes.vx[i] > 0;
+        fishes.turn_start_facing_right[i] = fishes.facing_right[i];
+        fishes.swim_phase[i] = rng.range(0, 600) / 100.0f;
+        fishes.swim_speed[i] = rng.range(80, 120) / 100.0f;
+        fishes.frame_roll[i] = rng.uniform();
+        fishes.depth[i] = rng.range(0, 100) / 100.0f;  // ランダムな奥行き
+        fishes.depth_target[i] = rng.range(0, 100) / 100.0f;
+        fishes.resetRect(i, getDrawScale(fishes.depth[i]));
+    }
+    
+    // セルの大きさを群れの近傍距離にすると、近傍の検索は周り 3x3 セルで済む
+    // 描画矩形の検索にも使うので、補間によるずれの分だけ検索範囲を広げる
+    fish_grid.begin(screen_width, screen_height, BOIDS_RADIUS,
+                    (int)ceilf(FISH_WIDTH * DEPTH_SCALE_MAX / 2) + GRID_SLACK,
+                    (int)ceilf(FISH_HEIGHT * DEPTH_SCALE_MAX / 2) + GRID_SLACK);
+    fish_grid.resize(num_fishes);
+    for (int i = 0; i < num_fishes; i++) {
+        fish_grid.update(i, fishes.center_x[i], fishes.center_y[i]);
+    }
+    sim_tick = 0;
+}
+
+// 口の近くの餌に寄っていき、届いたら食べる（群れの加速度に足す）
+static void seekFood() {
+    // 群れの行動が無効なら steer() が加速度を作り直さないので、ここで 0 から作る
+    if (!schooling) {
+        std::fill(fishes.steer_x.begin(), fishes.steer_x.end(), 0.0f);
+        std::fill(fishes.steer_y.begin(), fishes.steer_y.end(), 0.0f);
+    }
+    for (int i = 0; i < fishes.size() && particles.pelletCount() > 0; i++) {
+        float mouth_x = fishes.center_x[i] + (fishes.facing_right[i] ? 0.4f : -0.4f) * fishes.extent_w[i];
+        float mouth_y = fishes.center_y[i];
+        int pellet = particles.nearestPellet(mouth_x, mouth_y, FOOD_SENSE_RADIUS);
+        if (pellet < 0) {
+            continue;
+        }
+        float dx = particles.pelletX(pellet) - mouth_x;
+        float dy = particles.pelletY(pellet) - mouth_y;
+        float dist = sqrtf(dx * dx + dy * dy);
+        if (dist < FOOD_EAT_RADIUS) {
+            particles.eatPellet(pellet);
+            continue;
+        }
+        float scale = FOOD_SEEK_STRENGTH / dist;
+        fishes.steer_x[i] += dx * scale;
+        fishes.steer_y[i] += dy * scale;
     }
 }
 
 void updateFishes(uint32_t delta_ms) {
-    float delta_sec = delta_ms / 1000.0f;
-    
-    for (auto& fish : fishes) {
-        // 泳ぎのアニメーション位相を更新
-        fish.swim_phase += delta_sec * 6.0f * fish.swim_speed;
-        if (fish.swim_phase >= 6.0f) {
-            fish.swim_phase -= 6.0f;
+    if (schooling) {
+        fishes.steer(spatial_index ? &fish_grid : nullptr);
+    }
+    particles.step(delta_ms / 1000.0f);
+    seekFood();
+    fishes.update(delta_ms / 1000.0f, screen_width, screen_height, getDrawScale);
+    // セルが変わった魚だけを付け替える
+    for (int i = 0; i < fishes.size(); i++) {
+        fish_grid.update(i, fishes.center_x[i], fishes.center_y[i]);
+    }
+}
+
+// id のスプライトを取得する。常駐していなければ fallbacks から代わりを探す（-1 は無視）
+// id には SPRITE_MIRRORED が付いていてもよく、返したスプライトを反転して描くかを mirrored に入れる
+static FishSprite* acquireFishSprite(int id, const int* fallbacks, int num_fallbacks, bool* mirrored) {
+    int refs[MAX_SWIM_FRAMES + POSE_COUNT + 1];
+    int candidates[MAX_SWIM_FRAMES + POSE_COUNT + 1];
+    int count = 0;
+    if (id >= 0) {
+        refs[count] = id;
+        candidates[count++] = id & ~SPRITE_MIRRORED;
+    }
+    for (int i = 0; i < num_fallbacks; i++) {
+        if (fallbacks[i] >= 0) {
+            refs[count] = fallbacks[i];
+            candidates[count++] = fallbacks[i] & ~SPRITE_MIRRORED;
         }
-        
-        // 方向転換中の処理
-        if (fish.is_turning) {
-            fish.turn_progress += delta_sec / TURN_DURATION;
-            if (fish.turn_progress >= 1.0f) {
-                fish.turn_progress = 1.0f;
-                fish.is_turning = false;
-                fish.facing_right = fish.turn_target_right;
-            }
+    }
+    if (count == 0) {
+        return nullptr;
+    }
+    FishSprite* sprite = sprite_residency.acquire(candidates[0], candidates + 1, count - 1);
+    // acquire() は先頭から順に常駐しているものを返すので、最初に一致したものがそれ
+    for (int i = 0; sprite && i < count; i++) {
+        if (sprite_residency.sprite(candidates[i]) == sprite) {
+            *mirrored = (refs[i] & SPRITE_MIRRORED) != 0;
+            break;
         }
+    }
+    return sprite;
+}
+
+static void prefetchFishSprite(int id) {
+    if (id >= 0) {
+        sprite_residency.prefetch(id & ~SPRITE_MIRRORED);
+    }
+}
+
+// 方向転換の段階 step の画像 id（画像が無ければ代わりの画像）
+static int turnSpriteId(int mode, bool start_right, int step) {
+    const TurnFrame& frame = turnFrame(mode, start_right, step);
+    return turn_ids[frame.pose] >= 0 ? turn_ids[frame.pose] : turn_ids[frame.fallback];
+}
+
+FishSprite* getFishSprite(int fish, bool* mirrored) {
+    bool facing_right = fishes.facing_right[fish];
+    bool unused;
+    if (!mirrored) mirrored = &unused;
+    *mirrored = false;
+    if (fishes.is_turning[fish]) {
+        // 方向転換中：回転の種類と開始の向きで決まる表を進行度で引く
+        int mode = fishes.turn_via_tail[fish] ? TURN_VIA_TAIL : TURN_VIA_FRONT;
+        bool start_right = fishes.turn_start_facing_right[fish];
+        int step = turnStep(fishes.turn_progress[fish]);
+        int id = turnSpriteId(mode, start_right, step);
         
-        // 位置を更新
-        fish.x += fish.vx * delta_sec * 50;
-        fish.y += fish.vy * delta_sec * 50;
-        
-        // 画面端での反射（スケールを考慮）
-        float scale = getDepthScale(fish.depth);
-        int scaled_w = (int)(FISH_WIDTH * scale);
-        int scaled_h = (int)(FISH_HEIGHT * scale);
-        if (fish.x < 0) {
-            fish.x = 0;
-            fish.vx = -fish.vx;
-        }
-        if (fish.x + scaled_w > screen_width) {
-            fish.x = screen_width - scaled_w;
-            fish.vx = -fish.vx;
-        }
-        if (fish.y < 0) {
-            fish.y = 0;
-            fish.vy = -fish.vy;
-        }
-        if (fish.y + scaled_h > screen_height) {
-            fish.y = screen_height - scaled_h;
-            fish.vy = -fish.vy;
+        // これから使う段階を先読みする
+        for (int i = step + 1; i < min(step + 3, TURN_STEPS); i++) {
+            prefetchFishSprite(turnSpriteId(mode, start_right, i));
         }
-        
-        // ランダムな速度変更
-        fish.vx += (random(-10, 11) / 100.0f);
-        fish.vy += (random(-10, 11) / 100.0f);
-        
-        // 速度制限
-        float speed = sqrt(fish.vx * fish.vx + fish.vy * fish.vy);
-        if (speed > MAX_SPEED) {
-            fish.vx = fish.vx / speed * MAX_SPEED;
-            fish.vy = fish.vy / speed * MAX_SPEED;
+        // 読み込みが間に合わなければ、この段階の粗い画像、直前の段階、次の段階、
+        // 泳ぎの最初のフレームで代用する
+        int fallbacks[8];
+        int count = 0;
+        fallbacks[count++] = turn_ids[turnFrame(mode, start_right, step).fallback];
+        for (int i = step - 1; i >= max(0, step - 3); i--) fallbacks[count++] = turnSpriteId(mode, start_right, i);
+        if (step + 1 < TURN_STEPS) fallbacks[count++] = turnSpriteId(mode, start_right, step + 1);
+        if (swim_frame_count > 0) {
+            fallbacks[count++] = start_right ? swim_right_ids[0] : swim_left_ids[0];
+            fallbacks[count++] = facing_right ? swim_right_ids[0] : swim_left_ids[0];
         }
-        
-        // 速度の符号が変わったか確認（方向転換が必要か）
-        if (!fish.is_turning) {
-            bool new_facing_right = fish.vx > 0;
-            if (new_facing_right != fish.facing_right) {
-                // 方向が変わった → 方向転換アニメーション開始
-                fish.turn_start_facing_right = fish.facing_right;  // 古い方向を保存
-                fish.is_turning = true;
-                fish.turn_progress = 0.0f;
-                fish.turn_target_right = new_facing_right;
-                fish.facing_right = new_facing_right;  // 即座に更新
-                fish.turn_via_tail = random(0, 2) == 0;  // ランダムに回転方向を選択
-            }
+        return acquireFishSprite(id, fallbacks, count, mirrored);
+    } else {
+        if (swim_frame_count == 0) {
+            return nullptr;
         }
+        // 通常の泳ぎ：位相をフレームに割り当てる（間引きは frame_roll で決める）
+        // 反転して描くときは右向きも左向きの画像なので、左向きの間引き方を使う
+        int frame_index = swimFrame(fishes.swim_phase[fish], swim_frame_count,
+                                    facing_right && !mirror_sprites, fishes.frame_roll[fish]);
         
-        // 奥行きの更新（横方向の移動時に少しずつ変化）
-        if (fabs(fish.vx) > 0.1f) {
-            // 奥行きを目標値に向かって少しずつ変化
-            float depth_diff = fish.depth_target - fish.depth;
-            if (fabs(depth_diff) > 0.01f) {
-                float depth_step = DEPTH_CHANGE_SPEED * delta_sec;
-                if (fabs(depth_diff) < depth_step) {
-                    fish.depth = fish.depth_target;
-                } else {
-                    fish.depth += (depth_diff > 0 ? depth_step : -depth_step);
-                }
-            } else {
-                // 目標に到達したら新しい目標を設定
-                fish.depth_target = random(0, 100) / 100.0f;
+        const int* ids = facing_right ? swim_right_ids : swim_left_ids;
+        // 次のフレームを先読みし、速度が小さいときは方向転換の最初の画像も先読みする
+        prefetchFishSprite(ids[(frame_index + 1) % swim_frame_count]);
+        if (fabs(fishes.vx[fish]) < TURN_PREFETCH_SPEED) {
+            for (int mode = 0; mode < TURN_MODE_COUNT; mode++) {
+                prefetchFishSprite(turnSpriteId(mode, facing_right, 0));
+                prefetchFishSprite(turnSpriteId(mode, facing_right, 1));
             }
         }
-        fish.depth = max(0.0f, min(1.0f, fish.depth));
-        
-        // 前回の描画位置・サイズを保存
-        fish.prev_draw_x = fish.curr_draw_x;
-        fish.prev_draw_y = fish.curr_draw_y;
-        fish.prev_draw_w = fish.curr_draw_w;
-        fish.prev_draw_h = fish.curr_draw_h;
-        // 現在の描画位置・サイズを計算
-        scale = getDepthScale(fish.depth);
-        fish.curr_draw_w = (int)(FISH_WIDTH * scale);
-        fish.curr_draw_h = (int)(FISH_HEIGHT * scale);
-        fish.curr_draw_x = (int)fish.x;
-        fish.curr_draw_y = (int)fish.y;
-    }
-}
-
-M5Canvas* getFishSprite(const NeonTetra& fish) {
-    if (fish.is_turning) {
-        // 方向転換中：5段階の画像を使用
-        if (fish.turn_via_tail) {
-            // 尾経由で回転
-            if (fish.turn_progress < 0.2f) {
-                return fish.turn_start_facing_right ? &fish_sprite_right_90 : &fish_sprite_left_90;
-            } else if (fish.turn_progress < 0.4f) {
-                return fish.turn_start_facing_right ? &fish_sprite_tail_right_45 : &fish_sprite_tail_left_45;
-            } else if (fish.turn_progress < 0.6f) {
-                return &fish_sprite_tail;
-            } else if (fish.turn_progress < 0.8f) {
-                return fish.facing_right ? &fish_sprite_tail_right_45 : &fish_sprite_tail_left_45;
-            } else {
-                return fish.facing_right ? &fish_sprite_right_90 : &fish_sprite_left_90;
-            }
-        } else {
-            // 正面経由で回転
-            if (fish.turn_progress < 0.2f) {
-                return fish.turn_start_facing_right ? &fish_sprite_right_90 : &fish_sprite_left_90;
-            } else if (fish.turn_progress < 0.4f) {
-                return fish.turn_start_facing_right ? &fish_sprite_right_45 : &fish_sprite_left_45;
-            } else if (fish.turn_progress < 0.6f) {
-                return &fish_sprite_front;
-            } else if (fish.turn_progress < 0.8f) {
-                return fish.facing_right ? &fish_sprite_right_45 : &fish_sprite_left_45;
-            } else {
-                return fish.facing_right ? &fish_sprite_right_90 : &fish_sprite_left_90;
-            }
+        // 読み込みが間に合わなければ近いフレームで代用する
+        int fallbacks[MAX_SWIM_FRAMES];
+        int count = 0;
+        for (int d = 1; d < swim_frame_count; d++) {
+            fallbacks[count++] = ids[(frame_index + swim_frame_count - d) % swim_frame_count];
         }
+        return acquireFishSprite(ids[frame_index], fallbacks, count, mirrored);
+    }
+}
+
+// 更新領域の中での魚の描画位置（描画先に入る行と列はスプライトの左上から数える）
+struct FishPlacement {
+    const FishSprite* sprite;
+    int x, y, w, h;
+    bool mirror;
+    int row_begin, row_end;
+    int col_begin, col_end;
+};
+
+static bool placeFish(int idx, const DirtyRect& region, const DirtyRect* rects, FishSprite* const* sprites,
+                      const uint8_t* mirrored, FishPlacement* p) {
+    const DirtyRect& fish_rect = rects[idx];
+    if (!sprites[idx] || !intersects(fish_rect, region)) {
+        return false;
+    }
+    p->sprite = sprites[idx];
+    p->x = fish_rect.x - region.x;
+    p->y = fish_rect.y - region.y;
+    p->w = fish_rect.w;
+    p->h = fish_rect.h;
+    p->mirror = mirrored[idx];
+    p->row_begin = max(0, -p->y);
+    p->row_end = min(p->h, region.h - p->y);
+    p->col_begin = max(0, -p->x);
+    p->col_end = min(p->w, region.w - p->x);
+    return true;
+}
+
+// 1 行のうち描く列の区間を集め、まとめて描く（スパンの表を区間ごとにたどらずに済むように）
+struct RowRanges {
+    static const int CAPACITY = 64;
+    ColumnRange ranges[CAPACITY];
+    int count = 0;
+
+    // 昇順に足す。いっぱいになったら先に描く
+    template <class Draw>
+    void add(int begin, int end, Draw draw) {
+        if (count > 0 && ranges[count - 1].end == begin) {
+            ranges[count - 1].end = end;
+            return;
+        }
+        if (count == CAPACITY) {
+            draw(ranges, count);
+            count = 0;
+        }
+        ranges[count++] = {begin, end};
+    }
+    template <class Draw>
+    void flush(Draw draw) {
+        if (count > 0) {
+            draw(ranges, count);
+            count = 0;
+        }
+    }
+};
+
+// 合成に使う背景（半分の解像度で合成するときは縮小したもの）
+static const M5Canvas& composeBackground() {
+    return half_resolution ? background_half : background_canvas;
+}
+
+// 背景の (sx, sy) から len ピクセルを out に写す（背景画像の外は背景色）
+static void copyBackgroundRow(uint16_t* out, int sx, int sy, int len) {
+    const M5Canvas& background = composeBackground();
+    uint16_t fill = (uint16_t)((bg_color << 8) | (bg_color >> 8));  // バッファはスワップ済み
+    int copy_begin = sx;
+    int copy_end = sx;
+    if (background_loaded && sy >= 0 && sy < background.height()) {
+        copy_begin = max(sx, 0);
+        copy_end = max(copy_begin, min(sx + len, (int)background.width()));
+    }
+    for (int x = sx; x < copy_begin; x++) out[x - sx] = fill;
+    if (copy_end > copy_begin) {
+        const uint16_t* src = (const uint16_t*)background.getBuffer();
+        memcpy(out + (copy_begin - sx), src + sy * background.width() + copy_begin,
+               (copy_end - copy_begin) * sizeof(uint16_t));
+    }
+    for (int x = copy_end; x < sx + len; x++) out[x - sx] = fill;
+}
+
+// 背景 → 水草 → 魚の順に、奥から全て重ねて描く
+// order は領域に重なる魚の draw_order の番号（nullptr なら draw_order の全て）
+// rects は魚の描画位置（region と同じ座標）
+static void composeBackToFront(const DirtyRect& region, uint16_t* pixels, const int* draw_order,
+                               const int* order, int order_count, const DirtyRect* rects,
+                               FishSprite* const* sprites, const uint8_t* mirrored) {
+    uint32_t t1 = micros();
+    // バッファに背景を描画
+    if (background_loaded) {
+        buffer_canvas.fillRect(0, 0, region.w, region.h, bg_color);
+        composeBackground().pushSprite(&buffer_canvas, -region.x, -region.y);
     } else {
-        // 通常の泳ぎ：6フレームアニメーション
-        int frame_index = (int)fish.swim_phase;
-        if (frame_index >= 6) frame_index = 5;
+        buffer_canvas.fillRect(0, 0, region.w, region.h, bg_color);
+    }
+    frame_stats.pixels_blitted += region.area();
+    uint32_t t_plants = micros();
+    frame_stats.background_us += t_plants - t1;
+    PROFILE_RECORD(Background, t1, t_plants);
+    
+    // 中景の水草（魚より奥。半分の解像度のときは背景に含めてある）
+    if (scene_layers.enabled() && !half_resolution) {
+        frame_stats.pixels_blitted += scene_layers.drawPlants(pixels, region);
+    }
+    uint32_t t2 = micros();
+    frame_stats.plants_us += t2 - t_plants;
+    PROFILE_RECORD(Plants, t_plants, t2);
+    
+    // 領域に重なる魚を奥行き順に描画
+    for (int i = 0; i < order_count; i++) {
+        int idx = draw_order[order ? order[i] : i];
+        const DirtyRect& fish_rect = rects[idx];
+        if (!intersects(fish_rect, region)) {
+            continue;
+        }
+        int rel_x = fish_rect.x - region.x;
+        int rel_y = fish_rect.y - region.y;
+        int draw_w = fish_rect.w;
+        int draw_h = fish_rect.h;
         
-        // 特定フレームの出現頻度を減らす（80%スキップ）
-        if (fish.facing_right && frame_index == 4) {  // right_swim5
-            if (random(0, 100) < 80) {
-                frame_index = 3;  // swim4を代わりに表示
+        // スケールが元サイズと異なる場合は拡大縮小して描画
+        // （奥行きキャッシュから取得したスプライトは描画サイズと一致する）
+        FishSprite* sprite = sprites[idx];
+        if (!sprite) {
+            continue;
+        }
+        if (draw_w != sprite->width || draw_h != sprite->height) {
+            frame_stats.fish_scaled++;
+        }
+        PROFILE_SCOPE_ARG(FishBlit, idx);
+        frame_stats.pixels_blitted += drawFishSprite(*sprite, &buffer_canvas, rel_x, rel_y, draw_w, draw_h,
+                                                     mirrored[idx]);
+        frame_stats.fish_drawn++;
+    }
+    frame_stats.fish_us += micros() - t2;
+}
+
+// 手前の魚から順に、隠れていない部分だけを描く（CoverageMask の説明を参照）
+// 行ごとに描けない魚（キャンバス形式や、Spans / Alpha 形式の拡大縮小）があるか、
+// 区間が足りなくなったら false を返す（呼び出し側が奥から順に描き直す）
+static bool composeFrontToBack(const DirtyRect& region, uint16_t* pixels, const int* draw_order,
+                               const int* order, int order_count, const DirtyRect* rects,
+                               FishSprite* const* sprites, const uint8_t* mirrored) {
+    if (!coverage_mask.enabled() || region.h > coverage_mask.maxHeight()) {
+        return false;
+    }
+    // 魚ごとに、描画先に入る行が隠れていないかのビット（row_base[i] から）を持つ
+    // （半透明の縁を重ねるときに、隠れた行を読み飛ばす）
+    FishPlacement p;
+    int* row_base = frame_arena.alloc<int>(order_count);
+    if (!row_base) {
+        return false;
+    }
+    int total_rows = 0;
+    for (int i = 0; i < order_count; i++) {
+        row_base[i] = total_rows;
+        if (!placeFish(draw_order[order ? order[i] : i], region, rects, sprites, mirrored, &p)) {
+            continue;
+        }
+        if (!fishSpriteHasRows(*p.sprite, p.w, p.h)) {
+            return false;
+        }
+        total_rows += max(0, p.row_end - p.row_begin);
+    }
+    uint8_t* row_visible = frame_arena.alloc<uint8_t>((total_rows + 7) / 8);
+    uint8_t* visible = frame_arena.alloc<uint8_t>(order_count);
+    if (!row_visible || !visible) {
+        return false;
+    }
+    uint32_t t1 = micros();
+    coverage_mask.reset(region.h);
+    memset(row_visible, 0, (total_rows + 7) / 8);
+    uint32_t written = 0;
+    uint32_t drawn = 0;
+    uint32_t scaled = 0;
+    uint32_t occluded = 0;
+    RowRanges row_ranges;
+    
+    // 1. 手前の魚から、不透明なスパンのまだ埋まっていない部分を描いて埋める
+    //    （owner は奥から数えた順番 + 1。0 は水草）
+    for (int i = order_count - 1; i >= 0; i--) {
+        visible[i] = 0;
+        int idx = draw_order[order ? order[i] : i];
+        if (!placeFish(idx, region, rects, sprites, mirrored, &p)) {
+            continue;
+        }
+        PROFILE_SCOPE_ARG(FishBlit, idx);
+        uint16_t owner = (uint16_t)(i + 1);
+        for (int dy = p.row_begin; dy < p.row_end; dy++) {
+            int y = p.y + dy;
+            // 行の全てが手前の魚に隠れていれば、ピクセルを読まずに次の行へ
+            int left = p.col_end;
+            int right = p.col_begin;
+            forEachFishSpriteSpan(*p.sprite, dy, p.w, p.h, p.mirror, [&](int a, int b, bool) {
+                left = min(left, max(a, p.col_begin));
+                right = max(right, min(b, p.col_end));
+            });
+            if (left >= right || coverage_mask.covered(y, p.x + left, p.x + right)) {
+                continue;
             }
-        } else if (!fish.facing_right && frame_index == 5) {  // left_swim6
-            if (random(0, 100) < 80) {
-                frame_index = 4;  // swim5を代わりに表示
+            int bit = row_base[i] + dy - p.row_begin;
+            row_visible[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+            visible[i] = 1;
+            uint16_t* out = pixels + y * region.w + p.x;
+            auto draw = [&](const ColumnRange* ranges, int count) {
+                drawFishSpriteRow(*p.sprite, out, dy, ranges, count, p.w, p.h, p.mirror);
+            };
+            forEachFishSpriteSpan(*p.sprite, dy, p.w, p.h, p.mirror, [&](int a, int b, bool blend) {
+                a = max(a, p.col_begin);
+                b = min(b, p.col_end);
+                if (blend || a >= b) {
+                    return;
+                }
+                written += coverage_mask.fill(y, p.x + a, p.x + b, owner, [&](int ga, int gb) {
+                    row_ranges.add(ga - p.x, gb - p.x, draw);
+                });
+            });
+            row_ranges.flush(draw);
+        }
+        if (!visible[i]) {
+            occluded++;
+            continue;
+        }
+        drawn++;
+        if (p.w != p.sprite->width || p.h != p.sprite->height) {
+            scaled++;
+        }
+    }
+    uint32_t t_plants = micros();
+    frame_stats.fish_us += t_plants - t1;
+    
+    // 2. 水草（魚より奥。半分の解像度のときは背景に含めてある）
+    if (!coverage_mask.overflowed() && scene_layers.enabled() && !half_resolution) {
+        written += scene_layers.drawPlants(pixels, region, coverage_mask);
+    }
+    uint32_t t_background = micros();
+    frame_stats.plants_us += t_background - t_plants;
+    PROFILE_RECORD(Plants, t_plants, t_background);
+    if (coverage_mask.overflowed()) {
+        frame_stats.pixels_blitted += written;
+        return false;
+    }
+    
+    // 3. まだ埋まっていない部分に背景
+    for (int y = 0; y < region.h; y++) {
+        uint16_t* out = pixels + y * region.w;
+        coverage_mask.forEachExposed(y, 0, region.w, 0, [&](int a, int b) {
+            copyBackgroundRow(out + a, region.x + a, region.y + y, b - a);
+            written += b - a;
+        });
+    }
+    uint32_t t_blend = micros();
+    frame_stats.background_us += t_blend - t_background;
+    PROFILE_RECORD(Background, t_background, t_blend);
+    
+    // 4. 半透明の縁を奥の魚から順に、より手前の魚に埋められていない部分に重ねる
+    for (int i = 0; i < order_count; i++) {
+        if (!visible[i] || !placeFish(draw_order[order ? order[i] : i], region, rects, sprites, mirrored, &p)) {
+            continue;
+        }
+        uint16_t owner = (uint16_t)(i + 1);
+        for (int dy = p.row_begin; dy < p.row_end; dy++) {
+            int bit = row_base[i] + dy - p.row_begin;
+            if (!(row_visible[bit >> 3] & (1 << (bit & 7)))) {
+                continue;
             }
+            int y = p.y + dy;
+            uint16_t* out = pixels + y * region.w + p.x;
+            auto draw = [&](const ColumnRange* ranges, int count) {
+                written += drawFishSpriteRow(*p.sprite, out, dy, ranges, count, p.w, p.h, p.mirror);
+            };
+            forEachFishSpriteSpan(*p.sprite, dy, p.w, p.h, p.mirror, [&](int a, int b, bool blend) {
+                a = max(a, p.col_begin);
+                b = min(b, p.col_end);
+                if (!blend || a >= b) {
+                    return;
+                }
+                coverage_mask.forEachExposed(y, p.x + a, p.x + b, owner, [&](int ga, int gb) {
+                    row_ranges.add(ga - p.x, gb - p.x, draw);
+                });
+            });
+            row_ranges.flush(draw);
         }
-        
-        if (fish.facing_right) {
-            return &fish_sprites_right[frame_index];
-        } else {
-            return &fish_sprites_left[frame_index];
+    }
+    frame_stats.fish_us += micros() - t_blend;
+    frame_stats.pixels_blitted += written;
+    frame_stats.fish_drawn += drawn;
+    frame_stats.fish_scaled += scaled;
+    frame_stats.fish_occluded += occluded;
+    return true;
+}
+
+// 1つの更新領域について背景を復元し、重なる魚を合成する（転送は drawScene() でまとめて依頼する）
+// overlap があれば fish_grid で重なる魚を探して描画順（draw_rank）に並べる作業領域に使う
+// 半分の解像度のときは、region を縦横半分にした範囲に rects（半分の座標の魚の位置）で描く
+static void composeRegion(const DirtyRect& region, const int* draw_order, const int* draw_rank,
+                          int fish_count, const DirtyRect* rects, FishSprite* const* sprites,
+                          const uint8_t* mirrored, int* overlap) {
+    uint16_t* pixels = render_pipeline.addRegion(region);
+    if (!pixels) {
+        return;
+    }
+    DirtyRect target = region;
+    if (half_resolution) {
+        target = DirtyRect{region.x / 2, region.y / 2, region.w / 2, region.h / 2};
+    }
+    buffer_canvas.setBuffer(pixels, target.w, target.h, lgfx::rgb565_2Byte);
+    
+    // 領域に重なる魚を奥行き順に並べる
+    int overlap_count = fish_count;
+    if (overlap) {
+        overlap_count = 0;
+        fish_grid.forEachOverlapping(region, [&](int idx) {
+            if (intersects(fishes.curr_rect[idx], region)) {
+                overlap[overlap_count++] = draw_rank[idx];
+            }
+        });
+        std::sort(overlap, overlap + overlap_count);
+    }
+    if (!front_to_back ||
+        !composeFrontToBack(target, pixels, draw_order, overlap, overlap_count, rects, sprites, mirrored)) {
+        if (front_to_back) {
+            frame_stats.occlusion_fallbacks++;
         }
+        composeBackToFront(target, pixels, draw_order, overlap, overlap_count, rects, sprites, mirrored);
     }
+    
+    // 前景の泡と粒子（魚より手前。半分の解像度のときは泡を止めているので、粒子は餌だけになる）
+    uint32_t t3 = micros();
+    if (scene_layers.enabled() && !half_resolution) {
+        frame_stats.pixels_blitted += scene_layers.drawBubbles(pixels, region);
+    }
+    frame_stats.pixels_blitted += particles.draw(pixels, region, half_resolution);
+    uint32_t t4 = micros();
+    frame_stats.bubbles_us += t4 - t3;
+    PROFILE_RECORD(Bubbles, t3, t4);
+    frame_stats.bytes_pushed += region.area() * 2;
+}
+
+// frame_arena が確保できなかったフレームは描かない（途中まで合成した画面を出さない）
+// このフレームの更新領域を捨てるので、次のフレームで画面全体を描き直す
+static void skipFrame() {
+    full_repaint = true;
 }
 
 void drawScene() {
     static uint32_t frame_count = 0;
-    bool debug_log = (frame_count % 60 == 0);  // 60フレームごとにログ出力
+    // 60フレームごとにログ出力（ログの出力はフレームの時間を乱すので、既定では出さない）
+    bool debug_log = scene_debug_log && (frame_count % 60 == 0);
     
     if (debug_log) {
-        M5_LOGI("=== drawScene() frame %d, fishes count: %d ===", frame_count, fishes.size());
+        M5_LOGI("=== drawScene() frame %d, fishes count: %d ===", frame_count, (int)fishes.size());
     }
     
-    // 全魚の前回位置と今回位置を含む最小矩形を計算（スケール考慮）
-    int min_x = screen_width;
-    int max_x = 0;
-    int min_y = screen_height;
-    int max_y = 0;
+    uint32_t t_start = micros();
     
-    for (const auto& fish : fishes) {
-        if (debug_log) {
+    // 魚ごとに前回位置と今回位置を含む矩形を更新領域として登録（スケール考慮）
+    dirty_regions.setBounds(screen_width, screen_height);
+    dirty_regions.clear();
+    // 粒子は多いときだけ更新領域が増えるので、途中で広げずに済むよう最大数で確保しておく
+    // （領域数は魚・レイヤー・粒子・送れなかった差分の更新領域の数と画面全体の描き直しを超えない）
+    size_t max_regions = fishes.size() + scene_layers.maxRects() + particles.maxRects() +
+                         frame_stream.maxRects() + 1;
+    dirty_regions.reserve(max_regions);
+    for (int i = 0; i < fishes.size(); i++) {
+        const DirtyRect& curr = fishes.curr_rect[i];
+        if (debug_log && i < DEBUG_LOG_FISH) {
             M5_LOGI("Fish: pos=(%d,%d), depth=%.2f, scale=%.2f, size=(%dx%d)",
-                    fish.curr_draw_x, fish.curr_draw_y, fish.depth, 
-                    getDepthScale(fish.depth), fish.curr_draw_w, fish.curr_draw_h);
+                    curr.x, curr.y, fishes.depth[i], 
+                    getDepthScale(fishes.depth[i]), curr.w, curr.h);
         }
-        min_x = min(min_x, min(fish.prev_draw_x, fish.curr_draw_x));
-        max_x = max(max_x, max(fish.prev_draw_x + fish.prev_draw_w, fish.curr_draw_x + fish.curr_draw_w));
-        min_y = min(min_y, min(fish.prev_draw_y, fish.curr_draw_y));
-        max_y = max(max_y, max(fish.prev_draw_y + fish.prev_draw_h, fish.curr_draw_y + fish.curr_draw_h));
+        DirtyRect damage = unionRect(fishes.prev_rect[i], curr);
+        // 余白を追加
+        dirty_regions.add(damage.x - DIRTY_MARGIN, damage.y - DIRTY_MARGIN,
+                          damage.w + DIRTY_MARGIN * 2, damage.h + DIRTY_MARGIN * 2);
     }
-    
-    // 余白を追加
-    min_x = max(0, min_x - 10);
-    min_y = max(0, min_y - 10);
-    max_x = min(screen_width, max_x + 10);
-    max_y = min(screen_height, max_y + 10);
-    
-    int rect_width = max_x - min_x;
-    int rect_height = max_y - min_y;
-    
-    if (debug_log) {
-        M5_LOGI("Rect: min=(%d,%d), max=(%d,%d), size=(%dx%d)",
-                min_x, min_y, max_x, max_y, rect_width, rect_height);
+    // 水草と泡は動いた部分だけ
+    scene_layers.update(millis(), dirty_regions);
+    // 粒子は動いたタイルだけ（粒子の数によらず、更新領域はタイルの行ごとに数個まで）
+    uint32_t t_particles = micros();
+    particles.update(millis(), dirty_regions);
+    frame_stats.particles_us = micros() - t_particles;
+    frame_stats.layer_regions = scene_layers.stats().plant_rects + scene_layers.stats().bubble_rects +
+                                particles.stats().rects;
+    // 半分の解像度から戻ったときは、半分の解像度で描いた所が残らないよう全体を描き直す
+    if (full_repaint) {
+        dirty_regions.add(0, 0, screen_width, screen_height);
+        full_repaint = false;
     }
+    // 差分を送り出すフレームなら、リンクが追いつかず送れなかった領域も描き直して一緒に送る
+    frame_stream.beginFrame(dirty_regions);
     
-    // バッファのサイズを変更（必要な場合のみ）
-    static int prev_rect_width = 0;
-    static int prev_rect_height = 0;
-    if (rect_width != prev_rect_width || rect_height != prev_rect_height) {
-        buffer_canvas.deleteSprite();
-        buffer_canvas.setPsram(true);  // PSRAMを使用
-        buffer_canvas.setColorDepth(16);
-        buffer_canvas.createSprite(rect_width, rect_height);
-        prev_rect_width = rect_width;
-        prev_rect_height = rect_height;
+    // 重なる・近い領域だけを統合する
+    if (multi_rect_dirty) {
+        dirty_regions.merge();
+    } else {
+        dirty_regions.collapse();
+    }
+    // 重なった領域の合計が合成用のバッファより大きく、予算か PSRAM が足りずに広げられなければ
+    // 1 つの外接矩形にまとめる（画面全体の大きさのバッファに必ず収まる。半分の解像度なら広げずに済む）
+    if (!half_resolution && dirty_regions.regions().size() > 1 &&
+        !render_pipeline.reserve(dirty_regions.dirtyPixels(), max_regions)) {
+        dirty_regions.collapse();
+        memory_budget.noteDegraded(MemoryCategory::Compose);
     }
+    const auto& regions = dirty_regions.regions();
+    frame_stats.regions = regions.size();
+    frame_stats.union_pixels = dirty_regions.unionPixels();
+    frame_stats.dirty_pixels = dirty_regions.dirtyPixels();
     
-    // バッファに背景を描画
-    if (background_loaded) {
-        buffer_canvas.fillRect(0, 0, rect_width, rect_height, bg_color);
-        background_canvas.pushSprite(&buffer_canvas, -min_x, -min_y);
-    } else {
-        buffer_canvas.fillRect(0, 0, rect_width, rect_height, bg_color);
+    if (debug_log) {
+        for (const auto& r : regions) {
+            M5_LOGI("Rect: pos=(%d,%d), size=(%dx%d)", r.x, r.y, r.w, r.h);
+        }
+        M5_LOGI("Dirty pixels: %u (union: %u)",
+                frame_stats.dirty_pixels, frame_stats.union_pixels);
     }
     
+    uint32_t t_bounds = micros();
+    frame_stats.bounds_us = t_bounds - t_start;
+    PROFILE_RECORD(Bounds, t_start, t_bounds);
+    
     // 魚を奥行き順にソート（depthが小さい=奥から先に描画）
-    std::vector<int> draw_order(fishes.size());
-    for (int i = 0; i < (int)fishes.size(); i++) draw_order[i] = i;
-    std::sort(draw_order.begin(), draw_order.end(), [](int a, int b) {
-        return fishes[a].depth < fishes[b].depth;
+    // （描画順と選んだスプライトはフレーム内だけで使うので frame_arena に置く）
+    int count = (int)fishes.size();
+    int* draw_order = frame_arena.alloc<int>(count);
+    if (!draw_order) {
+        skipFrame();
+        frame_count++;
+        return;
+    }
+    for (int i = 0; i < count; i++) draw_order[i] = i;
+    std::sort(draw_order, draw_order + count, [](int a, int b) {
+        return fishes.depth[a] < fishes.depth[b];
     });
+    // 領域が 1 つなら全ての魚を 1 回ずつ調べるだけなので、グリッドは複数の領域のときだけ使う
+    int* draw_rank = nullptr;
+    int* overlap = nullptr;
+    if (spatial_index && regions.size() > 1) {
+        draw_rank = frame_arena.alloc<int>(count);
+        overlap = frame_arena.alloc<int>(count);
+        if (draw_rank && overlap) {
+            for (int i = 0; i < count; i++) draw_rank[draw_order[i]] = i;
+        } else {
+            overlap = nullptr;  // 確保できなければ全ての魚を調べる
+        }
+    }
     
-    // バッファに全ての魚を奥行き順に描画
-    for (int idx : draw_order) {
-        const auto& fish = fishes[idx];
-        int rel_x = fish.curr_draw_x - min_x;
-        int rel_y = fish.curr_draw_y - min_y;
-        int draw_w = fish.curr_draw_w;
-        int draw_h = fish.curr_draw_h;
-        
-        // 適切なフレームの画像を取得
-        M5Canvas* sprite = getFishSprite(fish);
-        
-        if (debug_log) {
-            M5_LOGI("Fish[%d]: depth=%.2f, scale=%.2f, draw_size=(%dx%d), rel_pos=(%d,%d)",
-                    idx, fish.depth, getDepthScale(fish.depth), draw_w, draw_h, rel_x, rel_y);
+    // 適切なフレームの画像を取得（領域をまたぐ魚も同じフレームになるよう1回だけ選ぶ）
+    // 奥行きキャッシュが有効なら縮小済みのスプライトに置き換える
+    // （読み込み中で代わりも無い魚は nullptr になり、このフレームは描画しない）
+    sprite_residency.beginFrame();
+    if (sprite_residency.starved() && !mirror_sprites) {
+        shareMirroredSprites();
+    }
+    depth_cache.beginFrame();
+    uint32_t hits_before = depth_cache.stats().hits;
+    uint32_t misses_before = depth_cache.stats().misses;
+    FishSprite** sprites = frame_arena.alloc<FishSprite*>(count);
+    uint8_t* mirrored = frame_arena.alloc<uint8_t>(count);
+    if (!sprites || !mirrored) {
+        skipFrame();
+        frame_count++;
+        return;
+    }
+    // レベルを間引いているときの縮小済みスプライトは魚の大きさより小さいので、描画範囲の中央に置く
+    // （魚の大きさはシミュレーションのものなので変えない。更新領域にも収まる）
+    DirtyRect* draw_rects = nullptr;
+    if (depth_cache.thinned()) {
+        draw_rects = frame_arena.alloc<DirtyRect>(count);
+        if (draw_rects) {  // 確保できなければ魚の大きさに拡大して描く
+            memcpy(draw_rects, fishes.curr_rect.data(), count * sizeof(DirtyRect));
         }
-        
-        // スケールが元サイズと異なる場合は拡大縮小して描画
-        if (draw_w != FISH_WIDTH || draw_h != FISH_HEIGHT) {
-            sprite->pushRotateZoomWithAA(&buffer_canvas, 
-                rel_x + draw_w / 2, rel_y + draw_h / 2,  // 描画先の中心座標
-                0.0f,  // 回転なし
-                (float)draw_w / FISH_WIDTH,   // Xスケール
-                (float)draw_h / FISH_HEIGHT,  // Yスケール
-                TFT_BLACK);  // 透過色
-        } else {
-            sprite->pushSprite(&buffer_canvas, rel_x, rel_y, TFT_BLACK);
+    }
+    for (int i = 0; i < count; i++) {
+        int idx = draw_order[i];
+        bool mirror = false;
+        FishSprite* sprite = getFishSprite(idx, &mirror);
+        mirrored[idx] = mirror;
+        FishSprite* scaled = sprite ? depth_cache.get(sprite, depth_cache.levelForDepth(fishes.depth[idx])) : nullptr;
+        sprites[idx] = scaled ? scaled : sprite;
+        if (draw_rects && scaled && scaled != sprite) {
+            DirtyRect& r = draw_rects[idx];
+            if (scaled->width <= r.w && scaled->height <= r.h) {
+                r.x += (r.w - scaled->width) / 2;
+                r.y += (r.h - scaled->height) / 2;
+                r.w = scaled->width;
+                r.h = scaled->height;
+            }
+        }
+        // タップした魚を方向転換の画像（読み込み中なら代わりの画像）で描く最初のフレームに、
+        // タップの時刻を付ける（転送が終わったときにタップからの遅延を集計する）
+        if (idx == tap_turn_fish && fishes.is_turning[idx] && sprites[idx]) {
+            render_pipeline.markInput(tap_turn_us);
+            tap_turn_fish = -1;
         }
     }
+    frame_stats.cache_hits = depth_cache.stats().hits - hits_before;
+    frame_stats.cache_misses = depth_cache.stats().misses - misses_before;
+    uint32_t t_sort = micros();
+    frame_stats.sort_us = t_sort - t_bounds;
+    PROFILE_RECORD(Sort, t_bounds, t_sort);
     
-    // バッファを画面に転送
+    if (debug_log && depth_cache.enabled()) {
+        const auto& cs = depth_cache.stats();
+        M5_LOGI("Depth cache: hits=%u, misses=%u, evictions=%u, entries=%u, resident=%u bytes",
+                cs.hits, cs.misses, cs.evictions, cs.entries, (unsigned)cs.resident_bytes);
+    }
     if (debug_log) {
-        M5_LOGI("Pushing buffer (%dx%d) to display at (%d,%d)",
-                rect_width, rect_height, min_x, min_y);
+        auto rs = sprite_residency.stats();
+        M5_LOGI("Sprites: resident=%u (%u bytes, peak %u), hits=%u, misses=%u, fallbacks=%u, loads=%u, evictions=%u",
+                rs.resident, (unsigned)rs.resident_bytes, (unsigned)rs.peak_bytes,
+                rs.hits, rs.misses, rs.fallbacks, rs.loads, rs.evictions);
+    }
+    
+    // 半分の解像度なら、領域を偶数の座標に広げ（2 倍に広げたときに位置がずれないように）、
+    // 魚の位置も半分の座標にする
+    const DirtyRect* compose_regions = regions.data();
+    const DirtyRect* rects = draw_rects ? draw_rects : fishes.curr_rect.data();
+    size_t compose_pixels = frame_stats.dirty_pixels;
+    if (half_resolution) {
+        DirtyRect* aligned = frame_arena.alloc<DirtyRect>(regions.size());
+        DirtyRect* half_rects = frame_arena.alloc<DirtyRect>(count);
+        if (!aligned || !half_rects) {
+            skipFrame();
+            frame_count++;
+            return;
+        }
+        compose_pixels = 0;
+        for (size_t i = 0; i < regions.size(); i++) {
+            const DirtyRect& r = regions[i];
+            int x0 = r.x & ~1;
+            int y0 = r.y & ~1;
+            int x1 = min(screen_width, (r.right() + 1) & ~1);
+            int y1 = min(screen_height, (r.bottom() + 1) & ~1);
+            aligned[i] = DirtyRect{x0, y0, x1 - x0, y1 - y0};
+            compose_pixels += aligned[i].area() / 4;
+        }
+        compose_regions = aligned;
+        for (int i = 0; i < count; i++) {
+            const DirtyRect& r = rects[i];
+            half_rects[i] = DirtyRect{r.x >> 1, r.y >> 1, max(1, r.w / 2), max(1, r.h / 2)};
+        }
+        rects = half_rects;
+    }
+    
+    // loop() の先頭で確保したバッファに領域ごとに合成し、転送タスクに渡す
+    if (!regions.empty()) {
+        uint32_t t1 = micros();
+        // 領域数は max_regions を超えないので、その数で確保しておけば以降は広げずに済む
+        bool reserved = render_pipeline.reserve(compose_pixels, max_regions, half_resolution);
+        frame_stats.alloc_us = micros() - t1;
+        if (reserved) {
+            for (size_t i = 0; i < regions.size(); i++) {
+                composeRegion(compose_regions[i], draw_order, draw_rank, count, rects, sprites, mirrored,
+                              overlap);
+            }
+        }
+        if (frame_stream.endFrame(compose_regions, regions.size(), compose_pixels, reserved)) {
+            render_pipeline.markStream(&frame_stream);
+        }
+        uint32_t t2 = micros();
+        render_pipeline.submit();
+        uint32_t t3 = micros();
+        frame_stats.push_us = t3 - t2;
+        PROFILE_RECORD(Submit, t2, t3);
+    }
+    
+    if (debug_log && frame_stats.dirty_pixels > 0) {
+        M5_LOGI("Overdraw: %.2f (%u pixels written to %u), occluded fish: %u, fallbacks: %u",
+                (float)frame_stats.pixels_blitted / frame_stats.dirty_pixels,
+                frame_stats.pixels_blitted, frame_stats.dirty_pixels, frame_stats.fish_occluded,
+                frame_stats.occlusion_fallbacks);
+    }
+    if (debug_log && frame_pacer.enabled()) {
+        const FramePacer::Stats& ps = frame_pacer.stats();
+        M5_LOGI("Pacing: quality %s, %u of %u frames over %u us budget, slept %u ms",
+                qualityName(frame_pacer.quality()), ps.misses, ps.frames,
+                (unsigned)frame_pacer.budgetUs(), ps.sleep_ms);
     }
-    buffer_canvas.pushSprite(display, min_x, min_y);
     
     frame_count++;
 }
 
-void handleTouch() {
-    // タッチされたかチェック
-    if (M5.Touch.getCount() > 0) {
-        auto touch = M5.Touch.getDetail();
-        if (touch.wasPressed()) {
-            int touch_x = touch.x;
-            int touch_y = touch.y;
-            
-            M5_LOGI("Touch detected at (%d, %d)", touch_x, touch_y);
-            
-            // タッチ位置にいる魚を探す
-            for (auto& fish : fishes) {
-                int fish_x = fish.curr_draw_x;
-                int fish_y = fish.curr_draw_y;
-                
-                // 魚の矩形範囲内かチェック（スケール考慮）
-                if (touch_x >= fish_x && touch_x <= fish_x + fish.curr_draw_w &&
-                    touch_y >= fish_y && touch_y <= fish_y + fish.curr_draw_h) {
-                    M5_LOGI("Fish tapped! Triggering turn.");
-                    triggerFishTurn(fish);
-                    break;  // 最初にヒットした魚だけを処理
-                }
+// 背景の 2x2 ピクセルの平均（スワップ済み RGB565）
+static uint16_t averageBackground(const uint16_t* src, int stride) {
+    uint32_t r = 0, g = 0, b = 0;
+    const uint16_t* quad[4] = {src, src + 1, src + stride, src + stride + 1};
+    for (const uint16_t* p : quad) {
+        uint16_t px = (uint16_t)((*p << 8) | (*p >> 8));
+        r += px >> 11;
+        g += (px >> 5) & 63;
+        b += px & 31;
+    }
+    uint16_t px = (uint16_t)((((r + 2) / 4) << 11) | (((g + 2) / 4) << 5) | ((b + 2) / 4));
+    return (uint16_t)((px << 8) | (px >> 8));
+}
+
+// 半分の解像度で合成するときの背景を作る（背景を 2x2 の平均で縮小し、今の水草を重ねる）
+// 水草は品質を下げた時点で止めてあるので、半分の解像度の間は作り直さなくてよい
+static void prepareHalfBackground() {
+    int w = background_half.width();
+    int h = background_half.height();
+    uint16_t* dst = (uint16_t*)background_half.getBuffer();
+    uint16_t fill = (uint16_t)((bg_color << 8) | (bg_color >> 8));
+    const uint16_t* src = (const uint16_t*)background_canvas.getBuffer();
+    int src_w = background_canvas.width();
+    int src_h = background_canvas.height();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            bool inside = background_loaded && x * 2 + 1 < src_w && y * 2 + 1 < src_h;
+            dst[y * w + x] = inside ? averageBackground(src + y * 2 * src_w + x * 2, src_w) : fill;
+        }
+    }
+    if (scene_layers.enabled()) {
+        scene_layers.drawPlantsHalf(dst, w, h);
+    }
+}
+
+static void applyQuality(Quality quality) {
+    scale_antialias = quality < Quality::NoAntialias;
+    depth_cache.setLevelStep(quality >= Quality::CoarseDepth ? 2 : 1);
+    scene_layers.setAnimated(quality < Quality::StaticLayers);
+    particles.setAnimated(quality < Quality::StaticLayers);
+    bool half = quality >= Quality::HalfResolution && background_half.getBuffer() &&
+                render_pipeline.halfResolutionEnabled();
+    if (half && !half_resolution) {
+        prepareHalfBackground();
+    } else if (!half && half_resolution) {
+        full_repaint = true;
+    }
+    half_resolution = half;
+    M5_LOGI("Quality: %s (frame %u, %u over budget)", qualityName(quality),
+            (unsigned)frame_pacer.stats().frames, (unsigned)frame_pacer.stats().misses);
+}
+
+static size_t writeStream(const uint8_t* data, size_t length, void*) {
+    return Serial.write(data, length);
+}
+
+#if AQUARIUM_PROFILE
+static void writeSerial(const char* text, size_t length, void*) {
+    Serial.write((const uint8_t*)text, length);
+}
+#endif
+
+static void logMemoryLine(const char* text, void*) {
+    M5_LOGI("%s", text);
+}
+
+// シリアルからの 1 文字のコマンド
+//   k: 差分の送り出しで、次に送るフレームに画面全体を入れる（ビューアーを途中から繋いだとき）
+//   m: 分類と持ち主ごとのメモリの使用量・最大値・予算をログに出す（memory_budget）
+//   t: リングに残っている区間を Chrome のトレース形式で書き出す（AQUARIUM_PROFILE のとき）
+//   p: 直近の集計区間の段階ごとの処理時間をログに出す（AQUARIUM_PROFILE のとき）
+void handleSerialCommand() {
+    if (!Serial.available()) {
+        return;
+    }
+    int command = Serial.read();
+    if (command == 'k') {
+        if (frame_stream.enabled()) {
+            frame_stream.requestKeyframe();
+        }
+        return;
+    }
+    if (command == 'm') {
+        memory_budget.report(logMemoryLine, nullptr);
+        return;
+    }
+#if AQUARIUM_PROFILE
+    if (command == 't') {
+        uint32_t events = profiler.exportTrace(writeSerial, nullptr);
+        M5_LOGI("Profiler: exported %u events", (unsigned)events);
+    } else if (command == 'p') {
+        for (int s = 0; s < (int)ProfileStage::Count; s++) {
+            const auto& sum = profiler.summary((ProfileStage)s);
+            M5_LOGI("%-10s n=%u min=%u avg=%u p99=%u max=%u us", profileStageName((ProfileStage)s),
+                    (unsigned)sum.count, (unsigned)sum.min_us, (unsigned)sum.avg_us,
+                    (unsigned)sum.p99_us, (unsigned)sum.max_us);
+        }
+    }
+#endif
+}
+
+// タッチ位置にいる魚を探す（見つからなければ -1）。複数いれば番号の小さい魚
+// （シミュレーション上の矩形で判定するので、記録を再生したときも同じ魚になる）
+static int findFishAt(int touch_x, int touch_y) {
+    auto hit = [&](int i) {
+        // 魚の矩形範囲内かチェック（スケール考慮）
+        DirtyRect rect = fishes.bounds(i);
+        return touch_x >= rect.x && touch_x <= rect.x + rect.w &&
+               touch_y >= rect.y && touch_y <= rect.y + rect.h;
+    };
+    int found = -1;
+    if (spatial_index) {
+        fish_grid.forEachOverlapping(DirtyRect{touch_x, touch_y, 1, 1}, [&](int i) {
+            if ((found < 0 || i < found) && hit(i)) {
+                found = i;
+            }
+        });
+    } else {
+        for (int i = 0; i < fishes.size() && found < 0; i++) {
+            if (hit(i)) {
+                found = i;
             }
         }
     }
+    return found;
+}
+
+static void applyStepTouch(uint32_t step_end_ms) {
+    static TouchSample current = {false, 0, 0};
+    TouchEvent event;
+    bool changed = false;
+    if (session_log.mode() == SessionLog::Mode::Replay) {
+        // 再生中は実際のタッチを捨て、記録した変化を使う
+        while (touch_input.pop(step_end_ms, &event)) {
+        }
+        while (session_log.replayTouch(sim_tick, &current)) {
+            handleTouch(current);
+            changed = true;
+        }
+    } else {
+        while (touch_input.pop(step_end_ms, &event)) {
+            current = event.sample;
+            session_log.recordTouch(sim_tick, current);
+            int fish = handleTouch(current);
+            if (fish >= 0) {
+                tap_turn_fish = fish;
+                tap_turn_us = event.time_us;
+            }
+            changed = true;
+        }
+    }
+    // 変化が無いステップも今の状態で呼ぶ（逃げる時間が終わったら寄ってくるように戻す）
+    if (!changed) {
+        handleTouch(current);
+    }
+}
+
+// タッチの変化を 1 つ反映する（変化の無いステップは今の状態で呼ぶ。押した瞬間は前の状態との比較で判定する）
+// 押した位置から TOUCH_DRAG_THRESHOLD 以上動かしたらなぞっているとみなし、魚が指を追いかける
+// タップで方向転換させた魚を返す（無ければ -1）
+int handleTouch(const TouchSample& touch) {
+    static bool was_pressed = false;
+    static bool dragging = false;
+    static int press_x = 0;
+    static int press_y = 0;
+    bool pressed_now = touch.pressed && !was_pressed;
+    was_pressed = touch.pressed;
+    bool avoiding = (int32_t)(sim_tick - touch_avoid_until) < 0;
+    int tapped = -1;
+    
+    if (pressed_now) {
+        int touch_x = touch.x;
+        int touch_y = touch.y;
+        press_x = touch_x;
+        press_y = touch_y;
+        dragging = false;
+        
+        M5_LOGI("Touch detected at (%d, %d)", touch_x, touch_y);
+        
+        // タッチ位置にいる魚を探す
+        int fish = findFishAt(touch_x, touch_y);
+        if (fish >= 0) {
+            M5_LOGI("Fish tapped! Triggering turn.");
+            triggerFishTurn(fish);
+            // 群れのときは周りの魚もタップした位置から逃げる
+            fishes.setAttractor(touch_x, touch_y, -TOUCH_AVOID_STRENGTH);
+            touch_avoid_until = sim_tick + TOUCH_AVOID_DURATION / SIM_STEP_MS;
+            avoiding = true;
+            tapped = fish;
+        } else if (feeding && particles_enabled) {
+            // 魚のいない所をタップしたら餌を落とす
+            particles.dropPellets(touch_x, touch_y);
+        }
+    } else if (touch.pressed && !dragging &&
+               abs(touch.x - press_x) + abs(touch.y - press_y) >= TOUCH_DRAG_THRESHOLD) {
+        dragging = true;
+    }
+    if (avoiding) {
+        return tapped;
+    }
+    if (touch.pressed) {
+        // 魚のいない所を押し続けている間はその位置に寄ってきて、なぞっている間は強めに追いかける
+        fishes.setAttractor(touch.x, touch.y, dragging ? TOUCH_FOLLOW_STRENGTH : TOUCH_ATTRACT_STRENGTH);
+    } else {
+        fishes.clearAttractor();
+    }
+    return tapped;
 }
 
 float getDepthScale(float depth) {
@@ -654,22 +1515,17 @@ float getDepthScale(float depth) {
     return DEPTH_SCALE_MIN + (DEPTH_SCALE_MAX - DEPTH_SCALE_MIN) * depth;
 }
 
-void triggerFishTurn(NeonTetra& fish) {
-    // 既に方向転換中の場合は無視
-    if (fish.is_turning) {
-        return;
+// 描画に使うスケール（奥行きキャッシュが有効ならレベルに量子化する）
+// シミュレーション（画面端の反射・群れ・当たり判定）の大きさにも使うので、品質やメモリの不足で
+// レベルを間引いても変えない（記録した操作を再生したときに同じ動きになるように）
+float getDrawScale(float depth) {
+    if (depth_cache.enabled()) {
+        return depth_cache.levelScale(depth_cache.baseLevel(depth));
     }
-    
-    // 速度の方向を反転
-    fish.vx = -fish.vx;
-    fish.vy = -fish.vy;
-    
-    // 方向転換アニメーションを開始
-    bool new_facing_right = fish.vx > 0;
-    fish.turn_start_facing_right = fish.facing_right;
-    fish.is_turning = true;
-    fish.turn_progress = 0.0f;
-    fish.turn_target_right = new_facing_right;
-    fish.facing_right = new_facing_right;
-    fish.turn_via_tail = random(0, 2) == 0;  // ランダムに回転方向を選択
+    return getDepthScale(depth);
+}
+
+void triggerFishTurn(int fish) {
+    // 速度の方向を反転して方向転換アニメーションを開始（既に方向転換中の場合は無視）
+    fishes.reverse(fish);
 }
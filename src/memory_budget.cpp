@@ -0,0 +1,255 @@
+#include "memory_budget.h"
+
+#include <cstdio>
+
+MemoryBudget memory_budget;
+
+namespace {
+
+const char* CATEGORY_NAMES[(int)MemoryCategory::Count] = {
+    "sprites", "cache", "compose", "scene", "work",
+};
+
+const char* OWNER_NAMES[(int)MemoryOwner::Count] = {
+    "fish_sprites", "sprite_load", "depth_cache", "compose", "upscale_rows", "background",
+    "half_background", "static_layer", "scene_layers", "particles", "coverage_mask", "scale_filter",
+    "sprite_scratch", "scale_buffers", "profiler",
+};
+
+const MemoryCategory OWNER_CATEGORIES[(int)MemoryOwner::Count] = {
+    MemoryCategory::Sprites,  // FishSprites
+    MemoryCategory::Sprites,  // SpriteLoad
+    MemoryCategory::Cache,    // DepthCache
+    MemoryCategory::Compose,  // ComposeBuffer
+    MemoryCategory::Compose,  // UpscaleRows
+    MemoryCategory::Scene,    // Background
+    MemoryCategory::Scene,    // HalfBackground
+    MemoryCategory::Scene,    // StaticLayer
+    MemoryCategory::Scene,    // SceneLayers
+    MemoryCategory::Scene,    // Particles
+    MemoryCategory::Work,     // CoverageMask
+    MemoryCategory::Work,     // ScaleFilter
+    MemoryCategory::Work,     // SpriteScratch
+    MemoryCategory::Work,     // ScaleBuffers
+    MemoryCategory::Work,     // Profiler
+};
+
+template <class T>
+void updateMax(std::atomic<T>& target, T value) {
+    T current = target.load();
+    while (value > current && !target.compare_exchange_weak(current, value)) {
+    }
+}
+
+unsigned kb(size_t bytes) {
+    return (unsigned)(bytes / 1024);
+}
+
+}  // namespace
+
+const char* memoryCategoryName(MemoryCategory category) {
+    return category < MemoryCategory::Count ? CATEGORY_NAMES[(int)category] : "?";
+}
+
+const char* memoryOwnerName(MemoryOwner owner) {
+    return owner < MemoryOwner::Count ? OWNER_NAMES[(int)owner] : "?";
+}
+
+MemoryCategory memoryOwnerCategory(MemoryOwner owner) {
+    return OWNER_CATEGORIES[(int)owner];
+}
+
+void MemoryBudget::setBudget(MemoryCategory category, size_t bytes) {
+    _budgets[(int)category] = bytes;
+}
+
+bool MemoryBudget::fits(MemoryCategory category, size_t bytes) const {
+    size_t limit = budget(category);
+    return limit == 0 || _categories[(int)category].bytes.load() + bytes <= limit;
+}
+
+bool MemoryBudget::reserve(MemoryOwner owner, size_t bytes) {
+    int c = (int)memoryOwnerCategory(owner);
+    size_t limit = _budgets[c].load();
+    Counter& category = _categories[c];
+    // ローダータスクと同時に計上しても予算を超えないよう、分類の値を比べながら増やす
+    size_t current = category.bytes.load();
+    do {
+        if (limit > 0 && current + bytes > limit) {
+            category.denied++;
+            _owners[(int)owner].denied++;
+            _total.denied++;
+            return false;
+        }
+    } while (!category.bytes.compare_exchange_weak(current, current + bytes));
+    updateMax(category.peak, current + bytes);
+    category.allocations++;
+    Counter& counter = _owners[(int)owner];
+    updateMax(counter.peak, counter.bytes += bytes);
+    counter.allocations++;
+    updateMax(_total.peak, _total.bytes += bytes);
+    _total.allocations++;
+    return true;
+}
+
+void MemoryBudget::charge(MemoryOwner owner, size_t bytes) {
+    add(owner, bytes);
+    _owners[(int)owner].allocations++;
+    _categories[(int)memoryOwnerCategory(owner)].allocations++;
+    _total.allocations++;
+}
+
+void MemoryBudget::release(MemoryOwner owner, size_t bytes) {
+    subtract(owner, bytes);
+}
+
+void MemoryBudget::fail(MemoryOwner owner, size_t bytes) {
+    subtract(owner, bytes);
+    _owners[(int)owner].failures++;
+    _categories[(int)memoryOwnerCategory(owner)].failures++;
+    _total.failures++;
+}
+
+void MemoryBudget::settle(MemoryOwner owner, size_t reserved, size_t actual) {
+    if (actual > reserved) {
+        add(owner, actual - reserved);
+    } else {
+        subtract(owner, reserved - actual);
+    }
+}
+
+void MemoryBudget::noteDegraded(MemoryCategory category) {
+    _categories[(int)category].degraded++;
+    _total.degraded++;
+}
+
+void MemoryBudget::add(MemoryOwner owner, size_t bytes) {
+    Counter& counter = _owners[(int)owner];
+    Counter& category = _categories[(int)memoryOwnerCategory(owner)];
+    updateMax(counter.peak, counter.bytes += bytes);
+    updateMax(category.peak, category.bytes += bytes);
+    updateMax(_total.peak, _total.bytes += bytes);
+}
+
+void MemoryBudget::subtract(MemoryOwner owner, size_t bytes) {
+    _owners[(int)owner].bytes -= bytes;
+    _categories[(int)memoryOwnerCategory(owner)].bytes -= bytes;
+    _total.bytes -= bytes;
+}
+
+MemoryBudget::Usage MemoryBudget::usage(const Counter& counter, size_t budget) {
+    Usage usage = {};
+    usage.bytes = counter.bytes.load();
+    usage.peak = counter.peak.load();
+    usage.budget = budget;
+    usage.allocations = counter.allocations.load();
+    usage.denied = counter.denied.load();
+    usage.failures = counter.failures.load();
+    usage.degraded = counter.degraded.load();
+    return usage;
+}
+
+MemoryBudget::Usage MemoryBudget::owner(MemoryOwner owner) const {
+    return usage(_owners[(int)owner], 0);
+}
+
+MemoryBudget::Usage MemoryBudget::category(MemoryCategory category) const {
+    return usage(_categories[(int)category], budget(category));
+}
+
+MemoryBudget::Usage MemoryBudget::total() const {
+    return usage(_total, 0);
+}
+
+void MemoryBudget::report(void (*line)(const char* text, void* context), void* context) const {
+    char text[128];
+    Usage all = total();
+    snprintf(text, sizeof(text), "memory: %u KB in use (peak %u KB), %u denied, %u failed, %u degraded, "
+             "free PSRAM %u KB",
+             kb(all.bytes), kb(all.peak), (unsigned)all.denied, (unsigned)all.failures,
+             (unsigned)all.degraded, (unsigned)(ESP.getFreePsram() / 1024));
+    line(text, context);
+    snprintf(text, sizeof(text), "  %-16s %8s %8s %8s %7s %6s %6s %8s", "owner", "KB", "peak KB", "budget",
+             "allocs", "denied", "failed", "degraded");
+    line(text, context);
+    for (int c = 0; c < (int)MemoryCategory::Count; c++) {
+        Usage u = category((MemoryCategory)c);
+        char budget_text[16];
+        if (u.budget > 0) {
+            snprintf(budget_text, sizeof(budget_text), "%u", kb(u.budget));
+        } else {
+            snprintf(budget_text, sizeof(budget_text), "-");
+        }
+        snprintf(text, sizeof(text), "  %-16s %8u %8u %8s %7u %6u %6u %8u", CATEGORY_NAMES[c], kb(u.bytes),
+                 kb(u.peak), budget_text, (unsigned)u.allocations, (unsigned)u.denied, (unsigned)u.failures,
+                 (unsigned)u.degraded);
+        line(text, context);
+        for (int o = 0; o < (int)MemoryOwner::Count; o++) {
+            Usage ou = owner((MemoryOwner)o);
+            if ((int)OWNER_CATEGORIES[o] != c || (ou.allocations == 0 && ou.denied == 0)) {
+                continue;
+            }
+            snprintf(text, sizeof(text), "    %-14s %8u %8u %8s %7u %6u %6u", OWNER_NAMES[o], kb(ou.bytes),
+                     kb(ou.peak), "", (unsigned)ou.allocations, (unsigned)ou.denied, (unsigned)ou.failures);
+            line(text, context);
+        }
+    }
+}
+
+void MemoryBudget::resetPeaks() {
+    for (auto& counter : _owners) {
+        counter.peak = counter.bytes.load();
+    }
+    for (auto& counter : _categories) {
+        counter.peak = counter.bytes.load();
+    }
+    _total.peak = _total.bytes.load();
+}
+
+bool createBudgetedSprite(M5Canvas& canvas, int w, int h, MemoryOwner owner) {
+    size_t bytes = (size_t)w * h * 2;
+    canvas.deleteSprite();
+    if (!memory_budget.reserve(owner, bytes)) {
+        M5_LOGW("Memory budget: %s denied %dx%d sprite (%s %u/%u KB)", memoryOwnerName(owner), w, h,
+                memoryCategoryName(memoryOwnerCategory(owner)),
+                kb(memory_budget.category(memoryOwnerCategory(owner)).bytes),
+                kb(memory_budget.budget(memoryOwnerCategory(owner))));
+        return false;
+    }
+    canvas.setPsram(true);  // PSRAMを使用
+    canvas.setColorDepth(16);
+    if (!canvas.createSprite(w, h) || canvas.width() != w || canvas.height() != h) {
+        M5_LOGE("Failed to create %dx%d sprite for %s (Free PSRAM: %d)", w, h, memoryOwnerName(owner),
+                ESP.getFreePsram());
+        canvas.deleteSprite();
+        memory_budget.fail(owner, bytes);
+        return false;
+    }
+    return true;
+}
+
+void deleteBudgetedSprite(M5Canvas& canvas, MemoryOwner owner) {
+    if (canvas.getBuffer()) {
+        memory_budget.release(owner, (size_t)canvas.width() * canvas.height() * 2);
+    }
+    canvas.deleteSprite();
+}
+
+void* budgetedAlloc(size_t bytes, MemoryOwner owner) {
+    if (!memory_budget.reserve(owner, bytes)) {
+        M5_LOGW("Memory budget: %s denied %u bytes", memoryOwnerName(owner), (unsigned)bytes);
+        return nullptr;
+    }
+    void* p = ps_malloc(bytes);
+    if (!p) {
+        memory_budget.fail(owner, bytes);
+    }
+    return p;
+}
+
+void budgetedFree(void* p, size_t bytes, MemoryOwner owner) {
+    if (p) {
+        memory_budget.release(owner, bytes);
+        free(p);
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <atomic>
+
+// 大きなバッファ（キャンバスと PSRAM に確保するもの）を持ち主ごとに集計し、分類ごとの予算で制限する
+//
+// 確保する側は先に reserve() で分類の予算に収まるか確かめて計上し、確保に失敗したら fail()、
+// 解放したら release() する。予算を超える要求は断る（false を返して denied を数える）。
+// 断られたり確保に失敗したりしたら、呼び出し側はそれぞれ決まった方法で軽くして描き続ける
+// （createSprite() が 0x0 のスプライトを作ったまま魚を描かない、ということを起こさない）:
+//   Sprites  魚スプライト（sprite_residency）: 使っていないものを解放し、それでも足りなければ
+//            右向きの画像をやめて左向きの画像を反転して描く
+//   Cache    奥行きキャッシュ: このフレームで使っていないレベルを解放し、それでも足りなければ
+//            使う奥行きのレベルを間引く
+//   Compose  合成用のバッファ: 広げられなければ更新領域を 1 つの外接矩形にまとめる
+//   Scene    背景とレイヤー: 半分の解像度の背景を作らない（背景が作れなければ背景色で塗る）
+//   Work     縮小の作業領域やプロファイラなど（起動時に確保する）
+// 予算 0 は無制限（既定。そのときは実際の確保の失敗だけで軽くする）。
+// 計上はローダータスクからも行うので、値は全て atomic にしてある。
+enum class MemoryCategory : uint8_t {
+    Sprites,
+    Cache,
+    Compose,
+    Scene,
+    Work,
+    Count
+};
+
+enum class MemoryOwner : uint8_t {
+    FishSprites,     // sprite_residency に常駐している魚スプライト
+    SpriteLoad,      // 魚スプライトの読み込み時の展開先（アルファ・パレットの番号）
+    DepthCache,      // 奥行きレベルごとの縮小済みスプライト
+    ComposeBuffer,   // render_pipeline の合成用のバッファ（2 面）
+    UpscaleRows,     // 半分の解像度のフレームを 2 倍に広げて送る行バッファ
+    Background,      // 背景（静的なレイヤーを重ねたもの）
+    HalfBackground,  // 半分の解像度で合成するときの背景
+    StaticLayer,     // 静的なレイヤーの読み込み先（背景に重ねたら解放する）
+    SceneLayers,     // 水草と泡
+    Particles,       // 細かい泡と餌のプール
+    CoverageMask,    // front-to-back の合成で使う行ごとの区間
+    ScaleFilter,     // 縦横に分けた縮小の作業領域
+    SpriteScratch,   // スパン形式を拡大縮小するときの展開先
+    ScaleBuffers,    // scaleFishSprite() の作業領域
+    Profiler,        // 計測区間のリング
+    Count
+};
+
+const char* memoryCategoryName(MemoryCategory category);
+const char* memoryOwnerName(MemoryOwner owner);
+MemoryCategory memoryOwnerCategory(MemoryOwner owner);
+
+class MemoryBudget {
+public:
+    struct Usage {
+        size_t bytes;          // 今計上しているバイト数
+        size_t peak;           // bytes の最大値
+        size_t budget;         // 分類の予算（持ち主の Usage では 0）
+        uint32_t allocations;  // 計上した回数
+        uint32_t denied;       // 予算を超えるので断った回数
+        uint32_t failures;     // 予算には収まったが確保に失敗した回数
+        uint32_t degraded;     // 断られた・失敗したので軽くした回数（分類の Usage だけ）
+    };
+
+    // 分類の予算を設定する（0 で無制限）。setup() の前に設定する
+    void setBudget(MemoryCategory category, size_t bytes);
+    size_t budget(MemoryCategory category) const { return _budgets[(int)category].load(); }
+    // category にあと bytes 入るか
+    bool fits(MemoryCategory category, size_t bytes) const;
+
+    // 予算に収まれば計上して true。収まらなければ断って false
+    bool reserve(MemoryOwner owner, size_t bytes);
+    // 予算を確かめずに計上する（確保した後で大きさがわかったもの、起動時に必ず要るもの）
+    void charge(MemoryOwner owner, size_t bytes);
+    void release(MemoryOwner owner, size_t bytes);
+    // reserve() した bytes の確保に失敗した（計上を戻して失敗を数える）
+    void fail(MemoryOwner owner, size_t bytes);
+    // reserve() した見積もり reserved を、確保した実際の大きさ actual に直す
+    void settle(MemoryOwner owner, size_t reserved, size_t actual);
+    // 予算が足りず category で軽くしたことを数える
+    void noteDegraded(MemoryCategory category);
+
+    Usage owner(MemoryOwner owner) const;
+    Usage category(MemoryCategory category) const;
+    Usage total() const;
+
+    // 分類と持ち主ごとの表を 1 行ずつ line に渡す（シリアルの 'm' とベンチマークの --memory-report）
+    void report(void (*line)(const char* text, void* context), void* context) const;
+    // 最大値を今の値に戻す（計測の区切りで使う）
+    void resetPeaks();
+
+private:
+    struct Counter {
+        std::atomic<size_t> bytes{0};
+        std::atomic<size_t> peak{0};
+        std::atomic<uint32_t> allocations{0};
+        std::atomic<uint32_t> denied{0};
+        std::atomic<uint32_t> failures{0};
+        std::atomic<uint32_t> degraded{0};
+    };
+
+    void add(MemoryOwner owner, size_t bytes);
+    void subtract(MemoryOwner owner, size_t bytes);
+    static Usage usage(const Counter& counter, size_t budget);
+
+    Counter _owners[(int)MemoryOwner::Count];
+    Counter _categories[(int)MemoryCategory::Count];
+    Counter _total;
+    std::atomic<size_t> _budgets[(int)MemoryCategory::Count] = {};
+};
+
+extern MemoryBudget memory_budget;
+
+// 予算を確かめてから canvas に w x h（16 ビット、PSRAM）のスプライトを作る
+// 作れなければ canvas を空のままにして false（ログに出して数える）
+bool createBudgetedSprite(M5Canvas& canvas, int w, int h, MemoryOwner owner);
+// createBudgetedSprite() で作ったスプライトを解放する
+void deleteBudgetedSprite(M5Canvas& canvas, MemoryOwner owner);
+// 予算を確かめてから PSRAM に bytes 確保する（断られたか確保に失敗したら nullptr）
+void* budgetedAlloc(size_t bytes, MemoryOwner owner);
+// budgetedAlloc() で確保した bytes を解放する（nullptr なら何もしない）
+void budgetedFree(void* p, size_t bytes, MemoryOwner owner);
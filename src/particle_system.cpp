@@ -0,0 +1,493 @@
+#include "particle_system.h"
+
+#include <M5Unified.h>
+#include <cmath>
+
+namespace {
+
+const int16_t NOT_DRAWN = INT16_MIN;
+const int MAX_ITEMS = 65535;  // _row_items の番号は uint16_t
+
+const int BUBBLE_LOOKS = 3;  // 半径 1〜3 の泡
+const float BUBBLE_SPEED_MIN = 50.0f;  // 上がる速さ（ピクセル/秒）
+const float BUBBLE_SPEED_MAX = 110.0f;
+const float BUBBLE_WOBBLE = 14.0f;  // 横揺れの速さの振幅（ピクセル/秒）
+const uint32_t BUBBLE_WOBBLE_STEP_MS = 30;  // 横揺れの位相を 1 つ進める時間（64 段で 1 周）
+const float AERATOR_SHARE = 0.5f;  // エアストーンから湧く泡の割合（残りは水底のあちこちから）
+const int AERATOR_SPREAD = 6;
+const uint32_t MAX_STEP_MS = 100;  // これより長く止まっていたら泡を飛ばさない
+
+const int PELLET_LOOK = BUBBLE_LOOKS;  // 餌の画像は泡の後に 2 種類
+const int PELLET_LOOKS = 2;
+const int PELLET_DROP_COUNT = 6;  // 1 回のタップで落とす数
+const float PELLET_SPREAD = 14.0f;  // 落とす位置のばらつき（ピクセル）
+const float PELLET_DRIFT = 25.0f;  // 落としたときの横の速さの最大（ピクセル/秒）
+const float PELLET_DRAG = 2.0f;  // 横の速さの減衰（秒あたり）
+const float PELLET_SINK_SPEED = 45.0f;  // 沈む速さ（ピクセル/秒）
+const int PELLET_FLOOR = 10;  // 底に着いたときの画面の下端からの高さ
+const uint16_t PELLET_REST_MS = 3000;  // 底に着いてから溶けて消えるまで
+
+const float TWO_PI = 6.2831853f;
+
+// 確保領域 p から capacity 個分の配列を切り出す
+template <class T>
+void carve(T*& array, uint8_t*& p, int capacity) {
+    array = (T*)p;
+    p += sizeof(T) * capacity;
+}
+
+// スプライトメモリと同じバイトスワップ済み RGB565
+uint16_t rawColor(int r, int g, int b) {
+    uint16_t v = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+    return (uint16_t)((v << 8) | (v >> 8));
+}
+
+// 半径 r の泡（輪とハイライト）。r = 0 なら 1 ピクセル
+bool buildBubble(SpanSprite& sprite, int r) {
+    uint16_t ring = rawColor(200, 235, 255);
+    uint16_t highlight = rawColor(255, 255, 255);
+    int d = r * 2 + 1;
+    uint16_t pixels[7 * 7];
+    for (int y = 0; y < d; y++) {
+        for (int x = 0; x < d; x++) {
+            float dist = sqrtf((float)((x - r) * (x - r) + (y - r) * (y - r)));
+            pixels[y * d + x] = (dist >= r - 0.8f && dist <= r + 0.3f) ? ring : TFT_BLACK;
+        }
+    }
+    if (r >= 2) {
+        pixels[(r / 2) * d + r / 2] = highlight;
+    }
+    return sprite.build(pixels, d, d, d, TFT_BLACK);
+}
+
+// size 四方の餌（左上を明るくする）
+bool buildPellet(SpanSprite& sprite, int size, int shade) {
+    uint16_t body = rawColor(150 + shade, 90 + shade / 2, 40);
+    uint16_t light = rawColor(200 + shade / 2, 140 + shade / 2, 70);
+    uint16_t pixels[4 * 4];
+    for (int i = 0; i < size * size; i++) {
+        pixels[i] = body;
+    }
+    if (size >= 3) {
+        pixels[0] = TFT_BLACK;  // 角を落として丸く見せる
+        pixels[size - 1] = TFT_BLACK;
+        pixels[size + 1] = light;
+    }
+    return sprite.build(pixels, size, size, size, TFT_BLACK);
+}
+
+}  // namespace
+
+ParticleSystem::~ParticleSystem() {
+    free(_bubbles.block);
+    free(_pellets.block);
+    free(_row_items);
+}
+
+bool ParticleSystem::allocatePool(Pool& pool, int capacity) {
+    free(pool.block);
+    pool = Pool();
+    // 4 バイトの配列から順に並べる（それぞれの境界に揃う）
+    size_t bytes = (size_t)capacity * (sizeof(float) * 4 + sizeof(uint16_t) + sizeof(int16_t) * 2 + 2);
+    pool.block = (uint8_t*)ps_malloc(max(bytes, (size_t)1));
+    if (!pool.block) {
+        return false;
+    }
+    uint8_t* p = pool.block;
+    carve(pool.x, p, capacity);
+    carve(pool.y, p, capacity);
+    carve(pool.vx, p, capacity);
+    carve(pool.vy, p, capacity);
+    carve(pool.life, p, capacity);
+    carve(pool.drawn_x, p, capacity);
+    carve(pool.drawn_y, p, capacity);
+    carve(pool.phase, p, capacity);
+    carve(pool.look, p, capacity);
+    pool.capacity = capacity;
+    return true;
+}
+
+bool ParticleSystem::begin(int width, int height, int bubble_capacity, int pellet_capacity, uint32_t seed) {
+    _width = width;
+    _height = height;
+    _tile_size = 32;
+    while ((width + _tile_size - 1) / _tile_size > MAX_TILE_COLUMNS ||
+           (height + _tile_size - 1) / _tile_size > MAX_TILE_ROWS) {
+        _tile_size *= 2;
+    }
+    _tile_columns = (width + _tile_size - 1) / _tile_size;
+    _tile_rows = (height + _tile_size - 1) / _tile_size;
+    memset(_tiles, 0, sizeof(_tiles));
+    _random = SimRandom(seed ^ 0x50415254u);  // シミュレーションとは別の系列
+    _sim_random = SimRandom(seed ^ 0x50454C4Cu);
+    _first = true;
+    _emit_accum = 0.0f;
+    _stats = Stats();
+
+    bubble_capacity = max(1, min(bubble_capacity, MAX_ITEMS - pellet_capacity));
+    free(_row_items);
+    _row_items = (uint16_t*)ps_malloc(sizeof(uint16_t) * (bubble_capacity + pellet_capacity));
+    if (!_row_items || !allocatePool(_bubbles, bubble_capacity) || !allocatePool(_pellets, pellet_capacity)) {
+        M5_LOGE("Failed to allocate particle pools (%d + %d)", bubble_capacity, pellet_capacity);
+        free(_bubbles.block);
+        free(_pellets.block);
+        _bubbles = Pool();
+        _pellets = Pool();
+        return false;
+    }
+    _bytes = (size_t)(bubble_capacity + pellet_capacity) * (sizeof(float) * 4 + sizeof(uint16_t) * 4 + 2);
+
+    // 泡は半径 1〜3、縦横半分の解像度ではその半分（0 は 1 ピクセル）
+    _looks = std::vector<Look>(BUBBLE_LOOKS + PELLET_LOOKS);
+    bool ok = true;
+    for (int k = 0; k < BUBBLE_LOOKS; k++) {
+        ok = ok && buildBubble(_looks[k].full, k + 1) && buildBubble(_looks[k].half, (k + 1) / 2);
+    }
+    for (int k = 0; k < PELLET_LOOKS; k++) {
+        Look& look = _looks[PELLET_LOOK + k];
+        ok = ok && buildPellet(look.full, 3 + k, k * 20) && buildPellet(look.half, 2, k * 20);
+    }
+    if (!ok) {
+        M5_LOGE("Failed to build particle sprites");
+        _bubbles.capacity = 0;
+        return false;
+    }
+    for (const auto& look : _looks) {
+        _bytes += look.full.bytes() + look.half.bytes();
+    }
+    for (int k = 0; k < 64; k++) {
+        _wobble[k] = BUBBLE_WOBBLE * sinf(TWO_PI * k / 64.0f);
+    }
+    for (auto& x : _emitters) {
+        x = width * (0.15f + 0.7f * _random.uniform());
+    }
+    M5_LOGI("Particles: %d bubbles + %d pellets, %dpx tiles (%dx%d), %u bytes", bubble_capacity,
+            pellet_capacity, _tile_size, _tile_columns, _tile_rows, (unsigned)_bytes);
+    return true;
+}
+
+float ParticleSystem::bubbleLifetime() const {
+    return (_height + BUBBLE_LOOKS * 2) / ((BUBBLE_SPEED_MIN + BUBBLE_SPEED_MAX) * 0.5f);
+}
+
+void ParticleSystem::fillBubbles(int count) {
+    for (int k = 0; k < count && enabled(); k++) {
+        spawnBubble(_height * _random.uniform());
+    }
+}
+
+void ParticleSystem::spawnBubble(float y) {
+    Pool& pool = _bubbles;
+    if (pool.count >= pool.capacity) {
+        _stats.pool_full++;
+        return;
+    }
+    int i = pool.count++;
+    bool aerator = _random.uniform() < AERATOR_SHARE;
+    pool.x[i] = aerator ? _emitters[_random.range(0, 2)] + _random.range(-AERATOR_SPREAD, AERATOR_SPREAD + 1)
+                        : _width * _random.uniform();
+    pool.y[i] = y;
+    pool.vx[i] = 0.0f;
+    pool.vy[i] = -(BUBBLE_SPEED_MIN + (BUBBLE_SPEED_MAX - BUBBLE_SPEED_MIN) * _random.uniform());
+    pool.life[i] = 0;
+    pool.phase[i] = (uint8_t)_random.range(0, 64);
+    pool.look[i] = (uint8_t)_random.range(0, BUBBLE_LOOKS);
+    pool.drawn_x[i] = NOT_DRAWN;
+    pool.drawn_y[i] = NOT_DRAWN;
+    _stats.spawned++;
+}
+
+int ParticleSystem::dropPellets(float x, float y) {
+    Pool& pool = _pellets;
+    int dropped = 0;
+    for (int k = 0; k < PELLET_DROP_COUNT; k++) {
+        // プールが一杯でも乱数は同じだけ進める（落とせた数で後の餌の動きが変わらないよう）
+        float px = x + (_sim_random.uniform() * 2.0f - 1.0f) * PELLET_SPREAD;
+        float py = y + (_sim_random.uniform() * 2.0f - 1.0f) * PELLET_SPREAD;
+        float vx = (_sim_random.uniform() * 2.0f - 1.0f) * PELLET_DRIFT;
+        float vy = PELLET_SINK_SPEED * (0.8f + 0.4f * _sim_random.uniform());
+        int look = PELLET_LOOK + _sim_random.range(0, PELLET_LOOKS);
+        if (pool.count >= pool.capacity) {
+            _stats.pool_full++;
+            continue;
+        }
+        int i = pool.count++;
+        pool.x[i] = px;
+        pool.y[i] = py;
+        pool.vx[i] = vx;
+        pool.vy[i] = vy;
+        pool.life[i] = PELLET_REST_MS;
+        pool.phase[i] = 0;
+        pool.look[i] = (uint8_t)look;
+        pool.drawn_x[i] = NOT_DRAWN;
+        pool.drawn_y[i] = NOT_DRAWN;
+        _stats.spawned++;
+        dropped++;
+    }
+    return dropped;
+}
+
+void ParticleSystem::step(float delta_sec) {
+    Pool& pool = _pellets;
+    const float floor_y = (float)(_height - PELLET_FLOOR);
+    const float damping = max(0.0f, 1.0f - PELLET_DRAG * delta_sec);
+    const int step_ms = (int)lroundf(delta_sec * 1000.0f);
+    for (int i = 0; i < pool.count;) {
+        float vx = pool.vx[i] * damping;
+        float x = pool.x[i] + vx * delta_sec;
+        float y = pool.y[i] + pool.vy[i] * delta_sec;
+        pool.vx[i] = vx;
+        pool.x[i] = x < 0.0f ? 0.0f : (x > _width - 1 ? (float)(_width - 1) : x);
+        pool.y[i] = y;
+        if (y >= floor_y) {
+            pool.y[i] = floor_y;
+            pool.vx[i] = 0.0f;
+            if (pool.life[i] <= step_ms) {
+                remove(pool, i);
+                continue;
+            }
+            pool.life[i] -= step_ms;
+        }
+        i++;
+    }
+}
+
+int ParticleSystem::nearestPellet(float x, float y, float radius) const {
+    const Pool& pool = _pellets;
+    int nearest = -1;
+    float best = radius * radius;
+    for (int i = 0; i < pool.count; i++) {
+        float dx = pool.x[i] - x;
+        float dy = pool.y[i] - y;
+        float dist_sq = dx * dx + dy * dy;
+        if (dist_sq < best) {
+            best = dist_sq;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+void ParticleSystem::eatPellet(int i) {
+    remove(_pellets, i);
+    _stats.eaten++;
+}
+
+void ParticleSystem::remove(Pool& pool, int i) {
+    int w = _looks[pool.look[i]].full.width();
+    if (pool.drawn_x[i] != NOT_DRAWN) {
+        markRect(pool.drawn_x[i], pool.drawn_y[i], w, w);
+    }
+    int last = --pool.count;
+    if (i != last) {
+        pool.x[i] = pool.x[last];
+        pool.y[i] = pool.y[last];
+        pool.vx[i] = pool.vx[last];
+        pool.vy[i] = pool.vy[last];
+        pool.life[i] = pool.life[last];
+        pool.phase[i] = pool.phase[last];
+        pool.look[i] = pool.look[last];
+        pool.drawn_x[i] = pool.drawn_x[last];
+        pool.drawn_y[i] = pool.drawn_y[last];
+    }
+}
+
+void ParticleSystem::place(Pool& pool, int i) {
+    int w = _looks[pool.look[i]].full.width();  // 粒子の画像は正方形
+    int x = (int)lroundf(pool.x[i]) - w / 2;
+    int y = (int)lroundf(pool.y[i]) - w / 2;
+    if (x == pool.drawn_x[i] && y == pool.drawn_y[i]) {
+        return;
+    }
+    if (pool.drawn_x[i] != NOT_DRAWN) {
+        markRect(pool.drawn_x[i], pool.drawn_y[i], w, w);
+    }
+    markRect(x, y, w, w);
+    pool.drawn_x[i] = (int16_t)x;
+    pool.drawn_y[i] = (int16_t)y;
+}
+
+void ParticleSystem::markRect(int x, int y, int w, int h) {
+    int x0 = max(0, x);
+    int y0 = max(0, y);
+    int x1 = min(_width, x + w);
+    int y1 = min(_height, y + h);
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
+    int c0 = x0 / _tile_size;
+    int c1 = (x1 - 1) / _tile_size;
+    // c0〜c1 のビット（c1 が 63 でもあふれないよう 2 回に分けてずらす）
+    uint64_t bits = (((uint64_t)2 << c1) - 1) & ~(((uint64_t)1 << c0) - 1);
+    for (int r = y0 / _tile_size; r <= (y1 - 1) / _tile_size; r++) {
+        _tiles[r] |= bits;
+    }
+}
+
+void ParticleSystem::update(uint32_t now_ms, DirtyRegionManager& regions) {
+    _stats.tiles = 0;
+    _stats.rects = 0;
+    _stats.pixels = 0;
+    if (!enabled()) {
+        return;
+    }
+    if (_first) {
+        _last_ms = now_ms;
+        _first = false;
+    }
+    float dt = min(now_ms - _last_ms, MAX_STEP_MS) / 1000.0f;
+    _last_ms = now_ms;
+
+    Pool& bubbles = _bubbles;
+    if (!_animated) {
+        // 止めている間は泡を消して湧かせない（描いてあった所だけ更新する）
+        while (bubbles.count > 0) {
+            remove(bubbles, bubbles.count - 1);
+        }
+        _emit_accum = 0.0f;
+    } else {
+        _emit_accum += _bubble_rate * dt;
+        while (_emit_accum >= 1.0f) {
+            spawnBubble((float)(_height + BUBBLE_LOOKS));
+            _emit_accum -= 1.0f;
+        }
+        // 位置はまとめて進め（分岐なし）、描く位置と消すかどうかは次のループで決める
+        const uint32_t phase = now_ms / BUBBLE_WOBBLE_STEP_MS;
+        float* __restrict px = bubbles.x;
+        float* __restrict py = bubbles.y;
+        const float* __restrict pvy = bubbles.vy;
+        const uint8_t* __restrict pphase = bubbles.phase;
+        for (int i = 0; i < bubbles.count; i++) {
+            py[i] += pvy[i] * dt;
+            px[i] += _wobble[(pphase[i] + phase) & 63] * dt;
+        }
+        for (int i = 0; i < bubbles.count;) {
+            // 水面の上に出たら消す
+            if (py[i] + BUBBLE_LOOKS < 0.0f) {
+                remove(bubbles, i);
+                continue;
+            }
+            place(bubbles, i);
+            i++;
+        }
+    }
+    for (int i = 0; i < _pellets.count; i++) {
+        place(_pellets, i);
+    }
+    flushTiles(regions);
+    buildRows();
+    _stats.bubbles = bubbles.count;
+    _stats.pellets = _pellets.count;
+}
+
+void ParticleSystem::flushTiles(DirtyRegionManager& regions) {
+    for (int r = 0; r < _tile_rows; r++) {
+        uint64_t row = _tiles[r];
+        if (!row) {
+            continue;
+        }
+        _tiles[r] = 0;
+        // 続いているタイルを 1 つの矩形にする（多すぎたら行全体の外接矩形）
+        int runs[MAX_ROW_RECTS + 1][2];
+        int count = 0;
+        int first = -1;
+        int last = -1;
+        for (int c = 0; c < _tile_columns; c++) {
+            if (!((row >> c) & 1)) {
+                continue;
+            }
+            _stats.tiles++;
+            if (count > 0 && runs[count - 1][1] == c) {
+                runs[count - 1][1] = c + 1;
+            } else if (count <= MAX_ROW_RECTS) {
+                runs[count][0] = c;
+                runs[count][1] = c + 1;
+                count++;
+            }
+            if (first < 0) first = c;
+            last = c;
+        }
+        if (count > MAX_ROW_RECTS) {
+            runs[0][0] = first;
+            runs[0][1] = last + 1;
+            count = 1;
+        }
+        for (int k = 0; k < count; k++) {
+            int x = runs[k][0] * _tile_size;
+            int y = r * _tile_size;
+            int w = min(_width, runs[k][1] * _tile_size) - x;
+            int h = min(_height, y + _tile_size) - y;
+            regions.add(x, y, w, h);
+            _stats.rects++;
+            _stats.pixels += (uint32_t)w * h;
+        }
+    }
+}
+
+void ParticleSystem::buildRows() {
+    // 描いた位置の上端のタイルの行ごとに数えて並べる（粒子はタイルより小さいので、掛かるのは
+    // その行と次の行だけ）
+    int counts[MAX_TILE_ROWS] = {};
+    auto rowOf = [&](int16_t y) { return max(0, min(_tile_rows - 1, (int)y / _tile_size)); };
+    for (const Pool* pool : {&_bubbles, &_pellets}) {
+        for (int i = 0; i < pool->count; i++) {
+            if (pool->drawn_x[i] != NOT_DRAWN) {
+                counts[rowOf(pool->drawn_y[i])]++;
+            }
+        }
+    }
+    _row_start[0] = 0;
+    for (int r = 0; r < _tile_rows; r++) {
+        _row_start[r + 1] = (uint16_t)(_row_start[r] + counts[r]);
+        counts[r] = _row_start[r];
+    }
+    for (int i = 0; i < _bubbles.count; i++) {
+        if (_bubbles.drawn_x[i] != NOT_DRAWN) {
+            _row_items[counts[rowOf(_bubbles.drawn_y[i])]++] = (uint16_t)i;
+        }
+    }
+    for (int i = 0; i < _pellets.count; i++) {
+        if (_pellets.drawn_x[i] != NOT_DRAWN) {
+            _row_items[counts[rowOf(_pellets.drawn_y[i])]++] = (uint16_t)(_bubbles.capacity + i);
+        }
+    }
+}
+
+uint32_t ParticleSystem::draw(uint16_t* dst, const DirtyRect& region, bool half) const {
+    if (!enabled() || _first) {
+        return 0;
+    }
+    uint32_t written = 0;
+    int r0 = max(0, region.y / _tile_size - 1);
+    int r1 = min(_tile_rows - 1, (region.bottom() - 1) / _tile_size);
+    for (int r = r0; r <= r1; r++) {
+        for (int k = _row_start[r]; k < _row_start[r + 1]; k++) {
+            int item = _row_items[k];
+            if (item < _bubbles.capacity) {
+                written += drawPool(_bubbles, item, dst, region, half);
+            } else {
+                written += drawPool(_pellets, item - _bubbles.capacity, dst, region, half);
+            }
+        }
+    }
+    return written;
+}
+
+uint32_t ParticleSystem::drawPool(const Pool& pool, int index, uint16_t* dst, const DirtyRect& region,
+                                  bool half) const {
+    const Look& look = _looks[pool.look[index]];
+    int w = look.full.width();
+    int x = pool.drawn_x[index];
+    int y = pool.drawn_y[index];
+    if (!intersects(DirtyRect{x, y, w, w}, region)) {
+        return 0;
+    }
+    if (!half) {
+        return look.full.blit(dst, region.w, region.h, x - region.x, y - region.y);
+    }
+    // 半分の解像度では中心を合わせて小さい画像を描く
+    int hw = look.half.width();
+    int hx = (x + w / 2) / 2 - hw / 2 - region.x / 2;
+    int hy = (y + w / 2) / 2 - hw / 2 - region.y / 2;
+    return look.half.blit(dst, region.w / 2, region.h / 2, hx, hy);
+}
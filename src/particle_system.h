@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dirty_region.h"
+#include "sim_random.h"
+#include "span_sprite.h"
+
+// 小さな粒子（水底から湧く細かい泡と、タップで落とす餌）
+//
+// 粒子は種類ごとの固定容量のプールに Structure of Arrays で持ち、begin() の後は確保しない
+// （一杯なら出さずに数える。消すときは最後の要素と入れ替える）。
+// 泡は見た目だけの粒子で、SceneLayers と同じく描画時刻で動かす（シミュレーションに影響しない）。
+// 餌は魚が寄ってきて食べるのでシミュレーションの一部で、固定刻みの step() で動かし、
+// 乱数も sim_seed から作った系列を使う（泡の数や描画の品質に左右されない）。
+//
+// 更新領域は粒子ごとではなく画面を 32 ピクセル四方（画面が大きければその倍）のタイルに分けて数える。前回と今回の位置が
+// 掛かるタイルに印を付け、タイルの行ごとに続いている所を 1 つの矩形にする（行ごとに
+// MAX_ROW_RECTS を超えたら行全体の外接矩形にまとめる）。粒子が何千あっても更新領域の数は
+// maxRects() を超えない。描画はタイルの行ごとに粒子の番号を並べておき、領域に掛かる行だけを見る。
+class ParticleSystem {
+public:
+    static const int MAX_TILE_COLUMNS = 64;  // タイルの行を uint64_t の印で持つ
+    static const int MAX_TILE_ROWS = 64;
+    static const int MAX_ROW_RECTS = 4;
+
+    struct Stats {
+        uint32_t bubbles;      // 生きている泡
+        uint32_t pellets;      // 生きている餌
+        uint32_t spawned;      // 出した粒子の累計
+        uint32_t pool_full;    // プールが一杯で出せなかった数
+        uint32_t eaten;        // 魚が食べた餌の累計
+        uint32_t tiles;        // 直近の update() で印を付けたタイルの数
+        uint32_t rects;        // そのとき加えた更新領域の数
+        uint32_t pixels;       // その面積
+    };
+
+    ParticleSystem() {}
+    ~ParticleSystem();
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+    // bubble_capacity 個の泡と pellet_capacity 個の餌のプールを確保する
+    bool begin(int width, int height, int bubble_capacity, int pellet_capacity, uint32_t seed);
+    bool enabled() const { return _bubbles.capacity > 0; }
+
+    // 泡が湧く速さ（個/秒）。泡の寿命は画面の高さと上がる速さで決まる
+    void setBubbleRate(float per_sec) { _bubble_rate = per_sec; }
+    float bubbleRate() const { return _bubble_rate; }
+    // 上がりきるまでの平均の時間（秒）。生きている泡の数 ≒ bubbleRate() * この時間
+    float bubbleLifetime() const;
+    // count 個の泡を水中のあちこちに出す（ベンチマークで定常状態から始めるため）
+    void fillBubbles(int count);
+    // false にすると泡を消して湧かなくする（次の update() で泡の跡を更新領域に加える）
+    void setAnimated(bool animated) { _animated = animated; }
+
+    // (x, y) に餌をひとつかみ落とす（シミュレーションのステップの中で呼ぶ）。落とした数を返す
+    int dropPellets(float x, float y);
+    // 餌を delta_sec 秒進める（沈んで底に着き、しばらくしたら溶けて消える）
+    void step(float delta_sec);
+    int pelletCount() const { return _pellets.count; }
+    // (x, y) から radius 以内で一番近い餌の番号（無ければ -1）
+    int nearestPellet(float x, float y, float radius) const;
+    float pelletX(int i) const { return _pellets.x[i]; }
+    float pelletY(int i) const { return _pellets.y[i]; }
+    // 餌 i を食べる（番号は最後の餌と入れ替わる）
+    void eatPellet(int i);
+
+    // now_ms の状態に進め、変化したタイルを regions に加える
+    void update(uint32_t now_ms, DirtyRegionManager& regions);
+    // 1 回の update() で加える更新領域の最大数
+    size_t maxRects() const { return (size_t)_tile_rows * MAX_ROW_RECTS; }
+
+    // region のバッファに重なる粒子を描画する。書き込んだピクセル数を返す
+    // half なら dst は region の縦横半分の解像度（region は画面上の位置）
+    uint32_t draw(uint16_t* dst, const DirtyRect& region, bool half) const;
+
+    const Stats& stats() const { return _stats; }
+    size_t bytes() const { return _bytes; }
+
+private:
+    // 1 種類分のプール（配列は 1 つの確保領域の一部）
+    struct Pool {
+        float* x = nullptr;
+        float* y = nullptr;
+        float* vx = nullptr;
+        float* vy = nullptr;
+        uint16_t* life = nullptr;   // 餌: 底に着いてから溶けて消えるまでの残り（ms）
+        uint8_t* phase = nullptr;   // 泡: 横揺れの位相
+        uint8_t* look = nullptr;    // 画像の番号（_looks）
+        int16_t* drawn_x = nullptr;  // 前回描いた左上（NOT_DRAWN なら描いていない）
+        int16_t* drawn_y = nullptr;
+        int count = 0;
+        int capacity = 0;
+        uint8_t* block = nullptr;
+    };
+    struct Look {
+        SpanSprite full;
+        SpanSprite half;
+    };
+
+    static bool allocatePool(Pool& pool, int capacity);
+    // 粒子 i を消す（最後の要素と入れ替える）。描いてあった所にタイルの印を付ける
+    void remove(Pool& pool, int i);
+    // 描く位置を決め、変わっていれば前回と今回の位置に印を付ける
+    void place(Pool& pool, int i);
+    void spawnBubble(float y);
+    void markRect(int x, int y, int w, int h);
+    // タイルの印を更新領域にして regions に加える
+    void flushTiles(DirtyRegionManager& regions);
+    // 描画用にタイルの行ごとに粒子を並べる
+    void buildRows();
+    uint32_t drawPool(const Pool& pool, int index, uint16_t* dst, const DirtyRect& region, bool half) const;
+
+    Pool _bubbles;
+    Pool _pellets;
+    std::vector<Look> _looks;
+    size_t _bytes = 0;
+    int _width = 0;
+    int _height = 0;
+    int _tile_size = 32;
+    int _tile_columns = 0;
+    int _tile_rows = 0;
+    uint64_t _tiles[MAX_TILE_ROWS] = {};
+    // タイルの行ごとの粒子（泡は番号そのまま、餌は番号 + 泡の容量）
+    uint16_t* _row_items = nullptr;
+    uint16_t _row_start[MAX_TILE_ROWS + 1] = {};
+    float _emitters[2] = {0.0f, 0.0f};  // 泡がまとまって湧く所（エアストーン）の x
+    float _wobble[64] = {};             // 泡の横揺れの速さ（位相ごと、ピクセル/秒）
+    float _bubble_rate = 0.0f;
+    float _emit_accum = 0.0f;
+    uint32_t _last_ms = 0;
+    bool _first = true;
+    bool _animated = true;
+    SimRandom _random{1};      // 泡（見た目だけ）
+    SimRandom _sim_random{1};  // 餌（シミュレーション）
+    Stats _stats = {};
+};
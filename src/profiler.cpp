@@ -0,0 +1,223 @@
+#include "profiler.h"
+
+#if AQUARIUM_PROFILE
+
+#include <cstdio>
+#include <new>
+
+#include "memory_budget.h"
+
+Profiler profiler;
+
+namespace {
+
+const char* STAGE_NAMES[(int)ProfileStage::Count] = {
+    "frame", "wait", "input", "update", "bounds", "sort", "background", "plants", "fish", "bubbles",
+    "submit", "push", "pace", "stream",
+};
+
+// Chrome のトレースで表示する行（転送と差分の送り出しは転送タスクの行に出す）
+int stageTrack(ProfileStage stage) {
+    return stage == ProfileStage::PanelPush || stage == ProfileStage::Stream ? 1 : 0;
+}
+
+template <class T>
+void updateMin(std::atomic<T>& target, T value) {
+    T current = target.load(std::memory_order_relaxed);
+    while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+template <class T>
+void updateMax(std::atomic<T>& target, T value) {
+    T current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+}  // namespace
+
+const char* profileStageName(ProfileStage stage) {
+    return stage < ProfileStage::Count ? STAGE_NAMES[(int)stage] : "?";
+}
+
+bool Profiler::begin(uint32_t window_frames) {
+    if (!_ring) {
+        // 16 バイト x RING_SIZE。内部 RAM を使わないよう PSRAM に置く
+        _ring = (Slot*)budgetedAlloc(sizeof(Slot) * RING_SIZE, MemoryOwner::Profiler);
+        if (!_ring) {
+            M5_LOGE("Failed to allocate profiler ring (%u bytes)", (unsigned)(sizeof(Slot) * RING_SIZE));
+            return false;
+        }
+        for (uint32_t i = 0; i < RING_SIZE; i++) {
+            new (&_ring[i]) Slot();
+            _ring[i].seq.store(0, std::memory_order_relaxed);
+        }
+    }
+    reset(window_frames);
+    return true;
+}
+
+void Profiler::record(ProfileStage stage, uint32_t start_us, uint32_t duration_us, uint32_t arg) {
+    if (!_ring) {
+        return;
+    }
+    uint32_t index = _head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = _ring[index & (RING_SIZE - 1)];
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.start_us.store(start_us, std::memory_order_relaxed);
+    slot.duration_us.store(duration_us, std::memory_order_relaxed);
+    slot.meta.store((uint32_t)stage | (arg << 8), std::memory_order_relaxed);
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+
+    Histogram& h = _histograms[(int)stage];
+    h.buckets[bucketOf(duration_us)].fetch_add(1, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sum_us.fetch_add(duration_us, std::memory_order_relaxed);
+    updateMin(h.min_us, duration_us);
+    updateMax(h.max_us, duration_us);
+}
+
+void Profiler::endFrame() {
+    if (_window_frames > 0 && ++_frames >= _window_frames) {
+        roll();
+    }
+}
+
+void Profiler::roll() {
+    for (int s = 0; s < (int)ProfileStage::Count; s++) {
+        Histogram& h = _histograms[s];
+        Summary summary = {};
+        summary.count = h.count.exchange(0, std::memory_order_relaxed);
+        uint64_t sum = h.sum_us.exchange(0, std::memory_order_relaxed);
+        summary.min_us = h.min_us.exchange(UINT32_MAX, std::memory_order_relaxed);
+        summary.max_us = h.max_us.exchange(0, std::memory_order_relaxed);
+        // 上から数えて 1% に入るバケットの代表値を p99 とする
+        uint32_t counts[BUCKETS];
+        uint32_t total = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            counts[b] = h.buckets[b].exchange(0, std::memory_order_relaxed);
+            total += counts[b];
+        }
+        uint32_t rank = total - total / 100;
+        uint32_t seen = 0;
+        for (int b = 0; b < BUCKETS && total > 0; b++) {
+            seen += counts[b];
+            if (seen >= rank) {
+                summary.p99_us = bucketValue(b);
+                break;
+            }
+        }
+        if (summary.count > 0) {
+            summary.avg_us = (uint32_t)(sum / summary.count);
+            // バケットの代表値は丸めてあるので、実測の範囲に収める
+            summary.p99_us = max(summary.min_us, min(summary.max_us, summary.p99_us));
+        } else {
+            summary.min_us = 0;
+        }
+        _summary[s] = summary;
+    }
+    _frames = 0;
+    _windows++;
+}
+
+void Profiler::reset(uint32_t window_frames) {
+    _window_frames = window_frames;
+    _frames = 0;
+    _windows = 0;
+    for (int s = 0; s < (int)ProfileStage::Count; s++) {
+        Histogram& h = _histograms[s];
+        for (auto& bucket : h.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        h.count.store(0, std::memory_order_relaxed);
+        h.sum_us.store(0, std::memory_order_relaxed);
+        h.min_us.store(UINT32_MAX, std::memory_order_relaxed);
+        h.max_us.store(0, std::memory_order_relaxed);
+        _summary[s] = Summary();
+    }
+    if (_ring) {
+        for (uint32_t i = 0; i < RING_SIZE; i++) {
+            _ring[i].seq.store(0, std::memory_order_relaxed);
+        }
+    }
+    _head.store(0, std::memory_order_relaxed);
+}
+
+// 8us 未満はそのまま、それ以上は 2 の累乗ごとに 4 分割する（誤差 25% 以内）
+int Profiler::bucketOf(uint32_t us) {
+    if (us < 8) {
+        return (int)us;
+    }
+    int msb = 31 - __builtin_clz(us);
+    int bucket = 8 + (msb - 3) * 4 + (int)((us >> (msb - 2)) & 3);
+    return min(bucket, BUCKETS - 1);
+}
+
+uint32_t Profiler::bucketValue(int bucket) {
+    if (bucket < 8) {
+        return (uint32_t)bucket;
+    }
+    int msb = (bucket - 8) / 4 + 3;
+    uint32_t sub = (uint32_t)((bucket - 8) % 4);
+    uint32_t low = (1u << msb) | (sub << (msb - 2));
+    return low + (1u << (msb - 3));  // バケットの中央
+}
+
+uint32_t Profiler::exportTrace(void (*out)(const char* text, size_t length, void* context),
+                               void* context) const {
+    char line[160];
+    auto emit = [&](int length) {
+        if (length > 0) {
+            out(line, min((size_t)length, sizeof(line) - 1), context);
+        }
+    };
+    emit(snprintf(line, sizeof(line),
+                  "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"loop\"}},\n"));
+    emit(snprintf(line, sizeof(line),
+                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"panel_push\"}}"));
+    if (!_ring) {
+        emit(snprintf(line, sizeof(line), "\n]}\n"));
+        return 0;
+    }
+    uint32_t head = _head.load(std::memory_order_acquire);
+    uint32_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+    uint32_t exported = 0;
+    for (uint32_t index = first; index < head; index++) {
+        const Slot& slot = _ring[index & (RING_SIZE - 1)];
+        uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        uint32_t start = slot.start_us.load(std::memory_order_relaxed);
+        uint32_t duration = slot.duration_us.load(std::memory_order_relaxed);
+        uint32_t meta = slot.meta.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // 書き込み中か、読んでいる間に上書きされたものは飛ばす
+        if (seq != 2 * index + 2 || slot.seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+        ProfileStage stage = (ProfileStage)(meta & 0xFF);
+        if (stage >= ProfileStage::Count) {
+            continue;
+        }
+        int length;
+        if (stage == ProfileStage::FishBlit) {
+            length = snprintf(line, sizeof(line),
+                              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%u,\"dur\":%u,"
+                              "\"args\":{\"fish\":%u}}",
+                              profileStageName(stage), stageTrack(stage), (unsigned)start,
+                              (unsigned)duration, (unsigned)(meta >> 8));
+        } else {
+            length = snprintf(line, sizeof(line),
+                              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%u,\"dur\":%u}",
+                              profileStageName(stage), stageTrack(stage), (unsigned)start,
+                              (unsigned)duration);
+        }
+        emit(length);
+        exported++;
+    }
+    emit(snprintf(line, sizeof(line), "\n]}\n"));
+    return exported;
+}
+
+#endif  // AQUARIUM_PROFILE
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <atomic>
+
+// フレームの段階ごとの処理時間を記録するプロファイラ
+//
+// 区間（段階・開始時刻・長さ）を起動時に確保したリングバッファに書き込み、段階ごとのヒストグラムで
+// PROFILE_WINDOW フレームごとの最小・平均・p99・最大を集計する。書き込みは loop() と転送タスクの
+// 両方から行うので、ロックは使わずスロットごとの通し番号で読み書きの食い違いを検出する。
+// リングの内容は Chrome のトレース形式（chrome://tracing、Perfetto）の JSON で書き出せる。
+//
+// AQUARIUM_PROFILE が 0（既定）なら PROFILE_* マクロは何も生成しない（製品版に残しておける）。
+// ネイティブビルドは platformio.ini で 1 にしている。
+
+#ifndef AQUARIUM_PROFILE
+#define AQUARIUM_PROFILE 0
+#endif
+
+enum class ProfileStage : uint8_t {
+    Frame,       // loop() 全体（frame_pacer の待ちを除く）
+    Wait,        // 合成先のバッファが転送から戻るのを待つ
+    Input,       // M5.update() とタッチの読み取り
+    Update,      // シミュレーションのステップと描画位置の補間
+    Bounds,      // 更新領域の計算
+    Sort,        // 奥行きソートとスプライトの選択
+    Background,  // 背景の復元（領域ごと）
+    Plants,      // 中景の水草（領域ごと）
+    FishBlit,    // 魚 1 匹の合成（arg は魚の番号）
+    Bubbles,     // 前景の泡（領域ごと）
+    Submit,      // 転送タスクへの受け渡し（直列なら転送まで）
+    PanelPush,   // パネルへの転送（転送タスク）
+    Pace,        // 次のフレームの開始時刻までの待ち（frame_pacer）
+    Stream,      // 差分の圧縮と送り出し（転送タスク、frame_stream）
+    Count
+};
+
+const char* profileStageName(ProfileStage stage);
+
+class Profiler {
+public:
+    static const uint32_t RING_SIZE = 4096;  // 2 の累乗
+    static const int BUCKETS = 128;
+
+    // 直近の集計区間の結果（マイクロ秒）
+    struct Summary {
+        uint32_t count;
+        uint32_t min_us;
+        uint32_t avg_us;
+        uint32_t p99_us;
+        uint32_t max_us;
+    };
+
+    bool begin(uint32_t window_frames);
+    bool enabled() const { return _ring != nullptr; }
+
+    void record(ProfileStage stage, uint32_t start_us, uint32_t duration_us, uint32_t arg = 0);
+    // loop() の最後に呼ぶ。window_frames ごとに集計してヒストグラムを空にする
+    void endFrame();
+    // ここまでの分で集計し直す（ベンチマークが計測の区切りで使う）
+    void roll();
+    // 集計とリングを空にして、集計区間を window_frames にする
+    void reset(uint32_t window_frames);
+
+    const Summary& summary(ProfileStage stage) const { return _summary[(int)stage]; }
+    uint32_t windows() const { return _windows; }  // 集計した回数
+    uint32_t recorded() const { return _head.load(std::memory_order_relaxed); }
+
+    // リングに残っているイベントを古い順に Chrome のトレース形式で書き出す。書き出した数を返す
+    // （out はテキストの断片ごとに呼ばれる）
+    uint32_t exportTrace(void (*out)(const char* text, size_t length, void* context),
+                         void* context) const;
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;  // 2*番号+1 なら書き込み中、2*番号+2 なら書き込み済み
+        std::atomic<uint32_t> start_us;
+        std::atomic<uint32_t> duration_us;
+        std::atomic<uint32_t> meta;  // 段階（下位 8 ビット）と arg（上位 24 ビット）
+    };
+    struct Histogram {
+        std::atomic<uint32_t> buckets[BUCKETS];
+        std::atomic<uint32_t> count;
+        std::atomic<uint32_t> min_us;
+        std::atomic<uint32_t> max_us;
+        std::atomic<uint64_t> sum_us;
+    };
+
+    static int bucketOf(uint32_t us);
+    static uint32_t bucketValue(int bucket);
+
+    Slot* _ring = nullptr;
+    std::atomic<uint32_t> _head{0};
+    Histogram _histograms[(int)ProfileStage::Count] = {};
+    Summary _summary[(int)ProfileStage::Count] = {};
+    uint32_t _window_frames = 0;
+    uint32_t _frames = 0;
+    uint32_t _windows = 0;
+};
+
+extern Profiler profiler;
+
+#if AQUARIUM_PROFILE
+// 計測済みの区間を記録する
+#define PROFILE_RECORD(stage, start_us, end_us) \
+    profiler.record(ProfileStage::stage, (start_us), (uint32_t)((end_us) - (start_us)))
+// このスコープの終わりまでを記録する
+#define PROFILE_SCOPE(stage) ProfileScope profile_scope_##stage(ProfileStage::stage)
+#define PROFILE_SCOPE_ARG(stage, arg) ProfileScope profile_scope_##stage(ProfileStage::stage, (arg))
+#define PROFILE_FRAME() profiler.endFrame()
+
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage, uint32_t arg = 0)
+        : _stage(stage), _arg(arg), _start(micros()) {}
+    ~ProfileScope() { profiler.record(_stage, _start, micros() - _start, _arg); }
+
+private:
+    ProfileStage _stage;
+    uint32_t _arg;
+    uint32_t _start;
+};
+#else
+#define PROFILE_RECORD(stage, start_us, end_us) ((void)0)
+#define PROFILE_SCOPE(stage) ((void)0)
+#define PROFILE_SCOPE_ARG(stage, arg) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#endif
@@ -0,0 +1,249 @@
+#include "render_pipeline.h"
+
+#include "memory_budget.h"
+#include "profiler.h"
+
+namespace {
+
+const uint32_t PUSH_STACK_SIZE = 4096;
+const UBaseType_t PUSH_PRIORITY = 2;  // loop() やスプライトのローダーより高く（ほとんど DMA 待ち）
+const BaseType_t PUSH_CORE = 0;       // loop() は core 1 で動く
+const int UPSCALE_ROWS = 16;          // 半分の解像度のフレームを 2 倍に広げて 1 回で送る行数（偶数）
+
+template <class T>
+void updateMax(std::atomic<T>& target, T value) {
+    T current = target.load();
+    while (value > current && !target.compare_exchange_weak(current, value)) {
+    }
+}
+
+}  // namespace
+
+bool RenderPipeline::begin(LGFX_Device* display, bool pipelined) {
+    _display = display;
+    _pipelined = pipelined;
+    _loop_task = xTaskGetCurrentTaskHandle();
+    size_t pixels = (size_t)display->width() * display->height();
+    if (_frames[0].capacity < pixels && !allocate(_frames[0], pixels)) {
+        _pipelined = false;
+        return false;
+    }
+    // 2 面目が予算か PSRAM に収まらなければ、1 面で合成と転送を交互に行う
+    if (_pipelined && _frames[1].capacity < pixels && !allocate(_frames[1], pixels)) {
+        M5_LOGW("Render pipeline: no room for a second compose buffer, pushing from loop()");
+        memory_budget.noteDegraded(MemoryCategory::Compose);
+        _pipelined = false;
+    }
+    if (_pipelined && !_push_task &&
+        xTaskCreatePinnedToCore(pushTask, "panel_push", PUSH_STACK_SIZE, this, PUSH_PRIORITY,
+                                &_push_task, PUSH_CORE) != pdPASS) {
+        M5_LOGE("Failed to start panel push task, pushing from loop()");
+        _pipelined = false;
+    }
+    M5_LOGI("Render pipeline: %s", _pipelined ? "compose/push on separate cores" : "serial");
+    return true;
+}
+
+void RenderPipeline::acquire() {
+    Frame& frame = _frames[_compose_index];
+    uint32_t t0 = micros();
+    while (frame.state.load(std::memory_order_acquire) != Free) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    uint32_t t1 = micros();
+    _wait_us += t1 - t0;
+    _wait_us_max = max(_wait_us_max, t1 - t0);
+    frame.used = 0;
+    frame.regions.clear();
+    frame.start_us = t1;
+    frame.has_input = false;
+    frame.stream = nullptr;
+}
+
+bool RenderPipeline::enableHalfResolution() {
+    if (halfResolutionEnabled()) {
+        return true;
+    }
+    size_t pixels = (size_t)_display->width() * UPSCALE_ROWS;
+    for (auto& buffer : _upscale) {
+        buffer = (uint16_t*)budgetedAlloc(pixels * sizeof(uint16_t), MemoryOwner::UpscaleRows);
+    }
+    if (!_upscale[0] || !_upscale[1]) {
+        M5_LOGE("Failed to allocate upscale buffers (%u pixels)", (unsigned)pixels);
+        for (auto& buffer : _upscale) {
+            budgetedFree(buffer, pixels * sizeof(uint16_t), MemoryOwner::UpscaleRows);
+            buffer = nullptr;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool RenderPipeline::reserve(size_t pixels, size_t regions, bool half) {
+    Frame& frame = _frames[_compose_index];
+    frame.regions.reserve(regions);
+    frame.half = half && halfResolutionEnabled();
+    // 重なった更新領域が残ると画面全体より大きくなることがある（何度も広げないよう 1.5 倍ずつ）
+    return pixels <= frame.capacity ||
+           allocate(frame, max(pixels, frame.capacity + frame.capacity / 2));
+}
+
+bool RenderPipeline::allocate(Frame& frame, size_t pixels) {
+    // 確保できなければ今のバッファのまま使えるよう、新しいバッファを確保してから解放する
+    uint16_t* buffer = (uint16_t*)budgetedAlloc(pixels * sizeof(uint16_t), MemoryOwner::ComposeBuffer);
+    if (!buffer) {
+        M5_LOGE("Failed to allocate compose buffer (%u pixels, Free PSRAM: %d)",
+                (unsigned)pixels, ESP.getFreePsram());
+        return false;
+    }
+    budgetedFree(frame.pixels, frame.capacity * sizeof(uint16_t), MemoryOwner::ComposeBuffer);
+    frame.pixels = buffer;
+    frame.capacity = pixels;
+    return true;
+}
+
+uint16_t* RenderPipeline::addRegion(const DirtyRect& region) {
+    Frame& frame = _frames[_compose_index];
+    size_t area = frame.half ? (size_t)(region.w / 2) * (region.h / 2) : region.area();
+    if (frame.used + area > frame.capacity) {
+        return nullptr;
+    }
+    uint16_t* pixels = frame.pixels + frame.used;
+    frame.used += area;
+    frame.regions.push_back(region);
+    return pixels;
+}
+
+void RenderPipeline::markInput(uint32_t event_us) {
+    Frame& frame = _frames[_compose_index];
+    frame.has_input = true;
+    frame.input_us = event_us;
+}
+
+void RenderPipeline::markStream(FrameStream* stream) {
+    _frames[_compose_index].stream = stream;
+}
+
+void RenderPipeline::submit() {
+    Frame& frame = _frames[_compose_index];
+    if (!_pipelined) {
+        push(frame);
+        return;
+    }
+    frame.state.store(Ready, std::memory_order_release);
+    xTaskNotifyGive(_push_task);
+    _compose_index ^= 1;
+}
+
+void RenderPipeline::flush() {
+    for (auto& frame : _frames) {
+        while (frame.state.load(std::memory_order_acquire) != Free) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+RenderPipeline::Stats RenderPipeline::stats() const {
+    Stats stats = {};
+    stats.frames = _frames_pushed.load();
+    stats.push_us = _push_us.load();
+    stats.push_us_max = _push_us_max.load();
+    stats.latency_us = _latency_us.load();
+    stats.latency_us_max = _latency_us_max.load();
+    stats.wait_us = _wait_us;
+    stats.wait_us_max = _wait_us_max;
+    stats.input_frames = _input_frames.load();
+    stats.input_latency_us = _input_latency_us.load();
+    stats.input_latency_us_max = _input_latency_us_max.load();
+    return stats;
+}
+
+void RenderPipeline::resetStats() {
+    _frames_pushed = 0;
+    _push_us = 0;
+    _push_us_max = 0;
+    _latency_us = 0;
+    _latency_us_max = 0;
+    _wait_us = 0;
+    _wait_us_max = 0;
+    _input_frames = 0;
+    _input_latency_us = 0;
+    _input_latency_us_max = 0;
+}
+
+// フレームの全領域を画面に転送する（DMA の完了まで待ってから戻る）
+// markStream() されたフレームは、転送が終わった後で同じバッファから圧縮して送り出す
+void RenderPipeline::push(Frame& frame) {
+    uint32_t t0 = micros();
+    const uint16_t* pixels = frame.pixels;
+    _display->startWrite();
+    for (const auto& region : frame.regions) {
+        if (frame.half) {
+            pushUpscaled(region, pixels);
+            pixels += (region.w / 2) * (region.h / 2);
+            continue;
+        }
+        _display->pushImageDMA(region.x, region.y, region.w, region.h,
+                               (const lgfx::swap565_t*)pixels);
+        pixels += region.area();
+    }
+    _display->waitDMA();
+    _display->endWrite();
+    uint32_t t1 = micros();
+    PROFILE_RECORD(PanelPush, t0, t1);
+    _push_us += t1 - t0;
+    _last_push_us = t1 - t0;
+    updateMax(_push_us_max, t1 - t0);
+    _latency_us += t1 - frame.start_us;
+    updateMax(_latency_us_max, t1 - frame.start_us);
+    if (frame.has_input) {
+        _input_frames++;
+        _input_latency_us += t1 - frame.input_us;
+        updateMax(_input_latency_us_max, t1 - frame.input_us);
+    }
+    _frames_pushed++;
+    if (frame.stream) {
+        frame.stream->send(frame.regions.data(), frame.regions.size(), frame.pixels, frame.half);
+    }
+}
+
+// 行バッファを交互に使う（次の pushImageDMA は前の転送の完了を待ってから始まるので、
+// 送っている間にもう一方を埋められる）
+void RenderPipeline::pushUpscaled(const DirtyRect& region, const uint16_t* pixels) {
+    int src_w = region.w / 2;
+    for (int y = 0; y < region.h; y += UPSCALE_ROWS) {
+        int rows = min(UPSCALE_ROWS, region.h - y);
+        uint16_t* out = _upscale[_upscale_index];
+        _upscale_index ^= 1;
+        for (int r = 0; r < rows; r += 2) {
+            const uint16_t* src = pixels + (y + r) / 2 * src_w;
+            uint16_t* row = out + r * region.w;
+            for (int x = 0; x < src_w; x++) {
+                row[x * 2] = src[x];
+                row[x * 2 + 1] = src[x];
+            }
+            if (r + 1 < rows) {
+                memcpy(row + region.w, row, region.w * sizeof(uint16_t));
+            }
+        }
+        _display->pushImageDMA(region.x, region.y + y, region.w, rows, (const lgfx::swap565_t*)out);
+    }
+}
+
+void RenderPipeline::pushTask(void* arg) {
+    RenderPipeline* self = (RenderPipeline*)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // 通知 1 回で溜まっているフレームを順に転送する
+        for (;;) {
+            Frame& frame = self->_frames[self->_push_index];
+            if (frame.state.load(std::memory_order_acquire) != Ready) {
+                break;
+            }
+            self->push(frame);
+            frame.state.store(Free, std::memory_order_release);
+            self->_push_index ^= 1;
+            xTaskNotifyGive(self->_loop_task);
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <vector>
+
+#include "dirty_region.h"
+#include "frame_stream.h"
+
+// 合成と画面転送を別コアで並行させる 2 面バッファ
+//
+// loop() 側は空いている方のバッファに更新領域ごとの画像を詰めて合成し、submit() で渡す。
+// 転送タスク（core 0）は受け取ったバッファを pushImageDMA で画面に送り、終わったら空きに戻す。
+// これによりフレーム N の転送中にフレーム N+1 を合成できる。
+// バッファの受け渡しは状態フラグ（atomic）だけで行い、待つときはタスク通知で起こす。
+// pipelined = false なら submit() の中で転送する（従来どおりの逐次処理）。
+// 半分の解像度のフレームは領域ごとに縦横半分の画像を持ち、転送するときに行バッファ（2 面）で
+// 2 倍に広げながら送る（描画の品質を下げたとき。合成するピクセル数が 1/4 になる）。
+class RenderPipeline {
+public:
+    struct Stats {
+        uint32_t frames;          // 転送したフレーム数
+        uint64_t push_us;         // 転送時間の合計（転送タスク側）
+        uint32_t push_us_max;
+        uint64_t latency_us;      // acquire() から転送完了までの合計
+        uint32_t latency_us_max;
+        uint64_t wait_us;         // 合成先が空くのを待った時間の合計（loop() 側）
+        uint32_t wait_us_max;
+        uint32_t input_frames;    // markInput() したフレーム数
+        uint64_t input_latency_us;  // 入力の時刻から、その結果を含むフレームの転送完了までの合計
+        uint32_t input_latency_us_max;
+    };
+
+    // 両方のバッファを画面全体の大きさで確保しておく（フレームごとの再確保をなくす）
+    // 2 面目が確保できなければ 1 面で直列に動かす（1 面目も確保できなければ false）
+    bool begin(LGFX_Device* display, bool pipelined);
+    bool pipelined() const { return _pipelined; }
+
+    // 次の合成先を決める（転送中なら空くまで待つ）。戻った時刻がレイテンシ計測の起点
+    // 同じバッファに対して submit() せずに再度呼んでもよい
+    void acquire();
+    // 半分の解像度のフレームを転送するための行バッファを確保する（setup() で呼ぶ）
+    bool enableHalfResolution();
+    bool halfResolutionEnabled() const { return _upscale[0] != nullptr; }
+    // このフレームの合成に必要なピクセル数と領域数を確保する（縮小はしない）
+    // 予算か PSRAM が足りず広げられなければ false（今のバッファは画面全体の大きさのまま残る）
+    // half なら各領域を縦横半分の解像度で合成する（pixels は半分の解像度での数）
+    bool reserve(size_t pixels, size_t regions, bool half = false);
+    // 領域 1 つ分の書き込み先を返す（region.w x region.h、容量不足なら nullptr）
+    // 半分の解像度のフレームでは region は画面上の位置（x, y, w, h は偶数）で、
+    // 書き込み先は region.w / 2 x region.h / 2
+    uint16_t* addRegion(const DirtyRect& region);
+    // このフレームに時刻 event_us（micros）の入力の結果が初めて映ることを記録する
+    // 転送が終わったときに入力からの遅延として集計する
+    void markInput(uint32_t event_us);
+    // このフレームを転送した後で stream に送り出す（合成用のバッファから直接圧縮する）
+    void markStream(FrameStream* stream);
+    // 合成したフレームを転送に回す
+    void submit();
+    // 転送中・転送待ちのフレームが無くなるまで待つ
+    void flush();
+
+    // 直近のフレームの転送時間（転送タスクから更新する）
+    uint32_t lastPushUs() const { return _last_push_us.load(); }
+    Stats stats() const;
+    void resetStats();
+
+private:
+    enum State : uint8_t { Free, Ready };
+
+    struct Frame {
+        uint16_t* pixels = nullptr;  // 領域ごとの画像を詰めて保持する（PSRAM）
+        size_t capacity = 0;         // ピクセル数
+        size_t used = 0;
+        std::vector<DirtyRect> regions;
+        bool half = false;           // 縦横半分の解像度で合成したか
+        uint32_t start_us = 0;
+        bool has_input = false;      // markInput() されたか
+        uint32_t input_us = 0;
+        FrameStream* stream = nullptr;  // markStream() されたら送り出し先
+        std::atomic<uint8_t> state{Free};
+    };
+
+    static bool allocate(Frame& frame, size_t pixels);
+    static void pushTask(void* arg);
+    void push(Frame& frame);
+    // 半分の解像度の pixels を 2 倍に広げながら region に転送する
+    void pushUpscaled(const DirtyRect& region, const uint16_t* pixels);
+
+    LGFX_Device* _display = nullptr;
+    bool _pipelined = false;
+    Frame _frames[2];
+    int _compose_index = 0;  // loop() 側でだけ使う
+    int _push_index = 0;     // 転送タスク側でだけ使う
+    TaskHandle_t _push_task = nullptr;
+    TaskHandle_t _loop_task = nullptr;
+    uint16_t* _upscale[2] = {nullptr, nullptr};  // 2 倍に広げた行（UPSCALE_ROWS 行ずつ）、転送タスク側で使う
+    int _upscale_index = 0;
+
+    // 転送タスクから更新する
+    std::atomic<uint32_t> _frames_pushed{0};
+    std::atomic<uint64_t> _push_us{0};
+    std::atomic<uint32_t> _push_us_max{0};
+    std::atomic<uint32_t> _last_push_us{0};
+    std::atomic<uint64_t> _latency_us{0};
+    std::atomic<uint32_t> _latency_us_max{0};
+    std::atomic<uint32_t> _input_frames{0};
+    std::atomic<uint64_t> _input_latency_us{0};
+    std::atomic<uint32_t> _input_latency_us_max{0};
+    // loop() 側でだけ更新する
+    uint64_t _wait_us = 0;
+    uint32_t _wait_us_max = 0;
+};
@@ -0,0 +1,285 @@
+#include "scale_filter.h"
+
+#include <M5Unified.h>
+
+#include "memory_budget.h"
+
+namespace {
+
+const int WEIGHT_ONE = 256;  // 重みの合計（縦横を掛けると 1 << 16）
+
+// 確保領域 p から count 個分の配列を切り出す
+template <class T>
+void carve(T*& array, uint8_t*& p, size_t count) {
+    array = (T*)p;
+    p += sizeof(T) * count;
+}
+
+inline uint16_t swap16(uint16_t v) {
+    return (uint16_t)((v << 8) | (v >> 8));
+}
+
+// 元の行を横に縮小する（縮小後の列 [u0, u1)）。重みの数を固定して内側のループを展開させる
+// 和は最大で 63 * WEIGHT_ONE なので 16 ビットで足りる（ベクトル命令で 1 回に扱えるピクセルが倍になる）
+template <int Taps, class Tap>
+void filterColumns(const Tap* taps, int u0, int u1, const uint16_t* __restrict color,
+                   const uint8_t* __restrict alpha, uint16_t* __restrict r, uint16_t* __restrict g,
+                   uint16_t* __restrict b, uint16_t* __restrict a) {
+    for (int u = u0; u < u1; u++) {
+        const Tap& tap = taps[u];
+        const uint16_t* c = color + tap.start;
+        const uint8_t* al = alpha + tap.start;
+        uint16_t sr = 0, sg = 0, sb = 0, sa = 0;
+        for (int k = 0; k < Taps; k++) {
+            uint16_t w = tap.weight[k];
+            sr += w * (c[k] >> 11);
+            sg += w * ((c[k] >> 5) & 63);
+            sb += w * (c[k] & 31);
+            sa += w * al[k];
+        }
+        r[u] = sr;
+        g[u] = sg;
+        b[u] = sb;
+        a[u] = sa;
+    }
+}
+
+// sum[u] += w * row[u]（u は [u0, u1)）
+inline void accumulate(uint32_t* __restrict sum, const uint16_t* __restrict row, uint32_t w, int u0, int u1) {
+    for (int u = u0; u < u1; u++) {
+        sum[u] += w * row[u];
+    }
+}
+
+// 縦に足した和を乗算済みの色とアルファにして、描画先（スワップ済み）に重ねる:
+//   dst = src + dst * (32 - alpha) / 32
+// Dir = -1 なら out から左へ書く（反転）
+template <int Dir>
+void composite(uint16_t* out, const uint32_t* const* sum, int u0, int u1) {
+    const uint32_t* __restrict sr = sum[0];
+    const uint32_t* __restrict sg = sum[1];
+    const uint32_t* __restrict sb = sum[2];
+    const uint32_t* __restrict sa = sum[3];
+    for (int u = u0; u < u1; u++, out += Dir) {
+        uint32_t a = (sa[u] + 0x8000) >> 16;
+        // 乗算済みの色がアルファを超えないように抑える（合成で桁あふれしない）
+        uint32_t r = min((sr[u] + 0x8000) >> 16, (31 * a) >> 5);
+        uint32_t g = min((sg[u] + 0x8000) >> 16, (63 * a) >> 5);
+        uint32_t b = min((sb[u] + 0x8000) >> 16, (31 * a) >> 5);
+        uint16_t d = swap16(*out);
+        uint32_t inv = 32 - a;
+        r += ((d >> 11) * inv) >> 5;
+        g += (((d >> 5) & 63) * inv) >> 5;
+        b += ((d & 31) * inv) >> 5;
+        *out = swap16((uint16_t)((r << 11) | (g << 5) | b));
+    }
+}
+
+}  // namespace
+
+ScaleFilter::~ScaleFilter() {
+    budgetedFree(_block, _bytes, MemoryOwner::ScaleFilter);
+}
+
+bool ScaleFilter::begin(int max_width, int max_height) {
+    budgetedFree(_block, _bytes, MemoryOwner::ScaleFilter);
+    _block = nullptr;
+    _bytes = 0;
+    int max_size = max(max_width, max_height);
+    // 4 バイトの配列から順に並べる（それぞれの境界に揃う）
+    size_t bytes = sizeof(uint32_t) * 4 * max_width + sizeof(uint16_t) * 4 * MAX_TAPS * max_width +
+                   sizeof(uint16_t) * max_width + sizeof(Tap) * TABLE_SLOTS * max_size + max_width;
+    _block = (uint8_t*)budgetedAlloc(bytes, MemoryOwner::ScaleFilter);
+    if (!_block) {
+        M5_LOGE("Failed to allocate scale filter (%u bytes)", (unsigned)bytes);
+        return false;
+    }
+    uint8_t* p = _block;
+    for (auto& sum : _sum) {
+        carve(sum, p, max_width);
+    }
+    for (Row& row : _rows) {
+        for (auto& channel : row.channel) {
+            carve(channel, p, max_width);
+        }
+        row.source = -1;
+    }
+    carve(_color, p, max_width);
+    for (Table& table : _tables) {
+        carve(table.entries, p, max_size);
+        table.src = 0;
+        table.dst = 0;
+        table.used = 0;
+    }
+    carve(_alpha, p, max_width);
+    _max_width = max_width;
+    _max_height = max_height;
+    _bytes = bytes;
+    M5_LOGI("Scale filter: up to %dx%d, %u bytes", max_width, max_height, (unsigned)bytes);
+    return true;
+}
+
+bool ScaleFilter::supports(int src_w, int src_h, int draw_w, int draw_h) const {
+    return _block && draw_w > 0 && draw_h > 0 && src_w <= _max_width && src_h <= _max_height &&
+           draw_w <= src_w && draw_h <= src_h && src_w >= MAX_TAPS && src_h >= MAX_TAPS &&
+           draw_w * (MAX_TAPS - 1) >= src_w && draw_h * (MAX_TAPS - 1) >= src_h;
+}
+
+const ScaleFilter::Table& ScaleFilter::table(int src, int dst) {
+    Table* oldest = &_tables[0];
+    for (Table& t : _tables) {
+        if (t.src == src && t.dst == dst) {
+            t.used = ++_table_clock;
+            return t;
+        }
+        if (t.used < oldest->used) {
+            oldest = &t;
+        }
+    }
+    Table& t = *oldest;
+    t.src = src;
+    t.dst = dst;
+    t.used = ++_table_clock;
+    _stats.table_builds++;
+
+    // 縮小後のピクセル d は元の [d * src / dst, (d + 1) * src / dst) を覆う（16 ビットの固定小数点）
+    uint32_t step = ((uint32_t)src << 16) / dst;
+    auto bounds = [&](int d, uint32_t* lo, uint32_t* hi) {
+        *lo = d * step;
+        *hi = d + 1 < dst ? (d + 1) * step : (uint32_t)src << 16;
+    };
+    t.taps = 1;
+    for (int d = 0; d < dst; d++) {
+        uint32_t lo, hi;
+        bounds(d, &lo, &hi);
+        t.taps = max(t.taps, (int)((hi - 1) >> 16) - (int)(lo >> 16) + 1);
+    }
+    t.taps = min(t.taps, MAX_TAPS);
+    for (int d = 0; d < dst; d++) {
+        uint32_t lo, hi;
+        bounds(d, &lo, &hi);
+        int first = lo >> 16;
+        int last = min((int)((hi - 1) >> 16), first + t.taps - 1);
+        // 重みの数をそろえるため、右端では開始を左にずらす（増えた所の重みは 0）
+        Tap& tap = t.entries[d];
+        tap.start = (int16_t)min(first, src - t.taps);
+        memset(tap.weight, 0, sizeof(tap.weight));
+        uint32_t span = hi - lo;
+        int total = 0;
+        int largest = first - tap.start;
+        for (int i = first; i <= last; i++) {
+            uint32_t overlap = min(hi, (uint32_t)(i + 1) << 16) - max(lo, (uint32_t)i << 16);
+            int k = i - tap.start;
+            tap.weight[k] = (uint16_t)((overlap * WEIGHT_ONE + span / 2) / span);
+            total += tap.weight[k];
+            if (tap.weight[k] > tap.weight[largest]) {
+                largest = k;
+            }
+        }
+        // 丸めの誤差は一番大きい重みに寄せて、合計をちょうど WEIGHT_ONE にする
+        tap.weight[largest] = (uint16_t)(tap.weight[largest] + WEIGHT_ONE - total);
+    }
+    return t;
+}
+
+const ScaleFilter::Row& ScaleFilter::filterRow(int row, const Table& columns, int u0, int u1,
+                                                const void* source, DecodeRow decode) {
+    Row& out = _rows[row % MAX_TAPS];
+    if (out.source == row) {
+        return out;
+    }
+    out.source = row;
+    _stats.rows++;
+    int x0 = 0;
+    int x1 = 0;
+    decode(source, row, _color, _alpha, &x0, &x1);
+    if (x0 >= x1) {
+        out.begin = out.end = u0;
+        return out;
+    }
+    // 透明でない列に掛かる縮小後の列だけを計算する（重みの丸めの分 1 列広げる）
+    out.begin = max(u0, x0 * columns.dst / columns.src - 1);
+    out.end = min(u1, (x1 * columns.dst + columns.src - 1) / columns.src + 1);
+    if (out.begin >= out.end) {
+        out.begin = out.end = u0;
+        return out;
+    }
+    uint16_t* const* ch = out.channel;
+    switch (columns.taps) {
+    case 1:
+        filterColumns<1>(columns.entries, out.begin, out.end, _color, _alpha, ch[0], ch[1], ch[2], ch[3]);
+        break;
+    case 2:
+        filterColumns<2>(columns.entries, out.begin, out.end, _color, _alpha, ch[0], ch[1], ch[2], ch[3]);
+        break;
+    case 3:
+        filterColumns<3>(columns.entries, out.begin, out.end, _color, _alpha, ch[0], ch[1], ch[2], ch[3]);
+        break;
+    default:
+        filterColumns<MAX_TAPS>(columns.entries, out.begin, out.end, _color, _alpha, ch[0], ch[1], ch[2],
+                                ch[3]);
+        break;
+    }
+    return out;
+}
+
+uint32_t ScaleFilter::draw(uint16_t* dst, int dst_w, int dst_h, int x, int y, int draw_w, int draw_h,
+                           bool mirror, const void* source, int src_w, int src_h, DecodeRow decode) {
+    if (!dst || !supports(src_w, src_h, draw_w, draw_h)) {
+        return 0;
+    }
+    // 描画先に入る行と、縮小後の列（反転する場合は描画位置の右端から数える）
+    int row_begin = max(0, -y);
+    int row_end = min(draw_h, dst_h - y);
+    int c0 = max(0, -x);
+    int c1 = min(draw_w, dst_w - x);
+    if (row_begin >= row_end || c0 >= c1) {
+        return 0;
+    }
+    int u0 = mirror ? draw_w - c1 : c0;
+    int u1 = mirror ? draw_w - c0 : c1;
+    _stats.draws++;
+    const Table& columns = table(src_w, draw_w);
+    const Table& rows = table(src_h, draw_h);
+    for (Row& row : _rows) {
+        row.source = -1;
+    }
+
+    uint32_t written = 0;
+    for (int dy = row_begin; dy < row_end; dy++) {
+        const Tap& tap = rows.entries[dy];
+        // 縦の重みが掛かる元の行のうち、透明でない列の範囲を合わせたもの
+        const Row* taps[MAX_TAPS];
+        int begin = u1;
+        int end = u0;
+        for (int k = 0; k < rows.taps; k++) {
+            taps[k] = tap.weight[k] ? &filterRow(tap.start + k, columns, u0, u1, source, decode) : nullptr;
+            if (taps[k] && taps[k]->begin < taps[k]->end) {
+                begin = min(begin, taps[k]->begin);
+                end = max(end, taps[k]->end);
+            }
+        }
+        if (begin >= end) {
+            continue;
+        }
+        for (auto* sum : _sum) {
+            memset(sum + begin, 0, sizeof(uint32_t) * (end - begin));
+        }
+        for (int k = 0; k < rows.taps; k++) {
+            if (!taps[k] || taps[k]->begin >= taps[k]->end) {
+                continue;
+            }
+            for (int c = 0; c < 4; c++) {
+                accumulate(_sum[c], taps[k]->channel[c], tap.weight[k], taps[k]->begin, taps[k]->end);
+            }
+        }
+        uint16_t* out = dst + (y + dy) * dst_w + x;
+        if (mirror) {
+            composite<-1>(out + draw_w - 1 - begin, _sum, begin, end);
+        } else {
+            composite<1>(out + begin, _sum, begin, end);
+        }
+        written += end - begin;
+    }
+    return written;
+}
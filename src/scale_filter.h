@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 魚を縦横に縮小して描画先に直接重ねる（奥行きを量子化しないときの拡大縮小）
+//
+// pushRotateZoomWithAA は回転もできる汎用の変換で、描画先のピクセルごとに元の座標を求めて
+// 4 点を補間する。魚は回転せず縦横に縮小するだけなので、横と縦に分けた面積平均
+// （縮小後の 1 ピクセルが覆う元の区間に掛かる割合で平均する box フィルタ）で描く。
+// ・重み（合計 256）は元と縮小後の大きさの組ごとに表にしておく（直近に使った TABLE_SLOTS 組）
+// ・元の行を 1 行ずつ乗算済みの色とアルファ（0〜32）に展開して横に縮小し、行のリングに置く。
+//   縮小後の行はリングの行を縦の重みで足して作る（元の行は 1 回だけ展開する）
+// ・透過色の部分はアルファ 0（色も 0）として平均するので、縁に透過色の黒がにじまない
+// ・結果は SpanSprite のブレンドスパンと同じ式（src + dst * (32 - alpha) / 32）で重ねる。
+//   アルファ 32 なら上書き、0 なら描画先のままになるので、ピクセルごとに分岐しない
+// 計算は整数だけで、横は重みの数ごとに展開したループ、縦と合成は連続した配列のループにしてある
+// （ホストでは自動ベクトル化される）。描画先に入る行と列、透明でない列の範囲だけを計算する。
+class ScaleFilter {
+public:
+    static const int MAX_TAPS = 4;     // 縮小後の 1 ピクセルに掛かる元のピクセルの最大数（1/3 倍まで）
+    static const int TABLE_SLOTS = 8;  // 重みの表を持つ大きさの組の数
+
+    // 元の行 row を color（乗算済み、ネイティブ順 RGB565）と alpha（0〜32）に展開し、
+    // 透明でない列の範囲 [*x0, *x1) を返す（範囲の外も 0 で埋めること）
+    typedef void (*DecodeRow)(const void* source, int row, uint16_t* color, uint8_t* alpha, int* x0,
+                              int* x1);
+
+    struct Stats {
+        uint32_t draws;         // draw() の回数
+        uint32_t rows;          // 展開して横に縮小した元の行の数
+        uint32_t table_builds;  // 重みの表を作った回数
+    };
+
+    ScaleFilter() {}
+    ~ScaleFilter();
+    ScaleFilter(const ScaleFilter&) = delete;
+    ScaleFilter& operator=(const ScaleFilter&) = delete;
+
+    // 元の画像の大きさの上限で作業領域と重みの表を確保する
+    bool begin(int max_width, int max_height);
+    bool enabled() const { return _block != nullptr; }
+    // src_w x src_h を draw_w x draw_h に描けるか（縦横それぞれ 1/3 倍から等倍まで）
+    bool supports(int src_w, int src_h, int draw_w, int draw_h) const;
+
+    // source（src_w x src_h）を draw_w x draw_h に縮小して、dst（dst_w x dst_h、stride = dst_w）の
+    // (x, y) に重ねる。mirror なら左右を反転する。計算したピクセル数を返す
+    uint32_t draw(uint16_t* dst, int dst_w, int dst_h, int x, int y, int draw_w, int draw_h, bool mirror,
+                  const void* source, int src_w, int src_h, DecodeRow decode);
+
+    const Stats& stats() const { return _stats; }
+    void resetStats() { _stats = Stats(); }
+    size_t bytes() const { return _bytes; }
+
+private:
+    // 縮小後の 1 ピクセル分の重み（元の start から MAX_TAPS ピクセル。使わない所は 0）
+    struct Tap {
+        int16_t start;
+        uint16_t weight[MAX_TAPS];
+    };
+    struct Table {
+        int src = 0;
+        int dst = 0;
+        int taps = 0;       // 重みの数（表の中で一番多いものにそろえる）
+        uint32_t used = 0;  // 最後に使った順番（一番古い表を作り直す）
+        Tap* entries = nullptr;
+    };
+    // 横に縮小した 1 行（チャンネルごとの重み付きの和。[begin, end) の外は 0）
+    struct Row {
+        uint16_t* channel[4];  // R G B A
+        int source = -1;       // 元の行（-1 なら空き）
+        int begin = 0;
+        int end = 0;
+    };
+
+    const Table& table(int src, int dst);
+    // 元の行 row を展開して横に縮小し、リングに置く（縮小後の列 [u0, u1) だけ）
+    const Row& filterRow(int row, const Table& columns, int u0, int u1, const void* source,
+                         DecodeRow decode);
+
+    uint8_t* _block = nullptr;
+    size_t _bytes = 0;
+    int _max_width = 0;
+    int _max_height = 0;
+    Table _tables[TABLE_SLOTS];
+    uint32_t _table_clock = 0;
+    uint16_t* _color = nullptr;  // 展開した元の行
+    uint8_t* _alpha = nullptr;
+    Row _rows[MAX_TAPS];         // 元の行 r は _rows[r % MAX_TAPS]
+    uint32_t* _sum[4] = {};      // 縦に足した縮小後の行
+    Stats _stats = {};
+};
@@ -0,0 +1,340 @@
+#include "scene_layers.h"
+
+#include <M5Unified.h>
+#include <cmath>
+
+namespace {
+
+const int PLANT_COUNT = 6;
+const int PLANT_WIDTH = 120;
+const int PLANT_HEIGHT_MIN = 200;
+const int PLANT_HEIGHT_MAX = 340;
+const int PLANT_SINK = 8;  // 根元を画面の下端より下に隠す
+const int PLANT_SWAY_MIN = 8;  // 先端の揺れ幅（ピクセル）
+const int PLANT_SWAY_MAX = 16;
+const uint32_t PLANT_PERIOD_MIN = 3000;  // 揺れの周期（ms）
+const uint32_t PLANT_PERIOD_MAX = 5000;
+
+const int BUBBLE_COUNT = 10;
+const int BUBBLE_RADIUS_MIN = 3;
+const int BUBBLE_RADIUS_MAX = 8;
+const uint32_t BUBBLE_WOBBLE_MS = 1800;  // 横揺れの周期
+const uint32_t BUBBLE_DELAY_MAX = 4000;  // 水面に出てから次に湧くまでの最大の待ち時間
+const uint32_t MAX_STEP_MS = 100;  // これより長く止まっていたら泡を飛ばさない
+
+const float TWO_PI = 6.2831853f;
+
+// スプライトメモリと同じバイトスワップ済み RGB565
+uint16_t rawColor(int r, int g, int b) {
+    r = max(0, min(255, r));
+    g = max(0, min(255, g));
+    b = max(0, min(255, b));
+    uint16_t v = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+    return (uint16_t)((v << 8) | (v >> 8));
+}
+
+// 周期 period_ms の波の now_ms での値（-1〜1）。時刻が大きくなっても精度が落ちないよう剰余を取る
+float wave(uint32_t now_ms, uint32_t period_ms, float phase) {
+    return sinf(TWO_PI * (float)(now_ms % period_ms) / (float)period_ms + phase);
+}
+
+}  // namespace
+
+bool SceneLayers::begin(int width, int height, uint32_t seed) {
+    _width = width;
+    _height = height;
+    _random = SimRandom(seed ^ 0x4C415952u);  // シミュレーションとは別の系列
+    _first = true;
+    _stats = Stats();
+
+    // 水草: 作業用のバッファに 1 本ずつ描いてスパンに変換する
+    uint16_t* scratch = (uint16_t*)ps_malloc(sizeof(uint16_t) * PLANT_WIDTH * PLANT_HEIGHT_MAX);
+    if (!scratch) {
+        M5_LOGE("Failed to allocate plant scratch buffer");
+        return false;
+    }
+    _plants = std::vector<Plant>(PLANT_COUNT);
+    int heights[PLANT_COUNT];
+    size_t rows = 0;
+    for (int i = 0; i < PLANT_COUNT; i++) {
+        heights[i] = _random.range(PLANT_HEIGHT_MIN, PLANT_HEIGHT_MAX + 1);
+        rows += heights[i];
+    }
+    _row_shifts.assign(rows, 0);
+    int16_t* row_shift = _row_shifts.data();
+    bool ok = true;
+    for (int i = 0; i < PLANT_COUNT && ok; i++) {
+        Plant& plant = _plants[i];
+        ok = buildPlant(plant, heights[i], scratch);
+        plant.x = (int)((i + 0.5f) * width / PLANT_COUNT) - PLANT_WIDTH / 2 +
+                  _random.range(-PLANT_WIDTH / 4, PLANT_WIDTH / 4 + 1);
+        plant.y = height - heights[i] + PLANT_SINK;
+        plant.period_ms = (uint32_t)_random.range(PLANT_PERIOD_MIN, PLANT_PERIOD_MAX + 1);
+        plant.phase = _random.uniform() * TWO_PI;
+        plant.amplitude = _random.range(PLANT_SWAY_MIN, PLANT_SWAY_MAX + 1);
+        plant.top_shift = 0;
+        plant.row_shift = row_shift;
+        row_shift += heights[i];
+    }
+    free(scratch);
+
+    // 泡: 半径ごとに輪とハイライトだけの画像を作る
+    _bubble_sprites = std::vector<SpanSprite>(BUBBLE_RADIUS_MAX - BUBBLE_RADIUS_MIN + 1);
+    uint16_t ring = rawColor(200, 235, 255);
+    uint16_t highlight = rawColor(255, 255, 255);
+    for (int k = 0; k < (int)_bubble_sprites.size() && ok; k++) {
+        int r = BUBBLE_RADIUS_MIN + k;
+        int d = r * 2 + 1;
+        uint16_t pixels[(BUBBLE_RADIUS_MAX * 2 + 1) * (BUBBLE_RADIUS_MAX * 2 + 1)];
+        for (int y = 0; y < d; y++) {
+            for (int x = 0; x < d; x++) {
+                float dist = sqrtf((float)((x - r) * (x - r) + (y - r) * (y - r)));
+                pixels[y * d + x] = (dist >= r - 1.0f && dist <= r + 0.3f) ? ring : TFT_BLACK;
+            }
+        }
+        int hx = r / 2;
+        pixels[hx * d + hx] = highlight;
+        pixels[hx * d + hx + 1] = highlight;
+        ok = _bubble_sprites[k].build(pixels, d, d, d, TFT_BLACK);
+    }
+    if (!ok) {
+        M5_LOGE("Failed to build scene layer sprites");
+        _plants.clear();
+        return false;
+    }
+
+    _bubbles.assign(BUBBLE_COUNT, Bubble());
+    for (auto& bubble : _bubbles) {
+        spawnBubble(bubble, 0);
+    }
+    M5_LOGI("Scene layers: %d plants, %d bubbles, %u bytes", (int)_plants.size(),
+            (int)_bubbles.size(), (unsigned)bytes());
+    return true;
+}
+
+// 根元から先端まで細くなる葉を数枚、2 次ベジェ曲線に沿って描く
+bool SceneLayers::buildPlant(Plant& plant, int height, uint16_t* scratch) {
+    const int w = PLANT_WIDTH;
+    for (int i = 0; i < w * height; i++) {
+        scratch[i] = TFT_BLACK;
+    }
+    int blades = _random.range(3, 6);
+    for (int b = 0; b < blades; b++) {
+        float base_x = w / 2 + _random.range(-18, 19);
+        float tip_x = w / 2 + _random.range(-40, 41);
+        float ctrl_x = (base_x + tip_x) / 2 + _random.range(-25, 26);
+        int tip_y = _random.range(0, height / 3);
+        float base_w = 10.0f + _random.range(0, 8);
+        int red = 20 + _random.range(0, 40);
+        int green = 100 + _random.range(0, 60);
+        int blue = 30 + _random.range(0, 40);
+        for (int y = tip_y; y < height; y++) {
+            float t = (float)(height - 1 - y) / (float)(height - 1 - tip_y);  // 根元 0、先端 1
+            float u = 1.0f - t;
+            float cx = u * u * base_x + 2.0f * u * t * ctrl_x + t * t * tip_x;
+            float hw = base_w * 0.5f * u + 0.6f;
+            int x0 = max(0, (int)lroundf(cx - hw));
+            int x1 = min(w - 1, (int)lroundf(cx + hw));
+            for (int x = x0; x <= x1; x++) {
+                // 縁を暗く、先端ほど明るくする
+                float shade = 1.0f - 0.45f * fabsf(x - cx) / hw + 0.25f * t;
+                scratch[y * w + x] = rawColor((int)(red * shade), (int)(green * shade),
+                                              (int)(blue * shade));
+            }
+        }
+    }
+    return plant.sprite.build(scratch, w, height, w, TFT_BLACK);
+}
+
+void SceneLayers::spawnBubble(Bubble& bubble, uint32_t now_ms) {
+    const Plant& plant = _plants[_random.range(0, (int)_plants.size())];
+    bubble.base_x = plant.x + PLANT_WIDTH / 2 + _random.range(-20, 21);
+    bubble.y = _height + _random.range(0, 40);
+    bubble.speed = 40.0f + _random.uniform() * 50.0f;
+    bubble.wobble = 3.0f + _random.uniform() * 5.0f;
+    bubble.phase = _random.uniform() * TWO_PI;
+    bubble.size = _random.range(0, (int)_bubble_sprites.size());
+    bubble.spawn_ms = now_ms + (uint32_t)_random.range(0, BUBBLE_DELAY_MAX);
+    bubble.rect = DirtyRect{0, 0, 0, 0};
+}
+
+void SceneLayers::update(uint32_t now_ms, DirtyRegionManager& regions) {
+    _stats = Stats();
+    if (!enabled()) {
+        return;
+    }
+    if (_first) {
+        // begin() の時点の時刻は分からないので、待ち時間を最初のフレームからの時間にする
+        for (auto& bubble : _bubbles) {
+            bubble.spawn_ms += now_ms;
+        }
+        _last_ms = now_ms;
+    }
+    float dt = min(now_ms - _last_ms, MAX_STEP_MS) / 1000.0f;
+    _last_ms = now_ms;
+    auto addRect = [&](const DirtyRect& rect, uint32_t& count, uint32_t& pixels) {
+        regions.add(rect.x, rect.y, rect.w, rect.h);
+        count++;
+        pixels += rect.area();
+    };
+    if (!_animated && !_first) {
+        // 止めている間は水草を動かさず、泡は描いてあった所を消すだけ
+        for (auto& bubble : _bubbles) {
+            if (bubble.rect.w > 0) {
+                addRect(bubble.rect, _stats.bubble_rects, _stats.bubble_pixels);
+                bubble.rect.w = 0;
+            }
+        }
+        return;
+    }
+
+    // 水草: 先端のずれが変わったら、ずれの変わった行の範囲だけを更新する
+    for (auto& plant : _plants) {
+        int height = plant.sprite.height();
+        int shift = (int)lroundf(plant.amplitude * wave(now_ms, plant.period_ms, plant.phase));
+        if (shift == plant.top_shift && !_first) {
+            continue;
+        }
+        int first_row = height;
+        int last_row = -1;
+        for (int r = 0; r < height; r++) {
+            float f = (float)(height - r) / height;
+            int16_t s = (int16_t)lroundf(shift * f * f);
+            if (s != plant.row_shift[r] || _first) {
+                first_row = min(first_row, r);
+                last_row = r;
+                plant.row_shift[r] = s;
+            }
+        }
+        int left = min(0, min(shift, plant.top_shift));
+        int right = max(0, max(shift, plant.top_shift));
+        plant.top_shift = shift;
+        if (last_row >= first_row) {
+            addRect(DirtyRect{plant.x + left, plant.y + first_row, PLANT_WIDTH + right - left,
+                              last_row - first_row + 1},
+                    _stats.plant_rects, _stats.plant_pixels);
+        }
+    }
+
+    // 泡: 上がって水面に出たら、しばらく待ってから水草の根元に湧き直す
+    for (auto& bubble : _bubbles) {
+        if ((int32_t)(now_ms - bubble.spawn_ms) < 0) {
+            continue;
+        }
+        int d = _bubble_sprites[bubble.size].width();
+        bubble.y -= bubble.speed * dt;
+        if (bubble.y + d < 0) {
+            if (bubble.rect.w > 0) {
+                addRect(bubble.rect, _stats.bubble_rects, _stats.bubble_pixels);
+            }
+            spawnBubble(bubble, now_ms);
+            continue;
+        }
+        float x = bubble.base_x + bubble.wobble * wave(now_ms, BUBBLE_WOBBLE_MS, bubble.phase);
+        DirtyRect rect = {(int)lroundf(x) - d / 2, (int)lroundf(bubble.y) - d / 2, d, d};
+        if (bubble.rect.w > 0 && rect.x == bubble.rect.x && rect.y == bubble.rect.y) {
+            continue;
+        }
+        if (bubble.rect.w > 0 && intersects(rect, bubble.rect)) {
+            addRect(unionRect(rect, bubble.rect), _stats.bubble_rects, _stats.bubble_pixels);
+        } else {
+            if (bubble.rect.w > 0) {
+                addRect(bubble.rect, _stats.bubble_rects, _stats.bubble_pixels);
+            }
+            addRect(rect, _stats.bubble_rects, _stats.bubble_pixels);
+        }
+        bubble.rect = rect;
+    }
+    _first = false;
+}
+
+uint32_t SceneLayers::drawPlants(uint16_t* dst, const DirtyRect& region) const {
+    uint32_t written = 0;
+    for (const auto& plant : _plants) {
+        DirtyRect extent = {plant.x - plant.amplitude, plant.y, PLANT_WIDTH + plant.amplitude * 2,
+                            plant.sprite.height()};
+        if (intersects(extent, region)) {
+            written += plant.sprite.blit(dst, region.w, region.h, plant.x - region.x,
+                                         plant.y - region.y, plant.row_shift);
+        }
+    }
+    return written;
+}
+
+uint32_t SceneLayers::drawPlants(uint16_t* dst, const DirtyRect& region, CoverageMask& coverage) const {
+    uint32_t written = 0;
+    // 後の水草ほど手前に描くので、手前から埋める
+    for (auto it = _plants.rbegin(); it != _plants.rend(); ++it) {
+        const Plant& plant = *it;
+        DirtyRect extent = {plant.x - plant.amplitude, plant.y, PLANT_WIDTH + plant.amplitude * 2,
+                            plant.sprite.height()};
+        if (!intersects(extent, region)) {
+            continue;
+        }
+        int top = plant.y - region.y;
+        int row_begin = max(0, -top);
+        int row_end = min(plant.sprite.height(), region.h - top);
+        for (int r = row_begin; r < row_end; r++) {
+            int rx = plant.x - region.x + (plant.row_shift ? plant.row_shift[r] : 0);
+            uint16_t* out = dst + (top + r) * region.w + rx;
+            // 水草は不透明なスパンだけ（build() で作る）なので、埋めるだけでよい
+            plant.sprite.forEachRowSpan(r, false, [&](int a, int b, bool) {
+                int x0 = max(0, rx + a);
+                int x1 = min(region.w, rx + b);
+                if (x0 < x1) {
+                    written += coverage.fill(top + r, x0, x1, 0, [&](int ga, int gb) {
+                        plant.sprite.blitRow(out, r, ga - rx, gb - rx, false);
+                    });
+                }
+            });
+        }
+    }
+    return written;
+}
+
+uint32_t SceneLayers::drawBubbles(uint16_t* dst, const DirtyRect& region) const {
+    uint32_t written = 0;
+    for (const auto& bubble : _bubbles) {
+        if (bubble.rect.w > 0 && intersects(bubble.rect, region)) {
+            written += _bubble_sprites[bubble.size].blit(dst, region.w, region.h,
+                                                         bubble.rect.x - region.x,
+                                                         bubble.rect.y - region.y);
+        }
+    }
+    return written;
+}
+
+void SceneLayers::drawPlantsHalf(uint16_t* dst, int dst_w, int dst_h) const {
+    uint16_t row[PLANT_WIDTH];
+    for (const auto& plant : _plants) {
+        // 画面の偶数の行に当たる行だけ
+        for (int r = plant.y & 1; r < plant.sprite.height(); r += 2) {
+            int hy = (plant.y + r) / 2;
+            if (hy < 0 || hy >= dst_h) {
+                continue;
+            }
+            int rx = plant.x + plant.row_shift[r];
+            uint16_t* out = dst + hy * dst_w;
+            plant.sprite.forEachRowSpan(r, false, [&](int a, int b, bool) {
+                plant.sprite.blitRow(row, r, a, b, false);
+                for (int x = a + ((rx + a) & 1); x < b; x += 2) {
+                    int hx = (rx + x) / 2;
+                    if (hx >= 0 && hx < dst_w) {
+                        out[hx] = row[x];
+                    }
+                }
+            });
+        }
+    }
+}
+
+size_t SceneLayers::bytes() const {
+    size_t total = _row_shifts.size() * sizeof(int16_t);
+    for (const auto& plant : _plants) {
+        total += plant.sprite.bytes();
+    }
+    for (const auto& sprite : _bubble_sprites) {
+        total += sprite.bytes();
+    }
+    return total;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "coverage_mask.h"
+#include "dirty_region.h"
+#include "sim_random.h"
+#include "span_sprite.h"
+
+// 背景の上に重ねる動くレイヤー（中景の揺れる水草と、前景の泡）
+//
+// 遠景（背景画像と manifest の static/N）は setup() で background_canvas に 1 枚にまとめておき、
+// 合成時は従来どおりコピーするだけにする。動くレイヤーは変化した部分だけを更新領域に加える
+// （水草は揺れで位置が変わった行の範囲、泡は前回と今回の位置の外接矩形）。
+// 重なる領域の合成は 背景 → 水草 → 魚 → 泡 の順。
+//
+// 水草と泡の画像は begin() で手続き的に作り、SpanSprite で保持する（揺れは行ごとのずらし）。
+// 動きは描画時刻だけで決まり、シミュレーションの状態や乱数には影響しない。
+class SceneLayers {
+public:
+    struct Stats {
+        uint32_t plant_rects;   // 直近の update() で加えた更新領域の数
+        uint32_t bubble_rects;
+        uint32_t plant_pixels;  // その面積
+        uint32_t bubble_pixels;
+    };
+
+    SceneLayers() {}
+    SceneLayers(const SceneLayers&) = delete;
+    SceneLayers& operator=(const SceneLayers&) = delete;
+
+    bool begin(int width, int height, uint32_t seed);
+    bool enabled() const { return !_plants.empty(); }
+
+    // now_ms の状態に進め、変化した部分を regions に加える（最初の呼び出しでは全体）
+    void update(uint32_t now_ms, DirtyRegionManager& regions);
+    // false にすると水草の揺れを止め、泡を消す（次の update() で泡の跡を更新領域に加える）
+    // 描画の品質を下げるときに使う。true に戻すと止めた所から動き出す
+    void setAnimated(bool animated) { _animated = animated; }
+    bool animated() const { return _animated; }
+    // 1 回の update() で加える更新領域の最大数（転送のバッファを先に確保するため）
+    size_t maxRects() const { return _plants.size() + _bubbles.size() * 2; }
+
+    // region のバッファ（region.w x region.h）に重なる部分を描画する。書き込んだピクセル数を返す
+    uint32_t drawPlants(uint16_t* dst, const DirtyRect& region) const;
+    // front-to-back の合成で、coverage の埋まっていない部分にだけ水草を描いて埋める
+    // （水草の区間の owner は 0。魚はそれより大きい番号で先に埋めておく）
+    uint32_t drawPlants(uint16_t* dst, const DirtyRect& region, CoverageMask& coverage) const;
+    uint32_t drawBubbles(uint16_t* dst, const DirtyRect& region) const;
+    // 縦横半分の解像度の画面全体（dst_w x dst_h）に今の水草を描く（偶数の行と列を拾う）
+    void drawPlantsHalf(uint16_t* dst, int dst_w, int dst_h) const;
+
+    const Stats& stats() const { return _stats; }
+    size_t bytes() const;
+
+private:
+    struct Plant {
+        SpanSprite sprite;
+        int x;
+        int y;
+        uint32_t period_ms;  // 揺れの周期
+        float phase;
+        int amplitude;    // 先端の揺れ幅（ピクセル）
+        int top_shift;    // 現在の先端のずれ
+        int16_t* row_shift;  // 行ごとのずれ（_row_shifts の一部）
+    };
+    struct Bubble {
+        float base_x;
+        float y;
+        float speed;      // ピクセル/秒
+        float wobble;     // 横揺れの幅
+        float phase;
+        int size;         // _bubble_sprites の番号
+        uint32_t spawn_ms;  // これより前は水面に出て待っている
+        DirtyRect rect;   // 前回描画した位置（w == 0 なら描画していない）
+    };
+
+    bool buildPlant(Plant& plant, int height, uint16_t* scratch);
+    void spawnBubble(Bubble& bubble, uint32_t now_ms);
+
+    std::vector<Plant> _plants;
+    std::vector<Bubble> _bubbles;
+    std::vector<SpanSprite> _bubble_sprites;  // 半径ごと
+    std::vector<int16_t> _row_shifts;
+    int _width = 0;
+    int _height = 0;
+    uint32_t _last_ms = 0;
+    bool _first = true;
+    bool _animated = true;
+    SimRandom _random{1};
+    Stats _stats = {};
+};
@@ -0,0 +1,220 @@
+#include "session_log.h"
+
+#include <M5Unified.h>
+#include <cstring>
+
+namespace {
+
+const uint8_t SESSION_MAGIC[4] = {'A', 'Q', 'R', '1'};
+const size_t SESSION_HEADER_SIZE = 18;
+const size_t SESSION_RESERVE = 16 * 1024;  // 数分の記録なら確保し直さずに済む
+
+enum RecordType : uint8_t {
+    RECORD_PRESS = 0,
+    RECORD_RELEASE = 1,
+    RECORD_CHECK = 2,
+    RECORD_END = 3,
+};
+
+}  // namespace
+
+void SessionLog::beginRecord(const SessionHeader& header, uint32_t check_interval) {
+    _mode = Mode::Record;
+    _header = header;
+    _stats = Stats();
+    _check_interval = check_interval;
+    _tick = 0;
+    _touch = TouchSample{false, 0, 0};
+    _data.reserve(SESSION_RESERVE);
+    _data.assign(SESSION_MAGIC, SESSION_MAGIC + 4);
+    putU32(header.seed);
+    putU16(header.step_ms);
+    putU16(header.fish_count);
+    putU16(header.screen_width);
+    putU16(header.screen_height);
+    _data.push_back(header.depth_levels);
+    _data.push_back(header.flags);
+}
+
+bool SessionLog::beginReplay(const uint8_t* data, size_t size) {
+    if (size < SESSION_HEADER_SIZE || memcmp(data, SESSION_MAGIC, 4) != 0) {
+        M5_LOGE("Not a session log (%u bytes)", (unsigned)size);
+        return false;
+    }
+    _mode = Mode::Replay;
+    _stats = Stats();
+    _data.assign(data, data + size);
+    _pos = 4;
+    _header.seed = getU32();
+    _header.step_ms = getU16();
+    _header.fish_count = getU16();
+    _header.screen_width = getU16();
+    _header.screen_height = getU16();
+    _header.depth_levels = _data[_pos++];
+    _header.flags = _data[_pos++];
+    _tick = 0;
+    _touch = TouchSample{false, 0, 0};
+    _release_pending = false;
+    peekRecord();
+    return true;
+}
+
+void SessionLog::end() {
+    _mode = Mode::Off;
+    _has_next = false;
+}
+
+void SessionLog::recordTouch(uint32_t tick, const TouchSample& touch) {
+    if (_mode != Mode::Record) {
+        return;
+    }
+    bool changed = touch.pressed != _touch.pressed ||
+                   (touch.pressed && (touch.x != _touch.x || touch.y != _touch.y));
+    if (!changed) {
+        return;
+    }
+    putRecord(tick, touch.pressed ? RECORD_PRESS : RECORD_RELEASE);
+    if (touch.pressed) {
+        putU16((uint16_t)touch.x);
+        putU16((uint16_t)touch.y);
+    }
+    _touch = touch;
+    _stats.events++;
+}
+
+bool SessionLog::replayTouch(uint32_t tick, TouchSample* touch) {
+    if (_mode != Mode::Replay) {
+        return false;
+    }
+    if (_has_next && _next_tick <= tick && (_next_type == RECORD_PRESS || _next_type == RECORD_RELEASE)) {
+        _touch.pressed = _next_type == RECORD_PRESS;
+        if (_touch.pressed) {
+            _touch.x = (int16_t)getU16();
+            _touch.y = (int16_t)getU16();
+        }
+        _stats.events++;
+        peekRecord();
+    } else if (_release_pending) {
+        _release_pending = false;
+        _touch.pressed = false;
+    } else {
+        return false;
+    }
+    *touch = _touch;
+    return true;
+}
+
+bool SessionLog::wantsCheck(uint32_t tick) const {
+    if (_mode == Mode::Record) {
+        return _check_interval > 0 && tick % _check_interval == 0;
+    }
+    return _mode == Mode::Replay && _has_next && _next_tick == tick &&
+           (_next_type == RECORD_CHECK || _next_type == RECORD_END);
+}
+
+void SessionLog::check(uint32_t tick, uint32_t hash) {
+    if (_mode == Mode::Record) {
+        putRecord(tick, RECORD_CHECK);
+        putU32(hash);
+        _stats.checks++;
+        return;
+    }
+    if (!wantsCheck(tick)) {
+        return;
+    }
+    bool last = _next_type == RECORD_END;
+    uint32_t expected = getU32();
+    _stats.checks++;
+    if (expected != hash) {
+        if (_stats.mismatches == 0) {
+            _stats.first_mismatch_tick = tick;
+            M5_LOGW("Replay diverged at tick %u (expected %08x, got %08x)", (unsigned)tick,
+                    (unsigned)expected, (unsigned)hash);
+        }
+        _stats.mismatches++;
+    }
+    if (last) {
+        _has_next = false;
+        markEnded();
+        M5_LOGI("Replay finished at tick %u (%u checks, %u mismatches)", (unsigned)tick,
+                (unsigned)_stats.checks, (unsigned)_stats.mismatches);
+        return;
+    }
+    peekRecord();
+}
+
+void SessionLog::finish(uint32_t tick, uint32_t hash) {
+    if (_mode == Mode::Record) {
+        putRecord(tick, RECORD_END);
+        putU32(hash);
+        _stats.checks++;
+    }
+}
+
+void SessionLog::putRecord(uint32_t tick, uint8_t type) {
+    // 可変長整数（下位 7 ビットずつ、続きがあれば最上位ビットを立てる）
+    uint64_t v = ((uint64_t)(tick - _tick) << 2) | type;
+    while (v >= 0x80) {
+        _data.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    _data.push_back((uint8_t)v);
+    _tick = tick;
+    _stats.last_tick = tick;
+}
+
+void SessionLog::putU16(uint16_t v) {
+    _data.push_back((uint8_t)v);
+    _data.push_back((uint8_t)(v >> 8));
+}
+
+void SessionLog::putU32(uint32_t v) {
+    putU16((uint16_t)v);
+    putU16((uint16_t)(v >> 16));
+}
+
+bool SessionLog::peekRecord() {
+    _has_next = false;
+    uint64_t v = 0;
+    int shift = 0;
+    while (true) {
+        if (_pos >= _data.size() || shift > 35) {
+            // 終わりのレコードが無い記録（記録中に電源を切ったなど）はここで終わる
+            markEnded();
+            return false;
+        }
+        uint8_t b = _data[_pos++];
+        v |= (uint64_t)(b & 0x7F) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    _next_type = (uint8_t)(v & 3);
+    _next_tick = _tick + (uint32_t)(v >> 2);
+    size_t payload = _next_type == RECORD_RELEASE ? 0 : 4;
+    if (_pos + payload > _data.size()) {
+        markEnded();
+        return false;
+    }
+    _tick = _next_tick;
+    _stats.last_tick = _next_tick;
+    _has_next = true;
+    return true;
+}
+
+void SessionLog::markEnded() {
+    _stats.ended = true;
+    _release_pending = _touch.pressed;
+}
+
+uint16_t SessionLog::getU16() {
+    uint16_t v = (uint16_t)(_data[_pos] | (_data[_pos + 1] << 8));
+    _pos += 2;
+    return v;
+}
+
+uint32_t SessionLog::getU32() {
+    uint32_t lo = getU16();
+    return lo | ((uint32_t)getU16() << 16);
+}
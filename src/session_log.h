@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 記録したときのシミュレーションの条件（再生時はこの値に合わせる）
+struct SessionHeader {
+    uint32_t seed;
+    uint16_t step_ms;
+    uint16_t fish_count;
+    uint16_t screen_width;
+    uint16_t screen_height;
+    uint8_t depth_levels;
+    uint8_t flags;  // SESSION_* の組み合わせ
+};
+
+const uint8_t SESSION_SCHOOLING = 1 << 0;
+const uint8_t SESSION_SPATIAL_INDEX = 1 << 1;
+const uint8_t SESSION_FEEDING = 1 << 2;  // 魚のいない所をタップすると餌を落とす（無ければ落とさない）
+
+// 1 ステップで使うタッチの状態
+struct TouchSample {
+    bool pressed;
+    int16_t x;
+    int16_t y;
+};
+
+// タッチ入力の記録と再生
+//
+// 固定刻みのシミュレーションのステップ番号（tick）ごとに、タッチの状態が変わったときだけ
+// （押した・動かした・離した）記録する。一定間隔でシミュレーションの状態のハッシュも記録し、
+// 再生時に比べてずれを検出する。形式はリトルエンディアンで、実機とホストで同じファイルを使える。
+//   ヘッダー: "AQR1", seed(u32), step_ms(u16), fish_count(u16), width(u16), height(u16),
+//             depth_levels(u8), flags(u8)
+//   レコード: 可変長整数 (前のレコードからの tick の差 << 2 | 種類) + 種類ごとの内容
+//             0=押している x(u16) y(u16), 1=離した, 2=ハッシュ(u32), 3=終わり ハッシュ(u32)
+class SessionLog {
+public:
+    enum class Mode { Off, Record, Replay };
+
+    struct Stats {
+        uint32_t events;        // タッチのレコード数
+        uint32_t checks;        // 比べた（記録した）ハッシュの数
+        uint32_t mismatches;    // 一致しなかったハッシュの数
+        uint32_t first_mismatch_tick;
+        uint32_t last_tick;     // 最後に読み書きしたレコードの tick
+        bool ended;             // 再生で記録の終わりまで来た
+    };
+
+    void beginRecord(const SessionHeader& header, uint32_t check_interval);
+    // 記録を読み込んで再生を始める（形式が違えば false）
+    bool beginReplay(const uint8_t* data, size_t size);
+    void end();
+
+    Mode mode() const { return _mode; }
+    const SessionHeader& header() const { return _header; }
+    const Stats& stats() const { return _stats; }
+    // 記録したバイト列（記録中は途中までの内容。終わりのレコードは finish() で追加する）
+    const std::vector<uint8_t>& data() const { return _data; }
+
+    // 記録中なら tick のステップで反映したタッチを記録する（前に記録した状態から変わったときだけ）
+    // 1 つのステップに複数の変化があってもよい（押してすぐ離したタップを落とさない）
+    void recordTouch(uint32_t tick, const TouchSample& touch);
+    // 再生中なら tick のステップまでに記録された次のタッチの変化を touch に入れる（無ければ false）
+    // 記録の終わりで押したままなら、離した状態を 1 回返す
+    bool replayTouch(uint32_t tick, TouchSample* touch);
+    // tick のステップの後で状態のハッシュを記録・比較するか（ハッシュの計算を省くため）
+    bool wantsCheck(uint32_t tick) const;
+    void check(uint32_t tick, uint32_t hash);
+    // 記録の終わりを書く（再生では終わりのハッシュを比べる）
+    void finish(uint32_t tick, uint32_t hash);
+
+private:
+    void putRecord(uint32_t tick, uint8_t type);
+    void putU16(uint16_t v);
+    void putU32(uint32_t v);
+    // 次のレコードの先頭を読む（無ければ false）
+    bool peekRecord();
+    // 再生が記録の終わりまで来た（押したままなら離したことにする）
+    void markEnded();
+    uint16_t getU16();
+    uint32_t getU32();
+
+    Mode _mode = Mode::Off;
+    SessionHeader _header = {};
+    Stats _stats = {};
+    std::vector<uint8_t> _data;
+    size_t _pos = 0;             // 再生中の読み出し位置
+    uint32_t _tick = 0;          // 最後のレコードの tick
+    uint32_t _check_interval = 0;
+    TouchSample _touch = {false, 0, 0};  // 最後に記録・再生したタッチ
+    bool _release_pending = false;       // 再生の終わりで離したことをまだ返していない
+    // 再生中に読み進めた次のレコード
+    bool _has_next = false;
+    uint32_t _next_tick = 0;
+    uint8_t _next_type = 0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// シミュレーション用の乱数（xorshift32）
+//
+// シミュレーションの乱数は全て sim_seed から作ったこの系列だけを使い、Arduino の random() は使わない
+// （同じシードと同じ入力なら、実機でもホストでも同じ結果になる）。魚ごとの系列は FishSchool が持つ。
+
+// 状態を 1 回進めて返す（状態は 0 以外）
+inline uint32_t simNext(uint32_t& state) {
+    uint32_t s = state;
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    state = s;
+    return s;
+}
+
+// [0, 1) の一様乱数（配列の各要素に対して独立に計算できる）
+inline float simUniform(uint32_t& state) {
+    return (float)(int32_t)(simNext(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+// splitmix32 で seed から 0 以外の初期状態を作る（近い seed でも似た系列にならない）
+inline uint32_t simSeed(uint32_t seed) {
+    uint32_t v = seed;
+    v = (v ^ (v >> 16)) * 0x85EBCA6Bu;
+    v = (v ^ (v >> 13)) * 0xC2B2AE35u;
+    v ^= v >> 16;
+    return v ? v : 1;
+}
+
+class SimRandom {
+public:
+    explicit SimRandom(uint32_t seed) : _state(simSeed(seed)) {}
+
+    uint32_t next() { return simNext(_state); }
+    float uniform() { return simUniform(_state); }
+    // [lo, hi) の整数（random(lo, hi) の代わり）
+    int range(int lo, int hi) { return hi > lo ? lo + (int)(next() % (uint32_t)(hi - lo)) : lo; }
+
+private:
+    uint32_t _state;
+};
@@ -0,0 +1,709 @@
+#include "span_sprite.h"
+
+#include <M5Unified.h>
+
+namespace {
+
+const int BLEND_LANES = 16;  // アルファ 16 バイト = 128 ビット（SSE2 / NEON の 1 レジスタ）
+const int MIN_OPAQUE_RUN = 8;  // これより短い不透明区間は、半透明に接していればブレンドスパンに含める
+
+inline uint16_t swap16(uint16_t v) {
+    return (uint16_t)((v << 8) | (v >> 8));
+}
+
+// 8 ビットのアルファを 5 ビット（0〜32）にする。切り上げなので、乗算済みの色は
+// 各チャンネルの最大値 * alpha / 32 を超えず、合成で桁あふれしない
+inline int alpha5(int a) {
+    return (a * 32 + 254) / 255;
+}
+
+// 乗算済みの src（ネイティブ順）を dst（スワップ済み）の 1 ピクセルに重ねる:
+//   dst = src + dst * (32 - alpha) / 32
+// 各チャンネルは桁あふれしないので、チャンネルごとに 16 ビットで計算して足すだけでよい
+inline uint16_t blendPixel(uint16_t dst, uint16_t src, uint8_t alpha) {
+    uint16_t d = swap16(dst);
+    uint16_t inv = (uint16_t)(32 - alpha);
+    uint16_t r = (uint16_t)((uint16_t)((d >> 11) * inv) >> 5);
+    uint16_t g = (uint16_t)((uint16_t)(((d >> 5) & 63) * inv) >> 5);
+    uint16_t b = (uint16_t)((uint16_t)((d & 31) * inv) >> 5);
+    return swap16((uint16_t)(src + ((r << 11) | (g << 5) | b)));
+}
+
+// 先頭から BLEND_LANES の倍数分を合成し、処理したピクセル数を返す
+// 16 ビットの演算だけなので、ホストでは 1 回に 16 ピクセルずつのベクトル命令になる
+// （実機の GCC は自動ベクトル化しないが、分岐のない 1 ピクセルずつのループになる）
+int blendKernel(uint16_t* __restrict dst, const uint16_t* __restrict src,
+                const uint8_t* __restrict alpha, int count) {
+    int head = count & ~(BLEND_LANES - 1);
+    for (int i = 0; i < head; i++) {
+        dst[i] = blendPixel(dst[i], src[i], alpha[i]);
+    }
+    return head;
+}
+
+// 縁の半透明は 1〜2 ピクセルの短いスパンがほとんどなので、その場合は関数を呼ばずに済ませる
+inline void blendSpan(uint16_t* dst, const uint16_t* src, const uint8_t* alpha, int count) {
+    int i = count >= BLEND_LANES ? blendKernel(dst, src, alpha, count) : 0;
+    for (; i < count; i++) {
+        dst[i] = blendPixel(dst[i], src[i], alpha[i]);
+    }
+}
+
+// 左右を反転して count ピクセルを写す（dst[i] = src[-i]、src は区間の右端を指す）
+// 先頭から 8 の倍数分をまとめて処理し、処理したピクセル数を返す
+int reverseKernel(uint16_t* __restrict dst, const uint16_t* __restrict src, int count) {
+    int head = count & ~7;
+    for (int i = 0; i < head; i++) {
+        dst[i] = src[-i];
+    }
+    return head;
+}
+
+inline void reverseSpan(uint16_t* dst, const uint16_t* src, int count) {
+    int i = count >= 8 ? reverseKernel(dst, src, count) : 0;
+    for (; i < count; i++) {
+        dst[i] = src[-i];
+    }
+}
+
+// 反転した半透明の区間（src と alpha は区間の右端を指す）
+inline void blendSpanReversed(uint16_t* dst, const uint16_t* src, const uint8_t* alpha, int count) {
+    for (int i = 0; i < count; i++) {
+        dst[i] = blendPixel(dst[i], src[-i], alpha[-i]);
+    }
+}
+
+// パレットの番号から表を引いて count ピクセルを書き込む（Step = -1 なら src を右端から左へ読む）
+template <int Step>
+inline void lookupSpan(uint16_t* __restrict dst, const uint8_t* __restrict src, int count,
+                       const uint16_t* __restrict color) {
+    int i = 0;
+    // 4 ピクセルずつ（番号の読み出しと表引きを並べて、読み出しの待ちを重ねる）
+    for (; i + 4 <= count; i += 4) {
+        uint16_t c0 = color[src[i * Step]];
+        uint16_t c1 = color[src[(i + 1) * Step]];
+        uint16_t c2 = color[src[(i + 2) * Step]];
+        uint16_t c3 = color[src[(i + 3) * Step]];
+        dst[i] = c0;
+        dst[i + 1] = c1;
+        dst[i + 2] = c2;
+        dst[i + 3] = c3;
+    }
+    for (; i < count; i++) {
+        dst[i] = color[src[i * Step]];
+    }
+}
+
+template <int Step>
+inline void lookupBlendSpan(uint16_t* dst, const uint8_t* src, int count, const SpritePalette& palette) {
+    for (int i = 0; i < count; i++) {
+        uint8_t k = src[i * Step];
+        dst[i] = blendPixel(dst[i], palette.premul[k], palette.alpha32[k]);
+    }
+}
+
+// 縮小後の列から元の列への対応（元の列 = 列 * width / draw_w を割り算せずに進める）
+struct ScaledColumns {
+    int sx;        // 元の列
+    int rem;       // 列 * width を draw_w で割った余り
+    int step;      // width / draw_w
+    int step_rem;  // width % draw_w
+    int draw_w;
+};
+
+// 最近傍で縮小しながら count ピクセルを書き込む（dst は dir = -1 なら左へ進む）
+template <bool Blend>
+inline void lookupScaledSpan(uint16_t* dst, int dir, const uint8_t* row, int count,
+                             ScaledColumns c, const SpritePalette& palette) {
+    for (int i = 0; i < count; i++) {
+        uint8_t k = row[c.sx];
+        *dst = Blend ? blendPixel(*dst, palette.premul[k], palette.alpha32[k]) : palette.color[k];
+        dst += dir;
+        c.sx += c.step;
+        c.rem += c.step_rem;
+        if (c.rem >= c.draw_w) {
+            c.rem -= c.draw_w;
+            c.sx++;
+        }
+    }
+}
+
+}  // namespace
+
+bool SpanSprite::build(const uint16_t* src, int w, int h, int stride, uint16_t transp) {
+    return buildSpans(src, nullptr, w, h, stride, transp);
+}
+
+bool SpanSprite::buildAlpha(const uint16_t* src, const uint8_t* alpha, int w, int h, int stride) {
+    return buildSpans(src, alpha, w, h, stride, 0);
+}
+
+int SpanSprite::classify(const uint16_t* src, const uint8_t* alpha, int i, uint16_t transp) {
+    if (!alpha) {
+        return src[i] != transp ? 1 : 0;
+    }
+    int a = alpha5(alpha[i]);
+    return a == 0 ? 0 : (a >= 32 ? 1 : 2);
+}
+
+int SpanSprite::nextRun(const uint16_t* row, const uint8_t* alpha_row, int x, int w,
+                        uint16_t transp, int* kind) {
+    // 同じ種類が続く区間。半透明に接する短い不透明区間は半透明として扱う
+    auto rawRun = [&](int start, int* k) {
+        *k = classify(row, alpha_row, start, transp);
+        int end = start + 1;
+        while (end < w && classify(row, alpha_row, end, transp) == *k) end++;
+        if (*k == 1 && alpha_row && end - start < MIN_OPAQUE_RUN &&
+            ((start > 0 && classify(row, alpha_row, start - 1, transp) == 2) ||
+             (end < w && classify(row, alpha_row, end, transp) == 2))) {
+            *k = 2;
+        }
+        return end;
+    };
+    int end = rawRun(x, kind);
+    while (end < w) {
+        int next_kind;
+        int next_end = rawRun(end, &next_kind);
+        if (next_kind != *kind) break;
+        end = next_end;
+    }
+    return end;
+}
+
+bool SpanSprite::buildSpans(const uint16_t* src, const uint8_t* alpha, int w, int h, int stride,
+                            uint16_t transp) {
+    release();
+
+    // 1回目: スパン数とピクセル数を数える
+    uint32_t span_count = 0;
+    uint32_t pixel_count = 0;
+    uint32_t blend_count = 0;
+    for (int y = 0; y < h; y++) {
+        const uint8_t* alpha_row = alpha ? alpha + y * stride : nullptr;
+        for (int x = 0; x < w;) {
+            int kind;
+            int end = nextRun(src + y * stride, alpha_row, x, w, transp, &kind);
+            if (kind != 0) {
+                span_count++;
+                pixel_count += end - x;
+                blend_count += kind == 2 ? end - x : 0;
+            }
+            x = end;
+        }
+    }
+
+    size_t row_bytes = sizeof(uint32_t) * (h + 1) + sizeof(uint32_t) * h * 2;
+    size_t bytes = row_bytes + sizeof(Span) * span_count + sizeof(uint16_t) * pixel_count +
+                   blend_count;
+    uint8_t* data = (uint8_t*)ps_malloc(bytes);
+    if (!data) {
+        return false;
+    }
+    uint32_t* row_span = (uint32_t*)data;
+    uint32_t* row_pixel = row_span + (h + 1);
+    uint32_t* row_alpha = row_pixel + h;
+    Span* spans = (Span*)(data + row_bytes);
+    uint16_t* pixels = (uint16_t*)(spans + span_count);
+    uint8_t* alphas = (uint8_t*)(pixels + pixel_count);
+
+    // 2回目: スパンとピクセルを書き込む
+    uint32_t si = 0;
+    uint32_t pi = 0;
+    uint32_t ai = 0;
+    for (int y = 0; y < h; y++) {
+        const uint16_t* row = src + y * stride;
+        const uint8_t* alpha_row = alpha ? alpha + y * stride : nullptr;
+        row_span[y] = si;
+        row_pixel[y] = pi;
+        row_alpha[y] = ai;
+        for (int x = 0; x < w;) {
+            int kind;
+            int end = nextRun(row, alpha_row, x, w, transp, &kind);
+            if (kind == 1) {
+                memcpy(pixels + pi, row + x, (end - x) * sizeof(uint16_t));
+                pi += end - x;
+                spans[si++] = {(uint16_t)x, (uint16_t)(end - x)};
+            } else if (kind == 2) {
+                for (int i = x; i < end; i++) {
+                    // 乗算済みの色がアルファを超えないように抑える（合成で桁あふれしないように）
+                    int a = alpha5(alpha_row[i]);
+                    uint16_t px = swap16(row[i]);
+                    int r = min((px >> 11) & 31, (31 * a) >> 5);
+                    int g = min((px >> 5) & 63, (63 * a) >> 5);
+                    int b = min(px & 31, (31 * a) >> 5);
+                    pixels[pi++] = (uint16_t)((r << 11) | (g << 5) | b);
+                    alphas[ai++] = (uint8_t)a;
+                }
+                spans[si++] = {(uint16_t)x, (uint16_t)((end - x) | BLEND)};
+            }
+            x = end;
+        }
+    }
+    row_span[h] = si;
+
+    _data = data;
+    _row_span = row_span;
+    _row_pixel = row_pixel;
+    _row_alpha = row_alpha;
+    _spans = spans;
+    _pixels = pixels;
+    _alpha = alphas;
+    _width = w;
+    _height = h;
+    _span_count = span_count;
+    _pixel_count = pixel_count;
+    _blend_count = blend_count;
+    _bytes = bytes;
+    return true;
+}
+
+void SpanSprite::release() {
+    free(_data);
+    _data = nullptr;
+    _row_span = nullptr;
+    _row_pixel = nullptr;
+    _row_alpha = nullptr;
+    _spans = nullptr;
+    _pixels = nullptr;
+    _alpha = nullptr;
+    _width = 0;
+    _height = 0;
+    _span_count = 0;
+    _pixel_count = 0;
+    _blend_count = 0;
+    _bytes = 0;
+}
+
+uint32_t SpanSprite::blit(uint16_t* dst, int dst_w, int dst_h, int x, int y,
+                          const int16_t* row_shift) const {
+    if (!_data || !dst) {
+        return 0;
+    }
+    int row_begin = max(0, -y);
+    int row_end = min(_height, dst_h - y);
+    // スパンが描画先の横幅に収まる場合はクリップ判定を省く
+    bool clip_x = row_shift || x < 0 || x + _width > dst_w;
+    uint32_t written = 0;
+    for (int r = row_begin; r < row_end; r++) {
+        int rx = row_shift ? x + row_shift[r] : x;
+        uint16_t* out = dst + (y + r) * dst_w + rx;
+        const uint16_t* src = _pixels + _row_pixel[r];
+        const uint8_t* alpha = _alpha + _row_alpha[r];
+        const Span* s = _spans + _row_span[r];
+        const Span* s_end = _spans + _row_span[r + 1];
+        for (; s < s_end; s++) {
+            int x0 = s->x;
+            int full = s->len & LEN_MASK;
+            bool blend = s->len & BLEND;
+            int skip = 0;
+            int len = full;
+            if (clip_x) {
+                skip = max(0, -(rx + x0));
+                int over = max(0, rx + x0 + len - dst_w);
+                len -= skip + over;
+            }
+            if (len > 0) {
+                if (blend) {
+                    blendSpan(out + x0 + skip, src + skip, alpha + skip, len);
+                } else {
+                    memcpy(out + x0 + skip, src + skip, len * sizeof(uint16_t));
+                }
+                written += len;
+            }
+            src += full;
+            if (blend) {
+                alpha += full;
+            }
+        }
+    }
+    return written;
+}
+
+uint32_t SpanSprite::blitMirrored(uint16_t* dst, int dst_w, int dst_h, int x, int y) const {
+    if (!_data || !dst) {
+        return 0;
+    }
+    int row_begin = max(0, -y);
+    int row_end = min(_height, dst_h - y);
+    int col_begin = max(0, -x);
+    int col_end = min(_width, dst_w - x);
+    uint32_t written = 0;
+    for (int r = row_begin; r < row_end; r++) {
+        written += blitRow(dst + (y + r) * dst_w + x, r, col_begin, col_end, true);
+    }
+    return written;
+}
+
+uint32_t SpanSprite::blitRow(uint16_t* out, int r, int c0, int c1, bool mirror) const {
+    ColumnRange range = {c0, c1};
+    return c0 < c1 ? blitRow(out, r, &range, 1, mirror) : 0;
+}
+
+uint32_t SpanSprite::blitRow(uint16_t* out, int r, const ColumnRange* ranges, int count,
+                             bool mirror) const {
+    // 反転する場合は右端のスパンから読み、描画先の列が昇順になるようにする
+    uint32_t first = _row_span[r];
+    uint32_t span_count = _row_span[r + 1] - first;
+    const uint16_t* src = _pixels + (mirror ? rowPixelEnd(r) : _row_pixel[r]);
+    const uint8_t* alpha = _alpha + (mirror ? rowAlphaEnd(r) : _row_alpha[r]);
+    uint32_t written = 0;
+    int j = 0;
+    for (uint32_t n = 0; n < span_count && j < count; n++) {
+        const Span& s = _spans[mirror ? first + span_count - 1 - n : first + n];
+        int full = s.len & LEN_MASK;
+        bool blend = s.len & BLEND;
+        if (mirror) {
+            src -= full;
+            alpha -= blend ? full : 0;
+        }
+        // 反転する場合の区間は [x0, x0 + full) で、src[full - 1] が左端に来る
+        int x0 = mirror ? _width - s.x - full : s.x;
+        int x1 = x0 + full;
+        while (j < count && ranges[j].end <= x0) j++;
+        for (int k = j; k < count && ranges[k].begin < x1; k++) {
+            int a = max(x0, ranges[k].begin);
+            int b = min(x1, ranges[k].end);
+            if (mirror) {
+                int tail = x0 + full - 1 - a;
+                if (blend) {
+                    blendSpanReversed(out + a, src + tail, alpha + tail, b - a);
+                } else {
+                    reverseSpan(out + a, src + tail, b - a);
+                }
+            } else if (blend) {
+                blendSpan(out + a, src + a - x0, alpha + a - x0, b - a);
+            } else {
+                memcpy(out + a, src + a - x0, (b - a) * sizeof(uint16_t));
+            }
+            written += b - a;
+        }
+        if (!mirror) {
+            src += full;
+            alpha += blend ? full : 0;
+        }
+    }
+    return written;
+}
+
+void SpanSprite::decode(uint16_t* dst, int stride, uint16_t fill) const {
+    for (int r = 0; r < _height; r++) {
+        uint16_t* out = dst + r * stride;
+        for (int i = 0; i < _width; i++) out[i] = fill;
+        const uint16_t* src = _pixels + _row_pixel[r];
+        for (uint32_t k = _row_span[r]; k < _row_span[r + 1]; k++) {
+            int len = _spans[k].len & LEN_MASK;
+            uint16_t* span_out = out + _spans[k].x;
+            if (_spans[k].len & BLEND) {
+                for (int i = 0; i < len; i++) span_out[i] = swap16(src[i]);
+            } else {
+                memcpy(span_out, src, len * sizeof(uint16_t));
+            }
+            src += len;
+        }
+    }
+}
+
+void SpanSprite::decodeAlpha(uint8_t* dst, int stride) const {
+    for (int r = 0; r < _height; r++) {
+        uint8_t* out = dst + r * stride;
+        memset(out, 0, _width);
+        const uint8_t* alpha = _alpha + _row_alpha[r];
+        for (uint32_t k = _row_span[r]; k < _row_span[r + 1]; k++) {
+            int len = _spans[k].len & LEN_MASK;
+            uint8_t* span_out = out + _spans[k].x;
+            if (_spans[k].len & BLEND) {
+                for (int i = 0; i < len; i++) span_out[i] = (uint8_t)(alpha[i] * 255 / 32);
+                alpha += len;
+            } else {
+                memset(span_out, 255, len);
+            }
+        }
+    }
+}
+
+void SpanSprite::decodeRow(int r, uint16_t* color, uint8_t* alpha, int* x0, int* x1) const {
+    memset(color, 0, _width * sizeof(uint16_t));
+    memset(alpha, 0, _width);
+    uint32_t first = _row_span[r];
+    uint32_t last = _row_span[r + 1];
+    *x0 = first < last ? _spans[first].x : 0;
+    *x1 = first < last ? _spans[last - 1].x + (_spans[last - 1].len & LEN_MASK) : 0;
+    const uint16_t* src = _pixels + _row_pixel[r];
+    const uint8_t* src_alpha = _alpha + _row_alpha[r];
+    for (uint32_t k = first; k < last; k++) {
+        int len = _spans[k].len & LEN_MASK;
+        uint16_t* out = color + _spans[k].x;
+        uint8_t* out_alpha = alpha + _spans[k].x;
+        if (_spans[k].len & BLEND) {
+            memcpy(out, src, len * sizeof(uint16_t));
+            memcpy(out_alpha, src_alpha, len);
+            src_alpha += len;
+        } else {
+            for (int i = 0; i < len; i++) out[i] = swap16(src[i]);
+            memset(out_alpha, 32, len);
+        }
+        src += len;
+    }
+}
+
+void SpritePalette::set(int index, uint16_t rgb565, uint8_t a) {
+    int a5 = alpha5(a);
+    // SpanSprite::buildAlpha と同じく、乗算済みの色がアルファを超えないように抑える
+    int r = min((rgb565 >> 11) & 31, (31 * a5) >> 5);
+    int g = min((rgb565 >> 5) & 63, (63 * a5) >> 5);
+    int b = min(rgb565 & 31, (31 * a5) >> 5);
+    premul[index] = (uint16_t)((r << 11) | (g << 5) | b);
+    color[index] = swap16(premul[index]);
+    alpha32[index] = (uint8_t)a5;
+    alpha[index] = a;
+}
+
+uint8_t SpritePalette::nearest(uint16_t rgb565, uint8_t a) const {
+    // 8 ビットに揃えた各チャンネルとアルファの差の二乗和（tools/convert_assets.py と同じ）
+    int r = (rgb565 >> 11) & 31;
+    int g = (rgb565 >> 5) & 63;
+    int b = rgb565 & 31;
+    uint32_t best = UINT32_MAX;
+    int best_index = 0;
+    for (int i = 0; i < count; i++) {
+        int dr = (r - ((premul[i] >> 11) & 31)) * 8;
+        int dg = (g - ((premul[i] >> 5) & 63)) * 4;
+        int db = (b - (premul[i] & 31)) * 8;
+        int da = a - alpha[i];
+        uint32_t d = (uint32_t)(dr * dr + dg * dg + db * db + da * da);
+        if (d < best) {
+            best = d;
+            best_index = i;
+        }
+    }
+    return (uint8_t)best_index;
+}
+
+bool IndexedSprite::build(const uint8_t* indices, int w, int h, int stride,
+                          const SpritePalette* palette) {
+    release();
+    // スパンの分け方は SpanSprite と同じ（パレットのアルファで分類する）
+    uint8_t* alpha_row = (uint8_t*)malloc(w);
+    if (!alpha_row) {
+        return false;
+    }
+    auto rowAlpha = [&](int y) {
+        const uint8_t* row = indices + y * stride;
+        for (int x = 0; x < w; x++) alpha_row[x] = palette->alpha[row[x]];
+    };
+
+    // 1回目: スパン数とピクセル数を数える
+    uint32_t span_count = 0;
+    uint32_t pixel_count = 0;
+    uint32_t blend_count = 0;
+    for (int y = 0; y < h; y++) {
+        rowAlpha(y);
+        for (int x = 0; x < w;) {
+            int kind;
+            int end = SpanSprite::nextRun(nullptr, alpha_row, x, w, 0, &kind);
+            if (kind != 0) {
+                span_count++;
+                pixel_count += end - x;
+                blend_count += kind == 2 ? end - x : 0;
+            }
+            x = end;
+        }
+    }
+
+    size_t row_bytes = sizeof(uint32_t) * (h + 1) + sizeof(uint32_t) * h;
+    size_t bytes = row_bytes + sizeof(Span) * span_count + pixel_count;
+    uint8_t* data = (uint8_t*)ps_malloc(bytes);
+    if (!data) {
+        free(alpha_row);
+        return false;
+    }
+    uint32_t* row_span = (uint32_t*)data;
+    uint32_t* row_index = row_span + (h + 1);
+    Span* spans = (Span*)(data + row_bytes);
+    uint8_t* out = (uint8_t*)(spans + span_count);
+
+    // 2回目: スパンと番号を書き込む
+    uint32_t si = 0;
+    uint32_t pi = 0;
+    for (int y = 0; y < h; y++) {
+        const uint8_t* row = indices + y * stride;
+        rowAlpha(y);
+        row_span[y] = si;
+        row_index[y] = pi;
+        for (int x = 0; x < w;) {
+            int kind;
+            int end = SpanSprite::nextRun(nullptr, alpha_row, x, w, 0, &kind);
+            if (kind != 0) {
+                memcpy(out + pi, row + x, end - x);
+                pi += end - x;
+                spans[si++] = {(uint16_t)x, (uint16_t)((end - x) | (kind == 2 ? SpanSprite::BLEND : 0))};
+            }
+            x = end;
+        }
+    }
+    row_span[h] = si;
+    free(alpha_row);
+
+    _data = data;
+    _row_span = row_span;
+    _row_index = row_index;
+    _spans = spans;
+    _indices = out;
+    _palette = palette;
+    _width = w;
+    _height = h;
+    _span_count = span_count;
+    _pixel_count = pixel_count;
+    _blend_count = blend_count;
+    _bytes = bytes;
+    return true;
+}
+
+void IndexedSprite::release() {
+    free(_data);
+    _data = nullptr;
+    _row_span = nullptr;
+    _row_index = nullptr;
+    _spans = nullptr;
+    _indices = nullptr;
+    _palette = nullptr;
+    _width = 0;
+    _height = 0;
+    _span_count = 0;
+    _pixel_count = 0;
+    _blend_count = 0;
+    _bytes = 0;
+}
+
+uint32_t IndexedSprite::blit(uint16_t* dst, int dst_w, int dst_h, int x, int y, bool mirror) const {
+    return blitScaled(dst, dst_w, dst_h, x, y, _width, _height, mirror);
+}
+
+uint32_t IndexedSprite::blitScaled(uint16_t* dst, int dst_w, int dst_h, int x, int y, int draw_w,
+                                   int draw_h, bool mirror) const {
+    if (!_data || !dst || draw_w <= 0 || draw_h <= 0) {
+        return 0;
+    }
+    int row_begin = max(0, -y);
+    int row_end = min(draw_h, dst_h - y);
+    ColumnRange visible = {max(0, -x), min(draw_w, dst_w - x)};
+    if (visible.begin >= visible.end) {
+        return 0;
+    }
+    uint32_t written = 0;
+    for (int dy = row_begin; dy < row_end; dy++) {
+        written += blitRow(dst + (y + dy) * dst_w + x, dy, &visible, 1, draw_w, draw_h, mirror);
+    }
+    return written;
+}
+
+uint32_t IndexedSprite::blitRow(uint16_t* out, int dy, const ColumnRange* ranges, int count, int draw_w,
+                                int draw_h, bool mirror) const {
+    const SpritePalette& palette = *_palette;
+    bool scaled = draw_w != _width || draw_h != _height;
+    int r = scaled ? dy * _height / draw_h : dy;
+    // 反転する場合は右端のスパンから読み、描画先の列が昇順になるようにする
+    uint32_t first = _row_span[r];
+    uint32_t span_count = _row_span[r + 1] - first;
+    const uint8_t* src = _indices + (mirror ? rowEnd(r) : _row_index[r]);
+    // 縮小後の列 u の元の列は u * width / draw_w（割り算をせずに 1 列ずつ進める）
+    int step = _width / draw_w;
+    int step_rem = _width % draw_w;
+    uint32_t written = 0;
+    int j = 0;
+    for (uint32_t n = 0; n < span_count && j < count; n++) {
+        const Span& s = _spans[mirror ? first + span_count - 1 - n : first + n];
+        int full = s.len & SpanSprite::LEN_MASK;
+        bool blend = s.len & SpanSprite::BLEND;
+        if (mirror) {
+            src -= full;
+        }
+        // 描画先の区間 [x0, x1)（縮小する場合は元の区間に入る縮小後の列）
+        int u0 = scaled ? scaledColumn(s.x, draw_w) : s.x;
+        int u1 = scaled ? scaledColumn(s.x + full, draw_w) : s.x + full;
+        int x0 = mirror ? draw_w - u1 : u0;
+        int x1 = mirror ? draw_w - u0 : u1;
+        while (j < count && ranges[j].end <= x0) j++;
+        for (int k = j; k < count && ranges[k].begin < x1; k++) {
+            int a = max(x0, ranges[k].begin);
+            int b = min(x1, ranges[k].end);
+            if (!scaled) {
+                if (mirror) {
+                    const uint8_t* tail = src + (x0 + full - 1 - a);
+                    if (blend) {
+                        lookupBlendSpan<-1>(out + a, tail, b - a, palette);
+                    } else {
+                        lookupSpan<-1>(out + a, tail, b - a, palette.color);
+                    }
+                } else if (blend) {
+                    lookupBlendSpan<1>(out + a, src + (a - x0), b - a, palette);
+                } else {
+                    lookupSpan<1>(out + a, src + (a - x0), b - a, palette.color);
+                }
+            } else {
+                // 描画先の列 c には縮小後の列 c（反転する場合は draw_w - 1 - c）が来る
+                int u = mirror ? draw_w - b : a;
+                ScaledColumns columns = {u * _width / draw_w, u * _width % draw_w, step, step_rem, draw_w};
+                const uint8_t* row = src - s.x;  // 元の列 sx の番号は row[sx]
+                uint16_t* o = mirror ? out + b - 1 : out + a;
+                int dir = mirror ? -1 : 1;
+                if (blend) {
+                    lookupScaledSpan<true>(o, dir, row, b - a, columns, palette);
+                } else {
+                    lookupScaledSpan<false>(o, dir, row, b - a, columns, palette);
+                }
+            }
+            written += b - a;
+        }
+        if (!mirror) {
+            src += full;
+        }
+    }
+    return written;
+}
+
+void IndexedSprite::decode(uint16_t* dst, int stride, uint16_t fill) const {
+    for (int r = 0; r < _height; r++) {
+        uint16_t* out = dst + r * stride;
+        for (int i = 0; i < _width; i++) out[i] = fill;
+        const uint8_t* src = _indices + _row_index[r];
+        for (uint32_t k = _row_span[r]; k < _row_span[r + 1]; k++) {
+            int len = _spans[k].len & SpanSprite::LEN_MASK;
+            lookupSpan<1>(out + _spans[k].x, src, len, _palette->color);
+            src += len;
+        }
+    }
+}
+
+void IndexedSprite::decodeAlpha(uint8_t* dst, int stride) const {
+    for (int r = 0; r < _height; r++) {
+        uint8_t* out = dst + r * stride;
+        memset(out, 0, _width);
+        const uint8_t* src = _indices + _row_index[r];
+        for (uint32_t k = _row_span[r]; k < _row_span[r + 1]; k++) {
+            int len = _spans[k].len & SpanSprite::LEN_MASK;
+            for (int i = 0; i < len; i++) out[_spans[k].x + i] = _palette->alpha[src[i]];
+            src += len;
+        }
+    }
+}
+
+void IndexedSprite::decodeRow(int r, uint16_t* color, uint8_t* alpha, int* x0, int* x1) const {
+    memset(color, 0, _width * sizeof(uint16_t));
+    memset(alpha, 0, _width);
+    uint32_t first = _row_span[r];
+    uint32_t last = _row_span[r + 1];
+    *x0 = first < last ? _spans[first].x : 0;
+    *x1 = first < last ? _spans[last - 1].x + (_spans[last - 1].len & SpanSprite::LEN_MASK) : 0;
+    const uint8_t* src = _indices + _row_index[r];
+    for (uint32_t k = first; k < last; k++) {
+        int len = _spans[k].len & SpanSprite::LEN_MASK;
+        uint16_t* out = color + _spans[k].x;
+        uint8_t* out_alpha = alpha + _spans[k].x;
+        for (int i = 0; i < len; i++) {
+            out[i] = _palette->premul[src[i]];
+            out_alpha[i] = _palette->alpha32[src[i]];
+        }
+        src += len;
+    }
+}
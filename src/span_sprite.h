@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 描画先の列の区間 [begin, end)（行の一部だけを描くときに使う）
+struct ColumnRange {
+    int begin;
+    int end;
+};
+
+// 不透明ピクセルの連続区間（スパン）だけを保持するスプライト
+//
+// 魚の画像は 358x200 のうち大半が透過色（TFT_BLACK）なので、行ごとに
+// (開始位置, 長さ) のリストと不透明ピクセル列だけを保持する。
+// 描画はスパン単位の memcpy で済み、ピクセルごとの透過色判定が不要になる。
+// ピクセルはスプライトメモリと同じバイトスワップ済み RGB565 のまま保持する。
+//
+// buildAlpha() で作った場合は半透明の区間（ブレンドスパン）も持つ。ブレンドスパンの
+// ピクセルは乗算済み（黒の上に合成した色）のネイティブ順 RGB565 と 5 ビットのアルファ（1〜32）で、
+// 描画先と「src + dst * (32 - alpha) / 32」で合成する。完全に透明な部分は持たず、
+// 不透明な部分は従来どおり memcpy で描くので、半透明の縁の分だけしか遅くならない。
+// 半透明に挟まれた短い不透明区間はブレンドスパンに含める（スパンの数を増やさないため）。
+class SpanSprite {
+public:
+    struct Span {
+        uint16_t x;
+        uint16_t len;  // 最上位ビットが BLEND ならブレンドスパン
+    };
+    static const uint16_t BLEND = 0x8000;
+    static const uint16_t LEN_MASK = 0x7FFF;
+
+    SpanSprite() {}
+    ~SpanSprite() { release(); }
+
+    SpanSprite(const SpanSprite&) = delete;
+    SpanSprite& operator=(const SpanSprite&) = delete;
+
+    // src（stride ピクセル間隔の w x h）から transp 以外の区間を抽出する
+    bool build(const uint16_t* src, int w, int h, int stride, uint16_t transp);
+    // src（乗算済み、スワップ済み）と alpha（0〜255、同じ stride）から作る
+    bool buildAlpha(const uint16_t* src, const uint8_t* alpha, int w, int h, int stride);
+    void release();
+
+    bool empty() const { return _data == nullptr; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+    uint32_t opaquePixels() const { return _pixel_count - _blend_count; }
+    uint32_t blendPixels() const { return _blend_count; }  // ブレンドスパンのピクセル数
+    uint32_t spanCount() const { return _span_count; }
+    size_t bytes() const { return _bytes; }
+
+    // dst（dst_w x dst_h、stride = dst_w）の (x, y) に描画する。書き込んだピクセル数を返す
+    // row_shift があれば行 r を row_shift[r] ピクセル横にずらす（水草の揺れ）
+    uint32_t blit(uint16_t* dst, int dst_w, int dst_h, int x, int y,
+                  const int16_t* row_shift = nullptr) const;
+    // 左右を反転して描画する（右向きの魚を左向きの画像から描く）
+    uint32_t blitMirrored(uint16_t* dst, int dst_w, int dst_h, int x, int y) const;
+    // 行 r のスパンについて fn(開始の列, 終わりの列, 半透明か) を列の昇順に呼ぶ（反転した後の列）
+    template <class Fn>
+    void forEachRowSpan(int r, bool mirror, Fn fn) const {
+        uint32_t first = _row_span[r];
+        uint32_t count = _row_span[r + 1] - first;
+        for (uint32_t n = 0; n < count; n++) {
+            const Span& s = _spans[mirror ? first + count - 1 - n : first + n];
+            int len = s.len & LEN_MASK;
+            int x0 = mirror ? _width - s.x - len : s.x;
+            fn(x0, x0 + len, (s.len & BLEND) != 0);
+        }
+    }
+    // 行 r の列 [c0, c1) に掛かる部分だけを描く（out は描画先のその行の、スプライトの左端）
+    uint32_t blitRow(uint16_t* out, int r, int c0, int c1, bool mirror) const;
+    // 行 r の列の区間 ranges（昇順、重ならない）に掛かる部分だけを描く
+    uint32_t blitRow(uint16_t* out, int r, const ColumnRange* ranges, int count, bool mirror) const;
+    // 透過部分を fill で埋めて w x h の画像に戻す（半透明の部分は黒の上に合成した色）
+    void decode(uint16_t* dst, int stride, uint16_t fill) const;
+    // アルファ（0〜255）を w x h に書き出す
+    void decodeAlpha(uint8_t* dst, int stride) const;
+    // 行 r を乗算済みの色（ネイティブ順）とアルファ（0〜32）に展開し、スパンの掛かる列の範囲 [*x0, *x1) を返す
+    // （透明な部分は色もアルファも 0。ScaleFilter の元の行）
+    void decodeRow(int r, uint16_t* color, uint8_t* alpha, int* x0, int* x1) const;
+
+private:
+    friend class IndexedSprite;  // スパンの分け方（nextRun）を共有する
+
+    // src の 1 ピクセルの種類（0=透明、1=不透明、2=半透明）
+    static int classify(const uint16_t* src, const uint8_t* alpha, int i, uint16_t transp);
+    // 行 row（w ピクセル）の x から始まる区間の種類を kind に入れ、区間の終わりを返す
+    static int nextRun(const uint16_t* row, const uint8_t* alpha_row, int x, int w,
+                       uint16_t transp, int* kind);
+    bool buildSpans(const uint16_t* src, const uint8_t* alpha, int w, int h, int stride,
+                    uint16_t transp);
+    // 行 r のピクセルとアルファの終わり（次の行の始まり）
+    uint32_t rowPixelEnd(int r) const { return r + 1 < _height ? _row_pixel[r + 1] : _pixel_count; }
+    uint32_t rowAlphaEnd(int r) const { return r + 1 < _height ? _row_alpha[r + 1] : _blend_count; }
+
+    // 1つの確保領域に [行ごとのスパン開始][行ごとのピクセル開始][行ごとのアルファ開始]
+    // [スパン][ピクセル][アルファ] を並べる
+    uint8_t* _data = nullptr;
+    const uint32_t* _row_span = nullptr;   // height + 1 個
+    const uint32_t* _row_pixel = nullptr;  // height 個
+    const uint32_t* _row_alpha = nullptr;  // height 個
+    const Span* _spans = nullptr;
+    const uint16_t* _pixels = nullptr;
+    const uint8_t* _alpha = nullptr;       // ブレンドスパンのピクセルごと（1〜32）
+    int _width = 0;
+    int _height = 0;
+    uint32_t _span_count = 0;
+    uint32_t _pixel_count = 0;
+    uint32_t _blend_count = 0;
+    size_t _bytes = 0;
+};
+
+// 共有パレット（assets.pak の "palette/<名前>"）
+// 0 番は透明に予約する。色は乗算済み（黒の上に合成した色）
+struct SpritePalette {
+    static const int MAX_COLORS = 256;
+
+    uint16_t color[MAX_COLORS];   // スワップ済み RGB565（不透明な部分はそのまま書き込む）
+    uint16_t premul[MAX_COLORS];  // ネイティブ順 RGB565（半透明の合成用、アルファを超えないよう抑えたもの）
+    uint8_t alpha32[MAX_COLORS];  // 合成に使うアルファ（0〜32）
+    uint8_t alpha[MAX_COLORS];    // アセットのアルファ（0〜255）
+    int count = 0;
+
+    // index 番に乗算済みの色 rgb565（ネイティブ順）とアルファ（0〜255）を入れる
+    void set(int index, uint16_t rgb565, uint8_t a);
+    // 一番近い色の番号（縮小した画像をパレットに戻すとき）
+    uint8_t nearest(uint16_t rgb565, uint8_t a) const;
+};
+
+// パレットの番号（1 ピクセル 1 バイト）でスパンを保持するスプライト
+//
+// SpanSprite と同じ行ごとのスパンを持ち、ピクセルの代わりにパレットの番号を並べる。
+// 描画は番号から表を引いて RGB565 の描画先に直接書き込むので、展開用のバッファは要らない。
+// 半透明の区間はパレットのアルファで合成する。メモリと PSRAM からの読み出しは
+// RGB565 のスパンのおよそ半分（半透明の部分は 1/3）になる。
+// 拡大縮小も最近傍で描画先に直接書き込む（奥行きキャッシュを使わない場合の経路）。
+class IndexedSprite {
+public:
+    using Span = SpanSprite::Span;
+
+    IndexedSprite() {}
+    ~IndexedSprite() { release(); }
+
+    IndexedSprite(const IndexedSprite&) = delete;
+    IndexedSprite& operator=(const IndexedSprite&) = delete;
+
+    // indices（stride バイト間隔の w x h）から作る。palette は解放するまで有効であること
+    bool build(const uint8_t* indices, int w, int h, int stride, const SpritePalette* palette);
+    void release();
+
+    bool empty() const { return _data == nullptr; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+    const SpritePalette* palette() const { return _palette; }
+    uint32_t opaquePixels() const { return _pixel_count - _blend_count; }
+    uint32_t blendPixels() const { return _blend_count; }
+    uint32_t spanCount() const { return _span_count; }
+    size_t bytes() const { return _bytes; }
+
+    // dst（dst_w x dst_h、stride = dst_w）の (x, y) に描画する。書き込んだピクセル数を返す
+    uint32_t blit(uint16_t* dst, int dst_w, int dst_h, int x, int y, bool mirror = false) const;
+    // draw_w x draw_h に最近傍で拡大縮小して描画する
+    uint32_t blitScaled(uint16_t* dst, int dst_w, int dst_h, int x, int y, int draw_w, int draw_h,
+                        bool mirror = false) const;
+    // draw_w x draw_h で描くときの行 dy のスパンについて fn(開始の列, 終わりの列, 半透明か) を
+    // 列の昇順に呼ぶ（反転・拡大縮小した後の列。空になるスパンは渡さない）
+    template <class Fn>
+    void forEachRowSpan(int dy, int draw_w, int draw_h, bool mirror, Fn fn) const {
+        bool scaled = draw_w != _width || draw_h != _height;
+        int r = scaled ? dy * _height / draw_h : dy;
+        uint32_t first = _row_span[r];
+        uint32_t count = _row_span[r + 1] - first;
+        for (uint32_t n = 0; n < count; n++) {
+            const Span& s = _spans[mirror ? first + count - 1 - n : first + n];
+            int len = s.len & SpanSprite::LEN_MASK;
+            int u0 = s.x;
+            int u1 = u0 + len;
+            if (scaled) {
+                u0 = scaledColumn(u0, draw_w);
+                u1 = scaledColumn(u1, draw_w);
+            }
+            if (u0 < u1) {
+                fn(mirror ? draw_w - u1 : u0, mirror ? draw_w - u0 : u1, (s.len & SpanSprite::BLEND) != 0);
+            }
+        }
+    }
+    // draw_w x draw_h で描くときの行 dy の、列の区間 ranges（昇順、重ならない）に掛かる部分だけを描く
+    // （out は描画先のその行の、描画位置の左端）
+    uint32_t blitRow(uint16_t* out, int dy, const ColumnRange* ranges, int count, int draw_w, int draw_h,
+                     bool mirror) const;
+    // 透過部分を fill で埋めて w x h の画像に戻す（半透明の部分は黒の上に合成した色）
+    void decode(uint16_t* dst, int stride, uint16_t fill) const;
+    // アルファ（0〜255）を w x h に書き出す
+    void decodeAlpha(uint8_t* dst, int stride) const;
+    // 行 r を乗算済みの色（ネイティブ順）とアルファ（0〜32）に展開する（SpanSprite::decodeRow と同じ）
+    void decodeRow(int r, uint16_t* color, uint8_t* alpha, int* x0, int* x1) const;
+
+private:
+    // 元の列 sx 以降に来る、縮小後の最初の列（縮小後の列 u の元の列は u * width / draw_w）
+    int scaledColumn(int sx, int draw_w) const { return (sx * draw_w + _width - 1) / _width; }
+    // 行 r の番号の終わり（次の行の始まり）
+    uint32_t rowEnd(int r) const { return r + 1 < _height ? _row_index[r + 1] : _pixel_count; }
+
+    // 1つの確保領域に [行ごとのスパン開始][行ごとの番号の開始][スパン][番号] を並べる
+    uint8_t* _data = nullptr;
+    const uint32_t* _row_span = nullptr;   // height + 1 個
+    const uint32_t* _row_index = nullptr;  // height 個
+    const Span* _spans = nullptr;
+    const uint8_t* _indices = nullptr;
+    const SpritePalette* _palette = nullptr;
+    int _width = 0;
+    int _height = 0;
+    uint32_t _span_count = 0;
+    uint32_t _pixel_count = 0;
+    uint32_t _blend_count = 0;
+    size_t _bytes = 0;
+};
@@ -0,0 +1,63 @@
+#include "spatial_grid.h"
+
+#include <algorithm>
+
+void SpatialGrid::begin(int width, int height, int cell_size, int reach_x, int reach_y) {
+    _cell_size = cell_size > 0 ? cell_size : 1;
+    _inv_cell = 1.0f / _cell_size;
+    _cols = width > 0 ? (width + _cell_size - 1) / _cell_size : 1;
+    _rows = height > 0 ? (height + _cell_size - 1) / _cell_size : 1;
+    _reach_x = reach_x;
+    _reach_y = reach_y;
+    _head.assign(_cols * _rows, -1);
+    resize((int)_cell.size());
+}
+
+void SpatialGrid::resize(int count) {
+    std::fill(_head.begin(), _head.end(), -1);
+    _next.assign(count, -1);
+    _prev.assign(count, -1);
+    _cell.assign(count, -1);
+}
+
+void SpatialGrid::update(int i, float x, float y) {
+    int cell = cellY(y) * _cols + cellX(x);
+    if (cell == _cell[i]) {
+        return;
+    }
+    unlink(i);
+    _cell[i] = cell;
+    _prev[i] = -1;
+    _next[i] = _head[cell];
+    if (_next[i] >= 0) {
+        _prev[_next[i]] = i;
+    }
+    _head[cell] = i;
+    _moves++;
+}
+
+int SpatialGrid::cellX(float x) const {
+    int cx = (int)(x * _inv_cell);
+    return cx < 0 ? 0 : (cx >= _cols ? _cols - 1 : cx);
+}
+
+int SpatialGrid::cellY(float y) const {
+    int cy = (int)(y * _inv_cell);
+    return cy < 0 ? 0 : (cy >= _rows ? _rows - 1 : cy);
+}
+
+void SpatialGrid::unlink(int i) {
+    int cell = _cell[i];
+    if (cell < 0) {
+        return;
+    }
+    if (_prev[i] >= 0) {
+        _next[_prev[i]] = _next[i];
+    } else {
+        _head[cell] = _next[i];
+    }
+    if (_next[i] >= 0) {
+        _prev[_next[i]] = _prev[i];
+    }
+    _cell[i] = -1;
+}
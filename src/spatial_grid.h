@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "dirty_region.h"
+
+// 物体の中心座標を一定サイズのセルに振り分ける一様グリッド
+//
+// セルごとに物体の双方向リスト（先頭と前後の番号だけを配列で持つ）を作り、update() では
+// セルが変わった物体だけを付け替える（毎フレーム作り直さないので、動いた数にだけ比例する）。
+// 魚の近傍探索（群れの計算）、タッチの当たり判定、更新領域と重なる魚の検索に使う。
+// 検索は範囲に掛かるセルの物体を全て候補として返すので、正確な判定は呼び出し側で行う。
+class SpatialGrid {
+public:
+    // width x height を cell_size 四方のセルに分ける
+    // reach_x/y は物体の中心から端までの最大距離（矩形の重なりの検索で範囲を広げる分）
+    void begin(int width, int height, int cell_size, int reach_x, int reach_y);
+    // 物体の数を変える（全て未登録に戻る）
+    void resize(int count);
+    // i 番の中心を (x, y) に移す（範囲外はいちばん近いセルに入れる）
+    void update(int i, float x, float y);
+
+    bool enabled() const { return !_head.empty(); }
+    int cellSize() const { return _cell_size; }
+    uint32_t moves() const { return _moves; }  // セルを付け替えた回数（累計）
+
+    // 中心が [x0, x1] x [y0, y1] に掛かるセルにある物体について fn(i) を呼ぶ
+    template <class Fn>
+    void forEachInBox(float x0, float y0, float x1, float y1, Fn fn) const {
+        int cx0 = cellX(x0), cx1 = cellX(x1);
+        int cy0 = cellY(y0), cy1 = cellY(y1);
+        for (int cy = cy0; cy <= cy1; cy++) {
+            for (int cx = cx0; cx <= cx1; cx++) {
+                for (int i = _head[cy * _cols + cx]; i >= 0; i = _next[i]) {
+                    fn(i);
+                }
+            }
+        }
+    }
+    // 中心が (x, y) から radius 以内にありうる物体
+    template <class Fn>
+    void forEachNear(float x, float y, float radius, Fn fn) const {
+        forEachInBox(x - radius, y - radius, x + radius, y + radius, fn);
+    }
+    // rect と重なりうる物体
+    template <class Fn>
+    void forEachOverlapping(const DirtyRect& rect, Fn fn) const {
+        forEachInBox((float)(rect.x - _reach_x), (float)(rect.y - _reach_y),
+                     (float)(rect.right() + _reach_x), (float)(rect.bottom() + _reach_y), fn);
+    }
+
+private:
+    int cellX(float x) const;
+    int cellY(float y) const;
+    void unlink(int i);
+
+    int _cols = 0;
+    int _rows = 0;
+    int _cell_size = 1;
+    float _inv_cell = 1.0f;
+    int _reach_x = 0;
+    int _reach_y = 0;
+    uint32_t _moves = 0;
+    std::vector<int> _head;  // セルごとの先頭の物体（-1=空）
+    std::vector<int> _next;  // 同じセルの次の物体
+    std::vector<int> _prev;  // 同じセルの前の物体（-1=先頭）
+    std::vector<int> _cell;  // 物体が入っているセル（-1=未登録）
+};
@@ -0,0 +1,337 @@
+#include "sprite_residency.h"
+
+namespace {
+
+const int LOADER_QUEUE_LENGTH = 32;
+const uint32_t LOADER_STACK_SIZE = 8192;
+const UBaseType_t LOADER_PRIORITY = 1;  // 描画（loop）より低く
+const BaseType_t LOADER_CORE = 0;       // loop() は core 1 で動く
+const uint32_t KEEP_FRAMES = 2;         // 直近このフレーム数で使ったものは解放しない
+
+template <class T>
+void updateMax(std::atomic<T>& target, T value) {
+    T current = target.load();
+    while (value > current && !target.compare_exchange_weak(current, value)) {
+    }
+}
+
+}  // namespace
+
+bool SpriteResidency::begin(size_t budget_bytes, bool async) {
+    _budget = budget_bytes;
+    _async = async;
+    if (!_load_lock) {
+        _load_lock = xSemaphoreCreateMutex();
+    }
+    if (_async && !_queue) {
+        _queue = xQueueCreate(LOADER_QUEUE_LENGTH, sizeof(int));
+        if (!_queue || xTaskCreatePinnedToCore(loaderTask, "sprite_loader", LOADER_STACK_SIZE, this,
+                                               LOADER_PRIORITY, &_task, LOADER_CORE) != pdPASS) {
+            M5_LOGE("Failed to start sprite loader task, loading synchronously");
+            _async = false;
+        }
+    }
+    M5_LOGI("Sprite residency: budget %u bytes, %s", (unsigned)_budget,
+            _async ? "async" : "sync");
+    return true;
+}
+
+int SpriteResidency::add(const AssetEntry* entry, int width, int height) {
+    std::unique_ptr<Slot> slot(new Slot());
+    slot->entry = entry;
+    slot->width = width;
+    slot->height = height;
+    _slots.push_back(std::move(slot));
+    // 読み込み中に確保し直さないよう、最大の画像に合わせて先に広げておく
+    size_t pixels = (size_t)width * height;
+    bool indexed = sprite_format == SpriteFormat::Indexed && asset_archive.palette(*entry);
+    if (indexed && _indices.size() < pixels) {
+        _indices.resize(pixels);
+    }
+    if (!indexed && (sprite_format == SpriteFormat::Alpha || sprite_format == SpriteFormat::Indexed) &&
+        _alpha.size() < pixels) {
+        _alpha.resize(pixels);
+    }
+    size_t load_bytes = _alpha.capacity() + _indices.capacity();
+    if (load_bytes > _load_bytes) {
+        memory_budget.charge(MemoryOwner::SpriteLoad, load_bytes - _load_bytes);
+        _load_bytes = load_bytes;
+    }
+    updateMax(_load_estimate, loadBytes(*_slots.back()));
+    return (int)_slots.size() - 1;
+}
+
+bool SpriteResidency::pin(int id) {
+    Slot& slot = *_slots[id];
+    slot.pinned = true;
+    return loadNow(id) != nullptr;
+}
+
+void SpriteResidency::beginFrame() {
+    _frame++;
+    // memory_budget に断られた読み込みがあれば、1 枚分の空きができるまで解放する
+    uint32_t denied = _denied.load();
+    bool short_of_memory = denied != _denied_seen;
+    _denied_seen = denied;
+    _starved = false;
+    // 予算を超えていれば、長く使われていないものから解放する
+    while ((_budget > 0 && _resident_bytes.load() > _budget) ||
+           (short_of_memory && !memory_budget.fits(MemoryCategory::Sprites, _load_estimate.load()))) {
+        Slot* oldest = nullptr;
+        for (auto& slot : _slots) {
+            if (slot->pinned || slot->state.load() != Resident ||
+                _frame - slot->last_frame < KEEP_FRAMES) {
+                continue;
+            }
+            if (!oldest || slot->last_frame < oldest->last_frame) {
+                oldest = slot.get();
+            }
+        }
+        if (!oldest) {
+            // 解放できるものが無い（一時的に予算を超える。memory_budget の分は呼び出し側が空ける）
+            _starved = short_of_memory;
+            break;
+        }
+        evict(*oldest);
+    }
+    // 断られた読み込みは、収まるようになったら依頼できるよう空に戻す
+    for (auto& slot : _slots) {
+        uint8_t expected = Denied;
+        if (slot->state.load() == Denied && memory_budget.fits(MemoryCategory::Sprites, loadBytes(*slot))) {
+            slot->state.compare_exchange_strong(expected, Empty);
+        }
+    }
+}
+
+void SpriteResidency::release(int id) {
+    Slot& slot = *_slots[id];
+    slot.pinned = false;
+    if (slot.state.load(std::memory_order_acquire) == Resident) {
+        evict(slot);
+    }
+}
+
+FishSprite* SpriteResidency::acquire(int id, const int* fallbacks, int num_fallbacks) {
+    Slot& slot = *_slots[id];
+    if (slot.state.load(std::memory_order_acquire) == Resident) {
+        _hits++;
+        slot.last_frame = _frame;
+        return &slot.sprite;
+    }
+    _misses++;
+    if (!_async) {
+        // 同期モードではその場で読み込む
+        if (request(slot, id) && load(slot)) {
+            slot.last_frame = _frame;
+            return &slot.sprite;
+        }
+    } else {
+        request(slot, id);
+    }
+    for (int i = 0; i < num_fallbacks; i++) {
+        Slot& candidate = *_slots[fallbacks[i]];
+        if (candidate.state.load(std::memory_order_acquire) == Resident) {
+            _fallbacks++;
+            candidate.last_frame = _frame;
+            return &candidate.sprite;
+        }
+    }
+    _blanks++;
+    return nullptr;
+}
+
+void SpriteResidency::prefetch(int id) {
+    Slot& slot = *_slots[id];
+    if (slot.state.load() != Empty) {
+        return;
+    }
+    _prefetches++;
+    slot.last_frame = _frame;  // 読み込んだ直後に解放されないように
+    if (_async) {
+        request(slot, id);
+    }
+}
+
+FishSprite* SpriteResidency::loadNow(int id) {
+    Slot& slot = *_slots[id];
+    uint8_t state = Empty;
+    if (slot.state.compare_exchange_strong(state, Loading)) {
+        load(slot);
+    }
+    // ローダータスクが読み込み中なら終わるまで待つ
+    while ((state = slot.state.load(std::memory_order_acquire)) == Queued || state == Loading) {
+        vTaskDelay(1);
+    }
+    slot.last_frame = _frame;
+    return state == Resident ? &slot.sprite : nullptr;
+}
+
+bool SpriteResidency::resident(int id) const {
+    return _slots[id]->state.load(std::memory_order_acquire) == Resident;
+}
+
+void SpriteResidency::waitIdle() {
+    for (auto& slot : _slots) {
+        uint8_t state;
+        while ((state = slot->state.load(std::memory_order_acquire)) == Queued || state == Loading) {
+            vTaskDelay(1);
+        }
+    }
+}
+
+SpriteResidency::Stats SpriteResidency::stats() const {
+    Stats stats = {};
+    stats.hits = _hits;
+    stats.misses = _misses;
+    stats.fallbacks = _fallbacks;
+    stats.blanks = _blanks;
+    stats.prefetches = _prefetches;
+    stats.loads = _loads.load();
+    stats.load_failures = _load_failures.load();
+    stats.denied = _denied.load();
+    stats.evictions = _evictions;
+    for (const auto& slot : _slots) {
+        if (slot->state.load() == Resident) {
+            stats.resident++;
+        }
+    }
+    stats.resident_bytes = _resident_bytes.load();
+    stats.peak_bytes = _peak_bytes.load();
+    stats.load_us_max = _load_us_max.load();
+    return stats;
+}
+
+void SpriteResidency::resetCounters() {
+    _hits = 0;
+    _misses = 0;
+    _fallbacks = 0;
+    _blanks = 0;
+    _prefetches = 0;
+    _evictions = 0;
+    _loads = 0;
+    _load_failures = 0;
+    _denied = 0;
+    _denied_seen = 0;
+    _load_us_max = 0;
+    _peak_bytes = _resident_bytes.load();
+}
+
+// Empty → Queued にしてローダータスクへ送る（同期モードでは Loading にするだけ）
+bool SpriteResidency::request(Slot& slot, int id) {
+    uint8_t expected = Empty;
+    if (!_async) {
+        return slot.state.compare_exchange_strong(expected, Loading);
+    }
+    if (!slot.state.compare_exchange_strong(expected, Queued)) {
+        return false;
+    }
+    if (xQueueSend(_queue, &id, 0) != pdPASS) {
+        slot.state.store(Empty);  // キューが一杯なら次の要求で再度依頼する
+        return false;
+    }
+    return true;
+}
+
+size_t SpriteResidency::loadBytes(const Slot& slot) const {
+    // Indexed 形式は常駐する大きさが符号化した大きさとほぼ同じ（違いは settle() で直す）。
+    // キャンバスを経由するならキャンバスの分
+    if (sprite_format == SpriteFormat::Indexed && asset_archive.palette(*slot.entry)) {
+        return (size_t)slot.entry->size + slot.entry->alpha_size;
+    }
+    return (size_t)slot.width * slot.height * 2;
+}
+
+// slot は Loading 状態で呼ぶ
+bool SpriteResidency::load(Slot& slot) {
+    uint32_t t0 = micros();
+    const SpritePalette* palette =
+        sprite_format == SpriteFormat::Indexed ? asset_archive.palette(*slot.entry) : nullptr;
+    size_t reserved = loadBytes(slot);
+    if (!memory_budget.reserve(MemoryOwner::FishSprites, reserved)) {
+        _denied++;
+        memory_budget.noteDegraded(MemoryCategory::Sprites);  // 代わりのスプライトで描く
+        slot.state.store(Denied, std::memory_order_release);  // 空きができたら読み込み直す
+        return false;
+    }
+    if (palette) {
+        // パレットの番号のまま読み込む（キャンバスを経由しない）
+        xSemaphoreTake(_load_lock, portMAX_DELAY);
+        bool read = asset_archive.loadIndices(*slot.entry, _indices.data(), slot.width, slot.height);
+        bool ok = read && buildIndexedFishSprite(slot.sprite, _indices.data(), slot.width, slot.height, palette);
+        xSemaphoreGive(_load_lock);
+        if (!read) {
+            M5_LOGE("Failed to load fish image: %s", slot.entry->name);
+        }
+        return finishLoad(slot, ok, t0, reserved, read && !ok);
+    }
+    M5Canvas* canvas = &slot.sprite.canvas;
+    canvas->setPsram(true);  // PSRAMを使用
+    canvas->setColorDepth(16);
+    canvas->createSprite(slot.width, slot.height);
+    if (canvas->width() <= 0 || canvas->height() <= 0) {
+        M5_LOGE("Failed to create sprite for: %s (Free PSRAM: %d)",
+                slot.entry->name, ESP.getFreePsram());
+        return finishLoad(slot, false, t0, reserved, true);
+    }
+    canvas->fillSprite(TFT_BLACK);
+    // アルファの展開先は共有なので、変換が終わるまでロックしておく
+    uint8_t* alpha = _alpha.empty() ? nullptr : _alpha.data();
+    xSemaphoreTake(_load_lock, portMAX_DELAY);
+    bool ok = asset_archive.load(*slot.entry, canvas, alpha);
+    if (ok) {
+        ok = finishFishSprite(slot.sprite, alpha);
+    } else {
+        M5_LOGE("Failed to load fish image: %s", slot.entry->name);
+    }
+    xSemaphoreGive(_load_lock);
+    return finishLoad(slot, ok, t0, reserved);
+}
+
+bool SpriteResidency::finishLoad(Slot& slot, bool ok, uint32_t t0, size_t reserved, bool out_of_memory) {
+    if (!ok) {
+        slot.sprite.release();
+        if (out_of_memory) {
+            memory_budget.fail(MemoryOwner::FishSprites, reserved);
+            _denied++;
+            memory_budget.noteDegraded(MemoryCategory::Sprites);
+            slot.state.store(Denied, std::memory_order_release);
+        } else {
+            memory_budget.release(MemoryOwner::FishSprites, reserved);
+            _load_failures++;
+            slot.state.store(Failed, std::memory_order_release);
+        }
+        return false;
+    }
+    slot.bytes = slot.sprite.bytes();
+    memory_budget.settle(MemoryOwner::FishSprites, reserved, slot.bytes);
+    updateMax(_load_estimate, slot.bytes);
+    updateMax(_peak_bytes, _resident_bytes += slot.bytes);
+    updateMax(_load_us_max, micros() - t0);
+    _loads++;
+    slot.state.store(Resident, std::memory_order_release);
+    return true;
+}
+
+void SpriteResidency::evict(Slot& slot) {
+    slot.sprite.release();
+    memory_budget.release(MemoryOwner::FishSprites, slot.bytes);
+    _resident_bytes -= slot.bytes;
+    slot.bytes = 0;
+    _evictions++;
+    slot.state.store(Empty, std::memory_order_release);
+}
+
+void SpriteResidency::loaderTask(void* arg) {
+    SpriteResidency* self = (SpriteResidency*)arg;
+    for (;;) {
+        int id;
+        if (xQueueReceive(self->_queue, &id, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+        Slot& slot = *self->_slots[id];
+        uint8_t expected = Queued;
+        if (slot.state.compare_exchange_strong(expected, Loading)) {
+            self->load(slot);
+        }
+    }
+}
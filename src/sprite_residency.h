@@ -0,0 +1,136 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "asset_archive.h"
+#include "fish_sprite.h"
+#include "memory_budget.h"
+
+// 魚スプライトを必要になったときに読み込み、予算の範囲で保持する
+//
+// 画像ごとに add() で id を割り当て、描画時は acquire(id) で取得する。
+// 常駐していなければバックグラウンドのローダータスクに読み込みを依頼し、
+// 代わりに常駐している候補（隣のフレームなど）を返す。
+// 予算を超えた分は、固定したものと直近 2 フレームで使ったもの以外から古い順に解放する。
+// 解放はメインループ側の beginFrame() だけで行うので、acquire() の戻り値はそのフレーム中有効。
+// 読み込むときは memory_budget の Sprites に常駐する大きさの見積もり（Indexed 形式はアーカイブの
+// 符号化した大きさ。展開先の _indices は SpriteLoad に計上済み）を計上する。断られたら読み込まずに
+// 待ちにして（代わりのスプライトで描き、Sprites を軽くしたと数える）、空きができるまで依頼し直さない。
+// 次の beginFrame() で 1 枚分の空きができるまで古いものを解放し、解放できるものが無ければ
+// starved() を立てる（呼び出し側が右向きの画像をやめるなどして空ける）。
+class SpriteResidency {
+public:
+    struct Stats {
+        uint32_t hits;
+        uint32_t misses;         // 要求時に常駐していなかった数
+        uint32_t fallbacks;      // ミスのうち代わりのスプライトを返した数
+        uint32_t blanks;         // ミスのうち代わりも無かった数
+        uint32_t prefetches;     // 先読みを依頼した数
+        uint32_t loads;          // 読み込んだ数
+        uint32_t load_failures;
+        uint32_t denied;         // memory_budget の予算か PSRAM が足りず読み込めなかった数
+        uint32_t evictions;
+        uint32_t resident;       // 常駐している数
+        size_t resident_bytes;
+        size_t peak_bytes;       // resident_bytes の最大値
+        uint32_t load_us_max;    // 1 枚の読み込みにかかった最大時間
+    };
+
+    // budget_bytes: 常駐させる最大バイト数（0 で無制限）
+    // async: true ならローダータスクを起動する。false なら acquire() の中で読み込む
+    bool begin(size_t budget_bytes, bool async);
+
+    // 画像を登録して id を返す（読み込みはしない。acquire() などを呼ぶ前に全て登録する）
+    int add(const AssetEntry* entry, int width, int height);
+    int count() const { return (int)_slots.size(); }
+
+    // 読み込んで解放されないようにする（起動時に同期的に読み込む）
+    bool pin(int id);
+
+    // フレームの開始時に呼ぶ（予算を超えた分を解放する）
+    void beginFrame();
+    // 直前の beginFrame() で、memory_budget に断られた分の空きを作れなかったか
+    bool starved() const { return _starved; }
+    // id の画像を今すぐ解放し、固定も外す（もう使わない画像。メインループ側でフレームの間に呼ぶ）
+    void release(int id);
+
+    // id のスプライトを返す。常駐していなければ読み込みを依頼し、
+    // fallbacks のうち最初に常駐しているものを返す（どれも無ければ nullptr）
+    FishSprite* acquire(int id, const int* fallbacks = nullptr, int num_fallbacks = 0);
+
+    // 読み込みを依頼する（常駐していれば何もしない）
+    void prefetch(int id);
+
+    // 常駐するまで待ってから返す（ベンチマークなど）
+    FishSprite* loadNow(int id);
+    bool resident(int id) const;
+    // id の画像の置き場所（常駐しているとは限らない。acquire() が返したものとの照合用）
+    const FishSprite* sprite(int id) const { return &_slots[id]->sprite; }
+
+    // 依頼済みの読み込みが全て終わるまで待つ（ベンチマークの終了時など）
+    void waitIdle();
+
+    Stats stats() const;
+    void resetCounters();
+
+private:
+    // Denied: memory_budget に断られた（beginFrame() で収まるようになったら Empty に戻す）
+    enum State : uint8_t { Empty, Queued, Loading, Resident, Failed, Denied };
+
+    struct Slot {
+        const AssetEntry* entry = nullptr;
+        int width = 0;
+        int height = 0;
+        FishSprite sprite;
+        std::atomic<uint8_t> state{Empty};
+        bool pinned = false;
+        uint32_t last_frame = 0;
+        size_t bytes = 0;
+    };
+
+    static void loaderTask(void* arg);
+    bool request(Slot& slot, int id);
+    // 読み込むときに memory_budget に計上する見積もり
+    size_t loadBytes(const Slot& slot) const;
+    bool load(Slot& slot);
+    // 読み込みの結果を反映する（reserved は memory_budget に計上した見積もり。
+    // out_of_memory なら Failed にせず Denied にし、空きができたら読み込み直す）
+    bool finishLoad(Slot& slot, bool ok, uint32_t t0, size_t reserved, bool out_of_memory = false);
+    void evict(Slot& slot);
+
+    std::vector<std::unique_ptr<Slot>> _slots;
+    size_t _budget = 0;
+    bool _async = false;
+    uint32_t _frame = 0;
+    QueueHandle_t _queue = nullptr;
+    SemaphoreHandle_t _load_lock = nullptr;  // asset_archive を同時に読まないため
+    std::vector<uint8_t> _alpha;  // 読み込み時のアルファの展開先（_load_lock 中だけ使う）
+    std::vector<uint8_t> _indices;  // Indexed 形式のパレットの番号の展開先（同上）
+    size_t _load_bytes = 0;  // _alpha と _indices の分として memory_budget に計上したバイト数
+    TaskHandle_t _task = nullptr;
+
+    // メインループ側でだけ更新する
+    uint32_t _hits = 0;
+    uint32_t _misses = 0;
+    uint32_t _fallbacks = 0;
+    uint32_t _blanks = 0;
+    uint32_t _prefetches = 0;
+    uint32_t _evictions = 0;
+    uint32_t _denied_seen = 0;  // 前の beginFrame() までに見た _denied
+    bool _starved = false;
+    // ローダータスクからも更新する
+    std::atomic<uint32_t> _loads{0};
+    std::atomic<uint32_t> _load_failures{0};
+    std::atomic<uint32_t> _denied{0};
+    std::atomic<size_t> _load_estimate{0};  // 1 枚を読み込むときに計上する見積もりの最大（読み込んだ最大の大きさ）
+    std::atomic<uint32_t> _load_us_max{0};
+    std::atomic<size_t> _resident_bytes{0};
+    std::atomic<size_t> _peak_bytes{0};
+};
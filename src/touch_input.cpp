@@ -0,0 +1,85 @@
+#include "touch_input.h"
+
+namespace {
+
+const uint32_t SAMPLE_STACK_SIZE = 3072;
+const UBaseType_t SAMPLE_PRIORITY = 3;  // 転送タスクより高く（読み取りは短く、遅れると間隔が揺れる）
+const BaseType_t SAMPLE_CORE = 0;       // loop() は core 1 で動く
+
+}  // namespace
+
+bool TouchInput::begin(bool threaded) {
+    if (threaded && !_task &&
+        xTaskCreatePinnedToCore(sampleTask, "touch_input", SAMPLE_STACK_SIZE, this, SAMPLE_PRIORITY,
+                                &_task, SAMPLE_CORE) != pdPASS) {
+        M5_LOGE("Failed to start touch input task, reading touch from loop()");
+        _task = nullptr;
+    }
+    M5_LOGI("Touch input: %s", _task ? "sampled on core 0" : "read in loop()");
+    return true;
+}
+
+void TouchInput::poll() {
+    TouchSample sample = {false, 0, 0};
+    if (M5.Touch.getCount() > 0) {
+        auto touch = M5.Touch.getDetail();
+        sample.pressed = touch.isPressed();
+        sample.x = touch.x;
+        sample.y = touch.y;
+    }
+    _samples.fetch_add(1, std::memory_order_relaxed);
+    bool changed = sample.pressed != _last.pressed ||
+                   (sample.pressed && (sample.x != _last.x || sample.y != _last.y));
+    if (!changed) {
+        return;
+    }
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= (uint32_t)CAPACITY) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    TouchEvent& event = _queue[head % CAPACITY];
+    event.time_ms = millis();
+    event.time_us = micros();
+    event.sample = sample;
+    _head.store(head + 1, std::memory_order_release);
+    _last = sample;
+    _events.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool TouchInput::pop(uint32_t until_ms, TouchEvent* event) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    const TouchEvent& next = _queue[tail % CAPACITY];
+    if ((int32_t)(next.time_ms - until_ms) > 0) {
+        return false;
+    }
+    *event = next;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+TouchInput::Stats TouchInput::stats() const {
+    Stats stats = {};
+    stats.samples = _samples.load();
+    stats.events = _events.load();
+    stats.dropped = _dropped.load();
+    return stats;
+}
+
+void TouchInput::resetStats() {
+    _samples = 0;
+    _events = 0;
+    _dropped = 0;
+}
+
+void TouchInput::sampleTask(void* arg) {
+    TouchInput* self = (TouchInput*)arg;
+    for (;;) {
+        M5.Touch.update(millis());
+        self->poll();
+        vTaskDelay(pdMS_TO_TICKS(SAMPLE_MS));
+    }
+}
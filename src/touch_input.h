@@ -0,0 +1,62 @@
+#pragma once
+
+#include <M5Unified.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+
+#include "session_log.h"
+
+// タッチの変化 1 回分（押した・動かした・離した）
+struct TouchEvent {
+    uint32_t time_ms;  // 読み取った時刻（millis。シミュレーションのステップに振り分ける）
+    uint32_t time_us;  // 読み取った時刻（micros。画面に出るまでの遅延の計測用）
+    TouchSample sample;
+};
+
+// タッチパネルを loop() とは別のタスクで一定間隔で読み、変化を時刻付きでキューに積む
+//
+// 読み取りタスク（core 0）が SAMPLE_MS ごとに M5.Touch を更新し、状態が変わったときだけ
+// イベントを積む。キューは読み取りタスクが書いて loop() が読む 1 対 1 のリングバッファで、
+// head と tail の atomic だけで受け渡す（ロックしない）。一杯なら積まずに数え、次の読み取りで
+// 積み直す（離したイベントを落として押したままにならないよう、最後に積んだ状態と比べる）。
+// loop() はシミュレーションの各ステップの先頭で、そのステップの終わりまでに起きたイベントを
+// 取り出す。描画が遅いフレームでも入力がフレームの境目まで遅れず、短いタップも落とさない。
+// threaded = false なら loop() が M5.update() の後で poll() を呼ぶ（ベンチマークの再現性のため）。
+class TouchInput {
+public:
+    static const int CAPACITY = 64;  // 2 のべき乗
+    static const uint32_t SAMPLE_MS = 5;  // 読み取りタスクの間隔（200Hz）
+
+    struct Stats {
+        uint32_t samples;  // 読み取った回数
+        uint32_t events;   // 積んだイベント数
+        uint32_t dropped;  // キューが一杯で積めなかった回数
+    };
+
+    // threaded なら読み取りタスクを起動する（失敗したら loop() から読む）
+    bool begin(bool threaded);
+    bool threaded() const { return _task != nullptr; }
+
+    // M5.Touch の今の状態を読み、変わっていればキューに積む（読み取りタスクか loop() から呼ぶ）
+    void poll();
+    // time_ms が until_ms までのイベントを古い順に 1 つ取り出す（無ければ false。loop() から呼ぶ）
+    bool pop(uint32_t until_ms, TouchEvent* event);
+
+    Stats stats() const;
+    void resetStats();
+
+private:
+    static void sampleTask(void* arg);
+
+    TouchEvent _queue[CAPACITY];
+    std::atomic<uint32_t> _head{0};  // 次に書く位置（読み取り側だけが進める）
+    std::atomic<uint32_t> _tail{0};  // 次に読む位置（loop() だけが進める）
+    TouchSample _last = {false, 0, 0};  // 最後に積んだ状態（読み取り側でだけ使う）
+    TaskHandle_t _task = nullptr;
+
+    // 読み取り側から更新する
+    std::atomic<uint32_t> _samples{0};
+    std::atomic<uint32_t> _events{0};
+    std::atomic<uint32_t> _dropped{0};
+};
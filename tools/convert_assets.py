@@ -0,0 +1,630 @@
+#!/usr/bin/env python3
+"""data/images/manifest.txt に並べた画像を 1 つのアーカイブ data/assets.pak にまとめる.
+
+PlatformIO の extra_scripts としても、単体のコマンドとしても使える.
+
+    python3 tools/convert_assets.py [--data data] [--encoding qoi|raw] [--no-palette]
+                                    [--palette-colors 256] [--force]
+
+manifest.txt は 1 行に「名前  画像ファイル（images/ からの相対パス）」を書く.
+'#' 以降はコメント.
+
+assets.pak の形式（リトルエンディアン）:
+
+    0  char[4] magic "AQPK"
+    4  u16     version (1)
+    6  u16     entry count
+    8  u32     data offset
+    12 u32     total bytes
+    16 entry[count]（64 バイトずつ）
+         0  char[44] name（NUL 終端）
+         44 u32      offset（アーカイブ先頭から、4 バイト境界）
+         48 u32      size
+         52 u16      width
+         54 u16      height
+         56 u8       encoding (0=raw, 1=qoi565, 2=index8, 3=palette)
+         57 u8       flags (bit0: TFT_BLACK を透過色として使う, bit1: アルファ面あり)
+         58 u16      palette（index8 の画像が使うパレットの目次番号、それ以外は 0）
+         60 u32      alpha size（アルファ面のバイト数、無ければ 0）
+    data offset 以降に各画像のデータ（アルファ面は色のデータの直後）
+
+raw はスプライトメモリと同じバイト順（ビッグエンディアン）の RGB565 を並べたもの.
+qoi565 は QOI を RGB565 向けにしたもので、src/asset_archive.cpp がデコードする.
+アルファ付きの PNG は実機の drawPng と同じく黒の上に合成する（= 乗算済みの色）.
+透明なピクセルがあればアルファ面も付ける. アルファ面は 1 バイトに
+(4 ビットのアルファ << 4 | 続く数 - 1) を並べたランレングス（左上から行順）.
+
+PALETTE_GROUPS の画像（魚のスプライト）は共有パレットで 8 ビットのインデックスにする（index8）.
+パレットはまとめた画像の (乗算済みの RGB565, 4 ビットのアルファ) をメディアンカットで分け、
+k-means で整えたもの. 0 番は透明に予約する. パレットは "palette/<グループ名>" という
+目次の末尾の項目で、width 個の (u16 RGB565（乗算済み、リトルエンディアン）, u8 アルファ) を並べる.
+index8 は PackBits（n < 128: 続く n + 1 バイトをそのまま, n >= 128: 次の 1 バイトを
+n - 126 回）で、アルファはパレットから決まるのでアルファ面は付けない.
+変換時に PNG（黒の上に合成した 8 ビットの色）に対する PSNR を 16 ビットの場合と並べて表示する.
+
+実機では assets パーティションに書き込めばメモリマップして読む（uploadassets ターゲット）.
+書き込んでいない場合は LittleFS 上の /assets.pak を読む.
+"""
+
+import argparse
+import math
+import os
+import struct
+import sys
+import zlib
+
+PACK_MAGIC = b"AQPK"
+PACK_VERSION = 1
+HEADER_SIZE = 16
+ENTRY_SIZE = 64
+NAME_SIZE = 44
+ENCODING_RAW = 0
+ENCODING_QOI565 = 1
+ENCODING_INDEX8 = 2
+ENCODING_PALETTE = 3
+FLAG_COLOR_KEY = 1
+FLAG_ALPHA = 2
+
+# 共有パレットでインデックス化する画像（グループ名, 名前の接頭辞）
+PALETTE_GROUPS = (
+    ("fish", ("swim_left/", "swim_right/", "turn/")),
+)
+PALETTE_COLORS = 256  # 透明の 0 番を含む
+KMEANS_ITERATIONS = 2
+PACKBITS_MAX = 128
+
+OP_INDEX = 0x00
+OP_DIFF = 0x40
+OP_LUMA = 0x80
+OP_RUN = 0xC0
+OP_RGB565 = 0xFE
+OP_RUN_LONG = 0xFF
+MAX_SHORT_RUN = 62
+
+
+def read_png(path):
+    """8bit・非インターレースの RGB / RGBA / パレット PNG を (width, height, channels, bytes) で返す.
+
+    パレット形式は RGB（tRNS があれば RGBA）に展開する.
+    """
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != b"\x89PNG\r\n\x1a\n":
+        raise ValueError("%s: not a PNG file" % path)
+    pos = 8
+    idat = []
+    width = height = channels = None
+    color = None
+    palette = None
+    trns = None
+    while pos < len(data):
+        length, ctype = struct.unpack(">I4s", data[pos:pos + 8])
+        chunk = data[pos + 8:pos + 8 + length]
+        pos += 12 + length
+        if ctype == b"IHDR":
+            width, height, depth, color, _, _, interlace = struct.unpack(">IIBBBBB", chunk)
+            if depth != 8 or interlace != 0 or color not in (2, 3, 6):
+                raise ValueError("%s: unsupported PNG (depth=%d color=%d interlace=%d)"
+                                 % (path, depth, color, interlace))
+            channels = {2: 3, 3: 1, 6: 4}[color]
+        elif ctype == b"PLTE":
+            palette = chunk
+        elif ctype == b"tRNS":
+            trns = chunk
+        elif ctype == b"IDAT":
+            idat.append(chunk)
+        elif ctype == b"IEND":
+            break
+    raw = zlib.decompress(b"".join(idat))
+    stride = width * channels
+    out = bytearray(stride * height)
+    prev = bytearray(stride)
+    src = 0
+    for y in range(height):
+        ftype = raw[src]
+        line = bytearray(raw[src + 1:src + 1 + stride])
+        src += 1 + stride
+        if ftype == 1:
+            for i in range(channels, stride):
+                line[i] = (line[i] + line[i - channels]) & 0xFF
+        elif ftype == 2:
+            for i in range(stride):
+                line[i] = (line[i] + prev[i]) & 0xFF
+        elif ftype == 3:
+            for i in range(stride):
+                left = line[i - channels] if i >= channels else 0
+                line[i] = (line[i] + ((left + prev[i]) >> 1)) & 0xFF
+        elif ftype == 4:
+            for i in range(stride):
+                a = line[i - channels] if i >= channels else 0
+                b = prev[i]
+                c = prev[i - channels] if i >= channels else 0
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                if pa <= pb and pa <= pc:
+                    pred = a
+                elif pb <= pc:
+                    pred = b
+                else:
+                    pred = c
+                line[i] = (line[i] + pred) & 0xFF
+        elif ftype != 0:
+            raise ValueError("%s: bad filter type %d" % (path, ftype))
+        out[y * stride:(y + 1) * stride] = line
+        prev = line
+    if color == 3:
+        return expand_palette(width, height, out, palette, trns)
+    return width, height, channels, bytes(out)
+
+
+def expand_palette(width, height, indices, palette, trns):
+    entries = len(palette) // 3
+    if trns:
+        alpha = bytes(trns) + b"\xff" * (entries - len(trns))
+        table = [palette[i * 3:i * 3 + 3] + alpha[i:i + 1] for i in range(entries)]
+        channels = 4
+    else:
+        table = [palette[i * 3:i * 3 + 3] for i in range(entries)]
+        channels = 3
+    return width, height, channels, b"".join(table[i] for i in indices)
+
+
+def to_rgb565(width, height, channels, pixels):
+    """RGB565 の値のリストにする（アルファは黒の上に合成）."""
+    result = [0] * (width * height)
+    for i in range(width * height):
+        p = i * channels
+        r, g, b = pixels[p], pixels[p + 1], pixels[p + 2]
+        if channels == 4:
+            a = pixels[p + 3]
+            if a == 0:
+                continue
+            if a != 255:
+                r = r * a // 255
+                g = g * a // 255
+                b = b * a // 255
+        result[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)
+    return result
+
+
+def _hash(px):
+    return (((px >> 11) & 31) * 3 + ((px >> 5) & 63) * 5 + (px & 31) * 7) & 63
+
+
+def _wrap(v, bits):
+    half = 1 << (bits - 1)
+    return ((v + half) & ((1 << bits) - 1)) - half
+
+
+def encode_qoi565(pixels):
+    out = bytearray()
+    table = [0] * 64
+    prev = 0
+    run = 0
+
+    def flush_run():
+        if run == 0:
+            return
+        if run <= MAX_SHORT_RUN:
+            out.append(OP_RUN | (run - 1))
+        else:
+            out.append(OP_RUN_LONG)
+            out.extend(struct.pack("<H", run))
+
+    for px in pixels:
+        if px == prev:
+            run += 1
+            if run == 0xFFFF:
+                flush_run()
+                run = 0
+            continue
+        flush_run()
+        run = 0
+        index = _hash(px)
+        if table[index] == px:
+            out.append(OP_INDEX | index)
+        else:
+            table[index] = px
+            dr = _wrap(((px >> 11) & 31) - ((prev >> 11) & 31), 5)
+            dg = _wrap(((px >> 5) & 63) - ((prev >> 5) & 63), 6)
+            db = _wrap((px & 31) - (prev & 31), 5)
+            dr_dg = dr - (dg >> 1)
+            db_dg = db - (dg >> 1)
+            if -2 <= dr <= 1 and -2 <= dg <= 1 and -2 <= db <= 1:
+                out.append(OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2))
+            elif -8 <= dr_dg <= 7 and -8 <= db_dg <= 7:
+                out.append(OP_LUMA | (dg + 32))
+                out.append(((dr_dg + 8) << 4) | (db_dg + 8))
+            else:
+                out.append(OP_RGB565)
+                out.extend(struct.pack("<H", px))
+        prev = px
+    flush_run()
+    return bytes(out)
+
+
+def encode_alpha(width, height, pixels):
+    """4 ビットのアルファのランレングス（続く数は 1〜16）."""
+    out = bytearray()
+    prev = None
+    run = 0
+    for i in range(width * height):
+        a = (pixels[i * 4 + 3] * 15 + 127) // 255
+        if a == prev and run < 16:
+            run += 1
+            continue
+        if prev is not None:
+            out.append((prev << 4) | (run - 1))
+        prev = a
+        run = 1
+    if prev is not None:
+        out.append((prev << 4) | (run - 1))
+    return bytes(out)
+
+
+def encode_raw(pixels):
+    return struct.pack(">%dH" % len(pixels), *pixels)
+
+
+def palette_group(name):
+    for group, prefixes in PALETTE_GROUPS:
+        if name.startswith(prefixes):
+            return group
+    return None
+
+
+def expand565(px):
+    """RGB565 を 8 ビットずつの (r, g, b) にする."""
+    r, g, b = (px >> 11) & 31, (px >> 5) & 63, px & 31
+    return (r * 255 + 15) // 31, (g * 255 + 31) // 63, (b * 255 + 15) // 31
+
+
+def color_keys(width, height, channels, data, pixels):
+    """ピクセルごとの (4 ビットのアルファ << 16 | RGB565). 透明なピクセルは -1."""
+    keys = [-1] * (width * height)
+    has_alpha = image_flags(channels, data) & FLAG_ALPHA
+    for i in range(width * height):
+        a4 = (data[i * channels + 3] * 15 + 127) // 255 if has_alpha else 15
+        # アルファ面を付けない画像は黒が透過色（16 ビットで保存する場合と同じ）
+        if a4 == 0 or (not has_alpha and pixels[i] == 0):
+            continue
+        keys[i] = (a4 << 16) | pixels[i]
+    return keys
+
+
+def _key_vector(key):
+    r, g, b = expand565(key & 0xFFFF)
+    return (r, g, b, (key >> 16) * 17)
+
+
+def _nearest(vectors, v):
+    r, g, b, a = v
+    return min(range(len(vectors)), key=lambda j: (vectors[j][0] - r) ** 2 + (vectors[j][1] - g) ** 2
+               + (vectors[j][2] - b) ** 2 + (vectors[j][3] - a) ** 2)
+
+
+def _median_cut(items, count):
+    """(ベクトル, 出現数) の並びを count 個の箱に分ける（広がりと出現数の大きい箱から割る）."""
+    def spread(box):
+        return [max(v[c] for v, _ in box) - min(v[c] for v, _ in box) for c in range(4)]
+
+    def score(box):
+        return max(spread(box)) ** 2 * sum(n for _, n in box) if len(box) > 1 else -1
+
+    boxes = [list(items)]
+    scores = [score(boxes[0])]
+    while len(boxes) < count:
+        i = max(range(len(boxes)), key=lambda j: scores[j])
+        if scores[i] <= 0:
+            break
+        box = boxes[i]
+        widths = spread(box)
+        axis = widths.index(max(widths))
+        box.sort(key=lambda item: item[0][axis])
+        half = sum(n for _, n in box) / 2
+        seen = 0
+        cut = 1
+        for j, (_, n) in enumerate(box):
+            seen += n
+            if seen >= half:
+                cut = max(1, min(len(box) - 1, j + 1))
+                break
+        boxes[i:i + 1] = [box[:cut]]
+        boxes.append(box[cut:])
+        scores[i] = score(boxes[i])
+        scores.append(score(boxes[-1]))
+    return boxes
+
+
+def build_palette(histogram, colors):
+    """色の出現数から (パレット, 色 → インデックス) を作る. パレットの 0 番は透明."""
+    items = [(_key_vector(key), n) for key, n in histogram.items()]
+    if not items:
+        return [(0, 0)], {}
+    centers = []
+    for box in _median_cut(items, colors - 1):
+        total = sum(n for _, n in box)
+        centers.append(tuple(sum(v[c] * n for v, n in box) / total for c in range(4)))
+    for _ in range(KMEANS_ITERATIONS):
+        sums = [[0, 0, 0, 0, 0] for _ in centers]
+        for v, n in items:
+            s = sums[_nearest(centers, v)]
+            for c in range(4):
+                s[c] += v[c] * n
+            s[4] += n
+        centers = [tuple(s[c] / s[4] for c in range(4)) if s[4] else centers[j]
+                   for j, s in enumerate(sums)]
+    # RGB565 と 4 ビットのアルファに丸めてから、各色を一番近いものに割り当てる
+    palette = [(0, 0)]
+    for r, g, b, a in centers:
+        px = ((int(r * 31 / 255 + 0.5) << 11) | (int(g * 63 / 255 + 0.5) << 5)
+              | int(b * 31 / 255 + 0.5))
+        palette.append((px, max(1, min(15, int(a / 17 + 0.5))) * 17))
+    vectors = [expand565(px) + (a,) for px, a in palette[1:]]
+    mapping = {key: _nearest(vectors, v) + 1 for key, (v, _) in zip(histogram, items)}
+    return palette, mapping
+
+
+def encode_packbits(indices):
+    out = bytearray()
+    i = 0
+    n = len(indices)
+    while i < n:
+        run = 1
+        while i + run < n and run < PACKBITS_MAX + 1 and indices[i + run] == indices[i]:
+            run += 1
+        if run >= 2:
+            out.append(run + 126)
+            out.append(indices[i])
+            i += run
+            continue
+        # 2 つ以上続く値の手前までをそのまま並べる
+        start = i
+        i += 1
+        while (i < n and i - start < PACKBITS_MAX
+               and not (i + 1 < n and indices[i + 1] == indices[i])):
+            i += 1
+        out.append(i - start - 1)
+        out.extend(indices[start:i])
+    return bytes(out)
+
+
+def psnr(sse, count):
+    if count == 0 or sse == 0:
+        return float("inf")
+    return 10 * math.log10(255 * 255 * count / sse)
+
+
+def over_black(width, height, channels, data):
+    """PNG を黒の上に合成した 8 ビットの (r, g, b) の並び（PSNR の基準）."""
+    result = [0] * (width * height * 3)
+    for i in range(width * height):
+        p = i * channels
+        a = data[p + 3] if channels == 4 else 255
+        for c in range(3):
+            result[i * 3 + c] = data[p + c] * a // 255
+    return result
+
+
+def _sse(reference, colors):
+    total = 0
+    for i, rgb in enumerate(colors):
+        for c in range(3):
+            d = reference[i * 3 + c] - rgb[c]
+            total += d * d
+    return total
+
+
+def read_manifest(path):
+    entries = []
+    with open(path, encoding="utf-8") as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            fields = line.split()
+            if len(fields) != 2:
+                raise ValueError("%s:%d: expected '<name> <file>'" % (path, lineno))
+            name, image = fields
+            if len(name.encode("utf-8")) >= NAME_SIZE:
+                raise ValueError("%s:%d: name too long: %s" % (path, lineno, name))
+            entries.append((name, image))
+    return entries
+
+
+def image_flags(channels, data):
+    flags = FLAG_COLOR_KEY if channels == 4 else 0
+    # 透明な部分が無い画像（黒い背景の泳ぎフレームなど）は透過色だけで扱う
+    if channels == 4 and any(data[i] == 0 for i in range(3, len(data), 4)):
+        flags |= FLAG_ALPHA
+    return flags
+
+
+def encode_image(png_path, encoding):
+    width, height, channels, data = read_png(png_path)
+    pixels = to_rgb565(width, height, channels, data)
+    if encoding == ENCODING_QOI565:
+        payload = encode_qoi565(pixels)
+    else:
+        payload = encode_raw(pixels)
+    flags = image_flags(channels, data)
+    alpha = encode_alpha(width, height, data) if flags & FLAG_ALPHA else b""
+    return width, height, flags, payload, alpha
+
+
+def is_up_to_date(pak_path, sources, encoding, count):
+    if not os.path.exists(pak_path):
+        return False
+    mtime = os.path.getmtime(pak_path)
+    if any(os.path.getmtime(src) > mtime for src in sources):
+        return False
+    with open(pak_path, "rb") as f:
+        header = f.read(HEADER_SIZE + ENTRY_SIZE)
+    return (len(header) == HEADER_SIZE + ENTRY_SIZE and header[:4] == PACK_MAGIC
+            and struct.unpack("<H", header[6:8])[0] == count
+            and header[HEADER_SIZE + 56] == encoding)
+
+
+class PaletteGroup:
+    """共有パレットでインデックス化する画像のまとまり."""
+
+    def __init__(self, name, entry_index):
+        self.name = name
+        self.entry_index = entry_index  # パレットの目次番号
+        self.images = {}  # 名前 → (read_png の結果, RGB565, color_keys)
+        self.palette = None
+        self.mapping = None
+        self.sse16 = 0  # PNG（黒の上に合成）との差の二乗和
+        self.sse8 = 0
+        self.samples = 0
+
+    def load(self, name, png_path):
+        png = read_png(png_path)
+        pixels = to_rgb565(*png)
+        self.images[name] = (png, pixels, color_keys(*png, pixels))
+
+    def quantize(self, colors):
+        histogram = {}
+        for _, _, keys in self.images.values():
+            for key in keys:
+                if key >= 0:
+                    histogram[key] = histogram.get(key, 0) + 1
+        self.palette, self.mapping = build_palette(histogram, colors)
+
+    def encode(self, name):
+        (width, height, channels, data), pixels, keys = self.images[name]
+        indices = bytes(0 if key < 0 else self.mapping[key] for key in keys)
+        reference = over_black(width, height, channels, data)
+        self.sse16 += _sse(reference, [expand565(px) for px in pixels])
+        self.sse8 += _sse(reference, [expand565(self.palette[i][0]) for i in indices])
+        self.samples += width * height * 3
+        return width, height, image_flags(channels, data), encode_packbits(indices)
+
+    def payload(self):
+        return b"".join(struct.pack("<HB", px, a) for px, a in self.palette)
+
+
+def pack(data_dir, encoding=ENCODING_QOI565, force=False, log=print,
+         palette_colors=PALETTE_COLORS):
+    """palette_colors が 0 なら共有パレットを使わない（全て encoding で保存する）."""
+    images_dir = os.path.join(data_dir, "images")
+    manifest_path = os.path.join(images_dir, "manifest.txt")
+    pak_path = os.path.join(data_dir, "assets.pak")
+    manifest = read_manifest(manifest_path)
+    sources = [manifest_path, os.path.abspath(__file__)]
+    sources += [os.path.join(images_dir, image) for _, image in manifest]
+    used = {palette_group(name) for name, _ in manifest} if palette_colors else set()
+    groups = {}
+    for group, _ in PALETTE_GROUPS:
+        if group in used:
+            groups[group] = PaletteGroup(group, len(manifest) + len(groups))
+    count = len(manifest) + len(groups)
+    if not force and is_up_to_date(pak_path, sources, encoding, count):
+        return
+
+    # パレットはグループの全ての画像から作るので、先に読んでおく
+    for name, image in manifest:
+        group = groups.get(palette_group(name))
+        if group:
+            group.load(name, os.path.join(images_dir, image))
+    for group in groups.values():
+        group.quantize(palette_colors)
+
+    data_offset = HEADER_SIZE + ENTRY_SIZE * count
+    table = bytearray()
+    blobs = bytearray()
+    total_png = 0
+
+    def add(name, payload, width, height, entry_encoding, flags, palette, alpha):
+        nonlocal blobs
+        offset = data_offset + len(blobs)
+        table.extend(struct.pack("<%dsIIHHBBHI" % NAME_SIZE, name.encode("utf-8"), offset,
+                                 len(payload), width, height, entry_encoding, flags, palette,
+                                 len(alpha)))
+        blobs += payload
+        blobs += alpha
+        blobs += b"\0" * (-len(blobs) % 4)
+
+    for name, image in manifest:
+        png_path = os.path.join(images_dir, image)
+        total_png += os.path.getsize(png_path)
+        group = groups.get(palette_group(name))
+        if group:
+            width, height, flags, payload = group.encode(name)
+            add(name, payload, width, height, ENCODING_INDEX8, flags, group.entry_index, b"")
+        else:
+            width, height, flags, payload, alpha = encode_image(png_path, encoding)
+            add(name, payload, width, height, encoding, flags, 0, alpha)
+    for group in groups.values():
+        add("palette/" + group.name, group.payload(), len(group.palette), 1, ENCODING_PALETTE,
+            0, 0, b"")
+    total = data_offset + len(blobs)
+    header = PACK_MAGIC + struct.pack("<HHII", PACK_VERSION, count, data_offset, total)
+
+    tmp_path = pak_path + ".tmp"
+    with open(tmp_path, "wb") as f:
+        f.write(header)
+        f.write(table)
+        f.write(blobs)
+    os.replace(tmp_path, pak_path)
+    log("convert_assets: %d images, png %d bytes -> %s %d bytes"
+        % (len(manifest), total_png, pak_path, total))
+    for group in groups.values():
+        log("convert_assets: palette/%s %d colours for %d images, PSNR vs PNG 16-bit %.1f dB, "
+            "index8 %.1f dB" % (group.name, len(group.palette), len(group.images),
+                                psnr(group.sse16, group.samples), psnr(group.sse8, group.samples)))
+
+
+def partition_offset(csv_path, label):
+    with open(csv_path) as f:
+        for line in f:
+            fields = [v.strip() for v in line.split("#", 1)[0].split(",")]
+            if len(fields) >= 5 and fields[0] == label:
+                return fields[3]
+    return None
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--data", default="data")
+    parser.add_argument("--encoding", choices=("qoi", "raw"), default="qoi")
+    parser.add_argument("--no-palette", action="store_true",
+                        help="魚のスプライトもインデックス化せずに保存する")
+    parser.add_argument("--palette-colors", type=int, default=PALETTE_COLORS,
+                        help="共有パレットの色数（透明の 0 番を含む、2〜256）")
+    parser.add_argument("--force", action="store_true")
+    args = parser.parse_args(argv)
+    if not 2 <= args.palette_colors <= 256:
+        parser.error("--palette-colors must be 2..256")
+    encoding = ENCODING_QOI565 if args.encoding == "qoi" else ENCODING_RAW
+    pack(args.data, encoding, args.force,
+         palette_colors=0 if args.no_palette else args.palette_colors)
+    return 0
+
+
+try:
+    Import("env")  # noqa: F821  PlatformIO から読み込まれた場合
+except NameError:
+    env = None
+
+if env is not None:
+    # buildfs / uploadfs とネイティブビルドの前にまとめ直す（画像が更新された場合だけ）
+    targets = COMMAND_LINE_TARGETS  # noqa: F821
+    data_dir = env.subst("$PROJECT_DATA_DIR")
+    if (env["PIOPLATFORM"] == "native" or "buildfs" in targets or "uploadfs" in targets
+            or "uploadassets" in targets):
+        pack(data_dir)
+    if env["PIOPLATFORM"] != "native":
+        # assets パーティションへの書き込み（pio run -t uploadassets）
+        offset = partition_offset(env.subst("$PROJECT_DIR/partitions.csv"), "assets")
+        if offset:
+            env.AddCustomTarget(
+                name="uploadassets",
+                dependencies=None,
+                actions=['"$PYTHONEXE" "$UPLOADER" --chip $BOARD_MCU --port "$UPLOAD_PORT" '
+                         '--baud $UPLOAD_SPEED write_flash %s "%s"'
+                         % (offset, os.path.join(data_dir, "assets.pak"))],
+                title="Upload assets",
+                description="data/assets.pak を assets パーティションに書き込む")
+elif __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
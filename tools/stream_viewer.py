@@ -0,0 +1,280 @@
+#!/usr/bin/env python3
+"""src/frame_stream.h の差分ストリームを読み、画面を組み立て直して PNG / PPM に書き出す.
+
+実機の USB CDC のシリアル、ネイティブビルドの --stream で書いたファイルや pty を読める.
+
+    python3 tools/stream_viewer.py /dev/ttyACM0 --out screen.png --every 30
+    .pio/build/native/program --frames 600 --stream /tmp/aquarium.aqs
+    python3 tools/stream_viewer.py /tmp/aquarium.aqs --out screen.ppm
+
+pty で動かしたまま見る場合（socat が作った 2 つの端の片方に書き、もう片方を読む）:
+
+    socat -d -d pty,raw,echo=0 pty,raw,echo=0
+    .pio/build/native/program --frames 3600 --stream /dev/pts/N &
+    python3 tools/stream_viewer.py /dev/pts/M --out screen.png --every 60
+
+パケットの形式（リトルエンディアン）:
+
+    0  char[2] 'A' 'Q'
+    2  u8      種類（1=矩形, 2=フレームの終わり）
+    3  u8      フラグ（矩形: bit0 半分の解像度）
+    4  u16     内容のバイト数
+    6  内容
+    末尾 u32   Adler-32（種類から内容の終わりまで）
+
+矩形の内容は x, y, w, h（u16）と h 行分の PackBits（n < 128: 続く n + 1 ピクセルを
+そのまま, n >= 128: 次の 1 ピクセルを n - 126 回）. ピクセルはビッグエンディアンの RGB565.
+半分の解像度なら w / 2 x h / 2 のピクセルで、縦横 2 倍に広げて置く.
+フレームの終わりは frame(u32) time_ms(u32) width(u16) height(u16) rects(u16) dropped(u16).
+矩形はフレームの終わりが届いたときにまとめて画面に置く（画面の大きさもそこでわかる）.
+ログなどが混ざっていても、見出しと検査値が合う所まで 1 バイトずつ読み飛ばす.
+端末（シリアルや pty）を開いたら 'k' を送り、次のフレームで画面全体を送ってもらう.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"AQ"
+HEADER_SIZE = 6
+CHECK_SIZE = 4
+PACKET_RECT = 1
+PACKET_FRAME = 2
+FLAG_HALF = 1
+READ_SIZE = 65536
+RGB_TABLE = None  # RGB565 から 8 ビットの RGB への表（最初に書き出すときに作る）
+
+
+def unpack_row(data, pos, width):
+    """PackBits の 1 行（width ピクセル）を展開して (bytes, 次の位置) を返す."""
+    out = []
+    count = 0
+    while count < width:
+        n = data[pos]
+        pos += 1
+        if n < 128:
+            size = (n + 1) * 2
+            out.append(data[pos:pos + size])
+            pos += size
+            count += n + 1
+        else:
+            out.append(data[pos:pos + 2] * (n - 126))
+            pos += 2
+            count += n - 126
+    if count != width:
+        raise ValueError("row overruns width")
+    return b"".join(out), pos
+
+
+def double_row(row):
+    """半分の解像度の行の各ピクセルを横に 2 つ並べる."""
+    pixels = [row[i:i + 2] for i in range(0, len(row), 2)]
+    return b"".join(p + p for p in pixels)
+
+
+class Screen:
+    def __init__(self):
+        self.width = 0
+        self.height = 0
+        self.pixels = bytearray()
+        self.frames = 0
+        self.rects = 0
+        self.dropped = 0
+        self.bad_packets = 0
+        self.skipped = 0
+        self.last_frame = None
+        self.pending = []  # フレームの終わりを待っている矩形
+
+    def rect(self, flags, body):
+        self.pending.append((flags, body))
+
+    def apply(self, flags, body):
+        x, y, w, h = struct.unpack_from("<4H", body, 0)
+        if x + w > self.width or y + h > self.height:
+            raise ValueError("rect outside the screen")
+        half = flags & FLAG_HALF
+        src_w = w // 2 if half else w
+        rows = h // 2 if half else h
+        pos = 8
+        stride = self.width * 2
+        for r in range(rows):
+            row, pos = unpack_row(body, pos, src_w)
+            if half:
+                row = double_row(row)
+                for dy in (0, 1):
+                    if r * 2 + dy < h:
+                        start = (y + r * 2 + dy) * stride + x * 2
+                        self.pixels[start:start + w * 2] = row
+            else:
+                start = (y + r) * stride + x * 2
+                self.pixels[start:start + w * 2] = row
+        self.rects += 1
+
+    def frame(self, body):
+        number, time_ms, width, height, rects, dropped = struct.unpack_from("<IIHHHH", body, 0)
+        if (width, height) != (self.width, self.height):
+            self.width = width
+            self.height = height
+            self.pixels = bytearray(width * height * 2)
+        pending, self.pending = self.pending, []
+        for flags, rect in pending:
+            try:
+                self.apply(flags, rect)
+            except (ValueError, struct.error, IndexError):
+                self.bad_packets += 1
+        self.frames += 1
+        self.dropped += dropped
+        self.last_frame = (number, time_ms)
+
+    def rgb(self):
+        """dumpDisplayPpm と同じ式で 8 ビットの RGB にする."""
+        global RGB_TABLE
+        if RGB_TABLE is None:
+            RGB_TABLE = [bytes(((v >> 11) * 255 // 31, ((v >> 5) & 63) * 255 // 63, (v & 31) * 255 // 31))
+                         for v in range(65536)]
+        count = self.width * self.height
+        values = struct.unpack(">%dH" % count, bytes(self.pixels[:count * 2]))
+        return b"".join(RGB_TABLE[v] for v in values)
+
+    def save(self, path):
+        rgb = self.rgb()
+        if path.lower().endswith(".ppm"):
+            with open(path, "wb") as f:
+                f.write(b"P6\n%d %d\n255\n" % (self.width, self.height))
+                f.write(rgb)
+            return
+        stride = self.width * 3
+        raw = b"".join(b"\x00" + rgb[y * stride:(y + 1) * stride] for y in range(self.height))
+
+        def chunk(ctype, data):
+            crc = zlib.crc32(ctype + data) & 0xFFFFFFFF
+            return struct.pack(">I", len(data)) + ctype + data + struct.pack(">I", crc)
+
+        with open(path, "wb") as f:
+            f.write(b"\x89PNG\r\n\x1a\n")
+            f.write(chunk(b"IHDR", struct.pack(">IIBBBBB", self.width, self.height, 8, 2, 0, 0, 0)))
+            f.write(chunk(b"IDAT", zlib.compress(raw, 6)))
+            f.write(chunk(b"IEND", b""))
+
+
+def parse(buffer, screen, on_frame, final=False):
+    """buffer から読めるだけパケットを読んで、読み終えたバイト数を返す.
+
+    final なら続きは来ないので、途中で切れた見出し（ログの中の "AQ" など）も読み飛ばす.
+    """
+    pos = 0
+    end = len(buffer)
+    while True:
+        start = buffer.find(MAGIC, pos)
+        if start < 0:
+            # 最後の 1 バイトは見出しの途中かもしれないので残す
+            keep = end - 1 if end > pos and buffer[end - 1:end] == MAGIC[:1] else end
+            screen.skipped += keep - pos
+            return keep
+        screen.skipped += start - pos
+        pos = start
+        ok = end - pos >= HEADER_SIZE
+        if ok:
+            ptype, flags, length = struct.unpack_from("<BBH", buffer, pos + 2)
+            total = HEADER_SIZE + length + CHECK_SIZE
+            ok = ptype in (PACKET_RECT, PACKET_FRAME)
+        if (ok and end - pos < total) or end - pos < HEADER_SIZE:
+            if not final:
+                return pos
+            ok = False
+        if ok:
+            check, = struct.unpack_from("<I", buffer, pos + HEADER_SIZE + length)
+            ok = zlib.adler32(buffer[pos + 2:pos + HEADER_SIZE + length]) == check
+        if ok:
+            body = bytes(buffer[pos + HEADER_SIZE:pos + HEADER_SIZE + length])
+            if ptype == PACKET_RECT:
+                ok = length >= 8
+                if ok:
+                    screen.rect(flags, body)
+            else:
+                ok = length >= 16
+                if ok:
+                    screen.frame(body)
+                    on_frame(screen)
+        if not ok:
+            # 区切りを見失った（ログの中の "AQ" など）。1 バイト進めて探し直す
+            screen.bad_packets += 1
+            screen.skipped += 1
+            pos += 1
+            continue
+        pos += total
+
+
+def open_input(path, keyframe):
+    if path == "-":
+        return sys.stdin.buffer.fileno(), False
+    fd = os.open(path, os.O_RDONLY if not keyframe else os.O_RDWR | os.O_NOCTTY)
+    tty = os.isatty(fd)
+    if tty:
+        import termios
+        import tty as ttymod
+        ttymod.setraw(fd)
+        termios.tcflush(fd, termios.TCIFLUSH)
+        if keyframe:
+            os.write(fd, b"k")
+    return fd, tty
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="ストリームのファイル、シリアルや pty のデバイス（- で標準入力）")
+    parser.add_argument("--out", default="stream.png", help="組み立てた画面の書き出し先（.png か .ppm）")
+    parser.add_argument("--every", type=int, default=0,
+                        help="N フレームごとに --out を書き直す（0 なら終わりに 1 回）")
+    parser.add_argument("--follow", action="store_true",
+                        help="ファイルの終わりに来ても書き足されるのを待つ（端末なら常に待つ）")
+    parser.add_argument("--frames", type=int, default=0, help="N フレーム受け取ったら終える（0 なら終わりまで）")
+    parser.add_argument("--no-keyframe", action="store_true",
+                        help="端末を開いたときに画面全体を要求しない")
+    args = parser.parse_args(argv)
+
+    is_file = args.input != "-" and os.path.isfile(args.input)
+    fd, tty = open_input(args.input, keyframe=not args.no_keyframe and not is_file)
+    screen = Screen()
+
+    def on_frame(s):
+        if args.every > 0 and s.frames % args.every == 0:
+            s.save(args.out)
+            print("frame %d (%u ms): %d rects, %d dropped" % (s.last_frame[0], s.last_frame[1], s.rects,
+                                                             s.dropped), flush=True)
+
+    buffer = bytearray()
+    try:
+        while True:
+            data = os.read(fd, READ_SIZE)
+            if not data:
+                if tty or args.follow:
+                    time.sleep(0.05)
+                    continue
+                break
+            buffer += data
+            used = parse(buffer, screen, on_frame)
+            del buffer[:used]
+            if args.frames > 0 and screen.frames >= args.frames:
+                break
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if args.input != "-":
+            os.close(fd)
+    parse(buffer, screen, on_frame, final=True)
+    if screen.frames == 0:
+        print("no frames received (%d bytes skipped)" % screen.skipped, file=sys.stderr)
+        return 1
+    screen.save(args.out)
+    print("%d frames, %d rects, %d dropped by the device, %d bad packets, %d bytes skipped -> %s (%dx%d)"
+          % (screen.frames, screen.rects, screen.dropped, screen.bad_packets, screen.skipped, args.out,
+             screen.width, screen.height))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))